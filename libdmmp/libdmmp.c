@@ -19,6 +19,7 @@
  */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
 #include <sys/time.h>
@@ -41,9 +42,13 @@
  */
 
 #define _DMMP_IPC_SHOW_JSON_CMD			"show maps json"
+#define _DMMP_IPC_SHOW_JSON_SINCE_CMD		"show maps json since %" PRIu64
 #define _DMMP_JSON_MAJOR_KEY			"major_version"
 #define _DMMP_JSON_MAJOR_VERSION		0
 #define _DMMP_JSON_MAPS_KEY			"maps"
+#define _DMMP_JSON_STATE_GEN_KEY		"state_gen"
+#define _DMMP_JSON_FULL_KEY			"full"
+#define _DMMP_JSON_MAP_NAMES_KEY		"map_names"
 #define _ERRNO_STR_BUFF_SIZE			256
 #define _IPC_MAX_CMD_LEN			512
 /* ^ Was _MAX_CMD_LEN in ./libmultipath/uxsock.h */
@@ -57,6 +62,10 @@ struct dmmp_context {
 	void *userdata;
 	unsigned int tmo;
 	char last_err_msg[_LAST_ERR_MSG_BUFF_SIZE];
+	/* Maps returned by dmmp_mpath_array_refresh() */
+	struct dmmp_mpath **cache_mps;
+	uint32_t cache_mp_count;
+	uint64_t cache_gen;
 };
 
 /*
@@ -118,12 +127,17 @@ struct dmmp_context *dmmp_context_new(void)
 	ctx->userdata = NULL;
 	ctx->tmo = _DEFAULT_UXSOCK_TIMEOUT;
 	memset(ctx->last_err_msg, 0, _LAST_ERR_MSG_BUFF_SIZE);
+	ctx->cache_mps = NULL;
+	ctx->cache_mp_count = 0;
+	ctx->cache_gen = 0;
 
 	return ctx;
 }
 
 void dmmp_context_free(struct dmmp_context *ctx)
 {
+	if (ctx != NULL)
+		dmmp_mpath_array_free(ctx->cache_mps, ctx->cache_mp_count);
 	free(ctx);
 }
 
@@ -155,35 +169,23 @@ void dmmp_context_userdata_set(struct dmmp_context *ctx, void *userdata)
 	ctx->userdata = userdata;
 }
 
-int dmmp_mpath_array_get(struct dmmp_context *ctx,
-			 struct dmmp_mpath ***dmmp_mps, uint32_t *dmmp_mp_count)
+/*
+ * Parse JSON output of multipathd and check its major version.
+ * Need to free `*j_obj` via json_object_put().
+ */
+static int _dmmp_json_parse(struct dmmp_context *ctx, const char *j_str,
+			    json_object **j_obj)
 {
-	struct dmmp_mpath *dmmp_mp = NULL;
 	int rc = DMMP_OK;
-	char *j_str = NULL;
-	json_object *j_obj = NULL;
-	json_object *j_obj_map = NULL;
 	enum json_tokener_error j_err = json_tokener_success;
 	json_tokener *j_token = NULL;
-	struct array_list *ar_maps = NULL;
-	uint32_t i = 0;
 	int cur_json_major_version = -1;
-	int ar_maps_len = -1;
-	int ipc_fd = -1;
 
 	assert(ctx != NULL);
-	assert(dmmp_mps != NULL);
-	assert(dmmp_mp_count != NULL);
+	assert(j_str != NULL);
+	assert(j_obj != NULL);
 
-	*dmmp_mps = NULL;
-	*dmmp_mp_count = 0;
-
-	_good(_ipc_connect(ctx, &ipc_fd), rc, out);
-
-	_good(_process_cmd(ctx, ipc_fd, _DMMP_IPC_SHOW_JSON_CMD, &j_str),
-	      rc, out);
-
-	_debug(ctx, "Got json output from multipathd: '%s'", j_str);
+	*j_obj = NULL;
 
 	j_token = json_tokener_new();
 	if (j_token == NULL) {
@@ -191,9 +193,9 @@ int dmmp_mpath_array_get(struct dmmp_context *ctx,
 		_error(ctx, "BUG: json_tokener_new() returned NULL");
 		goto out;
 	}
-	j_obj = json_tokener_parse_ex(j_token, j_str, strlen(j_str) + 1);
+	*j_obj = json_tokener_parse_ex(j_token, j_str, strlen(j_str) + 1);
 
-	if (j_obj == NULL) {
+	if (*j_obj == NULL) {
 		rc = DMMP_ERR_IPC_ERROR;
 		j_err = json_tokener_get_error(j_token);
 		_error(ctx, "Failed to parse JSON output from multipathd IPC: "
@@ -201,7 +203,7 @@ int dmmp_mpath_array_get(struct dmmp_context *ctx,
 		goto out;
 	}
 
-	_json_obj_get_value(ctx, j_obj, cur_json_major_version,
+	_json_obj_get_value(ctx, *j_obj, cur_json_major_version,
 			    _DMMP_JSON_MAJOR_KEY, json_type_int,
 			    json_object_get_int, rc, out);
 
@@ -215,6 +217,31 @@ int dmmp_mpath_array_get(struct dmmp_context *ctx,
 	_debug(ctx, "multipathd JSON major version(%d) check pass",
 	       _DMMP_JSON_MAJOR_VERSION);
 
+out:
+	if (j_token != NULL)
+		json_tokener_free(j_token);
+	if ((rc != DMMP_OK) && (*j_obj != NULL)) {
+		json_object_put(*j_obj);
+		*j_obj = NULL;
+	}
+	return rc;
+}
+
+static int _dmmp_mpath_array_parse(struct dmmp_context *ctx,
+				   json_object *j_obj,
+				   struct dmmp_mpath ***dmmp_mps,
+				   uint32_t *dmmp_mp_count)
+{
+	struct dmmp_mpath *dmmp_mp = NULL;
+	int rc = DMMP_OK;
+	json_object *j_obj_map = NULL;
+	struct array_list *ar_maps = NULL;
+	uint32_t i = 0;
+	int ar_maps_len = -1;
+
+	*dmmp_mps = NULL;
+	*dmmp_mp_count = 0;
+
 	_json_obj_get_value(ctx, j_obj, ar_maps, _DMMP_JSON_MAPS_KEY,
 			    json_type_array, json_object_get_array, rc, out);
 
@@ -256,20 +283,278 @@ int dmmp_mpath_array_get(struct dmmp_context *ctx,
 		_good(_dmmp_mpath_update(ctx, dmmp_mp, j_obj_map), rc, out);
 	}
 
+out:
+	if (rc != DMMP_OK) {
+		dmmp_mpath_array_free(*dmmp_mps, *dmmp_mp_count);
+		*dmmp_mps = NULL;
+		*dmmp_mp_count = 0;
+	}
+
+	return rc;
+}
+
+int dmmp_mpath_array_get(struct dmmp_context *ctx,
+			 struct dmmp_mpath ***dmmp_mps, uint32_t *dmmp_mp_count)
+{
+	int rc = DMMP_OK;
+	char *j_str = NULL;
+	json_object *j_obj = NULL;
+	int ipc_fd = -1;
+
+	assert(ctx != NULL);
+	assert(dmmp_mps != NULL);
+	assert(dmmp_mp_count != NULL);
+
+	*dmmp_mps = NULL;
+	*dmmp_mp_count = 0;
+
+	_good(_ipc_connect(ctx, &ipc_fd), rc, out);
+
+	_good(_process_cmd(ctx, ipc_fd, _DMMP_IPC_SHOW_JSON_CMD, &j_str),
+	      rc, out);
+
+	_debug(ctx, "Got json output from multipathd: '%s'", j_str);
+
+	_good(_dmmp_json_parse(ctx, j_str, &j_obj), rc, out);
+	_good(_dmmp_mpath_array_parse(ctx, j_obj, dmmp_mps, dmmp_mp_count),
+	      rc, out);
+
 out:
 	if (ipc_fd >= 0)
 		mpath_disconnect(ipc_fd);
 	free(j_str);
-	if (j_token != NULL)
-		json_tokener_free(j_token);
 	if (j_obj != NULL)
 		json_object_put(j_obj);
 
+	return rc;
+}
+
+static int _dmmp_mpath_sort_cmp(const void *a, const void *b)
+{
+	return strcmp(dmmp_mpath_name_get(*(struct dmmp_mpath * const *) a),
+		      dmmp_mpath_name_get(*(struct dmmp_mpath * const *) b));
+}
+
+static int _dmmp_mpath_search_cmp(const void *name, const void *elem)
+{
+	return strcmp((const char *) name,
+		      dmmp_mpath_name_get(*(struct dmmp_mpath * const *) elem));
+}
+
+static struct dmmp_mpath **_dmmp_mpath_search(const char *name,
+					      struct dmmp_mpath **dmmp_mps,
+					      uint32_t dmmp_mp_count)
+{
+	if (dmmp_mp_count == 0)
+		return NULL;
+	return (struct dmmp_mpath **)
+		bsearch(name, dmmp_mps, dmmp_mp_count,
+			sizeof(struct dmmp_mpath *), _dmmp_mpath_search_cmp);
+}
+
+/*
+ * Build the new map array of dmmp_mpath_array_refresh() from the names of
+ * all maps multipathd reported, taking the changed maps from `changed_mps`
+ * and all others from the cache. Objects moved to the new array are set
+ * to NULL in `changed_mps` and the cache.
+ * Return DMMP_ERR_MPATH_NOT_FOUND if a map is neither in `changed_mps` nor
+ * in the cache.
+ */
+static int _dmmp_mpath_array_merge(struct dmmp_context *ctx,
+				   struct array_list *ar_names,
+				   struct dmmp_mpath **changed_mps,
+				   uint32_t changed_count,
+				   struct dmmp_mpath ***dmmp_mps,
+				   uint32_t *dmmp_mp_count)
+{
+	int rc = DMMP_OK;
+	int ar_names_len = -1;
+	uint32_t i = 0;
+	const char *name = NULL;
+	json_object *j_obj_name = NULL;
+	struct dmmp_mpath **found = NULL;
+	bool *cache_used = NULL;
+	bool *changed_used = NULL;
+
+	*dmmp_mps = NULL;
+	*dmmp_mp_count = 0;
+
+	ar_names_len = array_list_length(ar_names);
+	if (ar_names_len < 0) {
+		rc = DMMP_ERR_BUG;
+		_error(ctx, "BUG: Got negative length for ar_names");
+		goto out;
+	}
+	if (ar_names_len == 0)
+		goto out;
+
+	qsort(ctx->cache_mps, ctx->cache_mp_count, sizeof(struct dmmp_mpath *),
+	      _dmmp_mpath_sort_cmp);
+	qsort(changed_mps, changed_count, sizeof(struct dmmp_mpath *),
+	      _dmmp_mpath_sort_cmp);
+
+	cache_used = (bool *) calloc(ctx->cache_mp_count + 1, sizeof(bool));
+	_dmmp_alloc_null_check(ctx, cache_used, rc, out);
+	changed_used = (bool *) calloc(changed_count + 1, sizeof(bool));
+	_dmmp_alloc_null_check(ctx, changed_used, rc, out);
+	*dmmp_mps = (struct dmmp_mpath **)
+		calloc(ar_names_len, sizeof(struct dmmp_mpath *));
+	_dmmp_alloc_null_check(ctx, *dmmp_mps, rc, out);
+	*dmmp_mp_count = ar_names_len & UINT32_MAX;
+
+	for (i = 0; i < *dmmp_mp_count; ++i) {
+		j_obj_name = array_list_get_idx(ar_names, i);
+		if ((j_obj_name == NULL) ||
+		    (json_object_get_type(j_obj_name) != json_type_string)) {
+			rc = DMMP_ERR_IPC_ERROR;
+			_error(ctx, "Invalid JSON output from multipathd IPC: "
+			       "bad entry in '%s'", _DMMP_JSON_MAP_NAMES_KEY);
+			goto out;
+		}
+		name = json_object_get_string(j_obj_name);
+
+		found = _dmmp_mpath_search(name, changed_mps, changed_count);
+		if (found != NULL) {
+			changed_used[found - changed_mps] = true;
+		} else {
+			found = _dmmp_mpath_search(name, ctx->cache_mps,
+						   ctx->cache_mp_count);
+			if (found == NULL) {
+				rc = DMMP_ERR_MPATH_NOT_FOUND;
+				_debug(ctx, "mpath %s is neither changed nor "
+				       "cached", name);
+				goto out;
+			}
+			cache_used[found - ctx->cache_mps] = true;
+		}
+		(*dmmp_mps)[i] = *found;
+	}
+
+	/* Only now that nothing can fail, hand over the objects */
+	for (i = 0; i < changed_count; ++i)
+		if (changed_used[i])
+			changed_mps[i] = NULL;
+	for (i = 0; i < ctx->cache_mp_count; ++i)
+		if (cache_used[i])
+			ctx->cache_mps[i] = NULL;
+
+out:
+	free(cache_used);
+	free(changed_used);
 	if (rc != DMMP_OK) {
-		dmmp_mpath_array_free(*dmmp_mps, *dmmp_mp_count);
+		/* The objects are still owned by changed_mps and the cache */
+		free(*dmmp_mps);
 		*dmmp_mps = NULL;
 		*dmmp_mp_count = 0;
 	}
+	return rc;
+}
+
+int dmmp_mpath_array_refresh(struct dmmp_context *ctx,
+			     struct dmmp_mpath ***dmmp_mps,
+			     uint32_t *dmmp_mp_count)
+{
+	int rc = DMMP_OK;
+	char cmd[_IPC_MAX_CMD_LEN];
+	char *j_str = NULL;
+	json_object *j_obj = NULL;
+	json_object *j_obj_tmp = NULL;
+	struct array_list *ar_names = NULL;
+	struct dmmp_mpath **changed_mps = NULL;
+	uint32_t changed_count = 0;
+	struct dmmp_mpath **new_mps = NULL;
+	uint32_t new_count = 0;
+	int64_t state_gen = 0;
+	bool full = true;
+	int ipc_fd = -1;
+
+	assert(ctx != NULL);
+	assert(dmmp_mps != NULL);
+	assert(dmmp_mp_count != NULL);
+
+	*dmmp_mps = NULL;
+	*dmmp_mp_count = 0;
+
+	snprintf(cmd, _IPC_MAX_CMD_LEN, _DMMP_IPC_SHOW_JSON_SINCE_CMD,
+		 ctx->cache_gen);
+
+	_good(_ipc_connect(ctx, &ipc_fd), rc, out);
+	_good(_process_cmd(ctx, ipc_fd, cmd, &j_str), rc, out);
+
+	if (j_str[0] != '{') {
+		/* multipathd too old, fall back to full query every time */
+		_debug(ctx, "multipathd does not support '%s'", cmd);
+		free(j_str);
+		j_str = NULL;
+		_good(_process_cmd(ctx, ipc_fd, _DMMP_IPC_SHOW_JSON_CMD,
+				   &j_str), rc, out);
+	}
+
+	_debug(ctx, "Got json output from multipathd: '%s'", j_str);
+
+	_good(_dmmp_json_parse(ctx, j_str, &j_obj), rc, out);
+	_good(_dmmp_mpath_array_parse(ctx, j_obj, &changed_mps,
+				      &changed_count), rc, out);
+
+	if (json_object_object_get_ex(j_obj, _DMMP_JSON_STATE_GEN_KEY,
+				      &j_obj_tmp)) {
+		_json_obj_get_value(ctx, j_obj, state_gen,
+				    _DMMP_JSON_STATE_GEN_KEY, json_type_int,
+				    json_object_get_int64, rc, out);
+		_json_obj_get_value(ctx, j_obj, full, _DMMP_JSON_FULL_KEY,
+				    json_type_boolean, json_object_get_boolean,
+				    rc, out);
+	}
+
+	if (full) {
+		new_mps = changed_mps;
+		new_count = changed_count;
+		changed_mps = NULL;
+		changed_count = 0;
+	} else {
+		_json_obj_get_value(ctx, j_obj, ar_names,
+				    _DMMP_JSON_MAP_NAMES_KEY, json_type_array,
+				    json_object_get_array, rc, out);
+		rc = _dmmp_mpath_array_merge(ctx, ar_names, changed_mps,
+					     changed_count, &new_mps,
+					     &new_count);
+		if (rc == DMMP_ERR_MPATH_NOT_FOUND) {
+			/* Cache out of sync, start over with a full query */
+			_info(ctx, "libdmmp cache out of sync with multipathd, "
+			      "refreshing all mpaths");
+			dmmp_mpath_array_free(ctx->cache_mps,
+					      ctx->cache_mp_count);
+			ctx->cache_mps = NULL;
+			ctx->cache_mp_count = 0;
+			ctx->cache_gen = 0;
+			mpath_disconnect(ipc_fd);
+			ipc_fd = -1;
+			rc = dmmp_mpath_array_refresh(ctx, dmmp_mps,
+						      dmmp_mp_count);
+			goto out;
+		}
+		if (rc != DMMP_OK)
+			goto out;
+	}
+
+	_debug(ctx, "Refreshed %" PRIu32 " mpaths, %s, up to generation %" PRId64,
+	       new_count, full ? "full" : "delta", state_gen);
+
+	/* Objects reused in new_mps are NULL in the cache now */
+	dmmp_mpath_array_free(ctx->cache_mps, ctx->cache_mp_count);
+	ctx->cache_mps = new_mps;
+	ctx->cache_mp_count = new_count;
+	ctx->cache_gen = state_gen < 0 ? 0 : (uint64_t) state_gen;
+	*dmmp_mps = ctx->cache_mps;
+	*dmmp_mp_count = ctx->cache_mp_count;
+
+out:
+	if (ipc_fd >= 0)
+		mpath_disconnect(ipc_fd);
+	free(j_str);
+	if (j_obj != NULL)
+		json_object_put(j_obj);
+	dmmp_mpath_array_free(changed_mps, changed_count);
 
 	return rc;
 }
@@ -487,3 +772,112 @@ out:
 	free(output);
 	return rc;
 }
+
+int dmmp_event_subscribe(struct dmmp_context *ctx, int *fd, uint64_t *seq)
+{
+	int rc = DMMP_OK;
+	int errno_save = 0;
+	char errno_str_buff[_ERRNO_STR_BUFF_SIZE];
+	unsigned int ipc_tmo = 0;
+
+	assert(ctx != NULL);
+	assert(fd != NULL);
+	assert(seq != NULL);
+
+	*seq = 0;
+
+	_good(_ipc_connect(ctx, fd), rc, out);
+
+	ipc_tmo = ctx->tmo;
+	if (ctx->tmo == 0)
+		ipc_tmo = _DEFAULT_UXSOCK_TIMEOUT;
+
+	if (mpath_subscribe(*fd, seq, ipc_tmo) != 0) {
+		errno_save = errno;
+		memset(errno_str_buff, 0, _ERRNO_STR_BUFF_SIZE);
+		strerror_r(errno_save, errno_str_buff, _ERRNO_STR_BUFF_SIZE);
+		if (errno_save == EPERM) {
+			rc = DMMP_ERR_PERMISSION_DENY;
+			_error(ctx, "Permission deny, need to be root");
+		} else if (errno_save == ETIMEDOUT) {
+			rc = DMMP_ERR_IPC_TIMEOUT;
+			_error(ctx, "Timeout, try to increase it via "
+			       "dmmp_context_timeout_set()");
+		} else {
+			rc = DMMP_ERR_IPC_ERROR;
+			_error(ctx, "Failed to subscribe to multipathd events, "
+			       "error %d(%s)", errno_save, errno_str_buff);
+		}
+		goto out;
+	}
+	_debug(ctx, "Subscribed to multipathd events at sequence %" PRIu64,
+	       *seq);
+
+out:
+	if (rc != DMMP_OK && *fd >= 0) {
+		mpath_disconnect(*fd);
+		*fd = -1;
+	}
+	return rc;
+}
+
+int dmmp_event_array_get(struct dmmp_context *ctx, int fd,
+			 struct dmmp_event ***dmmp_evts,
+			 uint32_t *dmmp_evt_count)
+{
+	int rc = DMMP_OK;
+	int errno_save = 0;
+	char errno_str_buff[_ERRNO_STR_BUFF_SIZE];
+	char *output = NULL;
+	unsigned int ipc_tmo = 0;
+
+	assert(ctx != NULL);
+	assert(fd >= 0);
+	assert(dmmp_evts != NULL);
+	assert(dmmp_evt_count != NULL);
+
+	*dmmp_evts = NULL;
+	*dmmp_evt_count = 0;
+
+	/* Unlike other IPC calls, ctx->tmo == 0 means waiting forever here */
+	ipc_tmo = ctx->tmo;
+	if (ctx->tmo == 0)
+		ipc_tmo = (unsigned int) -1;
+
+	if (mpath_recv_reply(fd, &output, ipc_tmo) != 0) {
+		errno_save = errno;
+		memset(errno_str_buff, 0, _ERRNO_STR_BUFF_SIZE);
+		strerror_r(errno_save, errno_str_buff, _ERRNO_STR_BUFF_SIZE);
+		if (errno_save == ETIMEDOUT) {
+			rc = DMMP_ERR_IPC_TIMEOUT;
+			_debug(ctx, "No multipathd event in %u milliseconds",
+			       ipc_tmo);
+		} else {
+			rc = DMMP_ERR_IPC_ERROR;
+			_error(ctx, "Failed to receive multipathd events, "
+			       "error %d(%s)", errno_save, errno_str_buff);
+		}
+		goto out;
+	}
+	if (output == NULL) {
+		rc = DMMP_ERR_IPC_ERROR;
+		_error(ctx, "IPC return empty event reply");
+		goto out;
+	}
+
+	_good(_dmmp_event_array_parse(ctx, output, dmmp_evts, dmmp_evt_count),
+	      rc, out);
+
+out:
+	free(output);
+	return rc;
+}
+
+void dmmp_event_unsubscribe(struct dmmp_context *ctx, int fd)
+{
+	assert(ctx != NULL);
+
+	if (fd >= 0)
+		mpath_disconnect(fd);
+	_debug(ctx, "Unsubscribed from multipathd events");
+}
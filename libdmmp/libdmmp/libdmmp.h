@@ -103,6 +103,16 @@ struct DMMP_DLL_EXPORT dmmp_path;
 // ^ print.h does not expose this.
 #define DMMP_PATH_STATUS_DELAYED	9
 
+struct DMMP_DLL_EXPORT dmmp_event;
+
+#define DMMP_EVENT_TYPE_UNKNOWN			0
+#define DMMP_EVENT_TYPE_PATH_STATUS		1
+#define DMMP_EVENT_TYPE_MPATH_ADD		2
+#define DMMP_EVENT_TYPE_MPATH_REMOVE		3
+#define DMMP_EVENT_TYPE_MPATH_RELOAD		4
+#define DMMP_EVENT_TYPE_PATH_GROUP_SWITCH	5
+#define DMMP_EVENT_TYPE_OVERFLOW		6
+
 /**
  * dmmp_strerror() - Convert error code to string.
  *
@@ -355,6 +365,56 @@ DMMP_DLL_EXPORT int dmmp_mpath_array_get(struct dmmp_context *ctx,
 DMMP_DLL_EXPORT void dmmp_mpath_array_free(struct dmmp_mpath **dmmp_mps,
 					   uint32_t dmmp_mp_count);
 
+/**
+ * dmmp_mpath_array_refresh() - Query multipath devices, reusing cached ones.
+ *
+ * Like dmmp_mpath_array_get(), but the returned array is cached in 'ctx'.
+ * On subsequent calls, multipathd only sends the multipath devices whose
+ * state has changed since the previous call, and the objects of all other
+ * devices are kept as they are. This is much cheaper
+ * than dmmp_mpath_array_get() for programs which query periodically.
+ *
+ * The returned array and the 'struct dmmp_mpath' objects in it are owned by
+ * 'ctx', don't free them. They stay valid until the next call of
+ * dmmp_mpath_array_refresh() or dmmp_context_free(). Objects of unchanged
+ * multipath devices are reused by the next call, so their pointers stay the
+ * same.
+ *
+ * With older multipathd versions, every call queries all multipath devices.
+ *
+ * @ctx:
+ *	Pointer of 'struct dmmp_context'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @dmmp_mps:
+ *	Output pointer array of 'struct dmmp_mpath'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @dmmp_mp_count:
+ *	Output pointer of uint32_t. Hold the size of 'dmmp_mps' pointer array.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * Return:
+ *	int. Valid error codes are:
+ *
+ *	* DMMP_OK
+ *
+ *	* DMMP_ERR_BUG
+ *
+ *	* DMMP_ERR_NO_MEMORY
+ *
+ *	* DMMP_ERR_NO_DAEMON
+ *
+ *	* DMMP_ERR_IPC_TIMEOUT
+ *
+ *	* DMMP_ERR_IPC_ERROR
+ *
+ *	* DMMP_ERR_INCOMPATIBLE
+ *
+ *	Error number could be converted to string by dmmp_strerror().
+ */
+DMMP_DLL_EXPORT int dmmp_mpath_array_refresh(struct dmmp_context *ctx,
+					     struct dmmp_mpath ***dmmp_mps,
+					     uint32_t *dmmp_mp_count);
+
 /**
  * dmmp_mpath_wwid_get() - Retrieve WWID of certain mpath.
  *
@@ -728,6 +788,278 @@ DMMP_DLL_EXPORT int dmmp_reconfig(struct dmmp_context *ctx);
  */
 DMMP_DLL_EXPORT const char *dmmp_last_error_msg(struct dmmp_context *ctx);
 
+/**
+ * dmmp_event_subscribe() - Subscribe to multipathd change events.
+ *
+ * Open a new IPC connection to multipathd and switch it to event streaming
+ * mode. Afterwards, multipathd will send path checker state changes and
+ * multipath map add/remove/reload/switchgroup notifications on this
+ * connection without being polled. The returned file descriptor can be
+ * watched with poll()/epoll for POLLIN, and the events retrieved via
+ * dmmp_event_array_get().
+ *
+ * This saves clients from querying the full topology via
+ * dmmp_mpath_array_get() periodically: query once, then apply events.
+ *
+ * @ctx:
+ *	Pointer of 'struct dmmp_context'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @fd:
+ *	Output pointer of int. The subscribed IPC connection. Should be
+ *	closed by dmmp_event_unsubscribe().
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @seq:
+ *	Output pointer of uint64_t. The sequence number of the last event
+ *	multipathd generated before the subscription. The first event
+ *	received will have sequence number @seq + 1.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * Return:
+ *	int. Valid error codes are:
+ *
+ *	* DMMP_OK
+ *
+ *	* DMMP_ERR_BUG
+ *
+ *	* DMMP_ERR_NO_MEMORY
+ *
+ *	* DMMP_ERR_NO_DAEMON
+ *
+ *	* DMMP_ERR_IPC_TIMEOUT
+ *
+ *	* DMMP_ERR_IPC_ERROR
+ *
+ *	* DMMP_ERR_PERMISSION_DENY
+ *
+ *	Error number could be converted to string by dmmp_strerror().
+ */
+DMMP_DLL_EXPORT int dmmp_event_subscribe(struct dmmp_context *ctx, int *fd,
+					 uint64_t *seq);
+
+/**
+ * dmmp_event_array_get() - Retrieve pending multipathd events.
+ *
+ * Wait for the next batch of events on a connection returned by
+ * dmmp_event_subscribe(). The wait is limited by the timeout set via
+ * dmmp_context_timeout_set(); a timeout of 0 means waiting forever.
+ *
+ * If the client could not keep up with multipathd, an event of type
+ * DMMP_EVENT_TYPE_OVERFLOW is returned first, indicating that events have
+ * been lost. Clients should then query the whole topology again via
+ * dmmp_mpath_array_get().
+ *
+ * @ctx:
+ *	Pointer of 'struct dmmp_context'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @fd:
+ *	int. File descriptor returned by dmmp_event_subscribe().
+ * @dmmp_evts:
+ *	Output pointer of array of 'struct dmmp_event'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *	Memory should be freed by dmmp_event_array_free().
+ * @dmmp_evt_count:
+ *	Output pointer of uint32_t. Hold the size of 'dmmp_evts' array.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * Return:
+ *	int. Valid error codes are:
+ *
+ *	* DMMP_OK
+ *
+ *	* DMMP_ERR_BUG
+ *
+ *	* DMMP_ERR_NO_MEMORY
+ *
+ *	* DMMP_ERR_IPC_TIMEOUT
+ *
+ *	* DMMP_ERR_IPC_ERROR
+ *
+ *	Error number could be converted to string by dmmp_strerror().
+ */
+DMMP_DLL_EXPORT int dmmp_event_array_get(struct dmmp_context *ctx, int fd,
+					 struct dmmp_event ***dmmp_evts,
+					 uint32_t *dmmp_evt_count);
+
+/**
+ * dmmp_event_array_free() - Free 'struct dmmp_event' pointer array.
+ *
+ * Free the 'dmmp_evts' pointer array generated by dmmp_event_array_get().
+ * If provided 'dmmp_evts' pointer is NULL or dmmp_evt_count == 0, do
+ * nothing.
+ *
+ * @dmmp_evts:
+ *	Pointer of 'struct dmmp_event' array.
+ * @dmmp_evt_count:
+ *	uint32_t, the size of 'dmmp_evts' pointer array.
+ *
+ * Return:
+ *	void
+ */
+DMMP_DLL_EXPORT void dmmp_event_array_free(struct dmmp_event **dmmp_evts,
+					   uint32_t dmmp_evt_count);
+
+/**
+ * dmmp_event_unsubscribe() - Close multipathd event connection.
+ *
+ * Close the connection returned by dmmp_event_subscribe().
+ *
+ * @ctx:
+ *	Pointer of 'struct dmmp_context'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @fd:
+ *	int. File descriptor returned by dmmp_event_subscribe().
+ *	If negative, do nothing.
+ *
+ * Return:
+ *	void
+ */
+DMMP_DLL_EXPORT void dmmp_event_unsubscribe(struct dmmp_context *ctx, int fd);
+
+/**
+ * dmmp_event_seq_get() - Retrieve event sequence number.
+ *
+ * Retrieve the sequence number of specified event. Sequence numbers are
+ * assigned by multipathd and increase by one for every event.
+ *
+ * @dmmp_evt:
+ *	Pointer of 'struct dmmp_event'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * Return:
+ *	uint64_t.
+ */
+DMMP_DLL_EXPORT uint64_t dmmp_event_seq_get(struct dmmp_event *dmmp_evt);
+
+/**
+ * dmmp_event_type_get() - Retrieve event type.
+ *
+ * Retrieve the type of specified event. Possible values are:
+ *
+ *	* DMMP_EVENT_TYPE_UNKNOWN
+ *		Event not understood by this version of libdmmp.
+ *
+ *	* DMMP_EVENT_TYPE_PATH_STATUS
+ *		Path checker status changed.
+ *
+ *	* DMMP_EVENT_TYPE_MPATH_ADD
+ *		Multipath map added.
+ *
+ *	* DMMP_EVENT_TYPE_MPATH_REMOVE
+ *		Multipath map removed.
+ *
+ *	* DMMP_EVENT_TYPE_MPATH_RELOAD
+ *		Multipath map reloaded, e.g. paths added or removed.
+ *
+ *	* DMMP_EVENT_TYPE_PATH_GROUP_SWITCH
+ *		Multipath map switched to another path group.
+ *
+ *	* DMMP_EVENT_TYPE_OVERFLOW
+ *		Events were lost, the sequence number is the last lost one.
+ *
+ * @dmmp_evt:
+ *	Pointer of 'struct dmmp_event'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * Return:
+ *	uint32_t.
+ */
+DMMP_DLL_EXPORT uint32_t dmmp_event_type_get(struct dmmp_event *dmmp_evt);
+
+/**
+ * dmmp_event_type_str() - Convert event type to string.
+ *
+ * Convert event type uint32_t to string (const char *):
+ *
+ *	* DMMP_EVENT_TYPE_UNKNOWN -- "unknown"
+ *
+ *	* DMMP_EVENT_TYPE_PATH_STATUS -- "path"
+ *
+ *	* DMMP_EVENT_TYPE_MPATH_ADD -- "add"
+ *
+ *	* DMMP_EVENT_TYPE_MPATH_REMOVE -- "remove"
+ *
+ *	* DMMP_EVENT_TYPE_MPATH_RELOAD -- "reload"
+ *
+ *	* DMMP_EVENT_TYPE_PATH_GROUP_SWITCH -- "switchgroup"
+ *
+ *	* DMMP_EVENT_TYPE_OVERFLOW -- "overflow"
+ *
+ * @event_type:
+ *	uint32_t. Event type.
+ *	When provided value is not a valid event type, return
+ *	"Invalid argument".
+ *
+ * Return:
+ *	const char *. The meaning of event type value.
+ */
+DMMP_DLL_EXPORT const char *dmmp_event_type_str(uint32_t event_type);
+
+/**
+ * dmmp_event_mpath_name_get() - Retrieve multipath name of event.
+ *
+ * Retrieve the name of the multipath map the event refers to.
+ *
+ * @dmmp_evt:
+ *	Pointer of 'struct dmmp_event'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * Return:
+ *	const char *. NULL for DMMP_EVENT_TYPE_OVERFLOW and
+ *	DMMP_EVENT_TYPE_UNKNOWN. Don't free this memory, it will be freed by
+ *	dmmp_event_array_free().
+ */
+DMMP_DLL_EXPORT const char *dmmp_event_mpath_name_get
+	(struct dmmp_event *dmmp_evt);
+
+/**
+ * dmmp_event_blk_name_get() - Retrieve block name of path event.
+ *
+ * Retrieve the block name of the path of a DMMP_EVENT_TYPE_PATH_STATUS
+ * event, like 'sda'.
+ *
+ * @dmmp_evt:
+ *	Pointer of 'struct dmmp_event'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * Return:
+ *	const char *. NULL for other event types. Don't free this memory, it
+ *	will be freed by dmmp_event_array_free().
+ */
+DMMP_DLL_EXPORT const char *dmmp_event_blk_name_get
+	(struct dmmp_event *dmmp_evt);
+
+/**
+ * dmmp_event_path_status_get() - Retrieve new path status of path event.
+ *
+ * Retrieve the new path status of a DMMP_EVENT_TYPE_PATH_STATUS event.
+ * See dmmp_path_status_get() for possible values.
+ *
+ * @dmmp_evt:
+ *	Pointer of 'struct dmmp_event'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * Return:
+ *	uint32_t. DMMP_PATH_STATUS_UNKNOWN for other event types.
+ */
+DMMP_DLL_EXPORT uint32_t dmmp_event_path_status_get
+	(struct dmmp_event *dmmp_evt);
+
+/**
+ * dmmp_event_path_group_id_get() - Retrieve new path group of switch event.
+ *
+ * Retrieve the ID of the path group a multipath map switched to, for
+ * DMMP_EVENT_TYPE_PATH_GROUP_SWITCH events. See dmmp_path_group_id_get().
+ *
+ * @dmmp_evt:
+ *	Pointer of 'struct dmmp_event'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * Return:
+ *	uint32_t. 0 for other event types.
+ */
+DMMP_DLL_EXPORT uint32_t dmmp_event_path_group_id_get
+	(struct dmmp_event *dmmp_evt);
+
 #ifdef __cplusplus
 } /* End of extern "C" */
 #endif
@@ -0,0 +1,212 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <assert.h>
+
+#include "libdmmp/libdmmp.h"
+#include "libdmmp_private.h"
+
+#define _DMMP_EVENT_TYPE_STR_LEN	32
+
+struct dmmp_event {
+	uint64_t seq;
+	uint32_t type;
+	char *mpath_name;
+	char *blk_name;
+	uint32_t path_status;
+	uint32_t pg_id;
+};
+
+static const struct _num_str_conv _DMMP_EVENT_TYPE_CONV[] = {
+	{DMMP_EVENT_TYPE_UNKNOWN, "unknown"},
+	{DMMP_EVENT_TYPE_PATH_STATUS, "path"},
+	{DMMP_EVENT_TYPE_MPATH_ADD, "add"},
+	{DMMP_EVENT_TYPE_MPATH_REMOVE, "remove"},
+	{DMMP_EVENT_TYPE_MPATH_RELOAD, "reload"},
+	{DMMP_EVENT_TYPE_PATH_GROUP_SWITCH, "switchgroup"},
+	{DMMP_EVENT_TYPE_OVERFLOW, "overflow"},
+};
+
+_dmmp_str_func_gen(dmmp_event_type_str, uint32_t, event_type,
+		   _DMMP_EVENT_TYPE_CONV);
+_dmmp_str_conv_func_gen(_dmmp_event_type_str_conv, ctx, event_type_str,
+			uint32_t, DMMP_EVENT_TYPE_UNKNOWN,
+			_DMMP_EVENT_TYPE_CONV);
+
+_dmmp_getter_func_gen(dmmp_event_seq_get, struct dmmp_event, dmmp_evt,
+		      seq, uint64_t);
+_dmmp_getter_func_gen(dmmp_event_type_get, struct dmmp_event, dmmp_evt,
+		      type, uint32_t);
+_dmmp_getter_func_gen(dmmp_event_mpath_name_get, struct dmmp_event, dmmp_evt,
+		      mpath_name, const char *);
+_dmmp_getter_func_gen(dmmp_event_blk_name_get, struct dmmp_event, dmmp_evt,
+		      blk_name, const char *);
+_dmmp_getter_func_gen(dmmp_event_path_status_get, struct dmmp_event,
+		      dmmp_evt, path_status, uint32_t);
+_dmmp_getter_func_gen(dmmp_event_path_group_id_get, struct dmmp_event,
+		      dmmp_evt, pg_id, uint32_t);
+
+_dmmp_array_free_func_gen(dmmp_event_array_free, struct dmmp_event,
+			  _dmmp_event_free);
+
+static struct dmmp_event *_dmmp_event_new(void)
+{
+	struct dmmp_event *dmmp_evt = NULL;
+
+	dmmp_evt = (struct dmmp_event *) malloc(sizeof(struct dmmp_event));
+
+	if (dmmp_evt != NULL) {
+		dmmp_evt->seq = 0;
+		dmmp_evt->type = DMMP_EVENT_TYPE_UNKNOWN;
+		dmmp_evt->mpath_name = NULL;
+		dmmp_evt->blk_name = NULL;
+		dmmp_evt->path_status = DMMP_PATH_STATUS_UNKNOWN;
+		dmmp_evt->pg_id = _DMMP_PATH_GROUP_ID_UNKNOWN;
+	}
+	return dmmp_evt;
+}
+
+void _dmmp_event_free(struct dmmp_event *dmmp_evt)
+{
+	if (dmmp_evt == NULL)
+		return;
+	free(dmmp_evt->mpath_name);
+	free(dmmp_evt->blk_name);
+	free(dmmp_evt);
+}
+
+/*
+ * Parse one event line sent by multipathd, see mpath_subscribe() in
+ * mpath_cmd.h for the format.
+ */
+static int _dmmp_event_update(struct dmmp_context *ctx,
+			      struct dmmp_event *dmmp_evt, const char *line)
+{
+	int rc = DMMP_OK;
+	char type_str[_DMMP_EVENT_TYPE_STR_LEN];
+	char *name = NULL;
+	char *blk_name = NULL;
+	int pos = 0;
+	int pg_id = 0;
+
+	if (sscanf(line, "%" SCNu64 " %31s %n", &dmmp_evt->seq, type_str,
+		   &pos) != 2) {
+		rc = DMMP_ERR_IPC_ERROR;
+		_error(ctx, "Invalid event from multipathd IPC: '%s'", line);
+		goto out;
+	}
+	line += pos;
+	dmmp_evt->type = _dmmp_event_type_str_conv(ctx, type_str);
+
+	switch (dmmp_evt->type) {
+	case DMMP_EVENT_TYPE_PATH_STATUS:
+		pos = 0;
+		if (sscanf(line, "%ms %ms %n", &blk_name, &name, &pos) != 2 ||
+		    pos == 0) {
+			rc = DMMP_ERR_IPC_ERROR;
+			_error(ctx, "Invalid path event from multipathd IPC");
+			goto out;
+		}
+		/* The path status string may contain blanks */
+		dmmp_evt->path_status = _dmmp_path_status_parse(ctx,
+								line + pos);
+		dmmp_evt->blk_name = blk_name;
+		blk_name = NULL;
+		break;
+	case DMMP_EVENT_TYPE_PATH_GROUP_SWITCH:
+		if (sscanf(line, "%ms %d", &name, &pg_id) != 2 || pg_id < 0) {
+			rc = DMMP_ERR_IPC_ERROR;
+			_error(ctx, "Invalid switchgroup event from "
+			       "multipathd IPC");
+			goto out;
+		}
+		dmmp_evt->pg_id = pg_id & UINT32_MAX;
+		break;
+	case DMMP_EVENT_TYPE_MPATH_ADD:
+	case DMMP_EVENT_TYPE_MPATH_REMOVE:
+	case DMMP_EVENT_TYPE_MPATH_RELOAD:
+		if (sscanf(line, "%ms", &name) != 1) {
+			rc = DMMP_ERR_IPC_ERROR;
+			_error(ctx, "Invalid %s event from multipathd IPC",
+			       type_str);
+			goto out;
+		}
+		break;
+	default:
+		/* DMMP_EVENT_TYPE_OVERFLOW, or from newer multipathd */
+		break;
+	}
+	dmmp_evt->mpath_name = name;
+	name = NULL;
+
+	_debug(ctx, "Got event %" PRIu64 ": %s", dmmp_evt->seq,
+	       dmmp_event_type_str(dmmp_evt->type));
+out:
+	free(name);
+	free(blk_name);
+	return rc;
+}
+
+int _dmmp_event_array_parse(struct dmmp_context *ctx, char *str,
+			    struct dmmp_event ***dmmp_evts,
+			    uint32_t *dmmp_evt_count)
+{
+	int rc = DMMP_OK;
+	struct dmmp_event *dmmp_evt = NULL;
+	uint32_t count = 0;
+	uint32_t i = 0;
+	char *line = NULL;
+	char *saveptr = NULL;
+	char *p = NULL;
+
+	assert(ctx != NULL);
+	assert(str != NULL);
+	assert(dmmp_evts != NULL);
+	assert(dmmp_evt_count != NULL);
+
+	*dmmp_evts = NULL;
+	*dmmp_evt_count = 0;
+
+	for (p = str; *p != '\0'; ++p)
+		if (*p == '\n')
+			++count;
+	if (count == 0)
+		goto out;
+
+	*dmmp_evts = (struct dmmp_event **)
+		calloc(count, sizeof(struct dmmp_event *));
+	_dmmp_alloc_null_check(ctx, *dmmp_evts, rc, out);
+
+	for (line = strtok_r(str, "\n", &saveptr); line != NULL && i < count;
+	     line = strtok_r(NULL, "\n", &saveptr)) {
+		dmmp_evt = _dmmp_event_new();
+		_dmmp_alloc_null_check(ctx, dmmp_evt, rc, out);
+		(*dmmp_evts)[i++] = dmmp_evt;
+		_good(_dmmp_event_update(ctx, dmmp_evt, line), rc, out);
+	}
+
+out:
+	*dmmp_evt_count = i;
+	if (rc != DMMP_OK) {
+		dmmp_event_array_free(*dmmp_evts, *dmmp_evt_count);
+		*dmmp_evts = NULL;
+		*dmmp_evt_count = 0;
+	}
+	return rc;
+}
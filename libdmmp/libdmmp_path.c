@@ -113,3 +113,12 @@ void _dmmp_path_free(struct dmmp_path *dmmp_p)
 	free(dmmp_p->blk_name);
 	free(dmmp_p);
 }
+
+uint32_t _dmmp_path_status_parse(struct dmmp_context *ctx,
+				 const char *status_str)
+{
+	assert(ctx != NULL);
+	assert(status_str != NULL);
+
+	return _dmmp_path_status_str_conv(ctx, status_str);
+}
@@ -129,6 +129,13 @@ DMMP_DLL_LOCAL void _dmmp_path_group_free(struct dmmp_path_group *dmmp_pg);
 DMMP_DLL_LOCAL void _dmmp_path_group_array_free
 	(struct dmmp_path_group **dmmp_pgs, uint32_t dmmp_pg_count);
 DMMP_DLL_LOCAL void _dmmp_path_free(struct dmmp_path *dmmp_p);
+DMMP_DLL_LOCAL uint32_t _dmmp_path_status_parse(struct dmmp_context *ctx,
+						const char *status_str);
+DMMP_DLL_LOCAL int _dmmp_event_array_parse(struct dmmp_context *ctx,
+					   char *str,
+					   struct dmmp_event ***dmmp_evts,
+					   uint32_t *dmmp_evt_count);
+DMMP_DLL_LOCAL void _dmmp_event_free(struct dmmp_event *dmmp_evt);
 DMMP_DLL_LOCAL void _dmmp_log(struct dmmp_context *ctx, int priority,
 			      const char *file, int line,
 			      const char *func_name,
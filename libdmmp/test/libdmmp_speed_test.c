@@ -24,26 +24,67 @@
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
 
 #include <libdmmp/libdmmp.h>
 
+#define LOOPS 10
+
+static double time_diff(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) +
+		(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
 int main(void)
 {
 	struct dmmp_context *ctx = NULL;
 	struct dmmp_mpath **dmmp_mps = NULL;
 	uint32_t dmmp_mp_count = 0;
 	int rc = EXIT_SUCCESS;
+	struct timespec start;
+	struct timespec end;
+	int i = 0;
 
 	ctx = dmmp_context_new();
 	dmmp_context_log_priority_set(ctx, DMMP_LOG_PRIORITY_WARNING);
 
-	if (dmmp_mpath_array_get(ctx, &dmmp_mps, &dmmp_mp_count) != 0) {
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < LOOPS; ++i) {
+		if (dmmp_mpath_array_get(ctx, &dmmp_mps, &dmmp_mp_count) != 0) {
+			printf("FAILED\n");
+			rc = EXIT_FAILURE;
+			goto out;
+		}
+		if (i < LOOPS - 1)
+			dmmp_mpath_array_free(dmmp_mps, dmmp_mp_count);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Got %" PRIu32 " mpath\n", dmmp_mp_count);
+	dmmp_mpath_array_free(dmmp_mps, dmmp_mp_count);
+	printf("dmmp_mpath_array_get(): %.6f seconds per call\n",
+	       time_diff(&start, &end) / LOOPS);
+
+	/* The first refresh fills the cache */
+	if (dmmp_mpath_array_refresh(ctx, &dmmp_mps, &dmmp_mp_count) != 0) {
 		printf("FAILED\n");
 		rc = EXIT_FAILURE;
-	} else {
-		printf("Got %" PRIu32 " mpath\n", dmmp_mp_count);
-		dmmp_mpath_array_free(dmmp_mps, dmmp_mp_count);
+		goto out;
 	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < LOOPS; ++i) {
+		if (dmmp_mpath_array_refresh(ctx, &dmmp_mps,
+					     &dmmp_mp_count) != 0) {
+			printf("FAILED\n");
+			rc = EXIT_FAILURE;
+			goto out;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("dmmp_mpath_array_refresh(): %.6f seconds per call\n",
+	       time_diff(&start, &end) / LOOPS);
+
+out:
 	dmmp_context_free(ctx);
 	exit(rc);
 }
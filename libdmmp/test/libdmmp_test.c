@@ -102,6 +102,39 @@ out:
 	return rc;
 }
 
+static int test_events(struct dmmp_context *ctx, int evt_fd,
+		       const char *mpath_name)
+{
+	struct dmmp_event **dmmp_evts = NULL;
+	uint32_t dmmp_evt_count = 0;
+	uint32_t i = 0;
+	const char *name = NULL;
+	int rc = 0;
+	bool found = false;
+
+	while (found == false) {
+		if (dmmp_event_array_get(ctx, evt_fd, &dmmp_evts,
+					 &dmmp_evt_count) != DMMP_OK)
+			FAIL(rc, out, "dmmp_event_array_get() failed: %s\n",
+			     dmmp_last_error_msg(ctx));
+		for (i = 0; i < dmmp_evt_count; ++i) {
+			name = dmmp_event_mpath_name_get(dmmp_evts[i]);
+			PASS("dmmp_event_array_get(): %" PRIu64 " %s %s\n",
+			     dmmp_event_seq_get(dmmp_evts[i]),
+			     dmmp_event_type_str
+				(dmmp_event_type_get(dmmp_evts[i])),
+			     name ? name : "");
+			if ((dmmp_event_type_get(dmmp_evts[i]) ==
+			     DMMP_EVENT_TYPE_MPATH_REMOVE) &&
+			    (strcmp(name, mpath_name) == 0))
+				found = true;
+		}
+		dmmp_event_array_free(dmmp_evts, dmmp_evt_count);
+	}
+out:
+	return rc;
+}
+
 int main(void)
 {
 	struct dmmp_context *ctx = NULL;
@@ -115,6 +148,10 @@ int main(void)
 	int rc = EXIT_SUCCESS;
 	const char *old_name = NULL;
 	bool found = false;
+	int evt_fd = -1;
+	uint64_t evt_seq = 0;
+	struct dmmp_mpath **cached_mps = NULL;
+	uint32_t cached_mp_count = 0;
 
 	ctx = dmmp_context_new();
 	dmmp_context_log_priority_set(ctx, DMMP_LOG_PRIORITY_DEBUG);
@@ -154,12 +191,22 @@ int main(void)
 
 	dmmp_mpath_array_free(dmmp_mps, dmmp_mp_count);
 
+	if (dmmp_event_subscribe(ctx, &evt_fd, &evt_seq) != DMMP_OK)
+		FAIL(rc, out, "dmmp_event_subscribe() failed: %s\n",
+		     dmmp_last_error_msg(ctx));
+
+	PASS("dmmp_event_subscribe(): at %" PRIu64 "\n", evt_seq);
+
 	if (dmmp_flush_mpath(ctx, old_name) != DMMP_OK)
 		FAIL(rc, out, "dmmp_flush_mpath(): failed %s\n",
 		     dmmp_last_error_msg(ctx));
 
 	PASS("dmmp_flush_mpath(): OK\n");
 
+	rc = test_events(ctx, evt_fd, old_name);
+	if (rc != 0)
+		goto out;
+
 	if (dmmp_reconfig(ctx) != DMMP_OK)
 		FAIL(rc, out, "dmmp_reconfig() failed: %s\n",
 		     dmmp_last_error_msg(ctx));
@@ -188,7 +235,21 @@ int main(void)
 		FAIL(rc, out, "dmmp_reconfig() does not recreate deleted "
 		     "mpath %s\n", old_name);
 
+	for (i = 0; i < 2; ++i) {
+		if (dmmp_mpath_array_refresh(ctx, &cached_mps,
+					     &cached_mp_count) != DMMP_OK)
+			FAIL(rc, out, "dmmp_mpath_array_refresh() failed: %s\n",
+			     dmmp_last_error_msg(ctx));
+		if (cached_mp_count != dmmp_mp_count)
+			FAIL(rc, out, "dmmp_mpath_array_refresh(): Got %" PRIu32
+			     " mpath, expected %" PRIu32 "\n", cached_mp_count,
+			     dmmp_mp_count);
+		PASS("dmmp_mpath_array_refresh(): Got %" PRIu32 " mpath\n",
+		     cached_mp_count);
+	}
+
 out:
+	dmmp_event_unsubscribe(ctx, evt_fd);
 	dmmp_context_free(ctx);
 	exit(rc);
 }
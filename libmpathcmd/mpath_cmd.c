@@ -27,6 +27,7 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 
 #include "mpath_cmd.h"
 
@@ -224,3 +225,27 @@ int mpath_process_cmd(int fd, const char *cmd, char **reply,
 		return -1;
 	return mpath_recv_reply(fd, reply, timeout);
 }
+
+int mpath_subscribe(int fd, uint64_t *seq, unsigned int timeout)
+{
+	char *reply;
+	uint64_t last;
+	int ret = 0;
+
+	if (mpath_process_cmd(fd, "subscribe", &reply, timeout) != 0)
+		return -1;
+	if (!reply) {
+		errno = EIO;
+		return -1;
+	}
+	if (sscanf(reply, "subscribed %" SCNu64, &last) == 1) {
+		if (seq)
+			*seq = last;
+	} else {
+		errno = strncmp(reply, "permission deny",
+				strlen("permission deny")) ? EPROTO : EPERM;
+		ret = -1;
+	}
+	free(reply);
+	return ret;
+}
@@ -20,6 +20,8 @@
 #ifndef LIB_MPATH_CMD_H
 #define LIB_MPATH_CMD_H
 
+#include <stdint.h>
+
 /*
  * This should be sufficient for json output for >10000 maps,
  * and >60000 paths.
@@ -138,6 +140,34 @@ ssize_t mpath_recv_reply_len(int fd, unsigned int timeout);
 int mpath_recv_reply_data(int fd, char *reply, size_t len,
 			  unsigned int timeout);
 
+/*
+ * DESCRIPTION:
+ *	Subscribe to change events from multipathd. After this call,
+ *	the connection can't be used for other commands any more.
+ *	multipathd pushes events to the client as they happen; read
+ *	them with mpath_recv_reply(). Every reply contains one or more
+ *	events, one per line, each starting with its sequence number:
+ *
+ *	<seq> path <dev> <map> <chk_st>
+ *	<seq> add <map>
+ *	<seq> remove <map>
+ *	<seq> reload <map>
+ *	<seq> switchgroup <map> <group>
+ *	<seq> overflow
+ *
+ *	"overflow" means that the client didn't keep up, and events up to
+ *	and including <seq> were lost. The client should re-read the full
+ *	state in this case. Event sequence numbers are only meaningful
+ *	for the lifetime of a multipathd process.
+ *	If seq is not NULL, it is set to the sequence number of the last
+ *	event that happened before the subscription.
+ *
+ * RETURNS:
+ *	0 on success. -1 on failure (with errno set). errno is set to
+ *	EPROTO if multipathd doesn't support subscriptions.
+ */
+int mpath_subscribe(int fd, uint64_t *seq, unsigned int timeout);
+
 #ifdef __cplusplus
 }
 #endif
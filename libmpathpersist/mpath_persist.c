@@ -1,4 +1,5 @@
 #include <libdevmapper.h>
+#include <stdlib.h>
 
 #include "util.h"
 #include "vector.h"
@@ -52,6 +53,7 @@ mpath_lib_init (void)
 
 static void libmpathpersist_cleanup(void)
 {
+	pr_pool_stop();
 	libmultipath_exit();
 	dm_lib_exit();
 }
@@ -104,9 +106,10 @@ static int __mpath_persistent_reserve_init_vecs(vector *curmp_p,
 		goto err;
 	}
 
-	if (dm_get_maps(*curmp_p))
-		goto err;
-
+	/*
+	 * Maps are read from device-mapper on demand, only the ones
+	 * that PR commands are actually sent to.
+	 */
 	return MPATH_PR_SUCCESS;
 
 err:
@@ -124,7 +127,7 @@ int __mpath_persistent_reserve_in (int fd, int rq_servact,
 	struct prin_resp *resp, int noisy)
 {
 	return do_mpath_persistent_reserve_in(curmp, pathvec, fd, rq_servact,
-					      resp, noisy);
+					      resp, noisy, false);
 }
 
 
@@ -133,7 +136,7 @@ int __mpath_persistent_reserve_out ( int fd, int rq_servact, int rq_scope,
 {
 	return do_mpath_persistent_reserve_out(curmp, pathvec, fd, rq_servact,
 					       rq_scope, rq_type, paramp,
-					       noisy);
+					       noisy, false);
 }
 
 int mpath_persistent_reserve_in (int fd, int rq_servact,
@@ -146,7 +149,7 @@ int mpath_persistent_reserve_in (int fd, int rq_servact,
 	if (ret != MPATH_PR_SUCCESS)
 		return ret;
 	ret = do_mpath_persistent_reserve_in(curmp, pathvec, fd, rq_servact,
-					     resp, noisy);
+					     resp, noisy, false);
 	__mpath_persistent_reserve_free_vecs(curmp, pathvec);
 	return ret;
 }
@@ -161,7 +164,96 @@ int mpath_persistent_reserve_out ( int fd, int rq_servact, int rq_scope,
 	if (ret != MPATH_PR_SUCCESS)
 		return ret;
 	ret = do_mpath_persistent_reserve_out(curmp, pathvec, fd, rq_servact,
-					      rq_scope, rq_type, paramp, noisy);
+					      rq_scope, rq_type, paramp, noisy,
+					      false);
 	__mpath_persistent_reserve_free_vecs(curmp, pathvec);
 	return ret;
 }
+
+struct mpath_pr_context {
+	vector curmp;
+	vector pathvec;
+};
+
+struct mpath_pr_context *mpath_pr_context_new(int verbose)
+{
+	struct mpath_pr_context *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+	if (__mpath_persistent_reserve_init_vecs(&ctx->curmp, &ctx->pathvec,
+						 verbose) != MPATH_PR_SUCCESS) {
+		free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+void mpath_pr_context_free(struct mpath_pr_context *ctx)
+{
+	if (!ctx)
+		return;
+	__mpath_persistent_reserve_free_vecs(ctx->curmp, ctx->pathvec);
+	free(ctx);
+}
+
+int mpath_pr_context_reserve_in(struct mpath_pr_context *ctx, int fd,
+				int rq_servact, struct prin_resp *resp,
+				int noisy)
+{
+	if (!ctx)
+		return MPATH_PR_OTHER;
+	return do_mpath_persistent_reserve_in(ctx->curmp, ctx->pathvec, fd,
+					      rq_servact, resp, noisy, true);
+}
+
+int mpath_pr_context_reserve_out(struct mpath_pr_context *ctx, int fd,
+				 int rq_servact, int rq_scope,
+				 unsigned int rq_type,
+				 struct prout_param_descriptor *paramp,
+				 int noisy)
+{
+	if (!ctx)
+		return MPATH_PR_OTHER;
+	return do_mpath_persistent_reserve_out(ctx->curmp, ctx->pathvec, fd,
+					       rq_servact, rq_scope, rq_type,
+					       paramp, noisy, true);
+}
+
+int mpath_pr_context_reserve_out_batch(struct mpath_pr_context *ctx,
+				       const int *fds, int nr_fds,
+				       int rq_servact,
+				       struct prout_param_descriptor *paramp,
+				       int noisy, int *status)
+{
+	struct prout_param_descriptor *map_paramp;
+	size_t param_len;
+	int i, ret = MPATH_PR_SUCCESS;
+
+	if (!ctx || !fds || !paramp || !status || nr_fds < 0)
+		return MPATH_PR_OTHER;
+	if (rq_servact != MPATH_PROUT_REG_SA &&
+	    rq_servact != MPATH_PROUT_REG_IGN_SA)
+		return MPATH_PR_SYNTAX_ERROR;
+
+	param_len = sizeof(*paramp) +
+		paramp->num_transportid * sizeof(struct transportid *);
+	map_paramp = malloc(param_len);
+	if (!map_paramp)
+		return MPATH_PR_OTHER;
+
+	for (i = 0; i < nr_fds; i++) {
+		/* a failed registration rolls back the keys in paramp */
+		memcpy(map_paramp, paramp, param_len);
+		status[i] = do_mpath_persistent_reserve_out(ctx->curmp,
+							    ctx->pathvec,
+							    fds[i], rq_servact,
+							    0, 0, map_paramp,
+							    noisy, true);
+		if (status[i] != MPATH_PR_SUCCESS && ret == MPATH_PR_SUCCESS)
+			ret = status[i];
+	}
+	free(map_paramp);
+	return ret;
+}
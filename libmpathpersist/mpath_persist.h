@@ -321,6 +321,82 @@ int mpath_persistent_reserve_init_vecs(int verbose);
  */
 void mpath_persistent_reserve_free_vecs(void);
 
+/*
+ * Opaque state for a caller that sends many PR commands, e.g. a cluster
+ * fencing agent. Maps and paths are looked up on first use and kept in
+ * the context, and the state of a map is refreshed on every call.
+ */
+struct mpath_pr_context;
+
+/*
+ * DESCRIPTION :
+ * This function allocates a context for mpath_pr_context_reserve_in() and
+ * mpath_pr_context_reserve_out(). The library must be initialized first.
+ * @verbose: Set verbosity level. Input argument. value:0 to 3. 0->disabled, 3->Max verbose
+ *	Like for mpath_persistent_reserve_init_vecs(), this sets the verbosity
+ *	of the library, the calls using the context don't change it.
+ *
+ * RESTRICTIONS:
+ * A context must not be used by several threads at the same time.
+ *
+ * RETURNS: The new context, or NULL on allocation failure.
+ */
+struct mpath_pr_context *mpath_pr_context_new(int verbose);
+
+/*
+ * DESCRIPTION :
+ * This function frees a context allocated by mpath_pr_context_new().
+ */
+void mpath_pr_context_free(struct mpath_pr_context *ctx);
+
+/*
+ * DESCRIPTION :
+ * This function is like mpath_persistent_reserve_in(), except that
+ * it uses the state cached in @ctx.
+ *
+ * RETURNS: MPATH_PR_SUCCESS if PR command successful else returns any of the status specified
+ *       above in RETURN_STATUS.
+ */
+int mpath_pr_context_reserve_in(struct mpath_pr_context *ctx, int fd,
+				int rq_servact, struct prin_resp *resp,
+				int noisy);
+
+/*
+ * DESCRIPTION :
+ * This function is like mpath_persistent_reserve_out(), except that
+ * it uses the state cached in @ctx.
+ *
+ * RETURNS: MPATH_PR_SUCCESS if PR command successful else returns any of the status specified
+ *       above in RETURN_STATUS.
+ */
+int mpath_pr_context_reserve_out(struct mpath_pr_context *ctx, int fd,
+				 int rq_servact, int rq_scope,
+				 unsigned int rq_type,
+				 struct prout_param_descriptor *paramp,
+				 int noisy);
+
+/*
+ * DESCRIPTION :
+ * This function registers or unregisters a reservation key on several
+ * multipath devices, for example all devices of a host that is being
+ * fenced. The command is sent to the paths of each map in parallel.
+ * @fds: file descriptors of the multipath devices. Input argument.
+ * @nr_fds: number of elements in @fds and @status.
+ * @rq_servact: MPATH_PROUT_REG_SA or MPATH_PROUT_REG_IGN_SA. A zero
+ *	service action key in @paramp unregisters.
+ * @paramp: PR OUT parameters, used for every device. Input argument.
+ * @status: result of the command for every device. Output argument.
+ *
+ * RETURNS: MPATH_PR_SUCCESS if the command succeeded on all devices,
+ *	MPATH_PR_SYNTAX_ERROR for other service actions, otherwise the
+ *	first error in @status.
+ */
+int mpath_pr_context_reserve_out_batch(struct mpath_pr_context *ctx,
+				       const int *fds, int nr_fds,
+				       int rq_servact,
+				       struct prout_param_descriptor *paramp,
+				       int noisy, int *status);
+
 
 #ifdef __cplusplus
 }
@@ -27,12 +27,18 @@
 #include "propsel.h"
 #include "util.h"
 #include "unaligned.h"
+#include "list.h"
 
 #include "mpath_persist.h"
 #include "mpath_persist_int.h"
 #include "mpathpr.h"
 #include "mpath_pr_ioctl.h"
 
+struct prout_batch {
+	int pending;
+	pthread_cond_t done;
+};
+
 struct prout_param {
 	char dev[FILE_NAME_SIZE];
 	int rq_servact;
@@ -41,13 +47,137 @@ struct prout_param {
 	struct prout_param_descriptor  *paramp;
 	int noisy;
 	int status;
+	struct list_head node;
+	struct prout_batch *batch;
 };
 
-struct threadinfo {
-	int status;
-	pthread_t id;
-	struct prout_param param;
-};
+/*
+ * PR OUT commands for the paths of a map are sent in parallel by a
+ * small pool of worker threads, which is shared by all callers and
+ * started on first use.
+ */
+#define PR_POOL_MAX_WORKERS 16
+
+static pthread_mutex_t pr_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pr_pool_cond = PTHREAD_COND_INITIALIZER;
+static LIST_HEAD(pr_pool_queue);
+static pthread_t pr_pool_workers[PR_POOL_MAX_WORKERS];
+static int pr_pool_nr_workers;
+static bool pr_pool_stopping;
+
+static void *pr_pool_worker(__attribute__((unused)) void *arg)
+{
+	struct prout_param *param;
+
+	pthread_mutex_lock(&pr_pool_lock);
+	for (;;) {
+		while (list_empty(&pr_pool_queue) && !pr_pool_stopping)
+			pthread_cond_wait(&pr_pool_cond, &pr_pool_lock);
+		/* finish the queued commands, their callers wait for them */
+		if (list_empty(&pr_pool_queue))
+			break;
+		param = list_entry(pr_pool_queue.next, struct prout_param,
+				   node);
+		list_del_init(&param->node);
+		pthread_mutex_unlock(&pr_pool_lock);
+
+		param->status = prout_do_scsi_ioctl(param->dev,
+						    param->rq_servact,
+						    param->rq_scope,
+						    param->rq_type,
+						    param->paramp,
+						    param->noisy);
+
+		pthread_mutex_lock(&pr_pool_lock);
+		if (--param->batch->pending == 0)
+			pthread_cond_signal(&param->batch->done);
+	}
+	pthread_mutex_unlock(&pr_pool_lock);
+	return NULL;
+}
+
+/* call with pr_pool_lock held */
+static void pr_pool_grow(int wanted)
+{
+	int rc;
+
+	if (wanted > PR_POOL_MAX_WORKERS)
+		wanted = PR_POOL_MAX_WORKERS;
+	while (pr_pool_nr_workers < wanted) {
+		rc = pthread_create(&pr_pool_workers[pr_pool_nr_workers], NULL,
+				    pr_pool_worker, NULL);
+		if (rc) {
+			condlog(0, "failed to create pr worker thread: %d", rc);
+			break;
+		}
+		pr_pool_nr_workers++;
+	}
+}
+
+void pr_pool_stop(void)
+{
+	int i;
+
+	pthread_mutex_lock(&pr_pool_lock);
+	pr_pool_stopping = true;
+	pthread_cond_broadcast(&pr_pool_cond);
+	pthread_mutex_unlock(&pr_pool_lock);
+
+	for (i = 0; i < pr_pool_nr_workers; i++)
+		pthread_join(pr_pool_workers[i], NULL);
+
+	pthread_mutex_lock(&pr_pool_lock);
+	pr_pool_nr_workers = 0;
+	pr_pool_stopping = false;
+	pthread_mutex_unlock(&pr_pool_lock);
+}
+
+/*
+ * Send the PR OUT commands in params[] and wait until all of them have
+ * completed. The result of every command is stored in its status field.
+ */
+static void pr_pool_run(struct prout_param **params, int count)
+{
+	struct prout_batch batch = { .pending = 0, };
+	int i, oldstate;
+
+	if (count == 0)
+		return;
+
+	/* params[] live on the caller's stack, don't leave them behind */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+	pthread_cond_init(&batch.done, NULL);
+
+	pthread_mutex_lock(&pr_pool_lock);
+	/* while stopping, workers may already have exited */
+	if (!pr_pool_stopping)
+		pr_pool_grow(count);
+	if (pr_pool_nr_workers == 0 || pr_pool_stopping) {
+		pthread_mutex_unlock(&pr_pool_lock);
+		condlog(2, "no pr worker threads, sending commands serially");
+		for (i = 0; i < count; i++)
+			params[i]->status =
+				prout_do_scsi_ioctl(params[i]->dev,
+						    params[i]->rq_servact,
+						    params[i]->rq_scope,
+						    params[i]->rq_type,
+						    params[i]->paramp,
+						    params[i]->noisy);
+		goto out;
+	}
+	for (i = 0; i < count; i++) {
+		params[i]->batch = &batch;
+		list_add_tail(&params[i]->node, &pr_pool_queue);
+		batch.pending++;
+	}
+	pthread_cond_broadcast(&pr_pool_cond);
+	while (batch.pending > 0)
+		pthread_cond_wait(&batch.done, &pr_pool_lock);
+	pthread_mutex_unlock(&pr_pool_lock);
+out:
+	pthread_cond_destroy(&batch.done);
+	pthread_setcancelstate(oldstate, NULL);
+}
 
 static int mpath_send_prin_activepath (char * dev, int rq_servact,
 				struct prin_resp * resp, int noisy)
@@ -122,7 +252,8 @@ void *mpath_alloc_prin_response(int prin_sa)
 	return ptr;
 }
 
-static int get_mpvec(vector curmp, vector pathvec, char *refwwid)
+static int get_mpvec(vector curmp, vector pathvec, char *refwwid,
+		     bool refresh)
 {
 	int i;
 	struct multipath *mpp;
@@ -136,7 +267,7 @@ static int get_mpvec(vector curmp, vector pathvec, char *refwwid)
 			continue;
 		}
 
-		if (mpp->pg != NULL)
+		if (mpp->pg != NULL && !refresh)
 			/* Already seen this one */
 			continue;
 
@@ -154,8 +285,13 @@ static int get_mpvec(vector curmp, vector pathvec, char *refwwid)
 	return MPATH_PR_SUCCESS ;
 }
 
+/*
+ * Only the map behind fd is read from device-mapper, and added to curmp
+ * if it isn't there yet. With refresh set, a map that is already in
+ * curmp is re-read, so that a long-lived context sees current path states.
+ */
 static int mpath_get_map(vector curmp, vector pathvec, int fd, char **palias,
-			 struct multipath **pmpp)
+			 struct multipath **pmpp, bool refresh)
 {
 	int ret = MPATH_PR_DMMP_ERROR;
 	struct stat info;
@@ -190,8 +326,21 @@ static int mpath_get_map(vector curmp, vector pathvec, int fd, char **palias,
 		goto out;
 	}
 
+	if (!find_mp_by_alias(curmp, alias)) {
+		mpp = dm_get_multipath(alias);
+		if (!mpp) {
+			condlog(0, "%s: devmap not registered.", alias);
+			goto out;
+		}
+		if (!vector_alloc_slot(curmp)) {
+			free_multipath(mpp, KEEP_PATHS);
+			goto out;
+		}
+		vector_set_slot(curmp, mpp);
+	}
+
 	/* get info of all paths from the dm device     */
-	if (get_mpvec(curmp, pathvec, alias)){
+	if (get_mpvec(curmp, pathvec, alias, refresh)){
 		condlog(0, "%s: failed to get device info.", alias);
 		goto out;
 	}
@@ -217,12 +366,12 @@ out:
 
 int do_mpath_persistent_reserve_in(vector curmp, vector pathvec,
 				   int fd, int rq_servact,
-				   struct prin_resp *resp, int noisy)
+				   struct prin_resp *resp, int noisy, bool refresh)
 {
 	struct multipath *mpp;
 	int ret;
 
-	ret = mpath_get_map(curmp, pathvec, fd, NULL, &mpp);
+	ret = mpath_get_map(curmp, pathvec, fd, NULL, &mpp, refresh);
 	if (ret != MPATH_PR_SUCCESS)
 		return ret;
 
@@ -231,17 +380,6 @@ int do_mpath_persistent_reserve_in(vector curmp, vector pathvec,
 	return ret;
 }
 
-static void *mpath_prout_pthread_fn(void *p)
-{
-	int ret;
-	struct prout_param * param = (struct prout_param *)p;
-
-	ret = prout_do_scsi_ioctl( param->dev,param->rq_servact, param->rq_scope,
-			param->rq_type, param->paramp, param->noisy);
-	param->status = ret;
-	pthread_exit(NULL);
-}
-
 static int mpath_prout_reg(struct multipath *mpp,int rq_servact, int rq_scope,
 			   unsigned int rq_type,
 			   struct prout_param_descriptor * paramp, int noisy)
@@ -252,11 +390,12 @@ static int mpath_prout_reg(struct multipath *mpp,int rq_servact, int rq_scope,
 	struct path *pp = NULL;
 	int rollback = 0;
 	int active_pathcount=0;
-	int rc;
 	int count=0;
 	int status = MPATH_PR_SUCCESS;
 	int all_tg_pt;
 	uint64_t sa_key = 0;
+	struct prout_param_descriptor *nospec = NULL;
+	size_t param_len;
 
 	if (!mpp)
 		return MPATH_PR_DMMP_ERROR;
@@ -270,35 +409,42 @@ static int mpath_prout_reg(struct multipath *mpp,int rq_servact, int rq_scope,
 		return MPATH_PR_DMMP_ERROR;
 	}
 
-	struct threadinfo thread[active_pathcount];
+	struct prout_param param[active_pathcount];
+	struct prout_param *run[active_pathcount];
 	int hosts[active_pathcount];
 
-	memset(thread, 0, sizeof(thread));
+	memset(param, 0, sizeof(param));
 
 	/* init thread parameter */
 	for (i =0; i< active_pathcount; i++){
 		hosts[i] = -1;
-		thread[i].param.rq_servact = rq_servact;
-		thread[i].param.rq_scope = rq_scope;
-		thread[i].param.rq_type = rq_type;
-		thread[i].param.paramp = paramp;
-		thread[i].param.noisy = noisy;
-		thread[i].param.status = MPATH_PR_SKIP;
-
-		condlog (3, "THREAD ID [%d] INFO]", i);
-		condlog (3, "rq_servact=%d ", thread[i].param.rq_servact);
-		condlog (3, "rq_scope=%d ", thread[i].param.rq_scope);
-		condlog (3, "rq_type=%d ", thread[i].param.rq_type);
-		condlog (3, "rkey=");
-		condlog (3, "paramp->sa_flags =%02x ",
-			 thread[i].param.paramp->sa_flags);
-		condlog (3, "noisy=%d ", thread[i].param.noisy);
-		condlog (3, "status=%d ", thread[i].param.status);
-	}
-
-	pthread_attr_t attr;
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+		param[i].rq_servact = rq_servact;
+		param[i].rq_scope = rq_scope;
+		param[i].rq_type = rq_type;
+		param[i].paramp = paramp;
+		param[i].noisy = noisy;
+		param[i].status = MPATH_PR_SKIP;
+	}
+	condlog (3, "%s: rq_servact=%d rq_scope=%d rq_type=%d sa_flags=%02x noisy=%d",
+		 mpp->wwid, rq_servact, rq_scope, rq_type, paramp->sa_flags,
+		 noisy);
+
+	if (paramp->sa_flags & MPATH_F_SPEC_I_PT_MASK) {
+		/*
+		 * Clearing SPEC_I_PT for all but the first path, as
+		 * transportids are already registered by then.
+		 */
+		param_len = sizeof(*paramp) +
+			paramp->num_transportid * sizeof(struct transportid *);
+		nospec = malloc(param_len);
+		if (!nospec) {
+			condlog (0, "%s: failed to alloc pr out parameter.",
+				 mpp->wwid);
+			return MPATH_PR_OTHER;
+		}
+		memcpy(nospec, paramp, param_len);
+		nospec->sa_flags &= ~MPATH_F_SPEC_I_PT_MASK;
+	}
 
 	vector_foreach_slot (mpp->pg, pgp, j){
 		vector_foreach_slot (pgp->paths, pp, i){
@@ -306,6 +452,8 @@ static int mpath_prout_reg(struct multipath *mpp,int rq_servact, int rq_scope,
 				condlog (1, "%s: %s path not up. Skip.", mpp->wwid, pp->dev);
 				continue;
 			}
+			if (count >= active_pathcount)
+				break;
 			if (all_tg_pt && pp->sg_id.host_no != -1) {
 				for (k = 0; k < count; k++) {
 					if (pp->sg_id.host_no == hosts[k]) {
@@ -316,72 +464,48 @@ static int mpath_prout_reg(struct multipath *mpp,int rq_servact, int rq_scope,
 				if (k < count)
 					continue;
 			}
-			strlcpy(thread[count].param.dev, pp->dev,
-				FILE_NAME_SIZE);
-
-			if (count && (thread[count].param.paramp->sa_flags & MPATH_F_SPEC_I_PT_MASK)){
-				/*
-				 * Clearing SPEC_I_PT as transportids are already registered by now.
-				 */
-				thread[count].param.paramp->sa_flags &= (~MPATH_F_SPEC_I_PT_MASK);
-			}
+			strlcpy(param[count].dev, pp->dev, FILE_NAME_SIZE);
+			if (count && nospec)
+				param[count].paramp = nospec;
 
 			condlog (3, "%s: sending pr out command to %s", mpp->wwid, pp->dev);
-
-			rc = pthread_create(&thread[count].id, &attr, mpath_prout_pthread_fn, (void *)(&thread[count].param));
-			if (rc){
-				condlog (0, "%s: failed to create thread %d", mpp->wwid, rc);
-				thread[count].param.status = MPATH_PR_THREAD_ERROR;
-			}
-			else
-				hosts[count] = pp->sg_id.host_no;
+			hosts[count] = pp->sg_id.host_no;
+			run[count] = &param[count];
 			count = count + 1;
 		}
 	}
+	pr_pool_run(run, count);
+
 	for( i=0; i < count ; i++){
-		if (thread[i].param.status != MPATH_PR_THREAD_ERROR) {
-			rc = pthread_join(thread[i].id, NULL);
-			if (rc){
-				condlog (0, "%s: Thread[%d] failed to join thread %d", mpp->wwid, i, rc);
-			}
-		}
-		if (!rollback && (thread[i].param.status == MPATH_PR_RESERV_CONFLICT)){
+		if (!rollback && (param[i].status == MPATH_PR_RESERV_CONFLICT)){
 			rollback = 1;
 			sa_key = get_unaligned_be64(&paramp->sa_key[0]);
 			status = MPATH_PR_RESERV_CONFLICT ;
 		}
 		if (!rollback && (status == MPATH_PR_SUCCESS)){
-			status = thread[i].param.status;
+			status = param[i].status;
 		}
 	}
 	if (rollback && ((rq_servact == MPATH_PROUT_REG_SA) && sa_key != 0 )){
+		int n = 0;
+
 		condlog (3, "%s: ERROR: initiating pr out rollback", mpp->wwid);
 		memcpy(&paramp->key, &paramp->sa_key, 8);
 		memset(&paramp->sa_key, 0, 8);
-		for( i=0 ; i < count ; i++){
-			if(thread[i].param.status == MPATH_PR_SUCCESS) {
-				rc = pthread_create(&thread[i].id, &attr, mpath_prout_pthread_fn,
-						(void *)(&thread[i].param));
-				if (rc){
-					condlog (0, "%s: failed to create thread for rollback. %d",  mpp->wwid, rc);
-					thread[i].param.status = MPATH_PR_THREAD_ERROR;
-				}
-			} else
-				thread[i].param.status = MPATH_PR_SKIP;
+		if (nospec) {
+			memcpy(&nospec->key, &nospec->sa_key, 8);
+			memset(&nospec->sa_key, 0, 8);
 		}
-		for(i=0; i < count ; i++){
-			if (thread[i].param.status != MPATH_PR_SKIP &&
-			    thread[i].param.status != MPATH_PR_THREAD_ERROR) {
-				rc = pthread_join(thread[i].id, NULL);
-				if (rc){
-					condlog (3, "%s: failed to join thread while rolling back %d",
-						 mpp->wwid, i);
-				}
-			}
+		for( i=0 ; i < count ; i++){
+			if(param[i].status == MPATH_PR_SUCCESS)
+				run[n++] = &param[i];
+			else
+				param[i].status = MPATH_PR_SKIP;
 		}
+		pr_pool_run(run, n);
 	}
 
-	pthread_attr_destroy(&attr);
+	free(nospec);
 	return (status);
 }
 
@@ -389,34 +513,9 @@ static int send_prout_activepath(char *dev, int rq_servact, int rq_scope,
 				 unsigned int rq_type,
 				 struct prout_param_descriptor * paramp, int noisy)
 {
-	struct prout_param param;
-	param.rq_servact = rq_servact;
-	param.rq_scope  = rq_scope;
-	param.rq_type   = rq_type;
-	param.paramp    = paramp;
-	param.noisy = noisy;
-	param.status = -1;
-
-	pthread_t thread;
-	pthread_attr_t attr;
-	int rc;
-
-	memset(&thread, 0, sizeof(thread));
-	strlcpy(param.dev, dev, FILE_NAME_SIZE);
-	/* Initialize and set thread joinable attribute */
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-
-	rc = pthread_create(&thread, &attr, mpath_prout_pthread_fn, (void *)(&param));
-	if (rc){
-		condlog (3, "%s: failed to create thread %d", dev, rc);
-		return MPATH_PR_THREAD_ERROR;
-	}
-	/* Free attribute and wait for the other threads */
-	pthread_attr_destroy(&attr);
-	rc = pthread_join(thread, NULL);
-
-	return (param.status);
+	/* A single command, no need for a separate thread */
+	return prout_do_scsi_ioctl(dev, rq_servact, rq_scope, rq_type,
+				   paramp, noisy);
 }
 
 static int mpath_prout_common(struct multipath *mpp,int rq_servact, int rq_scope,
@@ -455,8 +554,7 @@ static int mpath_prout_rel(struct multipath *mpp,int rq_servact, int rq_scope,
 	struct pathgroup *pgp = NULL;
 	struct path *pp = NULL;
 	int active_pathcount = 0;
-	pthread_attr_t attr;
-	int rc, found = 0;
+	int found = 0;
 	int count = 0;
 	int status = MPATH_PR_SUCCESS;
 	struct prin_resp resp;
@@ -475,26 +573,20 @@ static int mpath_prout_rel(struct multipath *mpp,int rq_servact, int rq_scope,
 		return MPATH_PR_DMMP_ERROR;
 	}
 
-	struct threadinfo thread[active_pathcount];
-	memset(thread, 0, sizeof(thread));
-	for (i = 0; i < active_pathcount; i++){
-		thread[i].param.rq_servact = rq_servact;
-		thread[i].param.rq_scope = rq_scope;
-		thread[i].param.rq_type = rq_type;
-		thread[i].param.paramp = paramp;
-		thread[i].param.noisy = noisy;
-		thread[i].param.status = MPATH_PR_SKIP;
+	struct prout_param param[active_pathcount];
+	struct prout_param *run[active_pathcount];
 
-		condlog (3, " path count = %d", i);
-		condlog (3, "rq_servact=%d ", thread[i].param.rq_servact);
-		condlog (3, "rq_scope=%d ", thread[i].param.rq_scope);
-		condlog (3, "rq_type=%d ", thread[i].param.rq_type);
-		condlog (3, "noisy=%d ", thread[i].param.noisy);
-		condlog (3, "status=%d ", thread[i].param.status);
+	memset(param, 0, sizeof(param));
+	for (i = 0; i < active_pathcount; i++){
+		param[i].rq_servact = rq_servact;
+		param[i].rq_scope = rq_scope;
+		param[i].rq_type = rq_type;
+		param[i].paramp = paramp;
+		param[i].noisy = noisy;
+		param[i].status = MPATH_PR_SKIP;
 	}
-
-	pthread_attr_init (&attr);
-	pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
+	condlog (3, "%s: rq_servact=%d rq_scope=%d rq_type=%d noisy=%d",
+		 mpp->wwid, rq_servact, rq_scope, rq_type, noisy);
 
 	vector_foreach_slot (mpp->pg, pgp, j){
 		vector_foreach_slot (pgp->paths, pp, i){
@@ -502,37 +594,25 @@ static int mpath_prout_rel(struct multipath *mpp,int rq_servact, int rq_scope,
 				condlog (1, "%s: %s path not up.", mpp->wwid, pp->dev);
 				continue;
 			}
+			if (count >= active_pathcount)
+				break;
 
-			strlcpy(thread[count].param.dev, pp->dev,
-				FILE_NAME_SIZE);
+			strlcpy(param[count].dev, pp->dev, FILE_NAME_SIZE);
 			condlog (3, "%s: sending pr out command to %s", mpp->wwid, pp->dev);
-			rc = pthread_create (&thread[count].id, &attr, mpath_prout_pthread_fn,
-					(void *) (&thread[count].param));
-			if (rc) {
-				condlog (0, "%s: failed to create thread. %d",  mpp->wwid, rc);
-				thread[count].param.status = MPATH_PR_THREAD_ERROR;
-			}
+			run[count] = &param[count];
 			count = count + 1;
 		}
 	}
-	pthread_attr_destroy (&attr);
-	for (i = 0; i < count; i++){
-		if (thread[i].param.status != MPATH_PR_THREAD_ERROR) {
-			rc = pthread_join (thread[i].id, NULL);
-			if (rc){
-				condlog (1, "%s: failed to join thread.  %d",  mpp->wwid,  rc);
-			}
-		}
-	}
+	pr_pool_run(run, count);
 
 	for (i = 0; i < count; i++){
 		/*  check thread status here and return the status */
 
-		if (thread[i].param.status == MPATH_PR_RESERV_CONFLICT)
+		if (param[i].status == MPATH_PR_RESERV_CONFLICT)
 			status = MPATH_PR_RESERV_CONFLICT;
 		else if (status == MPATH_PR_SUCCESS
-				&& thread[i].param.status != MPATH_PR_RESERV_CONFLICT)
-			status = thread[i].param.status;
+				&& param[i].status != MPATH_PR_RESERV_CONFLICT)
+			status = param[i].status;
 	}
 
 	status = mpath_prin_activepath (mpp, MPATH_PRIN_RRES_SA, &resp, noisy);
@@ -650,7 +730,8 @@ out:
 
 int do_mpath_persistent_reserve_out(vector curmp, vector pathvec, int fd,
 				    int rq_servact, int rq_scope, unsigned int rq_type,
-				    struct prout_param_descriptor *paramp, int noisy)
+				    struct prout_param_descriptor *paramp, int noisy,
+				    bool refresh)
 {
 	struct multipath *mpp;
 	char *alias;
@@ -658,7 +739,7 @@ int do_mpath_persistent_reserve_out(vector curmp, vector pathvec, int fd,
 	uint64_t prkey;
 	struct config *conf;
 
-	ret = mpath_get_map(curmp, pathvec, fd, &alias, &mpp);
+	ret = mpath_get_map(curmp, pathvec, fd, &alias, &mpp, refresh);
 	if (ret != MPATH_PR_SUCCESS)
 		return ret;
 
@@ -1,6 +1,8 @@
 #ifndef _MPATH_PERSIST_INT_H
 #define _MPATH_PERSIST_INT_H
 
+#include <stdbool.h>
+
 /*
  * This header file contains symbols that are used by multipath-tools
  * but aren't part of the public libmpathpersist API.
@@ -9,17 +11,19 @@
 void * mpath_alloc_prin_response(int prin_sa);
 int do_mpath_persistent_reserve_in(vector curmp, vector pathvec,
 				   int fd, int rq_servact,
-				   struct prin_resp *resp, int noisy);
+				   struct prin_resp *resp, int noisy,
+				   bool refresh);
 void *mpath_alloc_prin_response(int prin_sa);
 int do_mpath_persistent_reserve_out(vector curmp, vector pathvec, int fd,
 				    int rq_servact, int rq_scope,
 				    unsigned int rq_type,
 				    struct prout_param_descriptor *paramp,
-				    int noisy);
+				    int noisy, bool refresh);
 int prin_do_scsi_ioctl(char * dev, int rq_servact, struct prin_resp * resp, int noisy);
 int prout_do_scsi_ioctl( char * dev, int rq_servact, int rq_scope,
 			 unsigned int rq_type, struct prout_param_descriptor *paramp, int noisy);
 void dumpHex(const char* , int len, int no_ascii);
 int update_map_pr(struct multipath *mpp);
+void pr_pool_stop(void);
 
 #endif /* _MPATH_PERSIST_INT_H */
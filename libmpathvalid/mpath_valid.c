@@ -4,6 +4,7 @@
 #include <libdevmapper.h>
 #include <libudev.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "devmapper.h"
 #include "structs.h"
@@ -166,15 +167,30 @@ mpathvalid_is_path(const char *name, unsigned int mode, char **wwid,
 			goto out;
 	}
 
-	conf = get_multipath_config();
-	if (!conf)
-		goto out_wwid;
-	find_multipaths_saved = conf->find_multipaths;
-	if (mode != MPATH_DEFAULT)
-		set_conf_mode(conf, mode);
-	r = convert_result(is_path_valid(name, conf, pp, true));
-	conf->find_multipaths = find_multipaths_saved;
-	put_multipath_config(conf);
+	/*
+	 * multipathd can answer from its in-memory state, unless the
+	 * caller asked for a different claim mode.
+	 */
+	if (mode == MPATH_DEFAULT) {
+		int nr_others = 0;
+
+		r = convert_result(is_path_valid_by_daemon(name, pp,
+							   &nr_others));
+		if (r == MPATH_IS_MAYBE_VALID && nr_others > 0)
+			r = MPATH_IS_VALID;
+	}
+
+	if (r == MPATH_IS_ERROR) {
+		conf = get_multipath_config();
+		if (!conf)
+			goto out_wwid;
+		find_multipaths_saved = conf->find_multipaths;
+		if (mode != MPATH_DEFAULT)
+			set_conf_mode(conf, mode);
+		r = convert_result(is_path_valid(name, conf, pp, true));
+		conf->find_multipaths = find_multipaths_saved;
+		put_multipath_config(conf);
+	}
 
 	if (r == MPATH_IS_MAYBE_VALID) {
 		for (i = 0; i < nr_paths; i++) {
@@ -200,3 +216,148 @@ out:
 	free_path(pp);
 	return r;
 }
+
+#define MPATHVALID_MAX_THREADS 16
+
+struct valid_batch {
+	const char **names;
+	unsigned int nr_names;
+	struct config *conf;
+	const struct wwids_index *wwids;
+	bool check_multipathd;
+	int *results;
+	char (*wwids_out)[WWID_SIZE];
+	pthread_mutex_t lock;
+	unsigned int next;
+};
+
+static void valid_batch_one(struct valid_batch *b, unsigned int i)
+{
+	struct path *pp;
+	int r = MPATH_IS_ERROR;
+
+	b->wwids_out[i][0] = '\0';
+	if (!b->names[i])
+		goto out;
+	pp = alloc_path();
+	if (!pp)
+		goto out;
+	r = convert_result(is_path_valid_wwids(b->names[i], b->conf, pp,
+					       b->check_multipathd, b->wwids));
+	if (r == MPATH_IS_VALID || r == MPATH_IS_VALID_NO_CHECK ||
+	    r == MPATH_IS_MAYBE_VALID)
+		strlcpy(b->wwids_out[i], pp->wwid, WWID_SIZE);
+	free_path(pp);
+out:
+	b->results[i] = r;
+}
+
+static void *valid_batch_thread(void *arg)
+{
+	struct valid_batch *b = arg;
+	unsigned int i;
+
+	for (;;) {
+		pthread_mutex_lock(&b->lock);
+		i = b->next++;
+		pthread_mutex_unlock(&b->lock);
+		if (i >= b->nr_names)
+			break;
+		valid_batch_one(b, i);
+	}
+	return NULL;
+}
+
+/*
+ * names: array of names of paths to check
+ * mode: as for mpathvalid_is_path()
+ * flags: MPATHVALID_PARALLEL to check the paths in several threads
+ * results: on success, the mpath_valid_result of each path
+ * wwids: optional, on success contains the wwid of each claimed path
+ */
+int
+mpathvalid_is_paths(const char **names, unsigned int nr_names,
+		    unsigned int mode, unsigned int flags, int *results,
+		    char **wwids)
+{
+	struct valid_batch b = {
+		.names = names,
+		.nr_names = nr_names,
+		.results = results,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	pthread_t threads[MPATHVALID_MAX_THREADS];
+	unsigned int i, j, nr_threads = 0;
+	struct wwids_index *wwids_idx;
+	int find_multipaths_saved, fd;
+
+	if (!names || !results || mode >= MPATH_MODE_ERROR || !udev)
+		return -1;
+	if (nr_names == 0)
+		return 0;
+
+	b.wwids_out = calloc(nr_names, WWID_SIZE);
+	if (!b.wwids_out)
+		return -1;
+
+	/* Is multipathd running? Check once for the whole batch */
+	fd = __mpath_connect(1);
+	if (fd >= 0)
+		mpath_disconnect(fd);
+	b.check_multipathd = fd < 0 && errno != EAGAIN;
+
+	/* If loading the index fails, each lookup reads the wwids file */
+	wwids_idx = load_wwids_index();
+	b.wwids = wwids_idx;
+
+	b.conf = get_multipath_config();
+	if (!b.conf) {
+		free_wwids_index(wwids_idx);
+		free(b.wwids_out);
+		return -1;
+	}
+	find_multipaths_saved = b.conf->find_multipaths;
+	if (mode != MPATH_DEFAULT)
+		set_conf_mode(b.conf, mode);
+
+	if (flags & MPATHVALID_PARALLEL) {
+		while (nr_threads < MPATHVALID_MAX_THREADS &&
+		       nr_threads < nr_names &&
+		       pthread_create(&threads[nr_threads], NULL,
+				      valid_batch_thread, &b) == 0)
+			nr_threads++;
+	}
+	/* the caller's thread takes part, and does all work if not parallel */
+	valid_batch_thread(&b);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	b.conf->find_multipaths = find_multipaths_saved;
+	put_multipath_config(b.conf);
+	free_wwids_index(wwids_idx);
+
+	/*
+	 * Like path_wwids in mpathvalid_is_path(): a device that may be
+	 * claimed is claimed if another device in the batch has its wwid.
+	 */
+	for (i = 0; i < nr_names; i++) {
+		if (results[i] != MPATH_IS_MAYBE_VALID)
+			continue;
+		for (j = 0; j < nr_names; j++) {
+			if (j != i && b.wwids_out[j][0] != '\0' &&
+			    !strncmp(b.wwids_out[j], b.wwids_out[i],
+				     WWID_SIZE)) {
+				results[i] = MPATH_IS_VALID;
+				break;
+			}
+		}
+	}
+
+	if (wwids) {
+		for (i = 0; i < nr_names; i++)
+			wwids[i] = b.wwids_out[i][0] != '\0' ?
+				strdup(b.wwids_out[i]) : NULL;
+	}
+	free(b.wwids_out);
+	return 0;
+}
@@ -47,6 +47,10 @@ enum mpath_valid_result {
 	MPATH_IS_MAYBE_VALID,
 };
 
+enum mpath_valid_flags {
+	MPATHVALID_PARALLEL = 1 << 0,	/* check paths in several threads */
+};
+
 enum mpath_valid_log_style {
 	MPATH_LOG_STDERR = -1,		/* log to STDERR */
 	MPATH_LOG_STDERR_TIMESTAMP,	/* log to STDERR, with timestamps */
@@ -149,6 +153,35 @@ unsigned int mpathvalid_get_mode(void);
 int mpathvalid_is_path(const char *name, unsigned int mode, char **wwid,
 		       const char **path_wwids, unsigned int nr_paths);
 
+/*
+ * DESCRIPTION:
+ * 	Return whether device-mapper multipath claims each of a set of
+ * 	path devices, like calling mpathvalid_is_path() for each of
+ * 	them, but sharing the work that doesn't depend on the device:
+ * 	the configuration is taken, the wwids file is read, and
+ * 	multipathd is looked for only once per call. A device that
+ * 	would be MPATH_IS_MAYBE_VALID is reported as MPATH_IS_VALID if
+ * 	another device in the set has the same wwid. If flags contains
+ * 	MPATHVALID_PARALLEL, the devices are checked by several threads.
+ * 	If wwids is not NULL, wwids[i] is set to the wwid of names[i] if
+ * 	that device is or may be claimed, and to NULL otherwise. Each
+ * 	set wwids[i] must be freed by the caller.
+ * @names: Array of kernel device names. input argument
+ * @nr_names: number of elements in names. input argument
+ * @mode: the find_multipaths claim mode (mpath_valid_mode). input argument
+ * @flags: bitwise or of mpath_valid_flags. input argument
+ * @results: array of nr_names elements, set to the device claim result
+ * 	     (mpath_valid_result) of each device. Output argument.
+ * @wwids: array of nr_names pointers to path wwids, or NULL.
+ * 	   Output argument.
+ *
+ * RETURNS: 0 = Success, -1 = Failure
+ * 	    On failure, results and wwids are not set.
+ */
+int mpathvalid_is_paths(const char **names, unsigned int nr_names,
+			unsigned int mode, unsigned int flags, int *results,
+			char **wwids);
+
 #ifdef __cplusplus
 }
 #endif
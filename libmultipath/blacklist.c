@@ -31,6 +31,68 @@ char *check_invert(char *str, bool *invert)
 	return str;
 }
 
+/*
+ * An indexed blacklist splits its entries into tiers. Entries of the
+ * form "^literal$" are looked up in a hash table by the whole string,
+ * entries of the form "^literal" by each prefix of the string whose
+ * length matches one of them. Only the remaining entries, including all
+ * inverted ones, are matched with regexec(). A list matches if any
+ * entry matches, so the verdict doesn't depend on the order of tiers.
+ */
+struct blist_literal {
+	struct blist_literal *next;
+	bool exact;
+	size_t len;
+	char str[];
+};
+
+struct blist_index {
+	unsigned int nr_buckets;
+	struct blist_literal **buckets;
+	unsigned int nr_exact;
+	/* distinct lengths of the prefix literals, ascending */
+	size_t *prefix_lens;
+	int nr_prefix_lens;
+	vector regexes;
+};
+
+#define BLIST_HASH_INIT		2166136261U
+#define BLIST_HASH_PRIME	16777619U
+
+static unsigned int blist_hash_step(unsigned int h, char c)
+{
+	return (h ^ (unsigned char)c) * BLIST_HASH_PRIME;
+}
+
+static void free_blist_index(struct blist_index *idx)
+{
+	struct blist_literal *lit, *next;
+	unsigned int i;
+
+	if (!idx)
+		return;
+	for (i = 0; i < idx->nr_buckets; i++) {
+		for (lit = idx->buckets[i]; lit; lit = next) {
+			next = lit->next;
+			free(lit);
+		}
+	}
+	free(idx->buckets);
+	free(idx->prefix_lens);
+	vector_free(idx->regexes);
+	free(idx);
+}
+
+static void drop_blist_index(vector blist)
+{
+	struct blentry *first = VECTOR_SLOT(blist, 0);
+
+	if (first && first->index) {
+		free_blist_index(first->index);
+		first->index = NULL;
+	}
+}
+
 int store_ble(vector blist, const char *str, int origin)
 {
 	struct blentry * ble;
@@ -46,6 +108,7 @@ int store_ble(vector blist, const char *str, int origin)
 
 	if (!blist)
 		goto out;
+	drop_blist_index(blist);
 
 	ble = calloc(1, sizeof(struct blentry));
 
@@ -140,12 +203,57 @@ out:
 	return 1;
 }
 
+static bool
+blist_lookup(const struct blist_index *idx, unsigned int h, const char *str,
+	     size_t len, bool exact)
+{
+	const struct blist_literal *lit;
+
+	for (lit = idx->buckets[h & (idx->nr_buckets - 1)]; lit; lit = lit->next)
+		if (lit->exact == exact && lit->len == len &&
+		    !memcmp(lit->str, str, len))
+			return true;
+	return false;
+}
+
+static int
+match_blist_index (const struct blist_index *idx, const char *str)
+{
+	unsigned int h = BLIST_HASH_INIT;
+	size_t len;
+	int i = 0;
+	struct blentry * ble;
+
+	/* the hash of each prefix is a step of the hash of the string */
+	for (len = 0; str[len]; len++) {
+		h = blist_hash_step(h, str[len]);
+		if (i < idx->nr_prefix_lens &&
+		    idx->prefix_lens[i] == len + 1) {
+			i++;
+			if (blist_lookup(idx, h, str, len + 1, false))
+				return 1;
+		}
+	}
+	if (idx->nr_exact && blist_lookup(idx, h, str, len, true))
+		return 1;
+
+	vector_foreach_slot (idx->regexes, ble, i) {
+		if (!!regexec(&ble->regex, str, 0, NULL, 0) == ble->invert)
+			return 1;
+	}
+	return 0;
+}
+
 static int
 match_reglist (const struct _vector *blist, const char *str)
 {
 	int i;
 	struct blentry * ble;
 
+	ble = VECTOR_SLOT(blist, 0);
+	if (ble && ble->index)
+		return match_blist_index(ble->index, str);
+
 	vector_foreach_slot (blist, ble, i) {
 		if (!!regexec(&ble->regex, str, 0, NULL, 0) == ble->invert)
 			return 1;
@@ -472,6 +580,7 @@ static void free_ble(struct blentry *ble)
 {
 	if (!ble)
 		return;
+	free_blist_index(ble->index);
 	regfree(&ble->regex);
 	free(ble->str);
 	free(ble);
@@ -504,6 +613,7 @@ void merge_blacklist(vector blist)
 				continue;
 			condlog(3, "%s: duplicate blist entry section for %s",
 				__func__, bl1->str);
+			drop_blist_index(blist);
 			free_ble(bl2);
 			vector_del_slot(blist, j);
 			j--;
@@ -575,3 +685,137 @@ void merge_blacklist_device(vector blist)
 		}
 	}
 }
+
+/*
+ * If the regular expression @re is "^literal" or "^literal$", where
+ * literal consists of ordinary characters and backslash-escaped special
+ * characters only, return the literal as a new index entry. Return NULL
+ * for any other expression.
+ */
+static struct blist_literal *regex_literal(const char *re)
+{
+	static const char special[] = ".[]()*+?{}|^$\\";
+	struct blist_literal *lit;
+	char *p;
+
+	if (re[0] != '^')
+		return NULL;
+	lit = calloc(1, sizeof(*lit) + strlen(re));
+	if (!lit)
+		return NULL;
+	for (p = lit->str, re++; *re; re++) {
+		if (*re == '\\') {
+			if (!re[1] || !strchr(special, re[1]))
+				goto fail;
+			*p++ = *++re;
+		} else if (*re == '$' && re[1] == '\0')
+			lit->exact = true;
+		else if (strchr(special, *re))
+			goto fail;
+		else
+			*p++ = *re;
+	}
+	lit->len = p - lit->str;
+	if (lit->len == 0)
+		goto fail;
+	return lit;
+fail:
+	free(lit);
+	return NULL;
+}
+
+static int add_prefix_len(struct blist_index *idx, size_t len)
+{
+	size_t *lens;
+	int i;
+
+	for (i = 0; i < idx->nr_prefix_lens && idx->prefix_lens[i] < len; i++)
+		;
+	if (i < idx->nr_prefix_lens && idx->prefix_lens[i] == len)
+		return 0;
+	lens = realloc(idx->prefix_lens,
+		       (idx->nr_prefix_lens + 1) * sizeof(*lens));
+	if (!lens)
+		return 1;
+	memmove(lens + i + 1, lens + i,
+		(idx->nr_prefix_lens - i) * sizeof(*lens));
+	lens[i] = len;
+	idx->prefix_lens = lens;
+	idx->nr_prefix_lens++;
+	return 0;
+}
+
+static int add_blist_literal(struct blist_index *idx,
+			     struct blist_literal *lit)
+{
+	unsigned int h = BLIST_HASH_INIT;
+	size_t i;
+
+	for (i = 0; i < lit->len; i++)
+		h = blist_hash_step(h, lit->str[i]);
+	if (blist_lookup(idx, h, lit->str, lit->len, lit->exact)) {
+		free(lit);
+		return 0;
+	}
+	if (!lit->exact && add_prefix_len(idx, lit->len)) {
+		free(lit);
+		return 1;
+	}
+	lit->next = idx->buckets[h & (idx->nr_buckets - 1)];
+	idx->buckets[h & (idx->nr_buckets - 1)] = lit;
+	if (lit->exact)
+		idx->nr_exact++;
+	return 0;
+}
+
+/*
+ * Build the index that match_reglist() uses for @blist. This must be
+ * called after the list is complete; adding or removing entries drops
+ * the index again. If indexing fails, the list is matched entry by
+ * entry as before.
+ */
+void index_blacklist(vector blist)
+{
+	struct blist_index *idx;
+	struct blist_literal *lit;
+	struct blentry *ble;
+	bool invert;
+	int i;
+
+	ble = VECTOR_SLOT(blist, 0);
+	if (!ble)
+		return;
+	drop_blist_index(blist);
+
+	idx = calloc(1, sizeof(*idx));
+	if (!idx)
+		goto fail;
+	for (idx->nr_buckets = 16;
+	     idx->nr_buckets < 2 * (unsigned int)VECTOR_SIZE(blist);
+	     idx->nr_buckets <<= 1)
+		;
+	idx->buckets = calloc(idx->nr_buckets, sizeof(*idx->buckets));
+	idx->regexes = vector_alloc();
+	if (!idx->buckets || !idx->regexes)
+		goto fail;
+
+	vector_foreach_slot (blist, ble, i) {
+		lit = ble->invert ? NULL :
+			regex_literal(check_invert(ble->str, &invert));
+		if (lit) {
+			if (add_blist_literal(idx, lit))
+				goto fail;
+		} else {
+			if (!vector_alloc_slot(idx->regexes))
+				goto fail;
+			vector_set_slot(idx->regexes, ble);
+		}
+	}
+	ble = VECTOR_SLOT(blist, 0);
+	ble->index = idx;
+	return;
+fail:
+	condlog(2, "%s: failed to index blacklist, using regex matching only",
+		__func__);
+	free_blist_index(idx);
+}
@@ -17,11 +17,15 @@
 #define MATCH_PROPERTY_BLIST_EXCEPT -MATCH_PROPERTY_BLIST
 #define MATCH_PROTOCOL_BLIST_EXCEPT -MATCH_PROTOCOL_BLIST
 
+struct blist_index;
+
 struct blentry {
 	char * str;
 	regex_t regex;
 	bool invert;
 	int origin;
+	/* set in the first entry of a list after index_blacklist() */
+	struct blist_index *index;
 };
 
 struct blentry_device {
@@ -53,5 +57,6 @@ void free_blacklist (vector);
 void free_blacklist_device (vector);
 void merge_blacklist(vector);
 void merge_blacklist_device(vector);
+void index_blacklist(vector);
 
 #endif /* _BLACKLIST_H */
@@ -2,7 +2,9 @@
 #include <string.h>
 #include <stddef.h>
 #include <dlfcn.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <urcu.h>
 #include <urcu/uatomic.h>
 #include <assert.h>
@@ -11,6 +13,7 @@
 #include "checkers.h"
 #include "vector.h"
 #include "util.h"
+#include "time-util.h"
 
 static const char * const checker_dir = MULTIPATH_DIR;
 
@@ -344,6 +347,8 @@ static const char *generic_msg[CHECKER_GENERIC_MSGTABLE_SIZE] = {
 	[CHECKER_MSGID_DOWN] = " reports path is down",
 	[CHECKER_MSGID_GHOST] = " reports path is ghost",
 	[CHECKER_MSGID_UNSUPPORTED] = " doesn't support this device",
+	[CHECKER_MSGID_RUNNING] = " still running",
+	[CHECKER_MSGID_TIMEOUT] = " timed out",
 };
 
 const char *checker_message(const struct checker *c)
@@ -403,6 +408,273 @@ int start_checker_thread(pthread_t *thread, const pthread_attr_t *attr,
 	return rv;
 }
 
+struct async_check {
+	struct checker_class *cls;
+	const struct async_check_ops *ops;
+	void *context;
+	dev_t devt;
+	int fd;
+	unsigned int timeout;
+	time_t deadline;
+	pthread_t thread;
+	int running; /* uatomic access only */
+	int holders; /* uatomic access only */
+	bool stalled;
+	pthread_mutex_t lock;
+	pthread_cond_t active;
+	int state;
+	short msgid;
+};
+
+static void async_check_put(struct async_check *ac)
+{
+	if (uatomic_sub_return(&ac->holders, 1))
+		return;
+	if (ac->ops->free_context)
+		ac->ops->free_context(ac->context);
+	pthread_mutex_destroy(&ac->lock);
+	pthread_cond_destroy(&ac->active);
+	free(ac);
+}
+
+int async_check_init(struct checker *c, const struct async_check_ops *ops,
+		     void *context)
+{
+	struct async_check *ac;
+	struct stat sb;
+
+	if (!c || !c->cls || !ops || !ops->check)
+		return 1;
+	ac = calloc(1, sizeof(*ac));
+	if (!ac)
+		return 1;
+	ac->cls = c->cls;
+	ac->ops = ops;
+	ac->context = context;
+	ac->state = PATH_UNCHECKED;
+	ac->fd = -1;
+	uatomic_set(&ac->holders, 1);
+	pthread_cond_init_mono(&ac->active);
+	pthread_mutex_init(&ac->lock, NULL);
+	if (fstat(c->fd, &sb) == 0)
+		ac->devt = sb.st_rdev;
+	c->context = ac;
+	return 0;
+}
+
+void async_check_free(struct checker *c)
+{
+	struct async_check *ac;
+
+	if (!c || !c->context)
+		return;
+	ac = c->context;
+	if (uatomic_xchg(&ac->running, 0))
+		pthread_cancel(ac->thread);
+	ac->thread = 0;
+	c->context = NULL;
+	async_check_put(ac);
+}
+
+void *async_check_context(const struct checker *c)
+{
+	struct async_check *ac = c ? c->context : NULL;
+
+	return ac ? ac->context : NULL;
+}
+
+static int async_check_run(struct async_check *ac, int fd,
+			   unsigned int timeout, short *msgid)
+{
+	struct checker chk;
+	int state;
+
+	checker_clear(&chk);
+	chk.cls = ac->cls;
+	chk.fd = fd;
+	chk.timeout = timeout;
+	chk.context = ac->context;
+	state = ac->ops->check(&chk);
+	*msgid = chk.msgid;
+	return state;
+}
+
+static int async_check_sync(struct checker *c, struct async_check *ac)
+{
+	int state;
+
+	if (ac->ops->prepare)
+		ac->ops->prepare(c);
+	state = async_check_run(ac, c->fd, c->timeout, &c->msgid);
+	if (ac->ops->complete)
+		ac->ops->complete(c, state);
+	return state;
+}
+
+static void async_check_cleanup_thread(void *arg)
+{
+	struct async_check *ac = arg;
+	struct checker_class *cls = ac->cls;
+
+	/* ac->context may be freed by code in the checker DSO */
+	async_check_put(ac);
+	free_checker_class(cls);
+	rcu_unregister_thread();
+}
+
+static void *async_check_thread(void *arg)
+{
+	struct async_check *ac = arg;
+	int state;
+	short msgid;
+
+	rcu_register_thread();
+	/* This thread can be cancelled, so set up cleanup */
+	pthread_cleanup_push(async_check_cleanup_thread, ac);
+	condlog(4, "%d:%d : %s checker starting up", major(ac->devt),
+		minor(ac->devt), ac->cls->name);
+
+	state = async_check_run(ac, ac->fd, ac->timeout, &msgid);
+	pthread_testcancel();
+
+	pthread_mutex_lock(&ac->lock);
+	ac->state = state;
+	ac->msgid = msgid;
+	pthread_cond_signal(&ac->active);
+	pthread_mutex_unlock(&ac->lock);
+
+	condlog(4, "%d:%d : %s checker finished, state %s", major(ac->devt),
+		minor(ac->devt), ac->cls->name, checker_state_name(state));
+
+	if (!uatomic_xchg(&ac->running, 0))
+		pause();
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+static int async_check_collect(struct checker *c, struct async_check *ac)
+{
+	int state;
+
+	pthread_mutex_lock(&ac->lock);
+	state = ac->state;
+	c->msgid = ac->msgid;
+	pthread_mutex_unlock(&ac->lock);
+	if (ac->ops->complete)
+		ac->ops->complete(c, state);
+	return state;
+}
+
+static int async_check_start(struct checker *c, struct async_check *ac)
+{
+	struct timespec now, tsp;
+	pthread_attr_t attr;
+	bool pending;
+	int state, r;
+
+	if (ac->ops->prepare)
+		ac->ops->prepare(c);
+	pthread_mutex_lock(&ac->lock);
+	ac->state = PATH_PENDING;
+	ac->msgid = CHECKER_MSGID_RUNNING;
+	pthread_mutex_unlock(&ac->lock);
+	ac->fd = c->fd;
+	ac->timeout = c->timeout;
+	get_monotonic_time(&now);
+	ac->deadline = now.tv_sec + c->timeout;
+
+	uatomic_add(&ac->holders, 1);
+	uatomic_set(&ac->running, 1);
+	/* Take a ref here, lest the class be freed before the thread starts */
+	(void)checker_class_ref(ac->cls);
+	setup_thread_attr(&attr, 64 * 1024, 1);
+	r = pthread_create(&ac->thread, &attr, async_check_thread, ac);
+	pthread_attr_destroy(&attr);
+	if (r) {
+		checker_class_unref(ac->cls);
+		uatomic_sub(&ac->holders, 1);
+		uatomic_set(&ac->running, 0);
+		ac->thread = 0;
+		condlog(3, "%d:%d : failed to start %s checker thread, using sync mode",
+			major(ac->devt), minor(ac->devt), ac->cls->name);
+		state = async_check_run(ac, c->fd, c->timeout, &c->msgid);
+		if (ac->ops->complete)
+			ac->ops->complete(c, state);
+		return state;
+	}
+
+	/* Give fast devices a chance to respond right away */
+	get_monotonic_time(&tsp);
+	tsp.tv_nsec += 1000 * 1000;
+	normalize_timespec(&tsp);
+	pthread_mutex_lock(&ac->lock);
+	if (ac->state == PATH_PENDING && ac->msgid == CHECKER_MSGID_RUNNING)
+		pthread_cond_timedwait(&ac->active, &ac->lock, &tsp);
+	pending = ac->state == PATH_PENDING &&
+		ac->msgid == CHECKER_MSGID_RUNNING;
+	pthread_mutex_unlock(&ac->lock);
+
+	if (pending) {
+		c->msgid = CHECKER_MSGID_RUNNING;
+		return PATH_PENDING;
+	}
+	if (uatomic_xchg(&ac->running, 0))
+		pthread_cancel(ac->thread);
+	ac->thread = 0;
+	return async_check_collect(c, ac);
+}
+
+int async_check(struct checker *c)
+{
+	struct async_check *ac = c->context;
+	struct timespec now;
+
+	if (!ac)
+		return PATH_UNCHECKED;
+
+	if (checker_is_sync(c))
+		return async_check_sync(c, ac);
+
+	if (ac->thread) {
+		get_monotonic_time(&now);
+		if (uatomic_read(&ac->running) == 0) {
+			ac->thread = 0;
+			return async_check_collect(c, ac);
+		}
+		if (now.tv_sec <= ac->deadline) {
+			condlog(4, "%d:%d : %s checker not finished",
+				major(ac->devt), minor(ac->devt),
+				ac->cls->name);
+			c->msgid = CHECKER_MSGID_RUNNING;
+			return PATH_PENDING;
+		}
+		if (!uatomic_xchg(&ac->running, 0)) {
+			/* finished just now */
+			ac->thread = 0;
+			return async_check_collect(c, ac);
+		}
+		pthread_cancel(ac->thread);
+		ac->thread = 0;
+		condlog(3, "%d:%d : %s checker timeout", major(ac->devt),
+			minor(ac->devt), ac->cls->name);
+		c->msgid = CHECKER_MSGID_TIMEOUT;
+		return PATH_TIMEOUT;
+	}
+
+	if (uatomic_read(&ac->holders) > 1) {
+		/* The thread has been cancelled but hasn't quit yet */
+		if (!ac->stalled)
+			condlog(2, "%d:%d : waiting for stalled %s checker thread to finish",
+				major(ac->devt), minor(ac->devt),
+				ac->cls->name);
+		ac->stalled = true;
+		c->msgid = CHECKER_MSGID_TIMEOUT;
+		return PATH_TIMEOUT;
+	}
+	ac->stalled = false;
+	return async_check_start(c, ac);
+}
+
 void checker_clear_message (struct checker *c)
 {
 	if (!c)
@@ -51,7 +51,7 @@
  * - Description: Indicates a check IO is in flight.
  *
  * PATH_TIMEOUT:
- * - Use: Only tur checker
+ * - Use: All async checkers except directio
  * - Description: Command timed out
  *
  * PATH REMOVED:
@@ -112,6 +112,8 @@ enum {
 	CHECKER_MSGID_DOWN,
 	CHECKER_MSGID_GHOST,
 	CHECKER_MSGID_UNSUPPORTED,
+	CHECKER_MSGID_RUNNING,
+	CHECKER_MSGID_TIMEOUT,
 	CHECKER_GENERIC_MSGTABLE_SIZE,
 	CHECKER_FIRST_MSGID = 100,	/* lowest msgid for checkers */
 	CHECKER_MSGTABLE_SIZE = 100,	/* max msg table size for checkers */
@@ -171,6 +173,37 @@ int start_checker_thread (pthread_t *thread, const pthread_attr_t *attr,
 			  struct checker_context *ctx);
 int checker_check (struct checker *, int);
 int checker_is_sync(const struct checker *);
+
+/*
+ * Generic async mode for checkers that only implement a synchronous check.
+ *
+ * The checker calls async_check_init() from libcheck_init(), which sets
+ * c->context, and forwards libcheck_check() and libcheck_free() to
+ * async_check() and async_check_free(). In async mode, async_check()
+ * runs ops->check in a detached thread and returns PATH_PENDING until it
+ * has completed, or PATH_TIMEOUT if it doesn't complete within the
+ * checker timeout. A new check isn't started while a timed out one is
+ * still running.
+ *
+ * ops->check is called with a private copy of the checker, which only
+ * has cls, fd, timeout and context (the one passed to async_check_init())
+ * set. ops->prepare and ops->complete are optional and are called in the
+ * caller's context with the path's checker, before a check is started and
+ * after its result has been collected. They may access c->mpcontext,
+ * which ops->check must not use. ops->free_context frees the context
+ * once no check is running any more.
+ */
+struct async_check_ops {
+	int (*check)(struct checker *c);
+	void (*prepare)(struct checker *c);
+	void (*complete)(struct checker *c, int state);
+	void (*free_context)(void *context);
+};
+int async_check_init(struct checker *c, const struct async_check_ops *ops,
+		     void *context);
+void async_check_free(struct checker *c);
+int async_check(struct checker *c);
+void *async_check_context(const struct checker *c);
 const char *checker_name (const struct checker *);
 void reset_checker_classes(void);
 /*
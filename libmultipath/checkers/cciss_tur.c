@@ -46,17 +46,7 @@ struct cciss_tur_checker_context {
 	void * dummy;
 };
 
-int libcheck_init (__attribute__((unused)) struct checker * c)
-{
-	return 0;
-}
-
-void libcheck_free (__attribute__((unused)) struct checker * c)
-{
-	return;
-}
-
-int libcheck_check(struct checker * c)
+static int cciss_tur_check(struct checker *c)
 {
 	int rc;
 	int ret;
@@ -127,3 +117,22 @@ out:
 
 	return(ret);
 }
+
+static const struct async_check_ops cciss_tur_ops = {
+	.check = cciss_tur_check,
+};
+
+int libcheck_init(struct checker *c)
+{
+	return async_check_init(c, &cciss_tur_ops, NULL);
+}
+
+void libcheck_free(struct checker *c)
+{
+	async_check_free(c);
+}
+
+int libcheck_check(struct checker *c)
+{
+	return async_check(c);
+}
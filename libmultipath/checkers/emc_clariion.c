@@ -77,6 +77,14 @@ const char *libcheck_msgtable[] = {
 struct emc_clariion_checker_path_context {
 	char wwn[16];
 	unsigned wwn_set;
+	/*
+	 * The check may run in a separate thread, which can't access the
+	 * LU context. It works on a copy of the inactive snapshot flag,
+	 * and the change is applied when the result is collected:
+	 * -1 unchanged, 0 cleared, 1 set.
+	 */
+	int inactive_snap;
+	int inactive_snap_update;
 };
 
 struct emc_clariion_checker_LU_context {
@@ -96,16 +104,33 @@ void hexadecimal_to_ascii(char * wwn, char *wwnstr)
 	wwnstr[32]=0;
 }
 
+static int emc_clariion_check(struct checker *c);
+static void emc_clariion_prepare(struct checker *c);
+static void emc_clariion_complete(struct checker *c, int state);
+
+static const struct async_check_ops emc_clariion_ops = {
+	.check = emc_clariion_check,
+	.prepare = emc_clariion_prepare,
+	.complete = emc_clariion_complete,
+	.free_context = free,
+};
+
 int libcheck_init (struct checker * c)
 {
+	struct emc_clariion_checker_path_context *ct;
+
 	/*
 	 * Allocate and initialize the path specific context.
 	 */
-	c->context = calloc(1, sizeof(struct emc_clariion_checker_path_context));
-	if (!c->context)
+	ct = calloc(1, sizeof(struct emc_clariion_checker_path_context));
+	if (!ct)
 		return 1;
-	((struct emc_clariion_checker_path_context *)c->context)->wwn_set = 0;
-
+	ct->wwn_set = 0;
+	ct->inactive_snap_update = -1;
+	if (async_check_init(c, &emc_clariion_ops, ct) != 0) {
+		free(ct);
+		return 1;
+	}
 	return 0;
 }
 
@@ -127,10 +152,30 @@ int libcheck_mp_init (struct checker * c)
 
 void libcheck_free (struct checker * c)
 {
-	free(c->context);
+	async_check_free(c);
 }
 
-int libcheck_check (struct checker * c)
+static void emc_clariion_prepare(struct checker *c)
+{
+	struct emc_clariion_checker_path_context *ct = async_check_context(c);
+
+	ct->inactive_snap = IS_INACTIVE_SNAP(c);
+	ct->inactive_snap_update = -1;
+}
+
+static void emc_clariion_complete(struct checker *c,
+				  __attribute__((unused)) int state)
+{
+	struct emc_clariion_checker_path_context *ct = async_check_context(c);
+
+	if (ct->inactive_snap_update == 1) {
+		SET_INACTIVE_SNAP(c);
+	} else if (ct->inactive_snap_update == 0) {
+		CLR_INACTIVE_SNAP(c);
+	}
+}
+
+static int emc_clariion_check(struct checker *c)
 {
 	unsigned char sense_buffer[128] = { 0, };
 	unsigned char sb[SENSE_BUFF_LEN] = { 0, }, *sbb;
@@ -282,7 +327,7 @@ retry:
 				 * passive paths which will return
 				 * 02/04/03 not 05/25/01 on read.
 				 */
-				SET_INACTIVE_SNAP(c);
+				ct->inactive_snap_update = 1;
 				condlog(3, "emc_clariion_checker: Active "
 					"path to inactive snapshot WWN %s.",
 					wwnstr);
@@ -300,10 +345,10 @@ retry:
 			 * snapshot LUs if it was in this list since the
 			 * snapshot is no longer inactive.
 			 */
-			CLR_INACTIVE_SNAP(c);
+			ct->inactive_snap_update = 0;
 		}
 	} else {
-		if (IS_INACTIVE_SNAP(c)) {
+		if (ct->inactive_snap) {
 			hexadecimal_to_ascii(ct->wwn, wwnstr);
 			condlog(3, "emc_clariion_checker: Passive "
 				"path to inactive snapshot WWN %s.",
@@ -317,3 +362,8 @@ retry:
 
 	return ret;
 }
+
+int libcheck_check(struct checker *c)
+{
+	return async_check(c);
+}
@@ -28,20 +28,6 @@
 #define MX_ALLOC_LEN		255
 #define HEAVY_CHECK_COUNT       10
 
-struct sw_checker_context {
-	void * dummy;
-};
-
-int libcheck_init (__attribute__((unused)) struct checker * c)
-{
-	return 0;
-}
-
-void libcheck_free (__attribute__((unused)) struct checker * c)
-{
-	return;
-}
-
 static int
 do_inq(int sg_fd, int cmddt, int evpd, unsigned int pg_op,
        void *resp, int mx_resp_len, unsigned int timeout)
@@ -127,7 +113,7 @@ do_tur (int fd, unsigned int timeout)
 	return 0;
 }
 
-int libcheck_check(struct checker * c)
+static int hp_sw_check(struct checker *c)
 {
 	char buff[MX_ALLOC_LEN];
 	int ret = do_inq(c->fd, 0, 1, 0x80, buff, MX_ALLOC_LEN, c->timeout);
@@ -148,3 +134,22 @@ int libcheck_check(struct checker * c)
 	c->msgid = CHECKER_MSGID_UP;
 	return PATH_UP;
 }
+
+static const struct async_check_ops hp_sw_ops = {
+	.check = hp_sw_check,
+};
+
+int libcheck_init(struct checker *c)
+{
+	return async_check_init(c, &hp_sw_ops, NULL);
+}
+
+void libcheck_free(struct checker *c)
+{
+	async_check_free(c);
+}
+
+int libcheck_check(struct checker *c)
+{
+	return async_check(c);
+}
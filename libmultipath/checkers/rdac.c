@@ -10,6 +10,7 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <errno.h>
+#include <stdbool.h>
 
 #include "checkers.h"
 #include "debug.h"
@@ -56,10 +57,23 @@ struct control_mode_page {
 };
 
 struct rdac_checker_context {
-	void * dummy;
+	/* only accessed by the check, see async_check_init() */
+	bool tas_done;
 };
 
-int libcheck_init (struct checker * c)
+static int rdac_check(struct checker *c);
+
+static const struct async_check_ops rdac_ops = {
+	.check = rdac_check,
+	.free_context = free,
+};
+
+/*
+ * Set the TAS bit in the control mode page, so that aborted commands are
+ * reported to this initiator. This is sent from the first check, rather
+ * than from libcheck_init(), so that it doesn't block the caller.
+ */
+static void rdac_set_tas(struct checker *c)
 {
 	unsigned char cmd[MODE_SEN_SEL_CMDLEN];
 	unsigned char sense_b[SENSE_BUFF_LEN];
@@ -130,12 +144,25 @@ int libcheck_init (struct checker * c)
 out:
 	if (set == 0)
 		condlog(3, "rdac checker failed to set TAS bit");
+}
+
+int libcheck_init (struct checker * c)
+{
+	struct rdac_checker_context *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return 1;
+	if (async_check_init(c, &rdac_ops, ctx)) {
+		free(ctx);
+		return 1;
+	}
 	return 0;
 }
 
-void libcheck_free(__attribute__((unused)) struct checker *c)
+void libcheck_free(struct checker *c)
 {
-	return;
+	async_check_free(c);
 }
 
 static int
@@ -288,11 +315,16 @@ checker_msg_string(const struct volume_access_inq *inq)
 	}
 }
 
-int libcheck_check(struct checker * c)
+static int rdac_check(struct checker *c)
 {
+	struct rdac_checker_context *ctx = c->context;
 	struct volume_access_inq inq;
 	int ret, inqfail;
 
+	if (!ctx->tas_done) {
+		rdac_set_tas(c);
+		ctx->tas_done = true;
+	}
 	inqfail = 0;
 	memset(&inq, 0, sizeof(struct volume_access_inq));
 	ret = do_inq(c->fd, 0xC9, &inq, sizeof(struct volume_access_inq),
@@ -356,3 +388,8 @@ done:
 
 	return ret;
 }
+
+int libcheck_check(struct checker *c)
+{
+	return async_check(c);
+}
@@ -6,21 +6,7 @@
 #include "checkers.h"
 #include "libsg.h"
 
-struct readsector0_checker_context {
-	void * dummy;
-};
-
-int libcheck_init (__attribute__((unused)) struct checker * c)
-{
-	return 0;
-}
-
-void libcheck_free (__attribute__((unused)) struct checker * c)
-{
-	return;
-}
-
-int libcheck_check (struct checker * c)
+static int readsector0_check(struct checker *c)
 {
 	unsigned char buf[4096];
 	unsigned char sbuf[SENSE_BUFF_LEN];
@@ -42,3 +28,22 @@ int libcheck_check (struct checker * c)
 	}
 	return ret;
 }
+
+static const struct async_check_ops readsector0_ops = {
+	.check = readsector0_check,
+};
+
+int libcheck_init(struct checker *c)
+{
+	return async_check_init(c, &readsector0_ops, NULL);
+}
+
+void libcheck_free(struct checker *c)
+{
+	async_check_free(c);
+}
+
+int libcheck_check(struct checker *c)
+{
+	return async_check(c);
+}
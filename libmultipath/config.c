@@ -9,6 +9,7 @@
 #include <dirent.h>
 #include <limits.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "checkers.h"
 #include "util.h"
@@ -26,6 +27,7 @@
 #include "mpath_cmd.h"
 #include "propsel.h"
 #include "foreign.h"
+#include "config_cache.h"
 
 /*
  * We don't support re-initialization after
@@ -207,19 +209,170 @@ find_hwe (const struct _vector *hwtable,
 	return n;
 }
 
-struct mpentry *find_mpe(vector mptable, char *wwid)
+/*
+ * Memo of find_hwe() results, by device identification. All paths of
+ * a storage array have the same vendor, product and revision, so the
+ * hwtable needs to be matched only once per array model.
+ */
+#define HWE_MEMO_MAX 256
+
+struct hwe_memo_entry {
+	char vendor[SCSI_VENDOR_SIZE];
+	char product[PATH_PRODUCT_SIZE];
+	char revision[PATH_REV_SIZE];
+	bool has_revision;
+	int n;
+	struct hwentry *hwes[];
+};
+
+struct hwe_memo {
+	pthread_mutex_t lock;
+	vector entries;
+};
+
+static struct hwe_memo *alloc_hwe_memo(void)
 {
-	int i;
-	struct mpentry * mpe;
+	struct hwe_memo *memo = calloc(1, sizeof(*memo));
 
-	if (!wwid || !*wwid)
+	if (!memo)
 		return NULL;
+	memo->entries = vector_alloc();
+	if (!memo->entries) {
+		free(memo);
+		return NULL;
+	}
+	pthread_mutex_init(&memo->lock, NULL);
+	return memo;
+}
 
-	vector_foreach_slot (mptable, mpe, i)
-		if (mpe->wwid && !strcmp(mpe->wwid, wwid))
-			return mpe;
+static void free_hwe_memo(struct hwe_memo *memo)
+{
+	struct hwe_memo_entry *ent;
+	int i;
 
-	return NULL;
+	if (!memo)
+		return;
+	vector_foreach_slot(memo->entries, ent, i)
+		free(ent);
+	vector_free(memo->entries);
+	pthread_mutex_destroy(&memo->lock);
+	free(memo);
+}
+
+static bool hwe_memo_match(const struct hwe_memo_entry *ent,
+			   const char *vendor, const char *product,
+			   const char *revision)
+{
+	return !strcmp(ent->vendor, vendor) && !strcmp(ent->product, product) &&
+		ent->has_revision == (revision != NULL) &&
+		(!revision || !strcmp(ent->revision, revision));
+}
+
+static int hwe_memo_copy(const struct hwe_memo_entry *ent, vector result)
+{
+	int i;
+
+	vector_reset(result);
+	for (i = 0; i < ent->n; i++) {
+		if (!vector_alloc_slot(result))
+			break;
+		vector_set_slot(result, ent->hwes[i]);
+	}
+	return i;
+}
+
+static void hwe_memo_add(struct hwe_memo *memo, const char *vendor,
+			 const char *product, const char *revision,
+			 const struct _vector *hwes)
+{
+	struct hwe_memo_entry *ent;
+	struct hwentry *hwe;
+	int i;
+
+	ent = calloc(1, sizeof(*ent) +
+		     VECTOR_SIZE(hwes) * sizeof(struct hwentry *));
+	if (!ent)
+		return;
+	strlcpy(ent->vendor, vendor, sizeof(ent->vendor));
+	strlcpy(ent->product, product, sizeof(ent->product));
+	if (revision) {
+		strlcpy(ent->revision, revision, sizeof(ent->revision));
+		ent->has_revision = true;
+	}
+	vector_foreach_slot(hwes, hwe, i)
+		ent->hwes[ent->n++] = hwe;
+
+	pthread_mutex_lock(&memo->lock);
+	if (VECTOR_SIZE(memo->entries) < HWE_MEMO_MAX &&
+	    vector_alloc_slot(memo->entries)) {
+		vector_set_slot(memo->entries, ent);
+		ent = NULL;
+	}
+	pthread_mutex_unlock(&memo->lock);
+	free(ent);
+}
+
+/*
+ * Like find_hwe(conf->hwtable, ...), but remembers the result for
+ * later lookups with the same vendor, product, and revision.
+ */
+int find_hwe_cached(struct config *conf, const char *vendor,
+		    const char *product, const char *revision, vector result)
+{
+	struct hwe_memo *memo = conf->hwe_memo;
+	struct hwe_memo_entry *ent;
+	int i, n = -1;
+
+	/*
+	 * Strings that don't fit into the memo would be truncated, and
+	 * could match other devices' entries.
+	 */
+	if (!memo || !vendor || !product ||
+	    strlen(vendor) >= SCSI_VENDOR_SIZE ||
+	    strlen(product) >= PATH_PRODUCT_SIZE ||
+	    (revision && strlen(revision) >= PATH_REV_SIZE))
+		return find_hwe(conf->hwtable, vendor, product, revision,
+				result);
+
+	pthread_mutex_lock(&memo->lock);
+	vector_foreach_slot(memo->entries, ent, i) {
+		if (hwe_memo_match(ent, vendor, product, revision)) {
+			n = hwe_memo_copy(ent, result);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&memo->lock);
+	if (n >= 0) {
+		condlog(4, "%s: found %d cached hwtable matches for %s:%s:%s",
+			__func__, n, vendor, product, revision);
+		return n;
+	}
+
+	n = find_hwe(conf->hwtable, vendor, product, revision, result);
+	if (n == VECTOR_SIZE(result))
+		hwe_memo_add(memo, vendor, product, revision, result);
+	return n;
+}
+
+static int mpe_wwid_compar(const void *key, const void *p)
+{
+	return strcmp(key, (*(struct mpentry * const *)p)->wwid);
+}
+
+/*
+ * merge_mptable() sorts the mptable by wwid, and removes entries
+ * without wwid and duplicates.
+ */
+struct mpentry *find_mpe(vector mptable, char *wwid)
+{
+	struct mpentry **mpe;
+
+	if (!wwid || !*wwid || !VECTOR_SIZE(mptable))
+		return NULL;
+
+	mpe = bsearch(wwid, mptable->slot, VECTOR_SIZE(mptable),
+		      sizeof(*mptable->slot), mpe_wwid_compar);
+	return mpe ? *mpe : NULL;
 }
 
 const char *get_mpe_wwid(const struct _vector *mptable, const char *alias)
@@ -785,6 +938,7 @@ static void _uninit_config(struct config *conf)
 	free_hwtable(conf->hwtable);
 	free_hwe(conf->overrides);
 	free_keywords(conf->keywords);
+	free_hwe_memo(conf->hwe_memo);
 
 	memset(conf, 0, sizeof(*conf));
 }
@@ -879,35 +1033,58 @@ static void set_max_checkint_from_watchdog(struct config *conf)
 }
 #endif
 
-static int _init_config (const char *file, struct config *conf);
+static int _init_config (const char *file, const char *cache,
+			 struct config *conf);
 
 int init_config(const char *file)
 {
-	return _init_config(file, &__internal_config);
+	return _init_config(file, DEFAULT_CONFIG_CACHE, &__internal_config);
 }
 
-struct config *load_config(const char *file)
+struct config *load_config_cached(const char *file, const char *cache)
 {
 	struct config *conf = alloc_config();
 
-	if (conf && !_init_config(file, conf))
+	if (conf && !_init_config(file, cache, conf))
 		return conf;
 
 	free(conf);
 	return NULL;
 }
 
-int _init_config (const char *file, struct config *conf)
+struct config *load_config(const char *file)
 {
+	return load_config_cached(file, DEFAULT_CONFIG_CACHE);
+}
+
+static int _init_config (const char *file, const char *cache,
+			 struct config *conf)
+{
+	struct config_sources *sources = NULL;
+	int cache_state = CONFIG_CACHE_MISSING;
 
 	if (!conf)
 		conf = &__internal_config;
 
+	if (cache) {
+		sources = get_config_sources(file, CONFIG_DIR);
+		cache_state = load_config_cache(conf, sources, cache);
+		if (cache_state == CONFIG_CACHE_OK) {
+			conf->keywords = vector_alloc();
+			if (!conf->keywords)
+				goto out;
+			init_keywords(conf->keywords);
+			goto fill_voids;
+		}
+		_uninit_config(conf);
+	}
+
 	/*
-	 * Processing the config file will overwrite conf->verbosity if set
-	 * When we return, we'll copy the config value back
+	 * Processing the config file will set conf->verbosity if the
+	 * config file sets it. Otherwise, we'll use the value of
+	 * libmp_verbosity, after the config has been cached.
 	 */
-	conf->verbosity = libmp_verbosity;
+	conf->verbosity = -1;
 
 	/*
 	 * internal defaults
@@ -963,9 +1140,21 @@ int _init_config (const char *file, struct config *conf)
 	conf->processed_main_config = 1;
 	process_config_dir(conf, CONFIG_DIR);
 
+	if (cache) {
+		if (conf->config_cache)
+			save_config_cache(conf, sources, cache);
+		else if (cache_state == CONFIG_CACHE_STALE)
+			unlink(cache);
+	}
+
 	/*
 	 * fill the voids left in the config file
 	 */
+fill_voids:
+	free_config_sources(sources);
+	sources = NULL;
+	if (conf->verbosity < 0)
+		conf->verbosity = libmp_verbosity;
 #ifdef USE_SYSTEMD
 	set_max_checkint_from_watchdog(conf);
 #endif
@@ -1065,10 +1254,22 @@ int _init_config (const char *file, struct config *conf)
 	merge_blacklist(conf->elist_property);
 	merge_blacklist(conf->elist_wwid);
 	merge_blacklist_device(conf->elist_device);
+	index_blacklist(conf->blist_devnode);
+	index_blacklist(conf->blist_property);
+	index_blacklist(conf->blist_wwid);
+	index_blacklist(conf->blist_protocol);
+	index_blacklist(conf->elist_devnode);
+	index_blacklist(conf->elist_property);
+	index_blacklist(conf->elist_wwid);
+	index_blacklist(conf->elist_protocol);
+
+	/* without the memo, find_hwe_cached() falls back to find_hwe() */
+	conf->hwe_memo = alloc_hwe_memo();
 
 	libmp_verbosity = conf->verbosity;
 	return 0;
 out:
+	free_config_sources(sources);
 	_uninit_config(conf);
 	return 1;
 }
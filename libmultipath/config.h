@@ -199,6 +199,9 @@ struct config {
 	int ghost_delay;
 	int find_multipaths_timeout;
 	int marginal_pathgroups;
+	int marginal_path_detection;
+	int skip_probe_on_io;
+	int config_cache;
 	int skip_delegate;
 	unsigned int sequence_nr;
 	int recheck_wwid;
@@ -223,6 +226,7 @@ struct config {
 	vector mptable;
 	vector hwtable;
 	struct hwentry *overrides;
+	struct hwe_memo *hwe_memo;
 
 	vector blist_devnode;
 	vector blist_wwid;
@@ -288,6 +292,8 @@ void libmultipath_exit(void);
 int find_hwe (const struct _vector *hwtable,
 	      const char * vendor, const char * product, const char *revision,
 	      vector result);
+int find_hwe_cached(struct config *conf, const char *vendor,
+		    const char *product, const char *revision, vector result);
 struct mpentry * find_mpe (vector mptable, char * wwid);
 const char *get_mpe_wwid (const struct _vector *mptable, const char *alias);
 
@@ -303,6 +309,7 @@ void free_mptable (vector mptable);
 int store_hwe (vector hwtable, struct hwentry *);
 
 struct config *load_config (const char *file);
+struct config *load_config_cached(const char *file, const char *cache);
 void free_config (struct config * conf);
 int init_config(const char *file);
 void uninit_config(void);
@@ -0,0 +1,774 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Binary snapshot of the parsed multipath configuration, so that short-lived
+ * tools don't need to parse the config file, the config dir and the built-in
+ * hwtable on every invocation.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "vector.h"
+#include "util.h"
+#include "debug.h"
+#include "structs.h"
+#include "config.h"
+#include "blacklist.h"
+#include "file.h"
+#include "version.h"
+#include "config_cache.h"
+
+#define CONFIG_CACHE_MAGIC	"MPCC"
+#define CONFIG_CACHE_END	"MPCE"
+#define CONFIG_CACHE_FORMAT	1
+/* length marker for NULL strings and vectors */
+#define CACHE_NONE		UINT32_MAX
+
+struct cache_header {
+	char magic[4];
+	uint32_t format;
+	uint32_t version;
+	uint32_t config_size;
+	uint32_t hwentry_size;
+	uint32_t mpentry_size;
+	uint32_t pcentry_size;
+	uint32_t nr_sources;
+};
+
+struct source_id {
+	uint64_t size;
+	uint64_t hash;
+	uint32_t present;
+	uint32_t pad;
+};
+
+struct config_source {
+	char *path;
+	struct source_id id;
+};
+
+struct config_sources {
+	vector srcs;
+};
+
+static const size_t config_strs[] = {
+	offsetof(struct config, selector),
+	offsetof(struct config, uid_attribute),
+	offsetof(struct config, features),
+	offsetof(struct config, hwhandler),
+	offsetof(struct config, prio_name),
+	offsetof(struct config, prio_args),
+	offsetof(struct config, checker_name),
+	offsetof(struct config, alias_prefix),
+	offsetof(struct config, partition_delim),
+	offsetof(struct config, enable_foreign),
+};
+
+static const size_t hwentry_strs[] = {
+	offsetof(struct hwentry, vendor),
+	offsetof(struct hwentry, product),
+	offsetof(struct hwentry, revision),
+	offsetof(struct hwentry, uid_attribute),
+	offsetof(struct hwentry, features),
+	offsetof(struct hwentry, hwhandler),
+	offsetof(struct hwentry, selector),
+	offsetof(struct hwentry, checker_name),
+	offsetof(struct hwentry, prio_name),
+	offsetof(struct hwentry, prio_args),
+	offsetof(struct hwentry, alias_prefix),
+	offsetof(struct hwentry, bl_product),
+};
+
+static const size_t mpentry_strs[] = {
+	offsetof(struct mpentry, wwid),
+	offsetof(struct mpentry, alias),
+	offsetof(struct mpentry, uid_attribute),
+	offsetof(struct mpentry, selector),
+	offsetof(struct mpentry, features),
+	offsetof(struct mpentry, prio_name),
+	offsetof(struct mpentry, prio_args),
+};
+
+static const size_t config_blists[] = {
+	offsetof(struct config, blist_devnode),
+	offsetof(struct config, blist_wwid),
+	offsetof(struct config, blist_property),
+	offsetof(struct config, blist_protocol),
+	offsetof(struct config, elist_devnode),
+	offsetof(struct config, elist_wwid),
+	offsetof(struct config, elist_property),
+	offsetof(struct config, elist_protocol),
+};
+
+static const size_t config_blists_device[] = {
+	offsetof(struct config, blist_device),
+	offsetof(struct config, elist_device),
+};
+
+#define FIELD(obj, off, type) (*(type *)((char *)(obj) + (off)))
+
+static void free_config_source(struct config_source *src)
+{
+	free(src->path);
+	free(src);
+}
+
+void free_config_sources(struct config_sources *sources)
+{
+	struct config_source *src;
+	int i;
+
+	if (!sources)
+		return;
+	vector_foreach_slot(sources->srcs, src, i)
+		free_config_source(src);
+	vector_free(sources->srcs);
+	free(sources);
+}
+
+#define FNV64_OFFSET 0xcbf29ce484222325ULL
+#define FNV64_PRIME 0x100000001b3ULL
+
+/*
+ * Identify a config file by its contents. Timestamps aren't good enough,
+ * because a file may be modified twice within the timestamp granularity.
+ * Config files are small, and reading them is cheap compared to parsing.
+ */
+static void get_source_id(const char *path, struct source_id *id)
+{
+	char buf[4096];
+	uint64_t hash = FNV64_OFFSET;
+	uint64_t size = 0;
+	ssize_t n, i;
+	int fd;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd == -1)
+		return;
+	while ((n = read(fd, buf, sizeof(buf))) != 0) {
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			/* mismatch with any cache */
+			size = UINT64_MAX;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			hash ^= (unsigned char)buf[i];
+			hash *= FNV64_PRIME;
+		}
+		size += n;
+	}
+	close(fd);
+	id->size = size;
+	id->hash = hash;
+	id->present = 1;
+}
+
+static int add_config_source(struct config_sources *sources, const char *path)
+{
+	struct config_source *src;
+
+	src = calloc(1, sizeof(*src));
+	if (!src)
+		return 1;
+	src->path = strdup(path);
+	if (!src->path || !vector_alloc_slot(sources->srcs)) {
+		free_config_source(src);
+		return 1;
+	}
+	vector_set_slot(sources->srcs, src);
+	get_source_id(path, &src->id);
+	return 0;
+}
+
+/*
+ * Record the files that process_file() and process_config_dir() read,
+ * and their contents. This must be called before the files are parsed.
+ */
+struct config_sources *get_config_sources(const char *file, const char *dir)
+{
+	struct config_sources *sources;
+	struct dirent **namelist;
+	struct scandir_result sr;
+	char path[LINE_MAX];
+	int i, n, ret = 0;
+
+	if (!file || !dir || dir[0] != '/')
+		return NULL;
+
+	sources = calloc(1, sizeof(*sources));
+	if (!sources)
+		return NULL;
+	sources->srcs = vector_alloc();
+	if (!sources->srcs || add_config_source(sources, file))
+		goto out_free;
+
+	n = scandir(dir, &namelist, NULL, alphasort);
+	if (n <= 0)
+		return sources;
+
+	sr.di = namelist;
+	sr.n = n;
+	pthread_cleanup_push_cast(free_scandir_result, &sr);
+	for (i = 0; i < n && ret == 0; i++) {
+		char *ext = strrchr(namelist[i]->d_name, '.');
+
+		if (!ext || strcmp(ext, ".conf"))
+			continue;
+		snprintf(path, LINE_MAX, "%s/%s", dir, namelist[i]->d_name);
+		path[LINE_MAX-1] = '\0';
+		ret = add_config_source(sources, path);
+	}
+	pthread_cleanup_pop(1);
+	if (ret == 0)
+		return sources;
+out_free:
+	free_config_sources(sources);
+	return NULL;
+}
+
+/*
+ * Writing. Errors are collected in the FILE and checked at the end.
+ */
+
+static void put_bytes(FILE *f, const void *buf, size_t len)
+{
+	if (len > 0)
+		fwrite(buf, 1, len, f);
+}
+
+static void put_u32(FILE *f, uint32_t val)
+{
+	put_bytes(f, &val, sizeof(val));
+}
+
+static void put_str(FILE *f, const char *str)
+{
+	uint32_t len = str ? strlen(str) : CACHE_NONE;
+
+	put_u32(f, len);
+	if (str)
+		put_bytes(f, str, len);
+}
+
+static void put_hwe(FILE *f, const struct hwentry *hwe)
+{
+	const struct pcentry *pce;
+	unsigned int i;
+	int j;
+
+	put_bytes(f, hwe, sizeof(*hwe));
+	for (i = 0; i < ARRAY_SIZE(hwentry_strs); i++)
+		put_str(f, FIELD(hwe, hwentry_strs[i], char *));
+	put_u32(f, hwe->pctable ? VECTOR_SIZE(hwe->pctable) : CACHE_NONE);
+	vector_foreach_slot(hwe->pctable, pce, j)
+		put_bytes(f, pce, sizeof(*pce));
+}
+
+static void put_mpe(FILE *f, const struct mpentry *mpe)
+{
+	unsigned int i;
+
+	put_bytes(f, mpe, sizeof(*mpe));
+	for (i = 0; i < ARRAY_SIZE(mpentry_strs); i++)
+		put_str(f, FIELD(mpe, mpentry_strs[i], char *));
+}
+
+static void put_blist(FILE *f, const struct _vector *blist)
+{
+	const struct blentry *ble;
+	int i;
+
+	put_u32(f, blist ? VECTOR_SIZE(blist) : CACHE_NONE);
+	vector_foreach_slot(blist, ble, i) {
+		put_str(f, ble->str);
+		put_u32(f, ble->origin);
+	}
+}
+
+static void put_blist_device(FILE *f, const struct _vector *blist)
+{
+	const struct blentry_device *ble;
+	int i;
+
+	put_u32(f, blist ? VECTOR_SIZE(blist) : CACHE_NONE);
+	vector_foreach_slot(blist, ble, i) {
+		put_str(f, ble->vendor);
+		put_str(f, ble->product);
+		put_u32(f, ble->origin);
+	}
+}
+
+static void put_config(FILE *f, const struct config *conf,
+		       const struct config_sources *sources)
+{
+	struct cache_header hdr = {
+		.magic = CONFIG_CACHE_MAGIC,
+		.format = CONFIG_CACHE_FORMAT,
+		.version = VERSION_CODE,
+		.config_size = sizeof(struct config),
+		.hwentry_size = sizeof(struct hwentry),
+		.mpentry_size = sizeof(struct mpentry),
+		.pcentry_size = sizeof(struct pcentry),
+		.nr_sources = VECTOR_SIZE(sources->srcs),
+	};
+	const struct config_source *src;
+	const struct hwentry *hwe;
+	const struct mpentry *mpe;
+	const char *str;
+	unsigned int i;
+	int j;
+
+	put_bytes(f, &hdr, sizeof(hdr));
+	vector_foreach_slot(sources->srcs, src, j) {
+		put_str(f, src->path);
+		put_bytes(f, &src->id, sizeof(src->id));
+	}
+
+	put_bytes(f, conf, sizeof(*conf));
+	for (i = 0; i < ARRAY_SIZE(config_strs); i++)
+		put_str(f, FIELD(conf, config_strs[i], char *));
+	put_u32(f, VECTOR_SIZE(&conf->uid_attrs));
+	vector_foreach_slot(&conf->uid_attrs, str, j)
+		put_str(f, str);
+
+	put_u32(f, VECTOR_SIZE(conf->hwtable));
+	vector_foreach_slot(conf->hwtable, hwe, j)
+		put_hwe(f, hwe);
+	put_u32(f, conf->overrides ? 1 : 0);
+	if (conf->overrides)
+		put_hwe(f, conf->overrides);
+	put_u32(f, conf->mptable ? VECTOR_SIZE(conf->mptable) : CACHE_NONE);
+	vector_foreach_slot(conf->mptable, mpe, j)
+		put_mpe(f, mpe);
+
+	for (i = 0; i < ARRAY_SIZE(config_blists); i++)
+		put_blist(f, FIELD(conf, config_blists[i], vector));
+	for (i = 0; i < ARRAY_SIZE(config_blists_device); i++)
+		put_blist_device(f, FIELD(conf, config_blists_device[i],
+					  vector));
+	put_bytes(f, CONFIG_CACHE_END, 4);
+}
+
+/*
+ * Write the cache to a temporary file and rename it into place, so that
+ * readers never see a partially written cache.
+ */
+int save_config_cache(const struct config *conf,
+		      const struct config_sources *sources, const char *cache)
+{
+	char tmp[PATH_MAX];
+	FILE *f;
+	int fd, err;
+
+	if (!conf || !sources || !cache)
+		return 1;
+	if (safe_sprintf(tmp, "%s.XXXXXX", cache)) {
+		condlog(2, "%s: path too long: %s", __func__, cache);
+		return 1;
+	}
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd == -1 && errno == ENOENT &&
+	    ensure_directories_exist(cache, 0700) == 0) {
+		if (safe_sprintf(tmp, "%s.XXXXXX", cache))
+			return 1;
+		fd = mkostemp(tmp, O_CLOEXEC);
+	}
+	if (fd == -1) {
+		condlog(3, "%s: can't create %s: %m", __func__, tmp);
+		return 1;
+	}
+	f = fdopen(fd, "w");
+	if (!f) {
+		condlog(2, "%s: fdopen failed: %m", __func__);
+		close(fd);
+		goto out_unlink;
+	}
+
+	put_config(f, conf, sources);
+	err = ferror(f);
+	if (fclose(f) != 0 || err) {
+		condlog(2, "%s: error writing %s", __func__, tmp);
+		goto out_unlink;
+	}
+	if (rename(tmp, cache) == -1) {
+		condlog(2, "%s: can't rename %s to %s: %m", __func__, tmp,
+			cache);
+		goto out_unlink;
+	}
+	condlog(3, "wrote config cache %s", cache);
+	return 0;
+
+out_unlink:
+	unlink(tmp);
+	return 1;
+}
+
+/*
+ * Reading. The cache is mapped, and every access is bounds checked.
+ */
+
+struct cache_reader {
+	const char *pos;
+	const char *end;
+};
+
+static int get_bytes(struct cache_reader *r, void *buf, size_t len)
+{
+	if ((size_t)(r->end - r->pos) < len)
+		return 1;
+	memcpy(buf, r->pos, len);
+	r->pos += len;
+	return 0;
+}
+
+static int get_u32(struct cache_reader *r, uint32_t *val)
+{
+	return get_bytes(r, val, sizeof(*val));
+}
+
+static int get_str(struct cache_reader *r, char **str)
+{
+	uint32_t len;
+
+	*str = NULL;
+	if (get_u32(r, &len))
+		return 1;
+	if (len == CACHE_NONE)
+		return 0;
+	if ((size_t)(r->end - r->pos) < len)
+		return 1;
+	*str = strndup(r->pos, len);
+	if (!*str)
+		return 1;
+	r->pos += len;
+	return 0;
+}
+
+static bool match_str(struct cache_reader *r, const char *str)
+{
+	uint32_t len;
+
+	if (get_u32(r, &len) || len != strlen(str) ||
+	    (size_t)(r->end - r->pos) < len || memcmp(r->pos, str, len))
+		return false;
+	r->pos += len;
+	return true;
+}
+
+static int get_pctable(struct cache_reader *r, struct hwentry *hwe)
+{
+	struct pcentry *pce;
+	uint32_t i, n;
+
+	if (get_u32(r, &n))
+		return 1;
+	if (n == CACHE_NONE)
+		return 0;
+	hwe->pctable = vector_alloc();
+	if (!hwe->pctable)
+		return 1;
+	for (i = 0; i < n; i++) {
+		pce = malloc(sizeof(*pce));
+		if (!pce)
+			return 1;
+		if (get_bytes(r, pce, sizeof(*pce)) ||
+		    !vector_alloc_slot(hwe->pctable)) {
+			free(pce);
+			return 1;
+		}
+		vector_set_slot(hwe->pctable, pce);
+	}
+	return 0;
+}
+
+static struct hwentry *get_hwe(struct cache_reader *r)
+{
+	struct hwentry *hwe;
+	unsigned int i;
+
+	hwe = alloc_hwe();
+	if (!hwe)
+		return NULL;
+	if (get_bytes(r, hwe, sizeof(*hwe))) {
+		free(hwe);
+		return NULL;
+	}
+	/* the pointers in the cache are meaningless */
+	for (i = 0; i < ARRAY_SIZE(hwentry_strs); i++)
+		FIELD(hwe, hwentry_strs[i], char *) = NULL;
+	hwe->pctable = NULL;
+
+	for (i = 0; i < ARRAY_SIZE(hwentry_strs); i++)
+		if (get_str(r, &FIELD(hwe, hwentry_strs[i], char *)))
+			goto out_free;
+	if (get_pctable(r, hwe))
+		goto out_free;
+	return hwe;
+
+out_free:
+	free_hwe(hwe);
+	return NULL;
+}
+
+static struct mpentry *get_mpe(struct cache_reader *r)
+{
+	struct mpentry *mpe;
+	unsigned int i;
+
+	mpe = alloc_mpe();
+	if (!mpe)
+		return NULL;
+	if (get_bytes(r, mpe, sizeof(*mpe))) {
+		free(mpe);
+		return NULL;
+	}
+	for (i = 0; i < ARRAY_SIZE(mpentry_strs); i++)
+		FIELD(mpe, mpentry_strs[i], char *) = NULL;
+
+	for (i = 0; i < ARRAY_SIZE(mpentry_strs); i++)
+		if (get_str(r, &FIELD(mpe, mpentry_strs[i], char *)))
+			goto out_free;
+	return mpe;
+
+out_free:
+	free_mpe(mpe);
+	return NULL;
+}
+
+static int get_blist(struct cache_reader *r, vector *blist)
+{
+	uint32_t i, n, origin;
+	char *str;
+	int ret;
+
+	if (get_u32(r, &n))
+		return 1;
+	if (n == CACHE_NONE)
+		return 0;
+	*blist = vector_alloc();
+	if (!*blist)
+		return 1;
+	for (i = 0; i < n; i++) {
+		if (get_str(r, &str) || !str || get_u32(r, &origin)) {
+			free(str);
+			return 1;
+		}
+		ret = store_ble(*blist, str, origin);
+		free(str);
+		if (ret)
+			return 1;
+	}
+	return 0;
+}
+
+static int get_blist_device(struct cache_reader *r, vector *blist)
+{
+	uint32_t i, n, origin;
+	char *vendor = NULL, *product = NULL;
+	int ret = 0;
+
+	if (get_u32(r, &n))
+		return 1;
+	if (n == CACHE_NONE)
+		return 0;
+	*blist = vector_alloc();
+	if (!*blist)
+		return 1;
+	for (i = 0; i < n && ret == 0; i++) {
+		if (get_str(r, &vendor) || get_str(r, &product) ||
+		    get_u32(r, &origin) || alloc_ble_device(*blist) ||
+		    set_ble_device(*blist, vendor, product, origin))
+			ret = 1;
+		free(vendor);
+		free(product);
+		vendor = product = NULL;
+	}
+	return ret;
+}
+
+/*
+ * Fill conf from the cache. On error, conf may be partially filled, but
+ * all its pointers are either valid or NULL.
+ */
+static int get_config(struct cache_reader *r, struct config *conf)
+{
+	struct hwentry *hwe;
+	struct mpentry *mpe;
+	uint32_t i, n;
+	char *str;
+
+	if (get_bytes(r, conf, sizeof(*conf)))
+		goto out_zero;
+	memset(&conf->rcu, 0, sizeof(conf->rcu));
+	for (i = 0; i < ARRAY_SIZE(config_strs); i++)
+		FIELD(conf, config_strs[i], char *) = NULL;
+	conf->uid_attrs.allocated = 0;
+	conf->uid_attrs.slot = NULL;
+	conf->keywords = NULL;
+	conf->mptable = NULL;
+	conf->hwtable = NULL;
+	conf->overrides = NULL;
+	conf->hwe_memo = NULL;
+	for (i = 0; i < ARRAY_SIZE(config_blists); i++)
+		FIELD(conf, config_blists[i], vector) = NULL;
+	for (i = 0; i < ARRAY_SIZE(config_blists_device); i++)
+		FIELD(conf, config_blists_device[i], vector) = NULL;
+
+	for (i = 0; i < ARRAY_SIZE(config_strs); i++)
+		if (get_str(r, &FIELD(conf, config_strs[i], char *)))
+			return 1;
+	if (get_u32(r, &n))
+		return 1;
+	for (i = 0; i < n; i++) {
+		if (get_str(r, &str) || !str)
+			return 1;
+		if (!vector_alloc_slot(&conf->uid_attrs)) {
+			free(str);
+			return 1;
+		}
+		vector_set_slot(&conf->uid_attrs, str);
+	}
+
+	conf->hwtable = vector_alloc();
+	if (!conf->hwtable || get_u32(r, &n))
+		return 1;
+	for (i = 0; i < n; i++) {
+		hwe = get_hwe(r);
+		if (!hwe)
+			return 1;
+		if (!vector_alloc_slot(conf->hwtable)) {
+			free_hwe(hwe);
+			return 1;
+		}
+		vector_set_slot(conf->hwtable, hwe);
+	}
+	if (get_u32(r, &n))
+		return 1;
+	if (n != 0 && !(conf->overrides = get_hwe(r)))
+		return 1;
+	if (get_u32(r, &n))
+		return 1;
+	if (n != CACHE_NONE) {
+		conf->mptable = vector_alloc();
+		if (!conf->mptable)
+			return 1;
+		for (i = 0; i < n; i++) {
+			mpe = get_mpe(r);
+			if (!mpe)
+				return 1;
+			if (!vector_alloc_slot(conf->mptable)) {
+				free_mpe(mpe);
+				return 1;
+			}
+			vector_set_slot(conf->mptable, mpe);
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(config_blists); i++)
+		if (get_blist(r, &FIELD(conf, config_blists[i], vector)))
+			return 1;
+	for (i = 0; i < ARRAY_SIZE(config_blists_device); i++)
+		if (get_blist_device(r, &FIELD(conf, config_blists_device[i],
+					       vector)))
+			return 1;
+	if ((size_t)(r->end - r->pos) != 4 ||
+	    memcmp(r->pos, CONFIG_CACHE_END, 4))
+		return 1;
+	return 0;
+
+out_zero:
+	memset(conf, 0, sizeof(*conf));
+	return 1;
+}
+
+static int check_header(struct cache_reader *r,
+			const struct config_sources *sources)
+{
+	struct cache_header hdr;
+	const struct config_source *src;
+	struct source_id id;
+	int i;
+
+	if (get_bytes(r, &hdr, sizeof(hdr)) ||
+	    memcmp(hdr.magic, CONFIG_CACHE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.format != CONFIG_CACHE_FORMAT ||
+	    hdr.config_size != sizeof(struct config) ||
+	    hdr.hwentry_size != sizeof(struct hwentry) ||
+	    hdr.mpentry_size != sizeof(struct mpentry) ||
+	    hdr.pcentry_size != sizeof(struct pcentry))
+		return CONFIG_CACHE_MISSING;
+
+	/* The first source is the config file the cache was made for */
+	vector_foreach_slot(sources->srcs, src, i) {
+		if (!match_str(r, src->path))
+			return i == 0 ? CONFIG_CACHE_MISSING : CONFIG_CACHE_STALE;
+		if (get_bytes(r, &id, sizeof(id)) ||
+		    memcmp(&id, &src->id, sizeof(id)))
+			return CONFIG_CACHE_STALE;
+	}
+	if (hdr.nr_sources != (uint32_t)VECTOR_SIZE(sources->srcs) ||
+	    hdr.version != VERSION_CODE)
+		return CONFIG_CACHE_STALE;
+	return CONFIG_CACHE_OK;
+}
+
+/*
+ * Returns CONFIG_CACHE_OK if conf was filled from the cache. Otherwise,
+ * the pointers in conf are valid or NULL and must be freed by the caller.
+ */
+int load_config_cache(struct config *conf,
+		      const struct config_sources *sources, const char *cache)
+{
+	struct cache_reader r;
+	struct stat st;
+	void *map;
+	int fd, ret;
+
+	if (!conf || !sources || !cache)
+		return CONFIG_CACHE_MISSING;
+
+	fd = open(cache, O_RDONLY|O_CLOEXEC);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			condlog(3, "%s: can't open %s: %m", __func__, cache);
+		return CONFIG_CACHE_MISSING;
+	}
+	/* Only trust a cache that we could have written ourselves */
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_uid != geteuid() ||
+	    (size_t)st.st_size < sizeof(struct cache_header)) {
+		close(fd);
+		return CONFIG_CACHE_MISSING;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		condlog(3, "%s: can't map %s: %m", __func__, cache);
+		return CONFIG_CACHE_MISSING;
+	}
+
+	r.pos = map;
+	r.end = r.pos + st.st_size;
+	ret = check_header(&r, sources);
+	if (ret == CONFIG_CACHE_OK && get_config(&r, conf)) {
+		condlog(2, "%s: invalid config cache", cache);
+		ret = CONFIG_CACHE_STALE;
+	}
+	munmap(map, st.st_size);
+	if (ret == CONFIG_CACHE_OK)
+		condlog(3, "read config from cache %s", cache);
+	else if (ret == CONFIG_CACHE_STALE)
+		condlog(3, "config cache %s is out of date", cache);
+	return ret;
+}
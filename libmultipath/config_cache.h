@@ -0,0 +1,30 @@
+#ifndef _CONFIG_CACHE_H
+#define _CONFIG_CACHE_H
+
+/*
+ * Binary snapshot of the parsed configuration.
+ *
+ * The snapshot holds the configuration as it is after the config file and
+ * config dir have been processed, before the defaults are filled in.
+ * It is only valid for the same package version, and for the same
+ * config file and config dir contents, as recorded by
+ * get_config_sources().
+ */
+
+enum {
+	CONFIG_CACHE_OK = 0,
+	CONFIG_CACHE_STALE,	/* cache for this config file is out of date */
+	CONFIG_CACHE_MISSING,	/* no usable cache for this config file */
+};
+
+struct config;
+struct config_sources;
+
+struct config_sources *get_config_sources(const char *file, const char *dir);
+void free_config_sources(struct config_sources *sources);
+int load_config_cache(struct config *conf,
+		      const struct config_sources *sources, const char *cache);
+int save_config_cache(const struct config *conf,
+		      const struct config_sources *sources, const char *cache);
+
+#endif /* _CONFIG_CACHE_H */
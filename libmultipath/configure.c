@@ -43,6 +43,13 @@
 #include "sysfs.h"
 #include "io_err_stat.h"
 
+/*
+ * coalesce_paths() creates maps without waiting for udev in between, and
+ * waits for the shared udev cookie after at most this many maps. This
+ * bounds the value of the cookie's semaphore.
+ */
+#define UDEV_COOKIE_BATCH 256
+
 /* group paths in pg by host adapter
  */
 int group_by_host_adapter(struct pathgroup *pgp, vector adapters)
@@ -257,12 +264,17 @@ int rr_optimize_path_order(struct pathgroup *pgp)
 	return 0;
 }
 
-int setup_map(struct multipath *mpp, char **params, struct vectors *vecs)
+/*
+ * @batch, if non-NULL, holds the transport timeouts that have already been
+ * set for other maps. See sysfs_set_scsi_tmo().
+ */
+static int _setup_map(struct multipath *mpp, char **params,
+		      struct vectors *vecs, struct tmo_batch *batch)
 {
 	struct pathgroup * pgp;
 	struct path *pp;
 	struct config *conf;
-	int i, marginal_pathgroups;
+	int i, marginal_pathgroups, marginal_path_detection;
 	char *save_attr;
 
 	/*
@@ -356,8 +368,9 @@ int setup_map(struct multipath *mpp, char **params, struct vectors *vecs)
 	select_ghost_delay(conf, mpp);
 	select_flush_on_last_del(conf, mpp);
 
-	sysfs_set_scsi_tmo(conf, mpp);
+	sysfs_set_scsi_tmo(conf, mpp, batch);
 	marginal_pathgroups = conf->marginal_pathgroups;
+	marginal_path_detection = conf->marginal_path_detection;
 	pthread_cleanup_pop(1);
 
 	if (!mpp->features || !mpp->hwhandler || !mpp->selector) {
@@ -365,7 +378,8 @@ int setup_map(struct multipath *mpp, char **params, struct vectors *vecs)
 		return 1;
 	}
 
-	if (marginal_path_check_enabled(mpp))
+	if (marginal_path_check_enabled(mpp) &&
+	    marginal_path_detection == MARGINAL_PATH_DETECTION_ACTIVE)
 		start_io_err_stat_thread(vecs);
 
 	/*
@@ -415,6 +429,11 @@ int setup_map(struct multipath *mpp, char **params, struct vectors *vecs)
 	return 0;
 }
 
+int setup_map(struct multipath *mpp, char **params, struct vectors *vecs)
+{
+	return _setup_map(mpp, params, vecs, NULL);
+}
+
 static void
 compute_pgid(struct pathgroup * pgp)
 {
@@ -879,7 +898,12 @@ fail:
 	return 1;
 }
 
-int domap(struct multipath *mpp, char *params, int is_daemon)
+/*
+ * If @cookie is non-NULL, map creation doesn't wait for udev. The caller
+ * must call libmp_udev_wait() on *@cookie once it's done with the batch.
+ */
+static int _domap(struct multipath *mpp, char *params, int is_daemon,
+		  uint32_t *cookie)
 {
 	int r = DOMAP_FAIL;
 	struct config *conf;
@@ -948,7 +972,7 @@ int domap(struct multipath *mpp, char *params, int is_daemon)
 		if (is_daemon && mpp->ghost_delay > 0 && count_active_paths(mpp) &&
 		    pathcount(mpp, PATH_UP) == 0)
 			mpp->ghost_delay_tick = mpp->ghost_delay;
-		r = dm_addmap_create(mpp, params);
+		r = dm_addmap_create(mpp, params, cookie);
 
 		lock_multipath(mpp, 0);
 		break;
@@ -993,6 +1017,7 @@ int domap(struct multipath *mpp, char *params, int is_daemon)
 		} else  {
 			/* multipath daemon mode */
 			mpp->stat_map_loads++;
+			map_state_changed(mpp);
 			condlog(4, "%s: load table [0 %llu %s %s]", mpp->alias,
 				mpp->size, TGT_MPATH, params);
 			/*
@@ -1018,6 +1043,11 @@ int domap(struct multipath *mpp, char *params, int is_daemon)
 	return DOMAP_FAIL;
 }
 
+int domap(struct multipath *mpp, char *params, int is_daemon)
+{
+	return _domap(mpp, params, is_daemon, NULL);
+}
+
 extern int
 check_daemon(void)
 {
@@ -1075,6 +1105,9 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 	int allow_queueing;
 	struct bitfield *size_mismatch_seen;
 	struct multipath * cmpp;
+	uint32_t cookie = 0;
+	unsigned int cookie_users = 0;
+	struct tmo_batch *tmo_batch = NULL;
 
 	/* ignore refwwid if it's empty */
 	if (refwwid && !strlen(refwwid))
@@ -1092,6 +1125,9 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 	if (size_mismatch_seen == NULL)
 		return CP_FAIL;
 
+	/* not fatal, timeouts are then set for every path */
+	tmo_batch = alloc_tmo_batch();
+
 	if (mpvec)
 		newmp = mpvec;
 	else
@@ -1195,7 +1231,7 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 			mpp->queue_mode = cmpp->queue_mode;
 		if (cmd == CMD_DRY_RUN && mpp->action == ACT_UNDEF)
 			mpp->action = ACT_DRY_RUN;
-		if (setup_map(mpp, &params, vecs)) {
+		if (_setup_map(mpp, &params, vecs, tmo_batch)) {
 			remove_map(mpp, vecs->pathvec, NULL);
 			continue;
 		}
@@ -1204,9 +1240,14 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 			select_action(mpp, curmp,
 				      force_reload == FORCE_RELOAD_YES ? 1 : 0);
 
-		r = domap(mpp, params, is_daemon);
+		r = _domap(mpp, params, is_daemon, &cookie);
 		free(params);
 		params = NULL;
+		if (cookie && ++cookie_users >= UDEV_COOKIE_BATCH) {
+			libmp_udev_wait(cookie);
+			cookie = 0;
+			cookie_users = 0;
+		}
 
 		if (r == DOMAP_FAIL || r == DOMAP_RETRY) {
 			condlog(3, "%s: domap (%u) failure "
@@ -1260,6 +1301,9 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 	}
 	ret = CP_OK;
 out:
+	if (cookie)
+		libmp_udev_wait(cookie);
+	free_tmo_batch(tmo_batch);
 	free(size_mismatch_seen);
 	if (!mpvec) {
 		vector_foreach_slot (newmp, mpp, i)
@@ -71,6 +71,7 @@
 #define DEFAULT_WWIDS_FILE	STATE_DIR "/wwids"
 #define DEFAULT_PRKEYS_FILE	STATE_DIR "/prkeys"
 #define MULTIPATH_SHM_BASE	RUNTIME_DIR "/multipath/"
+#define DEFAULT_CONFIG_CACHE	RUNTIME_DIR "/multipath/config.cache"
 
 
 static inline char *set_default(char *str)
@@ -63,7 +63,7 @@ static inline int dm_task_set_cookie(struct dm_task *dmt, uint32_t *c, int a)
 	return 1;
 }
 
-static void libmp_udev_wait(unsigned int c)
+void libmp_udev_wait(unsigned int c)
 {
 }
 
@@ -71,7 +71,7 @@ static void dm_udev_set_sync_support(int c)
 {
 }
 #else
-static void libmp_udev_wait(unsigned int c)
+void libmp_udev_wait(unsigned int c)
 {
 	pthread_mutex_lock(&libmp_dm_lock);
 	pthread_cleanup_push(cleanup_mutex, &libmp_dm_lock);
@@ -385,16 +385,25 @@ libmp_dm_task_create(int task)
 
 #define do_deferred(x) ((x) == DEFERRED_REMOVE_ON || (x) == DEFERRED_REMOVE_IN_PROGRESS)
 
+/*
+ * If @cookie is non-NULL, the task is attached to the udev cookie *@cookie,
+ * and the caller must wait for it. See dm_addmap().
+ */
 static int
 dm_simplecmd (int task, const char *name, int no_flush, int need_sync,
-	      uint16_t udev_flags, int deferred_remove __DR_UNUSED__) {
+	      uint16_t udev_flags, int deferred_remove __DR_UNUSED__,
+	      uint32_t *cookie) {
 	int r = 0;
 	int udev_wait_flag = ((need_sync || udev_flags) &&
 			      (task == DM_DEVICE_RESUME ||
 			       task == DM_DEVICE_REMOVE));
-	uint32_t cookie = 0;
+	uint32_t own_cookie = 0;
+	bool wait_cookie = !cookie;
 	struct dm_task *dmt;
 
+	if (!cookie)
+		cookie = &own_cookie;
+
 	if (!(dmt = libmp_dm_task_create (task)))
 		return 0;
 
@@ -412,7 +421,7 @@ dm_simplecmd (int task, const char *name, int no_flush, int need_sync,
 		dm_task_deferred_remove(dmt);
 #endif
 	if (udev_wait_flag &&
-	    !dm_task_set_cookie(dmt, &cookie,
+	    !dm_task_set_cookie(dmt, cookie,
 				DM_UDEV_DISABLE_LIBRARY_FALLBACK | udev_flags))
 		goto out;
 
@@ -420,8 +429,8 @@ dm_simplecmd (int task, const char *name, int no_flush, int need_sync,
 	if (!r)
 		dm_log_error(2, task, dmt);
 
-	if (udev_wait_flag)
-			libmp_udev_wait(cookie);
+	if (udev_wait_flag && wait_cookie)
+			libmp_udev_wait(own_cookie);
 out:
 	dm_task_destroy (dmt);
 	return r;
@@ -429,27 +438,37 @@ out:
 
 int dm_simplecmd_flush (int task, const char *name, uint16_t udev_flags)
 {
-	return dm_simplecmd(task, name, 0, 1, udev_flags, 0);
+	return dm_simplecmd(task, name, 0, 1, udev_flags, 0, NULL);
 }
 
 int dm_simplecmd_noflush (int task, const char *name, uint16_t udev_flags)
 {
-	return dm_simplecmd(task, name, 1, 1, udev_flags, 0);
+	return dm_simplecmd(task, name, 1, 1, udev_flags, 0, NULL);
 }
 
 static int
-dm_device_remove (const char *name, int needsync, int deferred_remove) {
+dm_device_remove (const char *name, int needsync, int deferred_remove,
+		  uint32_t *cookie) {
 	return dm_simplecmd(DM_DEVICE_REMOVE, name, 0, needsync, 0,
-			    deferred_remove);
+			    deferred_remove, cookie);
 }
 
+/*
+ * If @cookie is non-NULL, DM_DEVICE_CREATE attaches to the udev cookie
+ * *@cookie (creating it if it's 0), and the caller must wait for it with
+ * libmp_udev_wait(). Otherwise, dm_addmap() waits for udev itself.
+ */
 static int
 dm_addmap (int task, const char *target, struct multipath *mpp,
-	   char * params, int ro, uint16_t udev_flags) {
+	   char * params, int ro, uint16_t udev_flags, uint32_t *cookie) {
 	int r = 0;
 	struct dm_task *dmt;
 	char *prefixed_uuid = NULL;
-	uint32_t cookie = 0;
+	uint32_t own_cookie = 0;
+	bool wait_cookie = !cookie;
+
+	if (!cookie)
+		cookie = &own_cookie;
 
 	if (task == DM_DEVICE_CREATE && strlen(mpp->wwid) == 0) {
 		condlog(1, "%s: refusing to create map with empty WWID",
@@ -502,15 +521,15 @@ dm_addmap (int task, const char *target, struct multipath *mpp,
 	dm_task_no_open_count(dmt);
 
 	if (task == DM_DEVICE_CREATE &&
-	    !dm_task_set_cookie(dmt, &cookie, udev_flags))
+	    !dm_task_set_cookie(dmt, cookie, udev_flags))
 		goto freeout;
 
 	r = libmp_dm_task_run (dmt);
 	if (!r)
 		dm_log_error(2, task, dmt);
 
-	if (task == DM_DEVICE_CREATE)
-			libmp_udev_wait(cookie);
+	if (task == DM_DEVICE_CREATE && wait_cookie)
+			libmp_udev_wait(own_cookie);
 freeout:
 	if (prefixed_uuid)
 		free(prefixed_uuid);
@@ -535,7 +554,7 @@ static uint16_t build_udev_flags(const struct multipath *mpp, int reload)
 		 MPATH_UDEV_RELOAD_FLAG : 0);
 }
 
-int dm_addmap_create (struct multipath *mpp, char * params)
+int dm_addmap_create (struct multipath *mpp, char * params, uint32_t *cookie)
 {
 	int ro;
 	uint16_t udev_flags = build_udev_flags(mpp, 0);
@@ -544,7 +563,7 @@ int dm_addmap_create (struct multipath *mpp, char * params)
 		int err;
 
 		if (dm_addmap(DM_DEVICE_CREATE, TGT_MPATH, mpp, params, ro,
-			      udev_flags)) {
+			      udev_flags, cookie)) {
 			if (unmark_failed_wwid(mpp->wwid) ==
 			    WWID_FAILED_CHANGED)
 				mpp->needs_paths_uevent = 1;
@@ -586,16 +605,16 @@ int dm_addmap_reload(struct multipath *mpp, char *params, int flush)
 	 */
 	if (!mpp->force_readonly)
 		r = dm_addmap(DM_DEVICE_RELOAD, TGT_MPATH, mpp, params,
-			      ADDMAP_RW, 0);
+			      ADDMAP_RW, 0, NULL);
 	if (!r) {
 		if (!mpp->force_readonly && errno != EROFS)
 			return 0;
 		r = dm_addmap(DM_DEVICE_RELOAD, TGT_MPATH, mpp,
-			      params, ADDMAP_RO, 0);
+			      params, ADDMAP_RO, 0, NULL);
 	}
 	if (r)
 		r = dm_simplecmd(DM_DEVICE_RESUME, mpp->alias, !flush,
-				 1, udev_flags, 0);
+				 1, udev_flags, 0, NULL);
 	if (r)
 		return r;
 
@@ -604,7 +623,7 @@ int dm_addmap_reload(struct multipath *mpp, char *params, int flush)
 	 * the original table */
 	if (dm_is_suspended(mpp->alias))
 		dm_simplecmd(DM_DEVICE_RESUME, mpp->alias, !flush, 1,
-			     udev_flags, 0);
+			     udev_flags, 0, NULL);
 	return 0;
 }
 
@@ -1060,42 +1079,17 @@ partmap_in_use(const char *name, void *data)
 	return 0;
 }
 
-int _dm_flush_map (const char * mapname, int need_sync, int deferred_remove,
-		   int need_suspend, int retries)
+/*
+ * Final part of flushing a map, after its partitions have been removed.
+ * queue_if_no_path is 1 if queueing was switched off for the flush,
+ * and -1 if switching it off failed.
+ */
+static int
+do_flush_map (const char *mapname, int need_sync, int deferred_remove,
+	      int need_suspend, int retries, int udev_flags,
+	      int queue_if_no_path, uint32_t *cookie)
 {
 	int r;
-	int queue_if_no_path = 0;
-	int udev_flags = 0;
-	unsigned long long mapsize;
-	char *params = NULL;
-
-	if (dm_is_mpath(mapname) != 1)
-		return 0; /* nothing to do */
-
-	/* if the device currently has no partitions, do not
-	   run kpartx on it if you fail to delete it */
-	if (do_foreach_partmaps(mapname, has_partmap, NULL) == 0)
-		udev_flags |= MPATH_UDEV_NO_KPARTX_FLAG;
-
-	/* If you aren't doing a deferred remove, make sure that no
-	 * devices are in use */
-	if (!do_deferred(deferred_remove) && partmap_in_use(mapname, NULL))
-			return 1;
-
-	if (need_suspend &&
-	    dm_get_map(mapname, &mapsize, &params) == DMP_OK &&
-	    strstr(params, "queue_if_no_path")) {
-		if (!dm_queue_if_no_path(mapname, 0))
-			queue_if_no_path = 1;
-		else
-			/* Leave queue_if_no_path alone if unset failed */
-			queue_if_no_path = -1;
-	}
-	free(params);
-	params = NULL;
-
-	if (dm_remove_partmaps(mapname, need_sync, deferred_remove))
-		return 1;
 
 	if (!do_deferred(deferred_remove) && dm_get_opencount(mapname)) {
 		condlog(2, "%s: map in use", mapname);
@@ -1106,7 +1100,8 @@ int _dm_flush_map (const char * mapname, int need_sync, int deferred_remove,
 		if (need_suspend && queue_if_no_path != -1)
 			dm_simplecmd_flush(DM_DEVICE_SUSPEND, mapname, 0);
 
-		r = dm_device_remove(mapname, need_sync, deferred_remove);
+		r = dm_device_remove(mapname, need_sync, deferred_remove,
+				     cookie);
 
 		if (r) {
 			if (do_deferred(deferred_remove)
@@ -1139,6 +1134,55 @@ int _dm_flush_map (const char * mapname, int need_sync, int deferred_remove,
 	return 1;
 }
 
+/*
+ * Switch off queue_if_no_path before suspending a map, so that queued
+ * IO fails instead of blocking the suspend.
+ * Returns the queue_if_no_path argument for do_flush_map().
+ */
+static int flush_disable_queueing(const char *mapname, const char *params)
+{
+	if (!params || !strstr(params, "queue_if_no_path"))
+		return 0;
+	if (!dm_queue_if_no_path(mapname, 0))
+		return 1;
+	/* Leave queue_if_no_path alone if unset failed */
+	return -1;
+}
+
+int _dm_flush_map (const char * mapname, int need_sync, int deferred_remove,
+		   int need_suspend, int retries)
+{
+	int queue_if_no_path = 0;
+	int udev_flags = 0;
+	unsigned long long mapsize;
+	char *params = NULL;
+
+	if (dm_is_mpath(mapname) != 1)
+		return 0; /* nothing to do */
+
+	/* if the device currently has no partitions, do not
+	   run kpartx on it if you fail to delete it */
+	if (do_foreach_partmaps(mapname, has_partmap, NULL) == 0)
+		udev_flags |= MPATH_UDEV_NO_KPARTX_FLAG;
+
+	/* If you aren't doing a deferred remove, make sure that no
+	 * devices are in use */
+	if (!do_deferred(deferred_remove) && partmap_in_use(mapname, NULL))
+			return 1;
+
+	if (need_suspend &&
+	    dm_get_map(mapname, &mapsize, &params) == DMP_OK)
+		queue_if_no_path = flush_disable_queueing(mapname, params);
+	free(params);
+	params = NULL;
+
+	if (dm_remove_partmaps(mapname, need_sync, deferred_remove))
+		return 1;
+
+	return do_flush_map(mapname, need_sync, deferred_remove, need_suspend,
+			    retries, udev_flags, queue_if_no_path, NULL);
+}
+
 #ifdef LIBDM_API_DEFERRED
 
 int
@@ -1158,12 +1202,166 @@ dm_flush_map_nopaths(const char * mapname,
 
 #endif
 
-int dm_flush_maps (int need_suspend, int retries)
+/*
+ * dm_flush_maps() waits for udev after at most this many removals,
+ * bounding the value of the shared cookie's semaphore.
+ */
+#define DM_FLUSH_COOKIE_BATCH 256
+
+/*
+ * A DM device as seen by dm_flush_maps(). Only multipath maps and
+ * kpartx partition maps are of interest.
+ */
+enum {
+	FLUSH_DEV_OTHER,
+	FLUSH_DEV_MPATH,
+	FLUSH_DEV_PART,
+};
+
+struct flush_dev {
+	char *name;
+	char *params;
+	char uuid[DM_UUID_LEN];
+	char dev_t[BLK_DEV_SIZE];
+	int type;
+	int open_count;
+	/* multipath maps only */
+	int nr_parts;
+	bool parts_in_use;
+	int queue_if_no_path;
+	int result;
+	/* partition maps only */
+	struct flush_dev *parent;
+};
+
+static void free_flush_dev(struct flush_dev *fd)
+{
+	if (!fd)
+		return;
+	free(fd->name);
+	free(fd->params);
+	free(fd);
+}
+
+static void free_flush_devs(vector devs)
+{
+	struct flush_dev *fd;
+	int i;
+
+	vector_foreach_slot(devs, fd, i)
+		free_flush_dev(fd);
+	vector_free(devs);
+}
+
+/* One DM_DEVICE_TABLE call yields open count, uuid and table */
+static struct flush_dev *get_flush_dev(const char *name, uint64_t dev)
+{
+	struct flush_dev *fd = NULL;
+	struct dm_task *dmt;
+	struct dm_info info;
+	uint64_t start, length;
+	char *target_type = NULL;
+	char *params;
+	const char *uuid;
+
+	if (!(dmt = libmp_dm_task_create(DM_DEVICE_TABLE)))
+		return NULL;
+
+	if (!dm_task_set_name(dmt, name))
+		goto out;
+
+	if (!libmp_dm_task_run(dmt)) {
+		dm_log_error(3, DM_DEVICE_TABLE, dmt);
+		goto out;
+	}
+
+	if (!dm_task_get_info(dmt, &info) || !info.exists)
+		goto out;
+
+	fd = calloc(1, sizeof(*fd));
+	if (!fd)
+		goto out;
+	fd->name = strdup(name);
+	if (!fd->name)
+		goto err;
+	fd->open_count = info.open_count;
+	snprintf(fd->dev_t, sizeof(fd->dev_t), "%u:%u",
+		 major(dev), minor(dev));
+	uuid = dm_task_get_uuid(dmt);
+	if (uuid)
+		strlcpy(fd->uuid, uuid, sizeof(fd->uuid));
+
+	/* Only single-target maps are of interest, like in dm_is_mpath() */
+	if (dm_get_next_target(dmt, NULL, &start, &length, &target_type,
+			       &params) != NULL || !target_type)
+		goto out;
+
+	if (!strcmp(target_type, TGT_MPATH) &&
+	    !strncmp(fd->uuid, UUID_PREFIX, UUID_PREFIX_LEN))
+		fd->type = FLUSH_DEV_MPATH;
+	else if (!strcmp(target_type, TGT_PART) &&
+		 !strncmp(fd->uuid, "part", 4))
+		fd->type = FLUSH_DEV_PART;
+	else
+		goto out;
+
+	if (params && !(fd->params = strdup(params)))
+		goto err;
+out:
+	dm_task_destroy(dmt);
+	return fd;
+err:
+	free_flush_dev(fd);
+	fd = NULL;
+	goto out;
+}
+
+static int flush_dev_uuid_compar(const void *a, const void *b)
+{
+	const struct flush_dev *fa = *(const struct flush_dev * const *)a;
+	const struct flush_dev *fb = *(const struct flush_dev * const *)b;
+
+	return strcmp(fa->uuid, fb->uuid);
+}
+
+/*
+ * Find the multipath map that the partition map @part maps over, in the
+ * multipath maps @maps sorted by uuid. Same criteria as
+ * do_foreach_partmaps().
+ */
+static struct flush_dev *
+find_flush_parent(vector maps, const struct flush_dev *part)
+{
+	struct flush_dev key, *kp = &key, **found;
+	const char *map_uuid, *p;
+
+	map_uuid = strstr(part->uuid, UUID_PREFIX);
+	if (!map_uuid || !part->params || VECTOR_SIZE(maps) == 0)
+		return NULL;
+	strlcpy(key.uuid, map_uuid, sizeof(key.uuid));
+	found = bsearch(&kp, maps->slot, VECTOR_SIZE(maps),
+			sizeof(*maps->slot), flush_dev_uuid_compar);
+	if (!found)
+		return NULL;
+
+	p = strstr(part->params, (*found)->dev_t);
+	if (!p || isdigit(*(p + strlen((*found)->dev_t))))
+		return NULL;
+	return *found;
+}
+
+/*
+ * Take a snapshot of all DM devices, and link partition maps to their
+ * multipath maps. Returns all devices in @devs and the multipath maps,
+ * sorted by uuid, in @maps.
+ */
+static int get_flush_devs(vector devs, vector maps)
 {
-	int r = 1;
 	struct dm_task *dmt;
 	struct dm_names *names;
+	struct flush_dev *fd;
 	unsigned next = 0;
+	int r = 1, i;
 
 	if (!(dmt = libmp_dm_task_create (DM_DEVICE_LIST)))
 		return r;
@@ -1183,19 +1381,122 @@ int dm_flush_maps (int need_suspend, int retries)
 		goto out;
 
 	do {
-		if (need_suspend)
-			r |= dm_suspend_and_flush_map(names->name, retries);
-		else
-			r |= dm_flush_map(names->name);
+		/* NULL if the device has gone away meanwhile */
+		fd = get_flush_dev(names->name, names->dev);
+		if (fd) {
+			if (!vector_alloc_slot(devs)) {
+				free_flush_dev(fd);
+				r = 1;
+				goto out;
+			}
+			vector_set_slot(devs, fd);
+			if (fd->type == FLUSH_DEV_MPATH) {
+				if (!vector_alloc_slot(maps)) {
+					r = 1;
+					goto out;
+				}
+				vector_set_slot(maps, fd);
+			}
+		}
 		next = names->next;
 		names = (void *) names + next;
 	} while (next);
 
+	vector_sort(maps, flush_dev_uuid_compar);
+	vector_foreach_slot(devs, fd, i) {
+		if (fd->type != FLUSH_DEV_PART)
+			continue;
+		fd->parent = find_flush_parent(maps, fd);
+		if (!fd->parent)
+			continue;
+		fd->parent->nr_parts++;
+		if (fd->open_count) {
+			condlog(2, "%s: map in use", fd->name);
+			fd->parent->parts_in_use = true;
+		}
+	}
 out:
 	dm_task_destroy (dmt);
 	return r;
 }
 
+static void flush_cookie_count(uint32_t *cookie, unsigned int *users)
+{
+	if (*cookie && ++*users >= DM_FLUSH_COOKIE_BATCH) {
+		libmp_udev_wait(*cookie);
+		*cookie = 0;
+		*users = 0;
+	}
+}
+
+/*
+ * Flush all multipath maps. Rather than looking up every map's partitions
+ * with a scan of all DM devices, as _dm_flush_map() does, take one
+ * snapshot of the DM devices up front. Switch off queueing on all maps
+ * that will be flushed first, so that their queued IO fails in parallel,
+ * and wait for udev once for the whole batch of removals.
+ */
+int dm_flush_maps (int need_suspend, int retries)
+{
+	int r = 1, i;
+	vector devs, maps = NULL;
+	struct flush_dev *fd;
+	uint32_t cookie = 0;
+	unsigned int cookie_users = 0;
+	int flushed = 0, failed = 0;
+
+	if (!(devs = vector_alloc()) || !(maps = vector_alloc()))
+		goto out;
+	if (get_flush_devs(devs, maps))
+		goto out;
+
+	vector_foreach_slot(maps, fd, i) {
+		if (fd->parts_in_use || fd->open_count != fd->nr_parts) {
+			condlog(2, "%s: map in use", fd->name);
+			fd->result = 1;
+			continue;
+		}
+		if (need_suspend)
+			fd->queue_if_no_path =
+				flush_disable_queueing(fd->name, fd->params);
+	}
+
+	vector_foreach_slot(devs, fd, i) {
+		if (fd->type != FLUSH_DEV_PART || !fd->parent ||
+		    fd->parent->result)
+			continue;
+		condlog(4, "partition map %s removed", fd->name);
+		dm_device_remove(fd->name, 1, 0, &cookie);
+		flush_cookie_count(&cookie, &cookie_users);
+	}
+
+	vector_foreach_slot(maps, fd, i) {
+		if (fd->result) {
+			failed++;
+			continue;
+		}
+		fd->result = do_flush_map(fd->name, 1, 0, need_suspend, retries,
+					  fd->nr_parts ? 0 :
+					  MPATH_UDEV_NO_KPARTX_FLAG,
+					  fd->queue_if_no_path, &cookie);
+		if (fd->result)
+			failed++;
+		else
+			flushed++;
+		flush_cookie_count(&cookie, &cookie_users);
+	}
+	if (cookie)
+		libmp_udev_wait(cookie);
+	condlog(3, "flushed %d multipath maps, %d failed", flushed, failed);
+	r = failed ? 1 : 0;
+out:
+	if (maps)
+		vector_free(maps);
+	if (devs)
+		free_flush_devs(devs);
+	return r;
+}
+
 int
 dm_message(const char * mapname, char * message)
 {
@@ -1528,7 +1829,7 @@ remove_partmap(const char *name, void *data)
 		}
 	}
 	condlog(4, "partition map %s removed", name);
-	dm_device_remove(name, rd->need_sync, rd->deferred_remove);
+	dm_device_remove(name, rd->need_sync, rd->deferred_remove, NULL);
 	return 0;
 }
 
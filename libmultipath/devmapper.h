@@ -38,9 +38,10 @@ void skip_libmp_dm_init(void);
 void libmp_dm_exit(void);
 void libmp_udev_set_sync_support(int on);
 struct dm_task *libmp_dm_task_create(int task);
+void libmp_udev_wait(unsigned int c);
 int dm_simplecmd_flush (int, const char *, uint16_t);
 int dm_simplecmd_noflush (int, const char *, uint16_t);
-int dm_addmap_create (struct multipath *mpp, char *params);
+int dm_addmap_create (struct multipath *mpp, char *params, uint32_t *cookie);
 int dm_addmap_reload (struct multipath *mpp, char *params, int flush);
 int dm_map_present (const char *);
 int dm_map_present_by_uuid(const char *uuid);
@@ -650,6 +650,43 @@ snprint_def_marginal_pathgroups(struct config *conf, struct strbuf *buff,
 			 marginal_pathgroups_optvals[conf->marginal_pathgroups]);
 }
 
+static const char * const marginal_path_detection_optvals[] = {
+	[MARGINAL_PATH_DETECTION_ACTIVE] = "active",
+	[MARGINAL_PATH_DETECTION_PASSIVE] = "passive",
+};
+
+static int
+def_marginal_path_detection_handler(struct config *conf, vector strvec,
+				    const char *file, int line_nr)
+{
+	char *buff;
+	unsigned int i;
+
+	buff = set_value(strvec);
+	if (!buff)
+		return 1;
+	for (i = MARGINAL_PATH_DETECTION_ACTIVE;
+	     i < ARRAY_SIZE(marginal_path_detection_optvals); i++) {
+		if (!strcmp(buff, marginal_path_detection_optvals[i])) {
+			conf->marginal_path_detection = i;
+			break;
+		}
+	}
+	if (i >= ARRAY_SIZE(marginal_path_detection_optvals))
+		condlog(1, "%s line %d, invalid value for marginal_path_detection: \"%s\"",
+			file, line_nr, buff);
+	free(buff);
+	return 0;
+}
+
+static int
+snprint_def_marginal_path_detection(struct config *conf, struct strbuf *buff,
+				    const void *data)
+{
+	return append_strbuf_quoted(buff,
+		marginal_path_detection_optvals[conf->marginal_path_detection]);
+}
+
 
 declare_def_arg_str_handler(selector, 1)
 declare_def_snprint_defstr(selector, print_str, DEFAULT_SELECTOR)
@@ -875,6 +912,12 @@ declare_def_snprint(uev_wait_timeout, print_int)
 declare_def_handler(strict_timing, set_yes_no)
 declare_def_snprint(strict_timing, print_yes_no)
 
+declare_def_handler(skip_probe_on_io, set_yes_no)
+declare_def_snprint(skip_probe_on_io, print_yes_no)
+
+declare_def_handler(config_cache, set_yes_no)
+declare_def_snprint(config_cache, print_yes_no)
+
 declare_def_handler(skip_kpartx, set_yes_no_undef)
 declare_def_snprint_defint(skip_kpartx, print_yes_no_undef,
 			   DEFAULT_SKIP_KPARTX)
@@ -2154,6 +2197,8 @@ init_keywords(vector keywords)
 	install_keyword("detect_pgpolicy_use_tpg", &def_detect_pgpolicy_use_tpg_handler, &snprint_def_detect_pgpolicy_use_tpg);
 	install_keyword("force_sync", &def_force_sync_handler, &snprint_def_force_sync);
 	install_keyword("strict_timing", &def_strict_timing_handler, &snprint_def_strict_timing);
+	install_keyword("skip_probe_on_io", &def_skip_probe_on_io_handler, &snprint_def_skip_probe_on_io);
+	install_keyword("config_cache", &def_config_cache_handler, &snprint_def_config_cache);
 	install_keyword("deferred_remove", &def_deferred_remove_handler, &snprint_def_deferred_remove);
 	install_keyword("partition_delimiter", &def_partition_delim_handler, &snprint_def_partition_delim);
 	install_keyword("config_dir", &deprecated_config_dir_handler, &snprint_deprecated);
@@ -2184,6 +2229,7 @@ init_keywords(vector keywords)
 	install_keyword("enable_foreign", &def_enable_foreign_handler,
 			&snprint_def_enable_foreign);
 	install_keyword("marginal_pathgroups", &def_marginal_pathgroups_handler, &snprint_def_marginal_pathgroups);
+	install_keyword("marginal_path_detection", &def_marginal_path_detection_handler, &snprint_def_marginal_path_detection);
 	install_keyword("recheck_wwid", &def_recheck_wwid_handler, &snprint_def_recheck_wwid);
 
 	install_keyword_root("blacklist", &blacklist_handler);
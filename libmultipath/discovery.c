@@ -576,10 +576,114 @@ sysfs_get_asymmetric_access_state(struct path *pp, char *buff, int buflen)
 	return !!preferred;
 }
 
+/*
+ * Transport objects (SCSI hosts, FC rports, iSCSI sessions, SAS end devices)
+ * are shared by many paths. A tmo_batch records the timeouts that have been
+ * applied to each of them, so that only the first path asking for a given
+ * setting has to write to sysfs. Settings are only recorded if all writes
+ * succeeded, so that the next path retries a failed update.
+ */
+struct transport_tmo {
+	char sysname[64];
+	int eh_deadline;
+	unsigned int dev_loss;
+	int fast_io_fail;
+	bool queueing;
+	/* dev_loss after sysfs_set_rport_tmo() possibly limited it */
+	unsigned int dev_loss_set;
+};
+
+struct tmo_batch {
+	vector tmos;
+};
+
+struct tmo_batch *alloc_tmo_batch(void)
+{
+	struct tmo_batch *batch = calloc(1, sizeof(*batch));
+
+	if (batch && !(batch->tmos = vector_alloc())) {
+		free(batch);
+		batch = NULL;
+	}
+	return batch;
+}
+
+void free_tmo_batch(struct tmo_batch *batch)
+{
+	struct transport_tmo *tt;
+	int i;
+
+	if (!batch)
+		return;
+	vector_foreach_slot(batch->tmos, tt, i)
+		free(tt);
+	vector_free(batch->tmos);
+	free(batch);
+}
+
+static bool same_tmo(const struct transport_tmo *a,
+		     const struct transport_tmo *b)
+{
+	return a->eh_deadline == b->eh_deadline &&
+		a->dev_loss == b->dev_loss &&
+		a->fast_io_fail == b->fast_io_fail &&
+		a->queueing == b->queueing;
+}
+
+static struct transport_tmo *
+find_transport_tmo(const struct tmo_batch *batch, const char *sysname)
+{
+	struct transport_tmo *tt;
+	int i;
+
+	vector_foreach_slot(batch->tmos, tt, i)
+		if (!strcmp(tt->sysname, sysname))
+			return tt;
+	return NULL;
+}
+
+/*
+ * Returns the batch entry if @want has already been applied to its
+ * transport object in this batch.
+ */
+static const struct transport_tmo *
+tmo_batch_applied(const struct tmo_batch *batch,
+		  const struct transport_tmo *want)
+{
+	const struct transport_tmo *tt;
+
+	if (!batch)
+		return NULL;
+	tt = find_transport_tmo(batch, want->sysname);
+	return tt && same_tmo(tt, want) ? tt : NULL;
+}
+
+static void tmo_batch_record(struct tmo_batch *batch,
+			     const struct transport_tmo *done)
+{
+	struct transport_tmo *tt;
+
+	if (!batch)
+		return;
+	tt = find_transport_tmo(batch, done->sysname);
+	if (!tt) {
+		tt = malloc(sizeof(*tt));
+		if (!tt)
+			return;
+		if (!vector_alloc_slot(batch->tmos)) {
+			free(tt);
+			return;
+		}
+		vector_set_slot(batch->tmos, tt);
+	}
+	*tt = *done;
+}
+
 static int
-sysfs_set_eh_deadline(struct path *pp)
+sysfs_set_eh_deadline(struct path *pp, struct tmo_batch *batch)
 {
 	struct udev_device *hostdev;
+	struct transport_tmo tt = { .eh_deadline = pp->eh_deadline };
 	char host_name[HOST_NAME_LEN], value[16];
 	int ret, len;
 
@@ -587,6 +691,9 @@ sysfs_set_eh_deadline(struct path *pp)
 		return 0;
 
 	sprintf(host_name, "host%d", pp->sg_id.host_no);
+	strlcpy(tt.sysname, host_name, sizeof(tt.sysname));
+	if (tmo_batch_applied(batch, &tt))
+		return 0;
 	hostdev = udev_device_new_from_subsystem_sysname(udev,
 			"scsi_host", host_name);
 	if (!hostdev)
@@ -609,6 +716,8 @@ sysfs_set_eh_deadline(struct path *pp)
 		log_sysfs_attr_set_value(3, ret,
 			"%s: failed to set eh_deadline to %s",
 			udev_device_get_sysname(hostdev), value);
+	else
+		tmo_batch_record(batch, &tt);
 
 	udev_device_unref(hostdev);
 	return (ret <= 0);
@@ -652,12 +761,20 @@ sysfs_set_max_retries(struct config *conf, struct path *pp)
 }
 
 static void
-sysfs_set_rport_tmo(struct multipath *mpp, struct path *pp)
+sysfs_set_rport_tmo(struct multipath *mpp, struct path *pp,
+		    struct tmo_batch *batch)
 {
 	struct udev_device *rport_dev = NULL;
+	struct transport_tmo tt = {
+		.dev_loss = pp->dev_loss,
+		.fast_io_fail = pp->fast_io_fail,
+		.queueing = mpp->no_path_retry == NO_PATH_RETRY_QUEUE,
+	};
+	const struct transport_tmo *done;
 	char value[16], *eptr;
 	char rport_id[42];
 	unsigned int tmo;
+	bool failed = false;
 	int ret;
 
 	if (pp->dev_loss == DEV_LOSS_TMO_UNSET &&
@@ -666,6 +783,13 @@ sysfs_set_rport_tmo(struct multipath *mpp, struct path *pp)
 
 	sprintf(rport_id, "rport-%d:%d-%d",
 		pp->sg_id.host_no, pp->sg_id.channel, pp->sg_id.transport_id);
+	strlcpy(tt.sysname, rport_id, sizeof(tt.sysname));
+	if ((done = tmo_batch_applied(batch, &tt))) {
+		condlog(4, "%s: timeouts of %s already set", pp->dev,
+			rport_id);
+		pp->dev_loss = done->dev_loss_set;
+		return;
+	}
 	rport_dev = udev_device_new_from_subsystem_sysname(udev,
 				"fc_remote_ports", rport_id);
 	if (!rport_dev) {
@@ -747,6 +871,7 @@ sysfs_set_rport_tmo(struct multipath *mpp, struct path *pp)
 		ret = sysfs_attr_set_value(rport_dev, "fast_io_fail_tmo",
 					   value, len);
 		if (ret != len) {
+			failed = true;
 			if (ret == -EBUSY)
 				condlog(3, "%s: rport blocked", rport_id);
 			else
@@ -762,6 +887,7 @@ sysfs_set_rport_tmo(struct multipath *mpp, struct path *pp)
 		len = strlen(value);
 		ret = sysfs_attr_set_value(rport_dev, "dev_loss_tmo", value, len);
 		if (ret != len) {
+			failed = true;
 			if (ret == -EBUSY)
 				condlog(3, "%s: rport blocked", rport_id);
 			else
@@ -770,16 +896,22 @@ sysfs_set_rport_tmo(struct multipath *mpp, struct path *pp)
 					rport_id, value);
 		}
 	}
+	if (!failed) {
+		tt.dev_loss_set = pp->dev_loss;
+		tmo_batch_record(batch, &tt);
+	}
 out:
 	udev_device_unref(rport_dev);
 }
 
 static void
-sysfs_set_session_tmo(struct path *pp)
+sysfs_set_session_tmo(struct path *pp, struct tmo_batch *batch)
 {
 	struct udev_device *session_dev = NULL;
+	struct transport_tmo tt = { .fast_io_fail = pp->fast_io_fail };
 	char session_id[64];
 	char value[11];
+	bool failed = false;
 
 	if (pp->dev_loss != DEV_LOSS_TMO_UNSET)
 		condlog(3, "%s: ignoring dev_loss_tmo on iSCSI", pp->dev);
@@ -787,6 +919,12 @@ sysfs_set_session_tmo(struct path *pp)
 		return;
 
 	sprintf(session_id, "session%d", pp->sg_id.transport_id);
+	strlcpy(tt.sysname, session_id, sizeof(tt.sysname));
+	if (tmo_batch_applied(batch, &tt)) {
+		condlog(4, "%s: timeouts of %s already set", pp->dev,
+			session_id);
+		return;
+	}
 	session_dev = udev_device_new_from_subsystem_sysname(udev,
 				"iscsi_session", session_id);
 	if (!session_dev) {
@@ -811,22 +949,28 @@ sysfs_set_session_tmo(struct path *pp)
 			len = strlen(value);
 			ret = sysfs_attr_set_value(session_dev, "recovery_tmo",
 						   value, len);
-			if (ret != len)
+			if (ret != len) {
+				failed = true;
 				log_sysfs_attr_set_value(3, ret,
 					"%s: Failed to set recovery_tmo to %s",
 							 pp->dev, value);
+			}
 		}
 	}
+	if (!failed)
+		tmo_batch_record(batch, &tt);
 	udev_device_unref(session_dev);
 	return;
 }
 
 static void
-sysfs_set_nexus_loss_tmo(struct path *pp)
+sysfs_set_nexus_loss_tmo(struct path *pp, struct tmo_batch *batch)
 {
 	struct udev_device *parent, *sas_dev = NULL;
+	struct transport_tmo tt = { .dev_loss = pp->dev_loss };
 	const char *end_dev_id = NULL;
 	char value[11];
+	bool failed = false;
 	static const char ed_str[] = "end_device-";
 
 	if (!pp->udev || pp->dev_loss == DEV_LOSS_TMO_UNSET)
@@ -846,6 +990,12 @@ sysfs_set_nexus_loss_tmo(struct path *pp)
 		condlog(1, "%s: No SAS end device", pp->dev);
 		return;
 	}
+	strlcpy(tt.sysname, end_dev_id, sizeof(tt.sysname));
+	if (tmo_batch_applied(batch, &tt)) {
+		condlog(4, "%s: timeouts of %s already set", pp->dev,
+			end_dev_id);
+		return;
+	}
 	sas_dev = udev_device_new_from_subsystem_sysname(udev,
 				"sas_end_device", end_dev_id);
 	if (!sas_dev) {
@@ -863,11 +1013,15 @@ sysfs_set_nexus_loss_tmo(struct path *pp)
 		len = strlen(value);
 		ret = sysfs_attr_set_value(sas_dev, "I_T_nexus_loss_timeout",
 					   value, len);
-		if (ret != len)
+		if (ret != len) {
+			failed = true;
 			log_sysfs_attr_set_value(3, ret,
 				"%s: failed to update I_T Nexus loss timeout",
 				pp->dev);
+		}
 	}
+	if (!failed)
+		tmo_batch_record(batch, &tt);
 	udev_device_unref(sas_dev);
 	return;
 }
@@ -886,7 +1040,8 @@ scsi_tmo_error_msg(struct path *pp)
 }
 
 int
-sysfs_set_scsi_tmo (struct config *conf, struct multipath *mpp)
+sysfs_set_scsi_tmo (struct config *conf, struct multipath *mpp,
+		    struct tmo_batch *batch)
 {
 	struct path *pp;
 	int i;
@@ -923,7 +1078,7 @@ sysfs_set_scsi_tmo (struct config *conf, struct multipath *mpp)
 			scsi_tmo_error_msg(pp);
 			continue;
 		}
-		sysfs_set_eh_deadline(pp);
+		sysfs_set_eh_deadline(pp, batch);
 		sysfs_set_max_retries(conf, pp);
 
 		if (pp->dev_loss == DEV_LOSS_TMO_UNSET &&
@@ -952,13 +1107,13 @@ sysfs_set_scsi_tmo (struct config *conf, struct multipath *mpp)
 
 		switch (pp->sg_id.proto_id) {
 		case SCSI_PROTOCOL_FCP:
-			sysfs_set_rport_tmo(mpp, pp);
+			sysfs_set_rport_tmo(mpp, pp, batch);
 			break;
 		case SCSI_PROTOCOL_ISCSI:
-			sysfs_set_session_tmo(pp);
+			sysfs_set_session_tmo(pp, batch);
 			break;
 		case SCSI_PROTOCOL_SAS:
-			sysfs_set_nexus_loss_tmo(pp);
+			sysfs_set_nexus_loss_tmo(pp, batch);
 			break;
 		default:
 			break;
@@ -1518,7 +1673,7 @@ get_vpd_sgio (int fd, int pg, int vend_id, char * str, int maxlen)
 }
 
 static int
-scsi_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
+scsi_sysfs_pathinfo (struct path *pp, struct config *conf)
 {
 	struct udev_device *parent;
 	const char *attr_path = NULL;
@@ -1564,7 +1719,7 @@ scsi_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
 	/*
 	 * set the hwe configlet pointer
 	 */
-	find_hwe(hwtable, pp->vendor_id, pp->product_id, pp->rev, pp->hwe);
+	find_hwe_cached(conf, pp->vendor_id, pp->product_id, pp->rev, pp->hwe);
 
 	/*
 	 * host / bus / target / lun
@@ -1589,7 +1744,7 @@ scsi_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
 }
 
 static int
-nvme_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
+nvme_sysfs_pathinfo (struct path *pp, struct config *conf)
 {
 	struct udev_device *parent;
 	const char *attr_path = NULL;
@@ -1642,13 +1797,13 @@ nvme_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
 	condlog(3, "%s: serial = %s", pp->dev, pp->serial);
 	condlog(3, "%s: rev = %s", pp->dev, pp->rev);
 
-	find_hwe(hwtable, pp->vendor_id, pp->product_id, NULL, pp->hwe);
+	find_hwe_cached(conf, pp->vendor_id, pp->product_id, NULL, pp->hwe);
 
 	return PATHINFO_OK;
 }
 
 static int
-ccw_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
+ccw_sysfs_pathinfo (struct path *pp, struct config *conf)
 {
 	struct udev_device *parent;
 	char attr_buff[NAME_SIZE];
@@ -1684,7 +1839,7 @@ ccw_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
 	/*
 	 * set the hwe configlet pointer
 	 */
-	find_hwe(hwtable, pp->vendor_id, pp->product_id, NULL, pp->hwe);
+	find_hwe_cached(conf, pp->vendor_id, pp->product_id, NULL, pp->hwe);
 
 	/*
 	 * host / bus / target / lun
@@ -1709,7 +1864,7 @@ ccw_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
 }
 
 static int
-cciss_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
+cciss_sysfs_pathinfo (struct path *pp, struct config *conf)
 {
 	const char * attr_path = NULL;
 	struct udev_device *parent;
@@ -1749,7 +1904,7 @@ cciss_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
 	/*
 	 * set the hwe configlet pointer
 	 */
-	find_hwe(hwtable, pp->vendor_id, pp->product_id, pp->rev, pp->hwe);
+	find_hwe_cached(conf, pp->vendor_id, pp->product_id, pp->rev, pp->hwe);
 
 	/*
 	 * host / bus / target / lun
@@ -1794,6 +1949,70 @@ common_sysfs_pathinfo (struct path * pp)
 	return PATHINFO_OK;
 }
 
+static unsigned long long
+read_scsi_counter(struct udev_device *parent, const char *attr)
+{
+	char buf[32];
+
+	if (!parent || sysfs_attr_get_value(parent, attr, buf, sizeof(buf)) <= 0)
+		return 0;
+	return strtoull(buf, NULL, 0);
+}
+
+/*
+ * Read the IO accounting of a path: completed IOs and IO ticks (ms) from
+ * the block layer, and the number of failed or timed out commands from
+ * the SCSI midlayer. *errs is always 0 for non-SCSI paths.
+ */
+int
+path_io_counters(struct path *pp, unsigned long long *ios,
+		 unsigned long long *ticks, unsigned long long *errs)
+{
+	struct udev_device *parent;
+	unsigned long long rd_ios, rd_ticks, wr_ios, wr_ticks, dummy;
+	char buf[256];
+
+	if (!pp->udev ||
+	    sysfs_attr_get_value(pp->udev, "stat", buf, sizeof(buf)) <= 0)
+		return 1;
+	if (sscanf(buf, "%llu %llu %llu %llu %llu %llu %llu %llu",
+		   &rd_ios, &dummy, &dummy, &rd_ticks,
+		   &wr_ios, &dummy, &dummy, &wr_ticks) != 8)
+		return 1;
+	*ios = rd_ios + wr_ios;
+	*ticks = rd_ticks + wr_ticks;
+
+	parent = udev_device_get_parent_with_subsystem_devtype(pp->udev, "scsi",
+							       "scsi_device");
+	*errs = read_scsi_counter(parent, "ioerr_cnt") +
+		read_scsi_counter(parent, "iotmo_cnt");
+	return 0;
+}
+
+/*
+ * Returns 1 if IO has completed on the path since the previous call, and
+ * no IO errors or timeouts were accounted in the meantime. Only SCSI
+ * paths account errors, so other paths always return 0.
+ */
+int
+path_io_progressed(struct path *pp)
+{
+	unsigned long long ios, ticks, errs;
+	int progressed;
+
+	if (pp->bus != SYSFS_BUS_SCSI ||
+	    path_io_counters(pp, &ios, &ticks, &errs) != 0) {
+		pp->chk_io_valid = 0;
+		return 0;
+	}
+	progressed = pp->chk_io_valid && ios > pp->chk_io_ios &&
+		     errs == pp->chk_io_errs;
+	pp->chk_io_ios = ios;
+	pp->chk_io_errs = errs;
+	pp->chk_io_valid = 1;
+	return progressed;
+}
+
 int
 path_offline (struct path * pp)
 {
@@ -1867,7 +2086,7 @@ path_offline (struct path * pp)
 }
 
 static int
-sysfs_pathinfo(struct path *pp, const struct _vector *hwtable)
+sysfs_pathinfo(struct path *pp, struct config *conf)
 {
 	int r = common_sysfs_pathinfo(pp);
 
@@ -1889,13 +2108,13 @@ sysfs_pathinfo(struct path *pp, const struct _vector *hwtable)
 	}
 	switch (pp->bus) {
 	case SYSFS_BUS_SCSI:
-		return scsi_sysfs_pathinfo(pp, hwtable);
+		return scsi_sysfs_pathinfo(pp, conf);
 	case SYSFS_BUS_CCW:
-		return ccw_sysfs_pathinfo(pp, hwtable);
+		return ccw_sysfs_pathinfo(pp, conf);
 	case SYSFS_BUS_CCISS:
-		return cciss_sysfs_pathinfo(pp, hwtable);
+		return cciss_sysfs_pathinfo(pp, conf);
 	case SYSFS_BUS_NVME:
-		return nvme_sysfs_pathinfo(pp, hwtable);
+		return nvme_sysfs_pathinfo(pp, conf);
 	case SYSFS_BUS_UNDEF:
 	default:
 		return PATHINFO_OK;
@@ -2344,6 +2563,8 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 			udev_device_get_sysattr_value(pp->udev, "hidden");
 
 		if (hidden && !strcmp(hidden, "1")) {
+			/* foreign libraries may track hidden path devices */
+			(void)add_foreign(pp->udev);
 			condlog(4, "%s: hidden", pp->dev);
 			return PATHINFO_SKIPPED;
 		}
@@ -2381,7 +2602,7 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 	 * fetch info available in sysfs
 	 */
 	if (mask & DI_SYSFS) {
-		int rc = sysfs_pathinfo(pp, conf->hwtable);
+		int rc = sysfs_pathinfo(pp, conf);
 
 		if (rc != PATHINFO_OK)
 			return rc;
@@ -29,11 +29,15 @@
 #define PATHINFO_SKIPPED 2
 
 struct config;
+struct tmo_batch;
 
 int path_discovery (vector pathvec, int flag);
 int path_get_tpgs(struct path *pp); /* This function never returns TPGS_UNDEF */
 int do_tur (char *);
 int path_offline (struct path *);
+int path_io_counters(struct path *pp, unsigned long long *ios,
+		     unsigned long long *ticks, unsigned long long *errs);
+int path_io_progressed(struct path *pp);
 int get_state (struct path * pp, struct config * conf, int daemon, int state);
 int get_vpd_sgio (int fd, int pg, int vend_id, char * str, int maxlen);
 int pathinfo (struct path * pp, struct config * conf, int mask);
@@ -42,7 +46,10 @@ int alloc_path_with_pathinfo (struct config *conf, struct udev_device *udevice,
 int store_pathinfo (vector pathvec, struct config *conf,
 		    struct udev_device *udevice, int flag,
 		    struct path **pp_ptr);
-int sysfs_set_scsi_tmo (struct config *conf, struct multipath *mpp);
+struct tmo_batch *alloc_tmo_batch(void);
+void free_tmo_batch(struct tmo_batch *batch);
+int sysfs_set_scsi_tmo (struct config *conf, struct multipath *mpp,
+			struct tmo_batch *batch);
 int sysfs_get_timeout(const struct path *pp, unsigned int *timeout);
 int sysfs_get_iscsi_ip_address(const struct path *pp, char *ip_address);
 int sysfs_get_host_adapter_name(const struct path *pp,
@@ -48,12 +48,17 @@ struct nvme_pathgroup {
 	struct _vector pathvec;
 };
 
+#define NAME_LEN 64 /* buffer length for temp attributes */
+
 struct nvme_path {
 	struct gen_path gen;
 	struct udev_device *udev;
 	struct udev_device *ctl;
 	struct nvme_map *map;
 	bool seen;
+	/* sysfs state, refreshed by check() */
+	char ctl_state[NAME_LEN];
+	char ana_state[NAME_LEN];
 	/*
 	 * The kernel works in failover mode.
 	 * Each path has a separate path group.
@@ -69,9 +74,10 @@ struct nvme_map {
 	struct _vector pgvec;
 	int nr_live;
 	int ana_supported;
+	/* controllers need to be rescanned in check() */
+	bool rescan;
 };
 
-#define NAME_LEN 64 /* buffer length for temp attributes */
 #define const_gen_mp_to_nvme(g) ((const struct nvme_map*)(g))
 #define gen_mp_to_nvme(g) ((struct nvme_map*)(g))
 #define nvme_mp_to_gen(n) &((n)->gen)
@@ -252,22 +258,18 @@ static int snprint_nvme_path(const struct gen_path *gp,
 		devt = udev_device_get_devnum(np->udev);
 		return print_strbuf(buff, "%u:%u", major(devt), minor(devt));
 	case 'o':
-		if (sysfs_attr_get_value(np->ctl, "state",
-					 fld, sizeof(fld)) > 0)
-			return append_strbuf_str(buff, fld);
+		if (*np->ctl_state)
+			return append_strbuf_str(buff, np->ctl_state);
 		break;
 	case 'T':
-		if (sysfs_attr_get_value(np->udev, "ana_state", fld,
-					 sizeof(fld)) > 0)
-			return append_strbuf_str(buff, fld);
+		if (*np->ana_state)
+			return append_strbuf_str(buff, np->ana_state);
 		break;
 	case 'p':
-		if (sysfs_attr_get_value(np->udev, "ana_state", fld,
-					 sizeof(fld)) > 0) {
-			rstrip(fld);
-			if (!strcmp(fld, "optimized"))
+		if (*np->ana_state) {
+			if (!strcmp(np->ana_state, "optimized"))
 				return print_strbuf(buff, "%d", 50);
-			else if (!strcmp(fld, "non-optimized"))
+			else if (!strcmp(np->ana_state, "non-optimized"))
 				return print_strbuf(buff, "%d", 10);
 			else
 				return print_strbuf(buff, "%d", 0);
@@ -628,6 +630,83 @@ static void test_ana_support(struct nvme_map *map, struct udev_device *ctl)
 	pthread_cleanup_pop(1);
 }
 
+static void _update_path_state(struct nvme_path *path)
+{
+	if (sysfs_attr_get_value(path->ctl, "state", path->ctl_state,
+				 sizeof(path->ctl_state)) <= 0)
+		*path->ctl_state = '\0';
+	if (sysfs_attr_get_value(path->udev, "ana_state", path->ana_state,
+				 sizeof(path->ana_state)) <= 0)
+		*path->ana_state = '\0';
+	else
+		rstrip(path->ana_state);
+}
+
+static void _count_live_paths(struct nvme_map *map)
+{
+	static const char live_state[] = "live";
+	struct nvme_pathgroup *pg;
+	int i;
+
+	map->nr_live = 0;
+	vector_foreach_slot(&map->pgvec, pg, i) {
+		struct nvme_path *path = nvme_pg_to_path(pg);
+
+		if (!strncmp(path->ctl_state, live_state,
+			     sizeof(live_state) - 1))
+			map->nr_live++;
+	}
+}
+
+/* Takes over the reference to udev, also on failure */
+static struct nvme_path *_add_path(struct nvme_map *map,
+				   struct udev_device *udev)
+{
+	struct nvme_path *path;
+
+	path = calloc(1, sizeof(*path));
+	if (path == NULL) {
+		udev_device_unref(udev);
+		return NULL;
+	}
+
+	path->gen.ops = &nvme_path_ops;
+	path->udev = udev;
+	path->seen = true;
+	path->map = map;
+	path->ctl = udev_device_get_parent_with_subsystem_devtype
+		(udev, "nvme", NULL);
+	if (path->ctl == NULL) {
+		condlog(1, "%s: %s: failed to get controller for %s",
+			__func__, THIS, udev_device_get_sysname(udev));
+		cleanup_nvme_path(path);
+		return NULL;
+	}
+	test_ana_support(map, path->ctl);
+
+	path->pg.gen.ops = &nvme_pg_ops;
+	if (!vector_alloc_slot(&path->pg.pathvec)) {
+		cleanup_nvme_path(path);
+		return NULL;
+	}
+	vector_set_slot(&path->pg.pathvec, path);
+	if (!vector_alloc_slot(&map->pgvec)) {
+		cleanup_nvme_path(path);
+		return NULL;
+	}
+	vector_set_slot(&map->pgvec, &path->pg);
+	_update_path_state(path);
+	condlog(3, "%s: %s: new path %s added to %s",
+		__func__, THIS, udev_device_get_sysname(udev),
+		udev_device_get_sysname(map->udev));
+	return path;
+}
+
+/*
+ * Full rescan of the controllers of a map. This is only done when a map
+ * is added, or if a uevent for the map asks for it. Paths are tracked
+ * by uevents otherwise, see add() and delete().
+ */
 static void _find_controllers(struct context *ctx, struct nvme_map *map)
 {
 	char pathbuf[PATH_MAX], realbuf[PATH_MAX];
@@ -641,6 +720,7 @@ static void _find_controllers(struct context *ctx, struct nvme_map *map)
 	if (map == NULL || map->udev == NULL)
 		return;
 
+	map->rescan = false;
 	vector_foreach_slot(&map->pgvec, pg, i) {
 		path = nvme_pg_to_path(pg);
 		path->seen = false;
@@ -711,45 +791,14 @@ static void _find_controllers(struct context *ctx, struct nvme_map *map)
 			path->seen = true;
 			condlog(4, "%s: %s already known",
 				__func__, fn);
+			udev_device_unref(udev);
 			continue;
 		}
 
-		path = calloc(1, sizeof(*path));
-		if (path == NULL)
-			continue;
-
-		path->gen.ops = &nvme_path_ops;
-		path->udev = udev;
-		path->seen = true;
-		path->map = map;
-		path->ctl = udev_device_get_parent_with_subsystem_devtype
-			(udev, "nvme", NULL);
-		if (path->ctl == NULL) {
-			condlog(1, "%s: %s: failed to get controller for %s",
-				__func__, THIS, fn);
-			cleanup_nvme_path(path);
-			continue;
-		}
-		test_ana_support(map, path->ctl);
-
-		path->pg.gen.ops = &nvme_pg_ops;
-		if (!vector_alloc_slot(&path->pg.pathvec)) {
-			cleanup_nvme_path(path);
-			continue;
-		}
-		vector_set_slot(&path->pg.pathvec, path);
-		if (!vector_alloc_slot(&map->pgvec)) {
-			cleanup_nvme_path(path);
-			continue;
-		}
-		vector_set_slot(&map->pgvec, &path->pg);
-		condlog(3, "%s: %s: new path %s added to %s",
-			__func__, THIS, udev_device_get_sysname(udev),
-			udev_device_get_sysname(map->udev));
+		_add_path(map, udev);
 	}
 	pthread_cleanup_pop(1);
 
-	map->nr_live = 0;
 	vector_foreach_slot_backwards(&map->pgvec, pg, i) {
 		path = nvme_pg_to_path(pg);
 		if (!path->seen) {
@@ -757,21 +806,105 @@ static void _find_controllers(struct context *ctx, struct nvme_map *map)
 				i, udev_device_get_sysname(map->udev));
 			vector_del_slot(&map->pgvec, i);
 			cleanup_nvme_path(path);
-		} else {
-			static const char live_state[] = "live";
-			char state[16];
-
-			if ((sysfs_attr_get_value(path->ctl, "state", state,
-						  sizeof(state)) > 0) &&
-			    !strncmp(state, live_state, sizeof(live_state) - 1))
-				map->nr_live++;
-		}
+		} else
+			_update_path_state(path);
 	}
+	_count_live_paths(map);
 	condlog(3, "%s: %s: map %s has %d/%d live paths", __func__, THIS,
 		udev_device_get_sysname(map->udev), map->nr_live,
 		VECTOR_SIZE(&map->pgvec));
 }
 
+/* Re-read the cached controller and ANA states of all paths of a map */
+static void _refresh_map(struct nvme_map *map)
+{
+	struct nvme_pathgroup *pg;
+	int i;
+
+	vector_foreach_slot(&map->pgvec, pg, i)
+		_update_path_state(nvme_pg_to_path(pg));
+	_count_live_paths(map);
+	condlog(4, "%s: %s: map %s has %d/%d live paths", __func__, THIS,
+		udev_device_get_sysname(map->udev), map->nr_live,
+		VECTOR_SIZE(&map->pgvec));
+}
+
+/*
+ * Path devices are named nvme${subsys}c${ctrl}n${ns}, and belong to the
+ * map nvme${subsys}n${ns}.
+ */
+static bool is_path_device(struct udev_device *ud, int *subsys_num,
+			   int *ns_num)
+{
+	const char *name = udev_device_get_sysname(ud);
+	int ctrl_num, len = 0;
+
+	return name != NULL &&
+		sscanf(name, "nvme%dc%dn%d%n", subsys_num, &ctrl_num,
+		       ns_num, &len) == 3 &&
+		name[len] == '\0';
+}
+
+static struct nvme_map *_find_map_for_path(const struct context *ctx,
+					   struct udev_device *ud)
+{
+	struct nvme_map *nm;
+	int subsys_num, ns_num, i;
+
+	if (!is_path_device(ud, &subsys_num, &ns_num))
+		return NULL;
+
+	vector_foreach_slot(ctx->mpvec, nm, i) {
+		int m, n;
+
+		if (sscanf(udev_device_get_sysname(nm->udev), "nvme%dn%d",
+			   &m, &n) == 2 && m == subsys_num && n == ns_num)
+			return nm;
+	}
+	return NULL;
+}
+
+static int _add_path_device(struct context *ctx, struct udev_device *ud)
+{
+	struct nvme_map *map;
+
+	map = _find_map_for_path(ctx, ud);
+	if (map == NULL)
+		/* The map will find the path when it's added */
+		return FOREIGN_IGNORED;
+	if (_find_path_by_syspath(map, udev_device_get_syspath(ud)) != NULL)
+		return FOREIGN_OK;
+	if (_add_path(map, udev_device_ref(ud)) == NULL)
+		return FOREIGN_ERR;
+	_count_live_paths(map);
+	return FOREIGN_CLAIMED;
+}
+
+static int _delete_path_device(struct context *ctx, struct udev_device *ud)
+{
+	struct nvme_map *map;
+	struct nvme_path *path;
+	int k;
+
+	map = _find_map_for_path(ctx, ud);
+	if (map == NULL)
+		return FOREIGN_IGNORED;
+	path = _find_path_by_syspath(map, udev_device_get_syspath(ud));
+	if (path == NULL)
+		return FOREIGN_IGNORED;
+
+	k = find_slot(&map->pgvec, &path->pg);
+	if (k == -1)
+		return FOREIGN_ERR;
+	vector_del_slot(&map->pgvec, k);
+	cleanup_nvme_path(path);
+	_count_live_paths(map);
+	condlog(3, "%s: %s: path %s removed from %s", __func__, THIS,
+		udev_device_get_sysname(ud),
+		udev_device_get_sysname(map->udev));
+	return FOREIGN_OK;
+}
+
 static int _add_map(struct context *ctx, struct udev_device *ud,
 		    struct udev_device *subsys)
 {
@@ -821,8 +954,20 @@ int add(struct context *ctx, struct udev_device *ud)
 	subsys = udev_device_get_parent_with_subsystem_devtype(ud,
 							       "nvme-subsystem",
 							       NULL);
-	if (subsys == NULL)
-		return FOREIGN_IGNORED;
+	if (subsys == NULL) {
+		int subsys_num, ns_num;
+
+		if (!is_path_device(ud, &subsys_num, &ns_num))
+			return FOREIGN_IGNORED;
+		lock(ctx);
+		pthread_cleanup_push(unlock, ctx);
+		rc = _add_path_device(ctx, ud);
+		pthread_cleanup_pop(1);
+		if (rc == FOREIGN_ERR)
+			condlog(1, "%s: %s: error adding path %s", __func__,
+				THIS, udev_device_get_sysname(ud));
+		return rc;
+	}
 
 	lock(ctx);
 	pthread_cleanup_push(unlock, ctx);
@@ -839,11 +984,44 @@ int add(struct context *ctx, struct udev_device *ud)
 	return rc;
 }
 
-int change(__attribute__((unused)) struct context *ctx,
-	   __attribute__((unused)) struct udev_device *ud)
+static int _change(struct context *ctx, struct udev_device *ud)
+{
+	struct nvme_map *map;
+	struct nvme_path *path;
+
+	map = _find_nvme_map_by_devt(ctx, udev_device_get_devnum(ud));
+	if (map != NULL) {
+		/* namespace or controller changes, rescan in check() */
+		map->rescan = true;
+		return FOREIGN_OK;
+	}
+
+	map = _find_map_for_path(ctx, ud);
+	if (map == NULL)
+		return FOREIGN_IGNORED;
+	path = _find_path_by_syspath(map, udev_device_get_syspath(ud));
+	if (path == NULL)
+		return FOREIGN_IGNORED;
+	_update_path_state(path);
+	_count_live_paths(map);
+	return FOREIGN_OK;
+}
+
+int change(struct context *ctx, struct udev_device *ud)
 {
+	int rc;
+
 	condlog(5, "%s called for \"%s\"", __func__, THIS);
-	return FOREIGN_IGNORED;
+
+	if (ud == NULL)
+		return FOREIGN_ERR;
+
+	lock(ctx);
+	pthread_cleanup_push(unlock, ctx);
+	rc = _change(ctx, ud);
+	pthread_cleanup_pop(1);
+
+	return rc;
 }
 
 static int _delete_map(struct context *ctx, struct udev_device *ud)
@@ -879,14 +1057,15 @@ int delete(struct context *ctx, struct udev_device *ud)
 	lock(ctx);
 	pthread_cleanup_push(unlock, ctx);
 	rc = _delete_map(ctx, ud);
-	pthread_cleanup_pop(1);
-
 	if (rc == FOREIGN_OK)
 		condlog(3, "%s: %s: map %s deleted", __func__, THIS,
 			udev_device_get_sysname(ud));
 	else if (rc != FOREIGN_IGNORED)
 		condlog(1, "%s: %s: retcode %d deleting map %s", __func__,
 			THIS, rc, udev_device_get_sysname(ud));
+	else
+		rc = _delete_path_device(ctx, ud);
+	pthread_cleanup_pop(1);
 
 	return rc;
 }
@@ -899,7 +1078,10 @@ void _check(struct context *ctx)
 	vector_foreach_slot(ctx->mpvec, gm, i) {
 		struct nvme_map *map = gen_mp_to_nvme(gm);
 
-		_find_controllers(ctx, map);
+		if (map->rescan)
+			_find_controllers(ctx, map);
+		else
+			_refresh_map(map);
 	}
 }
 
@@ -15,12 +15,14 @@
 #include <pthread.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <linux/fs.h>
 #include <libaio.h>
 #include <sys/mman.h>
-#include <sys/select.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 
 #include "vector.h"
 #include "checkers.h"
@@ -33,9 +35,12 @@
 #include "time-util.h"
 #include "io_err_stat.h"
 #include "util.h"
+#include "discovery.h"
 
-#define TIMEOUT_NO_IO_NSEC		10000000 /*10ms = 10000000ns*/
+#define SUBMIT_INTERVAL_NSEC		100000000 /*100ms*/
 #define FLAKY_PATHFAIL_THRESHOLD	2
+/* passive detection: don't judge a path on fewer IOs than this */
+#define PASSIVE_SAMPLE_MIN_IOS		100
 #define CONCUR_NR_EVENT			32
 #define NR_IOSTAT_PATHS			32
 
@@ -45,11 +50,17 @@
 #define io_err_stat_log(prio, fmt, args...) \
 	condlog(prio, "io error statistic: " fmt, ##args)
 
+struct io_err_stat_path;
+
 struct dio_ctx {
 	struct timespec	io_starttime;
 	unsigned int	blksize;
 	void		*buf;
 	struct iocb	io;
+	/* NULL if the path was freed while this IO was in flight */
+	struct io_err_stat_path *path;
+	/* already accounted as error, waiting for the IO to return */
+	bool		timed_out;
 };
 
 struct io_err_stat_path {
@@ -62,6 +73,12 @@ struct io_err_stat_path {
 
 	int		total_time;
 	int		err_rate_threshold;
+
+	/* next submission of the IOs that have completed */
+	struct timespec	next_submit;
+	/* when the path needs to be serviced next, and its heap slot */
+	struct timespec	due;
+	int		heap_idx;
 };
 
 static pthread_t	io_err_stat_thr;
@@ -74,6 +91,16 @@ static int io_err_thread_running = 0;
 static vector io_err_pathvec;
 struct vectors *vecs;
 io_context_t	ioctx;
+/* signaled by IO completions, and when a path is enqueued */
+static int	io_err_efd = -1;
+
+/*
+ * The paths under test, ordered by their due time. Protected by
+ * io_err_pathvec_lock, like io_err_pathvec.
+ */
+static struct io_err_stat_path **io_err_heap;
+static int	io_err_heap_nr;
+static int	io_err_heap_alloc;
 
 static void cancel_inflight_io(struct io_err_stat_path *pp);
 
@@ -150,6 +177,7 @@ static int setup_directio_ctx(struct io_err_stat_path *p)
 	for (i = 0; i < CONCUR_NR_EVENT; i++) {
 		if (init_each_dio_ctx(p->dio_ctx_array + i, blksize, pgsize))
 			goto deinit;
+		p->dio_ctx_array[i].path = p;
 	}
 	return 0;
 
@@ -175,8 +203,10 @@ static void free_io_err_stat_path(struct io_err_stat_path *p)
 	if (!p->dio_ctx_array)
 		goto free_path;
 
-	for (i = 0; i < CONCUR_NR_EVENT; i++)
+	for (i = 0; i < CONCUR_NR_EVENT; i++) {
+		p->dio_ctx_array[i].path = NULL;
 		inflight += deinit_each_dio_ctx(p->dio_ctx_array + i);
+	}
 
 	if (!inflight)
 		free(p->dio_ctx_array);
@@ -206,6 +236,7 @@ static struct io_err_stat_path *alloc_io_err_stat_path(void)
 	p->start_time.tv_nsec = 0;
 	p->err_rate_threshold = 0;
 	p->fd = -1;
+	p->heap_idx = -1;
 
 	return p;
 }
@@ -232,10 +263,101 @@ static void free_io_err_pathvec(void)
 		free_io_err_stat_path(path);
 	vector_free(io_err_pathvec);
 	io_err_pathvec = NULL;
+	free(io_err_heap);
+	io_err_heap = NULL;
+	io_err_heap_nr = io_err_heap_alloc = 0;
+	if (io_err_efd >= 0) {
+		close(io_err_efd);
+		io_err_efd = -1;
+	}
 out:
 	pthread_cleanup_pop(1);
 }
 
+static void heap_swap(int a, int b)
+{
+	struct io_err_stat_path *tmp = io_err_heap[a];
+
+	io_err_heap[a] = io_err_heap[b];
+	io_err_heap[b] = tmp;
+	io_err_heap[a]->heap_idx = a;
+	io_err_heap[b]->heap_idx = b;
+}
+
+static bool heap_before(int a, int b)
+{
+	return timespeccmp(&io_err_heap[a]->due, &io_err_heap[b]->due) < 0;
+}
+
+static void heap_sift_up(int i)
+{
+	while (i > 0 && heap_before(i, (i - 1) / 2)) {
+		heap_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void heap_sift_down(int i)
+{
+	int min, child;
+
+	for (;;) {
+		min = i;
+		child = 2 * i + 1;
+		if (child < io_err_heap_nr && heap_before(child, min))
+			min = child;
+		if (child + 1 < io_err_heap_nr && heap_before(child + 1, min))
+			min = child + 1;
+		if (min == i)
+			break;
+		heap_swap(i, min);
+		i = min;
+	}
+}
+
+static int heap_push(struct io_err_stat_path *pp)
+{
+	struct io_err_stat_path **tmp;
+	int alloc;
+
+	if (io_err_heap_nr == io_err_heap_alloc) {
+		alloc = io_err_heap_alloc ? 2 * io_err_heap_alloc : 16;
+		tmp = realloc(io_err_heap, alloc * sizeof(*tmp));
+		if (!tmp)
+			return 1;
+		io_err_heap = tmp;
+		io_err_heap_alloc = alloc;
+	}
+	pp->heap_idx = io_err_heap_nr++;
+	io_err_heap[pp->heap_idx] = pp;
+	heap_sift_up(pp->heap_idx);
+	return 0;
+}
+
+static struct io_err_stat_path *heap_pop(void)
+{
+	struct io_err_stat_path *pp;
+
+	if (io_err_heap_nr == 0)
+		return NULL;
+	pp = io_err_heap[0];
+	if (--io_err_heap_nr > 0) {
+		heap_swap(0, io_err_heap_nr);
+		heap_sift_down(0);
+	}
+	pp->heap_idx = -1;
+	return pp;
+}
+
+static void kick_io_err_stat_thread(void)
+{
+	uint64_t one = 1;
+
+	if (io_err_efd >= 0 && write(io_err_efd, &one, sizeof(one)) < 0)
+		io_err_stat_log(3, "failed to wake up thread: %s",
+				strerror(errno));
+}
+
 /*
  * return value
  * 0: enqueue OK
@@ -266,8 +388,15 @@ static int enqueue_io_err_stat_by_path(struct path *path)
 	pthread_mutex_lock(&io_err_pathvec_lock);
 	if (!vector_alloc_slot(io_err_pathvec))
 		goto unlock_pathvec;
+	/* service it right away */
+	get_monotonic_time(&p->due);
+	if (heap_push(p)) {
+		vector_del_slot(io_err_pathvec, VECTOR_SIZE(io_err_pathvec) - 1);
+		goto unlock_pathvec;
+	}
 	vector_set_slot(io_err_pathvec, p);
 	pthread_mutex_unlock(&io_err_pathvec_lock);
+	kick_io_err_stat_thread();
 
 	io_err_stat_log(3, "%s: enqueue path %s to check",
 			path->mpp->alias, path->dev);
@@ -342,6 +471,7 @@ int io_err_stat_handle_pathfail(struct path *path)
 			path->mpp->stat_path_failures++;
 			path->state = PATH_DOWN;
 			path->dmstate = PSTATE_FAILED;
+			map_state_changed(path->mpp);
 			if (oldstate == PATH_UP || oldstate == PATH_GHOST)
 				update_queue_mode_del_path(path->mpp);
 			if (path->tick > checkint)
@@ -392,6 +522,100 @@ recover:
 	return 0;
 }
 
+static void reset_io_sample(struct path *pp, time_t now,
+			    unsigned long long ios, unsigned long long ticks,
+			    unsigned long long errs)
+{
+	pp->io_sample_start = now;
+	pp->io_sample_ios = ios;
+	pp->io_sample_ticks = ticks;
+	pp->io_sample_errs = errs;
+}
+
+/*
+ * Passive marginal path detection: instead of sending test IO, derive
+ * the error rate from the block layer and SCSI midlayer counters of the
+ * path, sampled once per path check. At the end of each sample window of
+ * marginal_path_err_sample_time seconds, the path is flagged as marginal
+ * if the error rate exceeds marginal_path_err_rate_threshold. A window
+ * is extended until it has seen PASSIVE_SAMPLE_MIN_IOS IOs, so that an
+ * idle path isn't judged on a handful of errors. The average latency is
+ * only logged, there is no threshold to compare it with. A flagged
+ * path is unflagged after marginal_path_err_recheck_gap_time, or early
+ * if the map has no other usable path.
+ *
+ * Returns 1 if the path should be treated as marginal, 0 otherwise.
+ */
+int io_err_stat_sample_path(struct path *pp)
+{
+	struct timespec now;
+	unsigned long long ios, ticks, errs, d_ios, d_ticks, d_errs;
+	unsigned int err_rate;
+
+	if (!pp->mpp)
+		return 0;
+	get_monotonic_time(&now);
+
+	if (pp->io_err_disable_reinstate) {
+		if (count_active_paths(pp->mpp) <= 0) {
+			io_err_stat_log(2, "%s: no paths. recovering early",
+					pp->dev);
+			pp->io_err_disable_reinstate = 0;
+		} else if (now.tv_sec - pp->io_err_dis_reinstate_time >
+			   pp->mpp->marginal_path_err_recheck_gap_time) {
+			io_err_stat_log(3, "%s: good to enable reinstating after %d seconds",
+					pp->dev,
+					pp->mpp->marginal_path_err_recheck_gap_time);
+			pp->io_err_disable_reinstate = 0;
+		}
+		if (!pp->io_err_disable_reinstate)
+			pp->io_sample_start = 0;
+		else
+			return 1;
+	}
+
+	if (path_io_counters(pp, &ios, &ticks, &errs) != 0)
+		return 0;
+
+	/* first sample, or counters were reset (e.g. device re-added) */
+	if (pp->io_sample_start == 0 || ios < pp->io_sample_ios ||
+	    ticks < pp->io_sample_ticks || errs < pp->io_sample_errs) {
+		reset_io_sample(pp, now.tv_sec, ios, ticks, errs);
+		return 0;
+	}
+	if (now.tv_sec - pp->io_sample_start <
+	    pp->mpp->marginal_path_err_sample_time)
+		return 0;
+
+	d_ios = ios - pp->io_sample_ios;
+	d_ticks = ticks - pp->io_sample_ticks;
+	d_errs = errs - pp->io_sample_errs;
+
+	/* failed IOs are not always accounted as completed */
+	if (d_ios < d_errs)
+		d_ios = d_errs;
+	if (d_ios < PASSIVE_SAMPLE_MIN_IOS)
+		return 0;
+	reset_io_sample(pp, now.tv_sec, ios, ticks, errs);
+	err_rate = d_errs * 1000 / d_ios;
+	io_err_stat_log(4, "%s: %llu IOs, %llu errors, avg latency %llu ms, error rate (%u/1000)",
+			pp->dev, d_ios, d_errs, d_ticks / d_ios, err_rate);
+
+	if (err_rate <= (unsigned int)pp->mpp->marginal_path_err_rate_threshold)
+		return 0;
+	if (count_active_paths(pp->mpp) <= 1 &&
+	    (pp->state == PATH_UP || pp->state == PATH_GHOST)) {
+		io_err_stat_log(3, "%s: error rate (%u/1000) too high, but it is the last path",
+				pp->dev, err_rate);
+		return 0;
+	}
+	io_err_stat_log(2, "%s: error rate (%u/1000) too high, disable reinstating of %s",
+			pp->mpp->alias, err_rate, pp->dev);
+	pp->io_err_disable_reinstate = 1;
+	pp->io_err_dis_reinstate_time = now.tv_sec;
+	return 1;
+}
+
 static void account_async_io_state(struct io_err_stat_path *pp, int rc)
 {
 	switch (rc) {
@@ -408,12 +632,12 @@ static void account_async_io_state(struct io_err_stat_path *pp, int rc)
 	}
 }
 
-static int io_err_stat_time_up(struct io_err_stat_path *pp)
+static int io_err_stat_time_up(struct io_err_stat_path *pp,
+			       const struct timespec *now)
 {
-	struct timespec currtime, difftime;
+	struct timespec difftime;
 
-	get_monotonic_time(&currtime);
-	timespecsub(&currtime, &pp->start_time, &difftime);
+	timespecsub(now, &pp->start_time, &difftime);
 	if (difftime.tv_sec < pp->total_time)
 		return 0;
 	return 1;
@@ -466,93 +690,148 @@ static void end_io_err_stat(struct io_err_stat_path *pp)
 	lock_cleanup_pop(vecs->lock);
 }
 
-static int send_each_async_io(struct dio_ctx *ct, int fd, char *dev)
+static void add_timespec(struct timespec *ts, time_t sec, long nsec)
 {
-	int rc;
+	ts->tv_sec += sec;
+	ts->tv_nsec += nsec;
+	normalize_timespec(ts);
+}
 
-	if (ct->io_starttime.tv_nsec == 0 &&
-			ct->io_starttime.tv_sec == 0) {
-		struct iocb *ios[1] = { &ct->io };
+static void earliest(struct timespec *due, const struct timespec *t)
+{
+	if (timespeccmp(t, due) < 0)
+		*due = *t;
+}
 
-		get_monotonic_time(&ct->io_starttime);
-		io_prep_pread(&ct->io, fd, ct->buf, ct->blksize, 0);
-		if ((rc = io_submit(ioctx, 1, ios)) != 1) {
-			io_err_stat_log(2, "%s: io_submit error %s",
-					dev, strerror(-rc));
-			return -1;
-		}
-		return 0;
-	}
+static bool io_in_flight(const struct dio_ctx *ct)
+{
+	return ct->io_starttime.tv_sec != 0 || ct->io_starttime.tv_nsec != 0;
+}
 
-	return -1;
+/* Give a free time for all IO to complete or timeout */
+static bool may_submit(const struct io_err_stat_path *pp,
+		       const struct timespec *t)
+{
+	struct timespec difftime;
+
+	if (pp->start_time.tv_sec == 0 && pp->start_time.tv_nsec == 0)
+		return true;
+	timespecsub(t, &pp->start_time, &difftime);
+	return difftime.tv_sec + IOTIMEOUT_SEC < pp->total_time;
 }
 
-static void send_batch_async_ios(struct io_err_stat_path *pp)
+/* Queue the IOs of a path in @ios, they are submitted by submit_async_ios() */
+static void prep_batch_async_ios(struct io_err_stat_path *pp,
+				 const struct timespec *now,
+				 struct iocb **ios, int *nr_ios)
 {
 	int i;
 	struct dio_ctx *ct;
-	struct timespec currtime, difftime;
 
-	get_monotonic_time(&currtime);
-	/*
-	 * Give a free time for all IO to complete or timeout
-	 */
-	if (pp->start_time.tv_sec != 0) {
-		timespecsub(&currtime, &pp->start_time, &difftime);
-		if (difftime.tv_sec + IOTIMEOUT_SEC >= pp->total_time)
-			return;
-	}
+	if (!may_submit(pp, now))
+		return;
 
 	for (i = 0; i < CONCUR_NR_EVENT; i++) {
 		ct = pp->dio_ctx_array + i;
-		if (!send_each_async_io(ct, pp->fd, pp->devname))
-			pp->io_nr++;
+		if (io_in_flight(ct))
+			continue;
+		ct->io_starttime = *now;
+		ct->timed_out = false;
+		io_prep_pread(&ct->io, pp->fd, ct->buf, ct->blksize, 0);
+		io_set_eventfd(&ct->io, io_err_efd);
+		ios[(*nr_ios)++] = &ct->io;
+		pp->io_nr++;
 	}
 	if (pp->start_time.tv_sec == 0 && pp->start_time.tv_nsec == 0)
-		get_monotonic_time(&pp->start_time);
+		pp->start_time = *now;
 }
 
-static int try_to_cancel_timeout_io(struct dio_ctx *ct, struct timespec *t,
-		char *dev)
+/* Return an IO that couldn't be submitted, it is queued again later */
+static void unprep_async_io(struct iocb *io)
 {
-	struct timespec	difftime;
-	struct io_event	event;
-	int		rc = PATH_UNCHECKED;
-	int		r;
+	struct dio_ctx *ct = container_of(io, struct dio_ctx, io);
 
-	if (ct->io_starttime.tv_sec == 0 && ct->io_starttime.tv_nsec == 0)
-		return rc;
-	timespecsub(t, &ct->io_starttime, &difftime);
-	if (difftime.tv_sec > IOTIMEOUT_SEC) {
-		struct iocb *ios[1] = { &ct->io };
+	ct->io_starttime.tv_sec = 0;
+	ct->io_starttime.tv_nsec = 0;
+	ct->path->io_nr--;
+}
+
+static void submit_async_ios(struct iocb **ios, int nr_ios)
+{
+	struct dio_ctx *ct;
+	int done = 0, rc;
 
-		io_err_stat_log(5, "%s: abort check on timeout", dev);
-		r = io_cancel(ioctx, ios[0], &event);
+	while (done < nr_ios) {
+		rc = io_submit(ioctx, nr_ios - done, ios + done);
+		if (rc > 0) {
+			done += rc;
+			continue;
+		}
+		if (rc == 0 || rc == -EAGAIN) {
+			/* The context is full, retry the rest next time */
+			io_err_stat_log(3, "io_submit: %s, delaying %d IOs",
+					rc ? strerror(-rc) : "no IOs queued",
+					nr_ios - done);
+			while (done < nr_ios)
+				unprep_async_io(ios[done++]);
+			break;
+		}
+		/* Skip the IO that failed, and retry the rest */
+		ct = container_of(ios[done], struct dio_ctx, io);
+		io_err_stat_log(2, "%s: io_submit error %s",
+				ct->path->devname, strerror(-rc));
+		unprep_async_io(ios[done++]);
+	}
+}
+
+/* Account the IOs of @pp that have been in flight for too long */
+static void check_async_io_timeout(struct io_err_stat_path *pp,
+				   const struct timespec *now)
+{
+	struct timespec deadline;
+	struct io_event	event;
+	struct dio_ctx *ct;
+	int i, r;
+
+	for (i = 0; i < CONCUR_NR_EVENT; i++) {
+		ct = pp->dio_ctx_array + i;
+		if (!io_in_flight(ct) || ct->timed_out)
+			continue;
+		deadline = ct->io_starttime;
+		add_timespec(&deadline, IOTIMEOUT_SEC, 0);
+		if (timespeccmp(now, &deadline) < 0)
+			continue;
+		io_err_stat_log(5, "%s: abort check on timeout", pp->devname);
+		r = io_cancel(ioctx, &ct->io, &event);
 		if (r)
 			io_err_stat_log(5, "%s: io_cancel error %s",
-					dev, strerror(-r));
-		rc = PATH_TIMEOUT;
-	} else {
-		rc = PATH_PENDING;
+					pp->devname, strerror(-r));
+		ct->timed_out = true;
+		account_async_io_state(pp, PATH_TIMEOUT);
 	}
-
-	return rc;
 }
 
-static void poll_async_io_timeout(void)
+/*
+ * The next time @pp needs attention: the end of its sample window,
+ * the next submission, or the deadline of an IO in flight.
+ */
+static void update_due_time(struct io_err_stat_path *pp)
 {
-	struct io_err_stat_path *pp;
-	struct timespec curr_time;
-	int		rc = PATH_UNCHECKED;
-	int		i, j;
+	struct timespec t;
+	int i;
 
-	get_monotonic_time(&curr_time);
-	vector_foreach_slot(io_err_pathvec, pp, i) {
-		for (j = 0; j < CONCUR_NR_EVENT; j++) {
-			rc = try_to_cancel_timeout_io(pp->dio_ctx_array + j,
-					&curr_time, pp->devname);
-			account_async_io_state(pp, rc);
-		}
+	pp->due = pp->start_time;
+	add_timespec(&pp->due, pp->total_time, 0);
+	if (may_submit(pp, &pp->next_submit))
+		earliest(&pp->due, &pp->next_submit);
+	for (i = 0; i < CONCUR_NR_EVENT; i++) {
+		const struct dio_ctx *ct = pp->dio_ctx_array + i;
+
+		if (!io_in_flight(ct) || ct->timed_out)
+			continue;
+		t = ct->io_starttime;
+		add_timespec(&t, IOTIMEOUT_SEC, 0);
+		earliest(&pp->due, &t);
 	}
 }
 
@@ -565,8 +844,7 @@ static void cancel_inflight_io(struct io_err_stat_path *pp)
 		struct dio_ctx *ct = pp->dio_ctx_array + i;
 		struct iocb *ios[1] = { &ct->io };
 
-		if (ct->io_starttime.tv_sec == 0
-				&& ct->io_starttime.tv_nsec == 0)
+		if (!io_in_flight(ct))
 			continue;
 		io_err_stat_log(5, "%s: abort infligh io",
 				pp->devname);
@@ -583,61 +861,118 @@ static inline int handle_done_dio_ctx(struct dio_ctx *ct, struct io_event *ev)
 
 static void handle_async_io_done_event(struct io_event *io_evt)
 {
-	struct io_err_stat_path *pp;
-	struct dio_ctx *ct;
-	int rc = PATH_UNCHECKED;
-	int i, j;
-
-	vector_foreach_slot(io_err_pathvec, pp, i) {
-		for (j = 0; j < CONCUR_NR_EVENT; j++) {
-			ct = pp->dio_ctx_array + j;
-			if (&ct->io == io_evt->obj) {
-				rc = handle_done_dio_ctx(ct, io_evt);
-				account_async_io_state(pp, rc);
-				return;
-			}
-		}
-	}
+	struct dio_ctx *ct = container_of(io_evt->obj, struct dio_ctx, io);
+	bool timed_out = ct->timed_out;
+	int rc;
+
+	rc = handle_done_dio_ctx(ct, io_evt);
+	/* orphaned IO of a path that has been freed */
+	if (ct->path && !timed_out)
+		account_async_io_state(ct->path, rc);
 }
 
-static void process_async_ios_event(int timeout_nsecs, char *dev)
+/* Reap the completions of all paths, without waiting */
+static void process_async_ios_event(void)
 {
 	struct io_event events[CONCUR_NR_EVENT];
+	struct timespec	timeout = { .tv_sec = 0, };
 	int		i, n;
-	struct timespec	timeout = { .tv_nsec = timeout_nsecs };
 
-	pthread_testcancel();
-	n = io_getevents(ioctx, 1L, CONCUR_NR_EVENT, events, &timeout);
-	if (n < 0) {
-		io_err_stat_log(3, "%s: io_getevents returned %s",
-				dev, strerror(-n));
-	} else {
+	do {
+		n = io_getevents(ioctx, 0, CONCUR_NR_EVENT, events, &timeout);
+		if (n < 0) {
+			io_err_stat_log(3, "io_getevents returned %s",
+					strerror(-n));
+			break;
+		}
 		for (i = 0; i < n; i++)
 			handle_async_io_done_event(&events[i]);
-	}
+	} while (n == CONCUR_NR_EVENT);
+}
+
+static bool io_err_stat_started(const struct io_err_stat_path *pp)
+{
+	return pp->start_time.tv_sec != 0 || pp->start_time.tv_nsec != 0;
 }
 
-static void service_paths(void)
+/*
+ * Service the paths that are due, and return the time when the next
+ * one will be due in @next. Returns false if no path is under test.
+ */
+static bool service_paths(struct timespec *next)
 {
 	struct _vector _pathvec = { .allocated = 0 };
 	/* avoid gcc warnings that &_pathvec will never be NULL in vector ops */
 	struct _vector * const tmp_pathvec = &_pathvec;
-	struct io_err_stat_path *pp;
-	int i;
+	struct io_err_stat_path *pp, **due = NULL;
+	struct iocb **ios = NULL;
+	struct timespec now;
+	bool busy = false;
+	int i, nr_due = 0, nr_ios = 0;
 
 	pthread_mutex_lock(&io_err_pathvec_lock);
 	pthread_cleanup_push(cleanup_mutex, &io_err_pathvec_lock);
-	vector_foreach_slot(io_err_pathvec, pp, i) {
-		send_batch_async_ios(pp);
-		process_async_ios_event(TIMEOUT_NO_IO_NSEC, pp->devname);
-		poll_async_io_timeout();
-		if (io_err_stat_time_up(pp)) {
-			if (!vector_alloc_slot(tmp_pathvec))
-				continue;
-			vector_del_slot(io_err_pathvec, i--);
-			vector_set_slot(tmp_pathvec, pp);
+	pthread_cleanup_push(cleanup_free_ptr, &due);
+	pthread_cleanup_push(cleanup_free_ptr, &ios);
+	process_async_ios_event();
+	get_monotonic_time(&now);
+
+	if (io_err_heap_nr > 0 &&
+	    timespeccmp(&io_err_heap[0]->due, &now) <= 0) {
+		due = calloc(io_err_heap_nr, sizeof(*due));
+		ios = calloc(io_err_heap_nr * CONCUR_NR_EVENT, sizeof(*ios));
+	}
+	if (due && ios) {
+		while (io_err_heap_nr > 0 &&
+		       timespeccmp(&io_err_heap[0]->due, &now) <= 0)
+			due[nr_due++] = heap_pop();
+	} else if (io_err_heap_nr > 0 &&
+		   timespeccmp(&io_err_heap[0]->due, &now) <= 0) {
+		/* out of memory, try again later */
+		io_err_heap[0]->due = now;
+		add_timespec(&io_err_heap[0]->due, 0, SUBMIT_INTERVAL_NSEC);
+		heap_sift_down(0);
+	}
+
+	for (i = 0; i < nr_due; i++) {
+		pp = due[i];
+		check_async_io_timeout(pp, &now);
+		if (io_err_stat_started(pp) && io_err_stat_time_up(pp, &now)) {
+			if (vector_alloc_slot(tmp_pathvec)) {
+				vector_set_slot(tmp_pathvec, pp);
+				vector_del_slot(io_err_pathvec,
+						find_slot(io_err_pathvec, pp));
+				due[i] = NULL;
+			}
+			continue;
+		}
+		if (timespeccmp(&pp->next_submit, &now) <= 0) {
+			prep_batch_async_ios(pp, &now, ios, &nr_ios);
+			pp->next_submit = now;
+			add_timespec(&pp->next_submit, 0, SUBMIT_INTERVAL_NSEC);
+		}
+	}
+	submit_async_ios(ios, nr_ios);
+
+	for (i = 0; i < nr_due; i++) {
+		pp = due[i];
+		if (!pp)
+			continue;
+		update_due_time(pp);
+		if (timespeccmp(&pp->due, &now) <= 0) {
+			/* couldn't be started or finished, retry later */
+			pp->due = now;
+			add_timespec(&pp->due, 0, SUBMIT_INTERVAL_NSEC);
 		}
+		/* can't fail, the heap held all these paths before */
+		heap_push(pp);
 	}
+	if (io_err_heap_nr > 0) {
+		*next = io_err_heap[0]->due;
+		busy = true;
+	}
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
 	vector_foreach_slot_backwards(tmp_pathvec, pp, i) {
 		end_io_err_stat(pp);
@@ -645,6 +980,7 @@ static void service_paths(void)
 		free_io_err_stat_path(pp);
 	}
 	vector_reset(tmp_pathvec);
+	return busy;
 }
 
 static void cleanup_exited(__attribute__((unused)) void *arg)
@@ -673,17 +1009,25 @@ static void *io_err_stat_loop(void *data)
 	pthread_mutex_unlock(&io_err_thread_lock);
 
 	while (1) {
-		struct timespec ts;
-
-		service_paths();
-
-		ts.tv_sec = 0;
-		ts.tv_nsec = 100 * 1000 * 1000;
+		struct pollfd pfd = { .fd = io_err_efd, .events = POLLIN };
+		struct timespec next, now, ts, *tsp = NULL;
+		uint64_t val;
+
+		if (service_paths(&next)) {
+			get_monotonic_time(&now);
+			timespecsub(&next, &now, &ts);
+			if (ts.tv_sec < 0)
+				ts.tv_sec = ts.tv_nsec = 0;
+			tsp = &ts;
+		}
 		/*
-		 * pselect() with no fds, a timeout, and a sigmask:
-		 * sleep for 100ms and react on SIGUSR2.
+		 * Sleep until the next path is due, an IO completes or a
+		 * path is enqueued, and react on SIGUSR2.
 		 */
-		pselect(1, NULL, NULL, NULL, &ts, &set);
+		if (ppoll(&pfd, 1, tsp, &set) > 0 && (pfd.revents & POLLIN) &&
+		    read(io_err_efd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+			io_err_stat_log(3, "failed to read eventfd: %s",
+					strerror(errno));
 	}
 
 	pthread_cleanup_pop(1);
@@ -705,11 +1049,18 @@ int start_io_err_stat_thread(void *data)
 		return 1;
 	}
 
+	io_err_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (io_err_efd < 0) {
+		io_err_stat_log(1, "failed to create eventfd: %s",
+				strerror(errno));
+		goto destroy_ctx;
+	}
+
 	pthread_mutex_lock(&io_err_pathvec_lock);
 	io_err_pathvec = vector_alloc();
 	if (!io_err_pathvec) {
 		pthread_mutex_unlock(&io_err_pathvec_lock);
-		goto destroy_ctx;
+		goto close_efd;
 	}
 	pthread_mutex_unlock(&io_err_pathvec_lock);
 
@@ -740,6 +1091,9 @@ out_free:
 	vector_free(io_err_pathvec);
 	io_err_pathvec = NULL;
 	pthread_mutex_unlock(&io_err_pathvec_lock);
+close_efd:
+	close(io_err_efd);
+	io_err_efd = -1;
 destroy_ctx:
 	io_destroy(ioctx);
 	io_err_stat_log(0, "failed to start io_error statistic thread");
@@ -11,5 +11,6 @@ int start_io_err_stat_thread(void *data);
 void stop_io_err_stat_thread(void);
 int io_err_stat_handle_pathfail(struct path *path);
 int need_io_err_check(struct path *pp);
+int io_err_stat_sample_path(struct path *pp);
 
 #endif /* _IO_ERR_STAT_H */
@@ -3,6 +3,7 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include <libdevmapper.h>
 #include <stdarg.h>
 #include <sys/stat.h>
@@ -1421,6 +1422,54 @@ int snprint_multipath_topology_json (struct strbuf *buff,
 	return get_strbuf_len(buff) - initial_len;
 }
 
+/*
+ * Like snprint_multipath_topology_json(), but only print the maps in
+ * @changed. "map_names" lists all maps in @vecs, so that the reader can
+ * drop maps which have been removed. @state_gen and @full are passed
+ * through for the reader, see "show maps json since" in multipathd.
+ */
+int snprint_multipath_delta_json(struct strbuf *buff,
+				 const struct vectors *vecs,
+				 const struct _vector *changed,
+				 uint64_t state_gen, bool full)
+{
+	int i;
+	struct multipath * mpp;
+	size_t initial_len = get_strbuf_len(buff);
+	int rc;
+
+	if ((rc = snprint_json_header(buff)) < 0 ||
+	    (rc = print_strbuf(buff, "   \"state_gen\": %" PRIu64 ",\n",
+			       state_gen)) < 0 ||
+	    (rc = print_strbuf(buff, "   \"full\": %s,\n",
+			       full ? "true" : "false")) < 0 ||
+	    (rc = snprint_json(buff, 1, "\"map_names\": [")) < 0)
+		return rc;
+
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		if ((rc = append_strbuf_str(buff, i == 0 ? "\"" : ", \"")) < 0 ||
+		    (rc = snprint_str(buff, mpp->alias)) < 0 ||
+		    (rc = append_strbuf_str(buff, "\"")) < 0)
+			return rc;
+	}
+
+	if ((rc = append_strbuf_str(buff, "],\n")) < 0 ||
+	    (rc = snprint_json(buff, 1, PRINT_JSON_START_MAPS)) < 0)
+		return rc;
+
+	vector_foreach_slot(changed, mpp, i) {
+		if ((rc = snprint_multipath_fields_json(
+			     buff, mpp, i + 1 == VECTOR_SIZE(changed))) < 0)
+			return rc;
+	}
+
+	if ((rc = snprint_json(buff, 0, PRINT_JSON_END_ARRAY)) < 0 ||
+	    (rc = snprint_json(buff, 0, PRINT_JSON_END_LAST)) < 0)
+		return rc;
+
+	return get_strbuf_len(buff) - initial_len;
+}
+
 static int
 snprint_pcentry (const struct config *conf, struct strbuf *buff,
 		 const struct pcentry *pce)
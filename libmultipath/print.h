@@ -1,5 +1,7 @@
 #ifndef _PRINT_H
 #define _PRINT_H
+#include <stdbool.h>
+#include <stdint.h>
 #include "dm-generic.h"
 
 #define PRINT_PATH_CHECKER   "%i %d %D %p %t %T %o %C"
@@ -46,6 +48,9 @@ char *snprint_config(const struct config *conf, int *len,
 		     const struct _vector *hwtable,
 		     const struct _vector *mpvec);
 int snprint_multipath_map_json(struct strbuf *, const struct multipath *mpp);
+int snprint_multipath_delta_json(struct strbuf *, const struct vectors *vecs,
+				 const struct _vector *changed,
+				 uint64_t state_gen, bool full);
 int snprint_blacklist_report(struct config *, struct strbuf *);
 int snprint_wildcards(struct strbuf *);
 int snprint_status(struct strbuf *, const struct vectors *);
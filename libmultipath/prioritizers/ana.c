@@ -13,6 +13,10 @@
  * This file is released under the GPL version 2, or any later version.
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -23,6 +27,8 @@
 #include "nvme-lib.h"
 #include "prio.h"
 #include "util.h"
+#include "time-util.h"
+#include "list.h"
 #include "structs.h"
 
 enum {
@@ -107,63 +113,302 @@ static int get_ana_state(__u32 nsid, __u32 anagrpid, void *ana_log,
 	return -ANA_ERR_GETANAS_NOTFOUND;
 }
 
-static int get_ana_info(struct path * pp)
-{
-	int	rc;
+/*
+ * All namespaces of a controller share the same ANA log page. It's read
+ * at most once per ANA_CACHE_EXPIRE_SEC for every controller, together
+ * with the Identify Controller data. A cached ANA CHANGE state forces a
+ * re-read on the next call. The admin commands are sent without holding
+ * ana_ctrls_lock, the results are merged into the cache afterwards.
+ * Controllers which haven't been used for ANA_CTRL_IDLE_SEC are dropped.
+ */
+#define ANA_CACHE_EXPIRE_SEC 1
+#define ANA_CTRL_IDLE_SEC 300
+
+struct ana_nsid_grp {
 	__u32 nsid;
-	struct nvme_id_ctrl ctrl;
-	struct nvme_id_ns ns;
+	__u32 anagrpid;
+};
+
+struct ana_log {
+	int status;	/* 0, or negative error code of the refresh */
+	bool is_anagrpid_const;
 	void *ana_log;
 	size_t ana_log_len;
-	bool is_anagrpid_const;
+};
+
+struct ana_ctrl {
+	struct list_head node;
+	char name[NAME_SIZE];
+	struct timespec expires;
+	struct timespec last_used;
+	struct ana_log log;
+	/*
+	 * namespace to ANA group mapping, only if is_anagrpid_const.
+	 * Reset if the ANA log changes.
+	 */
+	struct ana_nsid_grp *grps;
+	unsigned int nr_grps;
+};
+
+static LIST_HEAD(ana_ctrls);
+static pthread_mutex_t ana_ctrls_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void reset_ana_grps(struct ana_ctrl *ac)
+{
+	free(ac->grps);
+	ac->grps = NULL;
+	ac->nr_grps = 0;
+}
+
+static void free_ana_ctrl(struct ana_ctrl *ac)
+{
+	list_del(&ac->node);
+	free(ac->log.ana_log);
+	free(ac->grps);
+	free(ac);
+}
+
+static void __attribute__((destructor)) free_ana_ctrls(void)
+{
+	struct ana_ctrl *ac, *tmp;
+
+	list_for_each_entry_safe(ac, tmp, &ana_ctrls, node)
+		free_ana_ctrl(ac);
+}
+
+/* The controller device name, or the path name if it can't be found */
+static void get_ana_ctrl_name(const struct path *pp, char *name, size_t len)
+{
+	struct udev_device *ctl = NULL;
+
+	if (pp->udev)
+		ctl = udev_device_get_parent_with_subsystem_devtype(pp->udev,
+								    "nvme",
+								    NULL);
+	strlcpy(name, ctl ? udev_device_get_sysname(ctl) : pp->dev, len);
+}
+
+/* Called with ana_ctrls_lock held */
+static struct ana_ctrl *find_ana_ctrl(const char *name,
+				      const struct timespec *now)
+{
+	struct ana_ctrl *ac, *tmp, *found = NULL;
+
+	list_for_each_entry_safe(ac, tmp, &ana_ctrls, node) {
+		if (!strcmp(ac->name, name))
+			found = ac;
+		else if (now->tv_sec - ac->last_used.tv_sec >
+			 ANA_CTRL_IDLE_SEC)
+			free_ana_ctrl(ac);
+	}
+	if (!found) {
+		found = calloc(1, sizeof(*found));
+		if (!found)
+			return NULL;
+		strlcpy(found->name, name, sizeof(found->name));
+		list_add(&found->node, &ana_ctrls);
+	}
+	found->last_used = *now;
+	return found;
+}
+
+/* Sends admin commands, must be called without ana_ctrls_lock */
+static void read_ana_log(const struct path *pp, struct ana_log *al)
+{
+	int rc;
+	struct nvme_id_ctrl ctrl;
 
 	rc = nvme_id_ctrl_ana(pp->fd, &ctrl);
 	if (rc < 0) {
 		log_nvme_errcode(rc, pp->dev, "nvme_identify_ctrl");
-		return -ANA_ERR_GETCTRL_FAILED;
-	} else if (rc == 0)
-		return -ANA_ERR_NOT_SUPPORTED;
-
-	nsid = nvme_get_nsid(pp->fd);
-	if (nsid <= 0) {
-		log_nvme_errcode(rc, pp->dev, "nvme_get_nsid");
-		return -ANA_ERR_GETNSID_FAILED;
+		al->status = -ANA_ERR_GETCTRL_FAILED;
+		return;
+	} else if (rc == 0) {
+		al->status = -ANA_ERR_NOT_SUPPORTED;
+		return;
 	}
-	is_anagrpid_const = ctrl.anacap & (1 << 6);
+
+	al->is_anagrpid_const = ctrl.anacap & (1 << 6);
 
 	/*
 	 * Code copied from nvme-cli/nvme.c. We don't need to allocate an
 	 * [nanagrpid*mnan] array of NSIDs because each NSID can occur at most
 	 * in one ANA group.
 	 */
-	ana_log_len = sizeof(struct nvme_ana_rsp_hdr) +
+	al->ana_log_len = sizeof(struct nvme_ana_rsp_hdr) +
 		le32_to_cpu(ctrl.nanagrpid)
 		* sizeof(struct nvme_ana_group_desc);
+	if (!al->is_anagrpid_const)
+		al->ana_log_len += le32_to_cpu(ctrl.mnan) * sizeof(__le32);
 
-	if (is_anagrpid_const) {
-		rc = nvme_identify_ns(pp->fd, nsid, 0, &ns);
-		if (rc) {
-			log_nvme_errcode(rc, pp->dev, "nvme_identify_ns");
-			return -ANA_ERR_GETNS_FAILED;
-		}
-	} else
-		ana_log_len += le32_to_cpu(ctrl.mnan) * sizeof(__le32);
-
-	ana_log = malloc(ana_log_len);
-	if (!ana_log)
-		return -ANA_ERR_NO_MEMORY;
-	pthread_cleanup_push(free, ana_log);
-	rc = nvme_ana_log(pp->fd, ana_log, ana_log_len,
-			  is_anagrpid_const ? NVME_ANA_LOG_RGO : 0);
+	al->ana_log = malloc(al->ana_log_len);
+	if (!al->ana_log) {
+		al->status = -ANA_ERR_NO_MEMORY;
+		return;
+	}
+	rc = nvme_ana_log(pp->fd, al->ana_log, al->ana_log_len,
+			  al->is_anagrpid_const ? NVME_ANA_LOG_RGO : 0);
 	if (rc) {
 		log_nvme_errcode(rc, pp->dev, "nvme_ana_log");
-		rc = -ANA_ERR_GETANALOG_FAILED;
-	} else
-		rc = get_ana_state(nsid,
-				   is_anagrpid_const ?
-				   le32_to_cpu(ns.anagrpid) : 0,
-				   ana_log, ana_log_len);
-	pthread_cleanup_pop(1);
+		al->status = -ANA_ERR_GETANALOG_FAILED;
+		return;
+	}
+	al->status = 0;
+}
+
+static bool ana_log_changed(const struct ana_log *old,
+			    const struct ana_log *new)
+{
+	const struct nvme_ana_rsp_hdr *ho = old->ana_log, *hn = new->ana_log;
+
+	return old->status < 0 || new->status < 0 ||
+		old->is_anagrpid_const != new->is_anagrpid_const ||
+		le64_to_cpu(ho->chgcnt) != le64_to_cpu(hn->chgcnt);
+}
+
+/* Called with ana_ctrls_lock held, takes over al->ana_log */
+static void update_ana_ctrl(struct ana_ctrl *ac, struct ana_log *al,
+			    const struct timespec *now)
+{
+	if (!ac->log.ana_log || ana_log_changed(&ac->log, al))
+		reset_ana_grps(ac);
+	free(ac->log.ana_log);
+	ac->log = *al;
+	if (ac->log.status < 0) {
+		free(ac->log.ana_log);
+		ac->log.ana_log = NULL;
+	}
+	al->ana_log = NULL;
+	ac->expires = *now;
+	ac->expires.tv_sec += ANA_CACHE_EXPIRE_SEC;
+}
+
+static int find_ana_grp(const struct ana_ctrl *ac, __u32 nsid)
+{
+	unsigned int i;
+
+	for (i = 0; i < ac->nr_grps; i++)
+		if (ac->grps[i].nsid == nsid)
+			return i;
+	return -1;
+}
+
+/* Called with ana_ctrls_lock held */
+static void add_ana_grp(struct ana_ctrl *ac, __u32 nsid, __u32 anagrpid)
+{
+	struct ana_nsid_grp *grps;
+
+	if (find_ana_grp(ac, nsid) >= 0)
+		return;
+	grps = realloc(ac->grps, (ac->nr_grps + 1) * sizeof(*grps));
+	if (grps) {
+		grps[ac->nr_grps].nsid = nsid;
+		grps[ac->nr_grps].anagrpid = anagrpid;
+		ac->grps = grps;
+		ac->nr_grps++;
+	}
+}
+
+enum {
+	ANA_NEED_NOTHING,
+	ANA_NEED_LOG,
+	ANA_NEED_GRPID,
+};
+
+/*
+ * Look up the ANA state of nsid in the cached data, with ana_ctrls_lock
+ * held. *need is set if admin commands must be sent first.
+ */
+static int get_cached_ana_state(struct ana_ctrl *ac, __u32 nsid,
+				const struct timespec *now, int *need)
+{
+	__u32 anagrpid = 0;
+	int rc, idx = -1;
+
+	*need = ANA_NEED_NOTHING;
+	if (timespeccmp(now, &ac->expires) >= 0) {
+		*need = ANA_NEED_LOG;
+		return 0;
+	}
+	if (ac->log.status < 0)
+		return ac->log.status;
+
+	if (ac->log.is_anagrpid_const) {
+		idx = find_ana_grp(ac, nsid);
+		if (idx < 0) {
+			*need = ANA_NEED_GRPID;
+			return 0;
+		}
+		anagrpid = ac->grps[idx].anagrpid;
+	}
+	rc = get_ana_state(nsid, anagrpid, ac->log.ana_log,
+			   ac->log.ana_log_len);
+	if (rc == -ANA_ERR_GETANAS_NOTFOUND && idx >= 0) {
+		/* the cached group may be stale, ask the controller again */
+		ac->grps[idx] = ac->grps[--ac->nr_grps];
+		*need = ANA_NEED_GRPID;
+	} else if (rc == NVME_ANA_CHANGE)
+		/* transitional state, don't trust the cached log any more */
+		ac->expires = *now;
+	return rc;
+}
+
+static int get_ana_info(struct path * pp)
+{
+	int	rc = 0, need = ANA_NEED_NOTHING, tries;
+	__u32 nsid, anagrpid = 0;
+	char name[NAME_SIZE];
+	struct ana_ctrl *ac;
+	struct ana_log al = { .ana_log = NULL };
+	struct nvme_id_ns ns;
+	struct timespec now;
+
+	nsid = nvme_get_nsid(pp->fd);
+	if (nsid <= 0) {
+		log_nvme_errcode(nsid, pp->dev, "nvme_get_nsid");
+		return -ANA_ERR_GETNSID_FAILED;
+	}
+	get_ana_ctrl_name(pp, name, sizeof(name));
+	get_monotonic_time(&now);
+
+	/* At most: read the log, look up the group, get the state */
+	for (tries = 0; tries < 3; tries++) {
+		pthread_mutex_lock(&ana_ctrls_lock);
+		pthread_cleanup_push(cleanup_mutex, &ana_ctrls_lock);
+		ac = find_ana_ctrl(name, &now);
+		if (!ac)
+			rc = -ANA_ERR_NO_MEMORY;
+		else {
+			if (need == ANA_NEED_LOG)
+				update_ana_ctrl(ac, &al, &now);
+			else if (need == ANA_NEED_GRPID && rc == 0)
+				add_ana_grp(ac, nsid, anagrpid);
+			rc = get_cached_ana_state(ac, nsid, &now, &need);
+		}
+		pthread_cleanup_pop(1);
+
+		if (!ac || need == ANA_NEED_NOTHING)
+			break;
+		if (tries == 2) {
+			/* the controller keeps contradicting the cache */
+			if (rc >= 0)
+				rc = -ANA_ERR_GETANAS_NOTFOUND;
+			break;
+		}
+		if (need == ANA_NEED_LOG)
+			read_ana_log(pp, &al);
+		else {
+			rc = nvme_identify_ns(pp->fd, nsid, 0, &ns);
+			if (rc) {
+				log_nvme_errcode(rc, pp->dev,
+						 "nvme_identify_ns");
+				rc = -ANA_ERR_GETNS_FAILED;
+				break;
+			}
+			anagrpid = le32_to_cpu(ns.anagrpid);
+		}
+	}
+	free(al.ana_log);
 	if (rc >= 0)
 		condlog(4, "%s: ana state = %02x [%s]", pp->dev, rc,
 			aas_print_string(rc));
@@ -7,8 +7,13 @@
 #include "strbuf.h"
 #include "prkey.h"
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
 #include <string.h>
 #include <inttypes.h>
 #include <errno.h>
@@ -64,97 +69,452 @@ int parse_prkey_flags(const char *ptr, uint64_t *prkey, uint8_t *flags)
 	return parse_prkey(ptr, prkey);
 }
 
-static int do_prkey(int fd, char *wwid, char *keystr, int cmd)
+/*
+ * The prkeys file is indexed in memory, and only re-read if it has been
+ * changed by another process. Keys are updated by marking the old line
+ * as deleted and appending a new one. Removing a key appends a "#" line
+ * instead, so that every change makes the file larger, and the size
+ * tells reliably whether it has changed, even if the mtime hasn't. The
+ * file is compacted once it holds more deleted lines than keys, by
+ * writing a new file and renaming it over the old one.
+ */
+#define PRKEY_MIN_BUCKETS 64
+#define PRKEY_COMPACT_MIN 64
+
+struct prkey_entry {
+	struct prkey_entry *next;
+	off_t offset;
+	char keystr[PRKEY_SIZE];
+	char wwid[WWID_SIZE];
+};
+
+struct prkey_index {
+	struct prkey_entry **buckets;
+	unsigned int nr_buckets;
+	unsigned int nr_keys;
+	unsigned int nr_deleted;
+	bool valid;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+};
+
+static pthread_mutex_t prkey_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct prkey_index prkeys;
+
+static unsigned int prkey_hash(const char *wwid)
 {
-	char buf[4097];
-	char *ptr;
-	off_t start = 0;
-	int bytes;
+	unsigned int h = 2166136261U;
 
-	while (1) {
-		if (lseek(fd, start, SEEK_SET) < 0) {
-			condlog(0, "prkey file read lseek failed : %s",
-				strerror(errno));
-			return 1;
+	for (; *wwid; wwid++)
+		h = (h ^ (unsigned char)*wwid) * 16777619U;
+	return h;
+}
+
+static void prkey_index_clear(struct prkey_index *idx)
+{
+	struct prkey_entry *pe, *next;
+	unsigned int i;
+
+	for (i = 0; i < idx->nr_buckets; i++) {
+		for (pe = idx->buckets[i]; pe; pe = next) {
+			next = pe->next;
+			free(pe);
 		}
-		bytes = read(fd, buf, 4096);
-		if (bytes < 0) {
-			if (errno == EINTR || errno == EAGAIN)
-				continue;
-			condlog(0, "failed to read from prkey file : %s",
-				strerror(errno));
-			return 1;
+	}
+	free(idx->buckets);
+	memset(idx, 0, sizeof(*idx));
+}
+
+static void __attribute__((destructor)) free_prkey_index(void)
+{
+	prkey_index_clear(&prkeys);
+}
+
+static struct prkey_entry **
+prkey_index_slot(struct prkey_index *idx, const char *wwid)
+{
+	struct prkey_entry **ppe;
+
+	ppe = &idx->buckets[prkey_hash(wwid) & (idx->nr_buckets - 1)];
+	while (*ppe && strcmp((*ppe)->wwid, wwid))
+		ppe = &(*ppe)->next;
+	return ppe;
+}
+
+static struct prkey_entry *
+prkey_index_find(struct prkey_index *idx, const char *wwid)
+{
+	if (!idx->nr_buckets)
+		return NULL;
+	return *prkey_index_slot(idx, wwid);
+}
+
+static int prkey_index_grow(struct prkey_index *idx)
+{
+	struct prkey_entry **buckets, *pe, *next;
+	unsigned int i, nr, h;
+
+	nr = idx->nr_buckets ? 2 * idx->nr_buckets : PRKEY_MIN_BUCKETS;
+	buckets = calloc(nr, sizeof(*buckets));
+	if (!buckets)
+		return 1;
+	for (i = 0; i < idx->nr_buckets; i++) {
+		for (pe = idx->buckets[i]; pe; pe = next) {
+			next = pe->next;
+			h = prkey_hash(pe->wwid) & (nr - 1);
+			pe->next = buckets[h];
+			buckets[h] = pe;
 		}
-		if (!bytes) {
-			ptr = NULL;
+	}
+	free(idx->buckets);
+	idx->buckets = buckets;
+	idx->nr_buckets = nr;
+	return 0;
+}
+
+static struct prkey_entry *
+prkey_index_add(struct prkey_index *idx, const char *wwid,
+		const char *keystr, off_t offset)
+{
+	struct prkey_entry *pe, **ppe;
+
+	if (idx->nr_keys >= idx->nr_buckets && prkey_index_grow(idx))
+		return NULL;
+	ppe = prkey_index_slot(idx, wwid);
+	if (*ppe)
+		return *ppe;
+	pe = calloc(1, sizeof(*pe));
+	if (!pe)
+		return NULL;
+	strlcpy(pe->wwid, wwid, sizeof(pe->wwid));
+	strlcpy(pe->keystr, keystr, sizeof(pe->keystr));
+	pe->offset = offset;
+	*ppe = pe;
+	idx->nr_keys++;
+	return pe;
+}
+
+static void prkey_index_del(struct prkey_index *idx, const char *wwid)
+{
+	struct prkey_entry **ppe, *pe;
+
+	if (!idx->nr_buckets)
+		return;
+	ppe = prkey_index_slot(idx, wwid);
+	if (!*ppe)
+		return;
+	pe = *ppe;
+	*ppe = pe->next;
+	free(pe);
+	idx->nr_keys--;
+}
+
+static void prkey_index_stamp(struct prkey_index *idx, const struct stat *st)
+{
+	idx->dev = st->st_dev;
+	idx->ino = st->st_ino;
+	idx->size = st->st_size;
+	idx->mtime = st->st_mtim;
+	idx->valid = true;
+}
+
+static bool prkey_index_current(const struct prkey_index *idx,
+				const struct stat *st)
+{
+	return idx->valid && idx->dev == st->st_dev &&
+		idx->ino == st->st_ino && idx->size == st->st_size &&
+		idx->mtime.tv_sec == st->st_mtim.tv_sec &&
+		idx->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/* Lines look like "<prkey> <wwid>\n". Deleted keys start with '#'. */
+static void prkey_index_parse(struct prkey_index *idx, char *buf, size_t len)
+{
+	char *line, *end, *wwid;
+	off_t offset;
+
+	for (line = buf; line < buf + len; line = end + 1) {
+		end = memchr(line, '\n', buf + len - line);
+		if (!end)
 			break;
+		*end = '\0';
+		offset = line - buf;
+		if (end - line <= PRKEY_SIZE || line[PRKEY_SIZE - 1] != ' ') {
+			if (*line != '#')
+				condlog(1, "malformed prkey file line: '%s'",
+					line);
+			continue;
 		}
-		buf[bytes] = '\0';
-		ptr = strstr(buf, wwid);
-		while (ptr) {
-			if (ptr == buf || *(ptr - 1) != ' ' ||
-			    *(ptr + strlen(wwid)) != '\n')
-				ptr = strstr(ptr + strlen(wwid), wwid);
-			else
-				break;
+		if (*line == '#') {
+			idx->nr_deleted++;
+			continue;
 		}
-		if (ptr) {
-			condlog(3, "found prkey for '%s'", wwid);
-			ptr[strlen(wwid)] = '\0';
-			if (ptr - PRKEY_SIZE < buf ||
-			    (ptr - PRKEY_SIZE != buf &&
-			     *(ptr - PRKEY_SIZE - 1) != '\n')) {
-				condlog(0, "malformed prkey file line for wwid: '%s'", ptr);
-				return 1;
-			}
-			ptr = ptr - PRKEY_SIZE;
-			break;
+		line[PRKEY_SIZE - 1] = '\0';
+		wwid = line + PRKEY_SIZE;
+		if (strlen(wwid) >= WWID_SIZE) {
+			condlog(1, "malformed prkey file line for wwid: '%s'",
+				wwid);
+			continue;
 		}
-		ptr = strrchr(buf, '\n');
-		if (ptr == NULL) {
-			condlog(4, "couldn't file newline, assuming end of file");
-			break;
+		if (prkey_index_find(idx, wwid)) {
+			condlog(1, "duplicate prkey for wwid: '%s'", wwid);
+			continue;
+		}
+		if (!prkey_index_add(idx, wwid, line, offset)) {
+			condlog(0, "failed to index prkey for '%s'", wwid);
+			continue;
 		}
-		start = start + (ptr - buf) + 1;
 	}
-	if (cmd == PRKEY_READ) {
-		if (!ptr || *ptr == '#')
-			return 1;
-		memcpy(keystr, ptr, PRKEY_SIZE - 1);
-		keystr[PRKEY_SIZE - 1] = '\0';
-		return 0;
+}
+
+static int prkey_index_load(struct prkey_index *idx, int fd)
+{
+	struct stat st;
+	char *buf;
+	ssize_t bytes;
+	size_t len = 0;
+
+	if (fstat(fd, &st) < 0) {
+		condlog(0, "cannot stat prkey file : %s", strerror(errno));
+		return 1;
 	}
-	if (!ptr && !keystr)
+	if (prkey_index_current(idx, &st))
 		return 0;
-	if (ptr) {
-		if (lseek(fd, start + (ptr - buf), SEEK_SET) < 0) {
-			condlog(0, "prkey write lseek failed : %s",
+
+	prkey_index_clear(idx);
+	buf = malloc(st.st_size + 1);
+	if (!buf)
+		return 1;
+	while (len < (size_t)st.st_size) {
+		bytes = pread(fd, buf + len, st.st_size - len, len);
+		if (bytes < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			condlog(0, "failed to read from prkey file : %s",
 				strerror(errno));
+			free(buf);
 			return 1;
 		}
+		if (!bytes)
+			break;
+		len += bytes;
 	}
-	if (!keystr) {
-		if (safe_write(fd, "#", 1) < 0) {
-			condlog(0, "failed to write to prkey file : %s",
-				strerror(errno));
-			return 1;
-		}
-		return 0;
+	prkey_index_parse(idx, buf, len);
+	free(buf);
+	/* the size may differ if the file was truncated while reading */
+	st.st_size = len;
+	prkey_index_stamp(idx, &st);
+	condlog(3, "loaded %u prkeys from prkey file", idx->nr_keys);
+	return 0;
+}
+
+static int prkey_write_at(int fd, off_t offset, const char *buf, size_t len)
+{
+	if (lseek(fd, offset, SEEK_SET) < 0) {
+		condlog(0, "prkey write lseek failed : %s", strerror(errno));
+		return 1;
 	}
-	if (!ptr) {
-		if (lseek(fd, 0, SEEK_END) < 0) {
-			condlog(0, "prkey write lseek failed : %s",
-				strerror(errno));
-			return 1;
+	if (safe_write(fd, buf, len) < 0) {
+		condlog(0, "failed to write to prkey file : %s",
+			strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Write the keys to a new file and rename it over the old one, so that
+ * readers never see a partially written file. On success, *fd is closed
+ * and replaced by the locked new file.
+ */
+static int prkey_index_compact(struct prkey_index *idx, int *fd)
+{
+	struct prkey_entry *pe;
+	STRBUF_ON_STACK(buf);
+	char tmpname[] = DEFAULT_PRKEYS_FILE ".XXXXXX";
+	struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET, };
+	unsigned int i;
+	int tmp_fd;
+
+	if (append_strbuf_str(&buf, PRKEYS_FILE_HEADER) < 0)
+		return 1;
+	for (i = 0; i < idx->nr_buckets; i++) {
+		for (pe = idx->buckets[i]; pe; pe = pe->next) {
+			pe->offset = get_strbuf_len(&buf);
+			if (print_strbuf(&buf, "%s %s\n",
+					 pe->keystr, pe->wwid) < 0)
+				return 1;
 		}
 	}
-	bytes = sprintf(buf, "%s %s\n", keystr, wwid);
-	if (safe_write(fd, buf, bytes) < 0) {
-		condlog(0, "failed to write to prkey file: %s",
+	tmp_fd = mkstemp(tmpname);
+	if (tmp_fd < 0) {
+		condlog(0, "cannot create temporary prkey file : %s",
 			strerror(errno));
 		return 1;
 	}
+	/* others will wait for this lock as soon as the file is renamed */
+	if (fcntl(tmp_fd, F_SETLK, &lock) < 0) {
+		condlog(0, "cannot lock temporary prkey file : %s",
+			strerror(errno));
+		goto fail;
+	}
+	if (prkey_write_at(tmp_fd, 0, get_strbuf_str(&buf),
+			   get_strbuf_len(&buf)))
+		goto fail;
+	if (fsync(tmp_fd) < 0) {
+		condlog(0, "cannot sync temporary prkey file : %s",
+			strerror(errno));
+		goto fail;
+	}
+	if (rename(tmpname, DEFAULT_PRKEYS_FILE) < 0) {
+		condlog(0, "cannot replace prkey file : %s", strerror(errno));
+		goto fail;
+	}
+	close(*fd);
+	*fd = tmp_fd;
+	condlog(3, "compacted prkey file, dropped %u deleted keys",
+		idx->nr_deleted);
+	idx->nr_deleted = 0;
 	return 0;
+fail:
+	unlink(tmpname);
+	close(tmp_fd);
+	return 1;
+}
+
+static int do_prkey_write(struct prkey_index *idx, int *fd, const char *wwid,
+			  const char *keystr)
+{
+	struct prkey_entry *pe;
+	struct stat st;
+	char line[PRKEY_SIZE + WWID_SIZE + 1];
+	off_t end;
+	int bytes, ret = 0;
+
+	pe = prkey_index_find(idx, wwid);
+	if (pe && keystr && !strcmp(pe->keystr, keystr))
+		return 0;
+	if (!pe && !keystr)
+		return 0;
+	if (pe) {
+		ret = prkey_write_at(*fd, pe->offset, "#", 1);
+		if (ret)
+			goto out;
+		prkey_index_del(idx, wwid);
+		idx->nr_deleted++;
+	}
+	end = lseek(*fd, 0, SEEK_END);
+	if (end < 0) {
+		condlog(0, "prkey write lseek failed : %s", strerror(errno));
+		ret = 1;
+		goto out;
+	}
+	if (keystr)
+		bytes = snprintf(line, sizeof(line), "%s %s\n", keystr, wwid);
+	else
+		/* only to grow the file, see above */
+		bytes = snprintf(line, sizeof(line), "#\n");
+	ret = prkey_write_at(*fd, end, line, bytes);
+	if (ret)
+		goto out;
+	if (keystr && !prkey_index_add(idx, wwid, keystr, end)) {
+		/* the file is correct, just re-read it next time */
+		idx->valid = false;
+		return 0;
+	}
+	if (idx->nr_deleted >= PRKEY_COMPACT_MIN &&
+	    idx->nr_deleted > idx->nr_keys &&
+	    prkey_index_compact(idx, fd)) {
+		/* The old file is intact, but the offsets aren't */
+		idx->valid = false;
+		return 0;
+	}
+out:
+	if (ret || fstat(*fd, &st) < 0)
+		idx->valid = false;
+	else
+		prkey_index_stamp(idx, &st);
+	return ret;
+}
+
+static int do_prkey(int *fd, char *wwid, char *keystr, int cmd)
+{
+	struct prkey_entry *pe;
+	int ret;
+
+	pthread_mutex_lock(&prkey_lock);
+	pthread_cleanup_push(cleanup_mutex, &prkey_lock);
+	ret = prkey_index_load(&prkeys, *fd);
+	if (ret)
+		goto out;
+	if (cmd == PRKEY_WRITE) {
+		ret = do_prkey_write(&prkeys, fd, wwid, keystr);
+		goto out;
+	}
+	pe = prkey_index_find(&prkeys, wwid);
+	if (!pe) {
+		ret = 1;
+		goto out;
+	}
+	condlog(3, "found prkey for '%s'", wwid);
+	strlcpy(keystr, pe->keystr, PRKEY_SIZE);
+out:
+	pthread_cleanup_pop(1);
+	return ret;
+}
+
+/*
+ * Look the key up without opening and locking the prkeys file, if it
+ * hasn't changed since it was last read. Every write makes the file
+ * larger or replaces it, so a stat() is enough to tell.
+ */
+static int lookup_cached_prkey(const char *wwid, char *keystr)
+{
+	struct prkey_entry *pe;
+	struct stat st;
+	int ret = -1;
+
+	if (stat(DEFAULT_PRKEYS_FILE, &st) < 0)
+		return -1;
+
+	pthread_mutex_lock(&prkey_lock);
+	pthread_cleanup_push(cleanup_mutex, &prkey_lock);
+	if (prkey_index_current(&prkeys, &st)) {
+		pe = prkey_index_find(&prkeys, wwid);
+		if (pe) {
+			strlcpy(keystr, pe->keystr, PRKEY_SIZE);
+			ret = 0;
+		} else
+			ret = 1;
+	}
+	pthread_cleanup_pop(1);
+	return ret;
+}
+
+/*
+ * If the file was compacted by another process while open_file() waited
+ * for the lock, the lock is held on the replaced file. Open it again.
+ */
+static int open_prkeys_file(int *can_write)
+{
+	struct stat fd_st, st;
+	int fd, tries;
+
+	for (tries = 0; tries < 3; tries++) {
+		fd = open_file(DEFAULT_PRKEYS_FILE, can_write,
+			       PRKEYS_FILE_HEADER);
+		if (fd < 0 || !*can_write)
+			return fd;
+		if (fstat(fd, &fd_st) < 0 ||
+		    stat(DEFAULT_PRKEYS_FILE, &st) < 0 ||
+		    (fd_st.st_dev == st.st_dev && fd_st.st_ino == st.st_ino))
+			return fd;
+		close(fd);
+	}
+	condlog(0, "prkey file keeps being replaced");
+	return -1;
 }
 
 int get_prkey(struct multipath *mpp, uint64_t *prkey, uint8_t *sa_flags)
@@ -167,18 +527,24 @@ int get_prkey(struct multipath *mpp, uint64_t *prkey, uint8_t *sa_flags)
 	if (!strlen(mpp->wwid))
 		goto out;
 
-	fd = open_file(DEFAULT_PRKEYS_FILE, &unused, PRKEYS_FILE_HEADER);
-	if (fd < 0)
+	ret = lookup_cached_prkey(mpp->wwid, keystr);
+	if (ret > 0)
 		goto out;
-	ret = do_prkey(fd, mpp->wwid, keystr, PRKEY_READ);
-	if (ret)
-		goto out_file;
+	if (ret < 0) {
+		fd = open_prkeys_file(&unused);
+		if (fd < 0) {
+			ret = 1;
+			goto out;
+		}
+		ret = do_prkey(&fd, mpp->wwid, keystr, PRKEY_READ);
+		close(fd);
+		if (ret)
+			goto out;
+	}
 	*sa_flags = 0;
 	if (strchr(keystr, 'X'))
 		*sa_flags = MPATH_F_APTPL_MASK;
 	ret = !!parse_prkey(keystr, prkey);
-out_file:
-	close(fd);
 out:
 	return ret;
 }
@@ -200,7 +566,7 @@ int set_prkey(struct config *conf, struct multipath *mpp, uint64_t prkey,
 		sa_flags &= MPATH_F_APTPL_MASK;
 	}
 
-	fd = open_file(DEFAULT_PRKEYS_FILE, &can_write, PRKEYS_FILE_HEADER);
+	fd = open_prkeys_file(&can_write);
 	if (fd < 0)
 		goto out;
 	if (!can_write) {
@@ -218,10 +584,10 @@ int set_prkey(struct config *conf, struct multipath *mpp, uint64_t prkey,
 		else
 			snprintf(keystr, PRKEY_SIZE, "0x%016" PRIx64, prkey);
 		keystr[PRKEY_SIZE - 1] = '\0';
-		ret = do_prkey(fd, mpp->wwid, keystr, PRKEY_WRITE);
+		ret = do_prkey(&fd, mpp->wwid, keystr, PRKEY_WRITE);
 	}
 	else
-		ret = do_prkey(fd, mpp->wwid, NULL, PRKEY_WRITE);
+		ret = do_prkey(&fd, mpp->wwid, NULL, PRKEY_WRITE);
 	if (ret == 0)
 		select_reservation_key(conf, mpp);
 	if (get_be64(mpp->reservation_key) != prkey)
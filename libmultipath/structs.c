@@ -7,6 +7,7 @@
 #include <libdevmapper.h>
 #include <libudev.h>
 #include <ctype.h>
+#include <urcu/uatomic.h>
 
 #include "checkers.h"
 #include "vector.h"
@@ -161,12 +162,27 @@ uninitialize_path(struct path *pp)
 	}
 }
 
+/* uatomic access only */
+static unsigned long path_free_gen;
+
+/*
+ * Paths are only removed from the pathvec to be freed, and adding paths
+ * changes its size. So if neither this generation nor the size of the
+ * pathvec has changed, it holds the same paths as before.
+ */
+unsigned long get_path_free_gen(void)
+{
+	return uatomic_read(&path_free_gen);
+}
+
 void
 free_path (struct path * pp)
 {
 	if (!pp)
 		return;
 
+	uatomic_inc(&path_free_gen);
+
 	uninitialize_path(pp);
 
 	if (pp->udev) {
@@ -108,6 +108,11 @@ enum marginal_pathgroups_mode {
 	MARGINAL_PATHGROUP_FPIN,
 };
 
+enum marginal_path_detection_mode {
+	MARGINAL_PATH_DETECTION_ACTIVE,
+	MARGINAL_PATH_DETECTION_PASSIVE,
+};
+
 enum flush_states {
 	FLUSH_UNDEF = YNU_UNDEF,
 	FLUSH_DISABLED = YNU_NO,
@@ -345,6 +350,26 @@ struct hd_geometry {
 #define GROUP_ID_UNDEF -1
 
 struct path {
+	/*
+	 * Scheduling and state fields that checkerloop() and check_path()
+	 * read for every path on every tick. They are kept together at the
+	 * start, so that a pass over paths that aren't due touches one cache
+	 * line each, not the identity and descriptive data below. See
+	 * tests/pathlayout.c.
+	 */
+	unsigned int tick;
+	unsigned int checkint;
+	int state;
+	int chkrstate;
+	int dmstate;
+	int initialized;
+	int priority;
+	int offline;
+	int marginal;
+	bool is_checked;
+	bool check_urgent;
+	struct multipath * mpp;
+
 	char dev[FILE_NAME_SIZE];
 	char dev_t[BLK_DEV_SIZE];
 	struct udev_device *udev;
@@ -358,15 +383,8 @@ struct path {
 	char tgt_node_name[NODE_NAME_SIZE];
 	char *vpd_data;
 	unsigned long long size;
-	unsigned int checkint;
-	unsigned int tick;
 	int bus;
-	int offline;
-	int state;
-	int dmstate;
-	int chkrstate;
 	int failcount;
-	int priority;
 	int pgindex;
 	int detect_prio;
 	int detect_checker;
@@ -374,9 +392,7 @@ struct path {
 	const char *uid_attribute;
 	struct prio prio;
 	struct checker checker;
-	struct multipath * mpp;
 	int fd;
-	int initialized;
 	int retriggers;
 	int partial_retrigger_delay;
 	unsigned int path_failures;
@@ -387,14 +403,21 @@ struct path {
 	int io_err_disable_reinstate;
 	int io_err_pathfail_cnt;
 	int io_err_pathfail_starttime;
+	/* counters at the start of the passive sample window */
+	time_t io_sample_start;
+	unsigned long long io_sample_ios;
+	unsigned long long io_sample_ticks;
+	unsigned long long io_sample_errs;
+	/* IO counters at the last path check, for skip_probe_on_io */
+	int chk_io_valid;
+	unsigned long long chk_io_ios;
+	unsigned long long chk_io_errs;
 	int find_multipaths_timeout;
-	int marginal;
 	int vpd_vendor_id;
 	int recheck_wwid;
 	int fast_io_fail;
 	unsigned int dev_loss;
 	int eh_deadline;
-	bool is_checked;
 	bool can_use_env_uid;
 	unsigned int checker_timeout;
 	/* configlet pointers */
@@ -473,6 +496,9 @@ struct multipath {
 	/* threads */
 	pthread_t waiter;
 
+	/* generation of the last state change, see map_state_changed() */
+	uint64_t state_gen;
+
 	/* stats */
 	unsigned int stat_switchgroup;
 	unsigned int stat_path_failures;
@@ -540,6 +566,7 @@ struct multipath * alloc_multipath (void);
 void *set_mpp_hwe(struct multipath *mpp, const struct path *pp);
 void uninitialize_path(struct path *pp);
 void free_path (struct path *);
+unsigned long get_path_free_gen(void);
 void free_pathvec (vector vec, enum free_path_mode free_paths);
 void free_pathgroup (struct pathgroup * pgp, enum free_path_mode free_paths);
 void free_pgvec (vector pgvec, enum free_path_mode free_paths);
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <libudev.h>
 
 #include "util.h"
@@ -526,10 +527,92 @@ void sync_paths(struct multipath *mpp, vector pathvec)
 		pp->mpp = mpp;
 }
 
+/*
+ * Source of mpp->state_gen. It is seeded from the wall clock (in us), so
+ * that generations handed out by a restarted daemon are larger than
+ * those of the previous instance. Only changed with the vecs lock held.
+ */
+static uint64_t map_state_gen;
+
+void map_state_changed(struct multipath *mpp)
+{
+	if (map_state_gen == 0) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		map_state_gen = (uint64_t)ts.tv_sec * 1000000 +
+			ts.tv_nsec / 1000;
+	}
+	mpp->state_gen = ++map_state_gen;
+}
+
+uint64_t get_map_state_gen(void)
+{
+	return map_state_gen;
+}
+
+int get_changed_maps(const struct _vector *mpvec, uint64_t since,
+		     vector changed)
+{
+	struct multipath *mpp;
+	int i;
+
+	if (since == 0 || since > map_state_gen)
+		return 1;
+
+	vector_foreach_slot(mpvec, mpp, i) {
+		if (mpp->state_gen <= since)
+			continue;
+		if (!vector_alloc_slot(changed))
+			return -1;
+		vector_set_slot(changed, mpp);
+	}
+	return 0;
+}
+
+static uint64_t hash_str(uint64_t h, const char *str)
+{
+	/* FNV-1a */
+	for (; str && *str; str++)
+		h = (h ^ (unsigned char)*str) * 0x100000001b3ULL;
+	return h;
+}
+
+static uint64_t hash_int(uint64_t h, int val)
+{
+	return (h ^ (unsigned int)val) * 0x100000001b3ULL;
+}
+
+/*
+ * Fingerprint of the map state that update_multipath_strings() reads
+ * from the kernel, to tell whether it has changed.
+ */
+static uint64_t dm_state_hash(const struct multipath *mpp)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	struct pathgroup *pgp;
+	struct path *pp;
+	int i, j;
+
+	h = hash_str(h, mpp->features);
+	h = hash_str(h, mpp->hwhandler);
+	h = hash_int(h, mpp->queuedio);
+	vector_foreach_slot(mpp->pg, pgp, i) {
+		h = hash_int(h, pgp->status);
+		vector_foreach_slot(pgp->paths, pp, j) {
+			h = hash_str(h, pp->dev_t);
+			h = hash_int(h, pp->dmstate);
+			h = hash_int(h, pp->failcount);
+		}
+	}
+	return h;
+}
+
 int
 update_multipath_strings(struct multipath *mpp, vector pathvec)
 {
 	struct pathgroup *pgp;
+	uint64_t old_hash;
 	int i, r = DMP_ERR;
 
 	if (!mpp)
@@ -538,13 +621,16 @@ update_multipath_strings(struct multipath *mpp, vector pathvec)
 	update_mpp_paths(mpp, pathvec);
 	condlog(4, "%s: %s", mpp->alias, __FUNCTION__);
 
+	old_hash = dm_state_hash(mpp);
 	free_multipath_attributes(mpp);
 	free_pgvec(mpp->pg, KEEP_PATHS);
 	mpp->pg = NULL;
 
 	r = update_multipath_table(mpp, pathvec, 0);
-	if (r != DMP_OK)
+	if (r != DMP_OK) {
+		map_state_changed(mpp);
 		return r;
+	}
 
 	sync_paths(mpp, pathvec);
 
@@ -552,6 +638,8 @@ update_multipath_strings(struct multipath *mpp, vector pathvec)
 		if (pgp->paths)
 			path_group_prio_update(pgp);
 
+	if (dm_state_hash(mpp) != old_hash)
+		map_state_changed(mpp);
 	return DMP_OK;
 }
 
@@ -575,6 +663,7 @@ static void enter_recovery_mode(struct multipath *mpp)
 	mpp->in_recovery = true;
 	mpp->stat_queueing_timeouts++;
 	mpp->retry_tick = mpp->no_path_retry * checkint + 1;
+	map_state_changed(mpp);
 	condlog(1, "%s: Entering recovery mode: max_retries=%d",
 		mpp->alias, mpp->no_path_retry);
 }
@@ -585,6 +674,8 @@ static void leave_recovery_mode(struct multipath *mpp)
 
 	mpp->in_recovery = false;
 	mpp->retry_tick = 0;
+	if (recovery)
+		map_state_changed(mpp);
 
 	/*
 	 * in_recovery is only ever set if mpp->no_path_retry > 0
@@ -20,6 +20,16 @@ void set_path_removed(struct path *pp);
 int verify_paths(struct multipath *mpp);
 int update_mpp_paths(struct multipath * mpp, vector pathvec);
 int update_multipath_strings (struct multipath *mpp, vector pathvec);
+
+void map_state_changed(struct multipath *mpp);
+uint64_t get_map_state_gen(void);
+/*
+ * Add the maps from mpvec whose state has changed after generation since
+ * to changed. Returns 0 on success, 1 if since is 0 or unknown (the caller
+ * must use all maps), and -1 on error.
+ */
+int get_changed_maps(const struct _vector *mpvec, uint64_t since,
+		     vector changed);
 void extract_hwe_from_path(struct multipath * mpp);
 
 void remove_map (struct multipath *mpp, vector pathvec, vector mpvec);
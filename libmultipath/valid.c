@@ -290,9 +290,12 @@ static int is_device_in_use(struct udev_device *udevice)
 	return used;
 }
 
+/*
+ * If wwids is not NULL, it's used instead of reading the wwids file.
+ */
 int
-is_path_valid(const char *name, struct config *conf, struct path *pp,
-	      bool check_multipathd)
+is_path_valid_wwids(const char *name, struct config *conf, struct path *pp,
+		    bool check_multipathd, const struct wwids_index *wwids)
 {
 	int r;
 	int fd;
@@ -357,7 +360,8 @@ is_path_valid(const char *name, struct config *conf, struct path *pp,
 	if (conf->find_multipaths == FIND_MULTIPATHS_GREEDY)
 		return PATH_IS_VALID;
 
-	if (check_wwids_file(pp->wwid, 0) == 0)
+	if ((wwids ? lookup_wwids_index(wwids, pp->wwid) :
+	     check_wwids_file(pp->wwid, 0)) == 0)
 		return PATH_IS_VALID_NO_CHECK;
 
 	if (dm_map_present_by_uuid(pp->wwid) == 1)
@@ -370,3 +374,60 @@ is_path_valid(const char *name, struct config *conf, struct path *pp,
 
 	return PATH_IS_MAYBE_VALID;
 }
+
+int
+is_path_valid(const char *name, struct config *conf, struct path *pp,
+	      bool check_multipathd)
+{
+	return is_path_valid_wwids(name, conf, pp, check_multipathd, NULL);
+}
+
+/*
+ * Ask multipathd for the is_path_valid() result of a path, evaluated
+ * with the daemon's configuration. On success, pp->wwid and
+ * pp->find_multipaths_timeout are set, and *nr_others is set to the
+ * number of other paths with the same WWID that multipathd knows of.
+ * Returns PATH_IS_ERROR if multipathd couldn't answer, e.g. because it
+ * isn't running or doesn't support the "valid path" command, if it
+ * couldn't read the WWID, which may only be in the uevent environment
+ * of the caller, or if the result depends on other devices that only
+ * a sysfs scan by the caller can find.
+ */
+int
+is_path_valid_by_daemon(const char *name, struct path *pp, int *nr_others)
+{
+	char cmd[FILE_NAME_SIZE + sizeof("valid path ")];
+	char *reply = NULL;
+	int fd, n, tmo, r = PATH_IS_ERROR;
+
+	if (!pp || !name || !nr_others ||
+	    safe_sprintf(cmd, "valid path %s", name))
+		return PATH_IS_ERROR;
+
+	fd = mpath_connect();
+	if (fd == -1)
+		return PATH_IS_ERROR;
+
+	if (mpath_process_cmd(fd, cmd, &reply, DEFAULT_REPLY_TIMEOUT) != 0 ||
+	    reply == NULL)
+		goto out;
+	if (!strcmp(reply, "no wwid\n")) {
+		condlog(4, "%s: multipathd can't read the WWID", name);
+		goto out;
+	}
+	/* "<result> <find_multipaths_timeout> <nr_others> [<wwid>]" */
+	n = sscanf(reply, "%d %d %d %127s", &r, &tmo, nr_others, pp->wwid);
+	if (n < 3 || r <= PATH_IS_ERROR || r >= PATH_MAX_VALID_RESULT) {
+		condlog(3, "%s: unexpected reply from multipathd: %s",
+			name, reply);
+		r = PATH_IS_ERROR;
+	} else if (r == PATH_IS_MAYBE_VALID && *nr_others < 0) {
+		condlog(4, "%s: multipathd knows no other paths", name);
+		r = PATH_IS_ERROR;
+	} else
+		pp->find_multipaths_timeout = tmo;
+out:
+	free(reply);
+	mpath_disconnect(fd);
+	return r;
+}
@@ -36,7 +36,14 @@ enum is_path_valid_result {
 	PATH_MAX_VALID_RESULT, /* only for bounds checking */
 };
 
+struct wwids_index;
+
 int is_path_valid(const char *name, struct config *conf, struct path *pp,
 		  bool check_multipathd);
+int is_path_valid_wwids(const char *name, struct config *conf,
+			struct path *pp, bool check_multipathd,
+			const struct wwids_index *wwids);
+int is_path_valid_by_daemon(const char *name, struct path *pp,
+			    int *nr_others);
 
 #endif /* _VALID_D */
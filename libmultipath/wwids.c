@@ -86,6 +86,80 @@ write_out_wwid(int fd, char *wwid) {
 	return 1;
 }
 
+/*
+ * A sorted in-memory copy of the wwids file, for callers that look up
+ * many WWIDs at once and don't write to the file.
+ */
+struct wwids_index {
+	vector wwids;
+};
+
+static int cmp_wwid(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+void free_wwids_index(struct wwids_index *idx)
+{
+	if (!idx)
+		return;
+	free_strvec(idx->wwids);
+	free(idx);
+}
+
+struct wwids_index *load_wwids_index(void)
+{
+	struct wwids_index *idx;
+	char line[LINE_MAX];
+	char *end, *wwid;
+	FILE *f;
+
+	idx = calloc(1, sizeof(*idx));
+	if (!idx)
+		return NULL;
+	idx->wwids = vector_alloc();
+	if (!idx->wwids)
+		goto fail;
+
+	f = fopen(DEFAULT_WWIDS_FILE, "re");
+	if (!f) {
+		if (errno == ENOENT)
+			return idx;
+		condlog(0, "can't open wwids file : %s", strerror(errno));
+		goto fail;
+	}
+	pthread_cleanup_push(cleanup_fclose, f);
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] != '/' || !(end = strchr(line + 1, '/')) ||
+		    end - line - 1 >= WWID_SIZE)
+			continue;
+		*end = '\0';
+		wwid = strdup(line + 1);
+		if (!wwid || !vector_alloc_slot(idx->wwids)) {
+			free(wwid);
+			break;
+		}
+		vector_set_slot(idx->wwids, wwid);
+	}
+	pthread_cleanup_pop(1);
+	if (VECTOR_SIZE(idx->wwids) > 1)
+		qsort(idx->wwids->slot, VECTOR_SIZE(idx->wwids),
+		      sizeof(char *), cmp_wwid);
+	return idx;
+fail:
+	free_wwids_index(idx);
+	return NULL;
+}
+
+/* Returns 0 if wwid is in the index, -1 otherwise, like check_wwids_file() */
+int lookup_wwids_index(const struct wwids_index *idx, const char *wwid)
+{
+	if (VECTOR_SIZE(idx->wwids) == 0)
+		return -1;
+	return bsearch(&wwid, idx->wwids->slot, VECTOR_SIZE(idx->wwids),
+		       sizeof(char *), cmp_wwid) ? 0 : -1;
+}
+
 int
 replace_wwids(vector mp)
 {
@@ -18,6 +18,11 @@ int check_wwids_file(char *wwid, int write_wwid);
 int remove_wwid(char *wwid);
 int replace_wwids(vector mp);
 
+struct wwids_index;
+struct wwids_index *load_wwids_index(void);
+void free_wwids_index(struct wwids_index *idx);
+int lookup_wwids_index(const struct wwids_index *idx, const char *wwid);
+
 enum {
 	WWID_IS_NOT_FAILED = 0,
 	WWID_IS_FAILED,
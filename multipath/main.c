@@ -70,7 +70,8 @@
 enum {
 	RTVL_OK = 0,
 	RTVL_FAIL = 1,
-	RTVL_RETRY, /* returned by configure(), not by main() */
+	RTVL_RETRY, /* returned by configure() and
+		     * check_path_valid_by_daemon(), not by main() */
 };
 
 static int
@@ -386,29 +387,26 @@ retry:
 	return FIND_MULTIPATHS_WAITING;
 }
 
-static int print_cmd_valid(int k, const vector pathvec,
-			   struct config *conf)
+/*
+ * pp is the path to examine. It may only be NULL if k is not
+ * PATH_IS_MAYBE_VALID. For PATH_IS_MAYBE_VALID, the caller must have
+ * set pp->find_multipaths_timeout.
+ */
+static int print_valid_result(int k, struct path *pp)
 {
 	int wait = FIND_MULTIPATHS_NEVER;
 	struct timespec until;
-	struct path *pp;
 
 	if (k != PATH_IS_VALID && k != PATH_IS_NOT_VALID &&
 	    k != PATH_IS_MAYBE_VALID)
 		return PATH_IS_NOT_VALID;
 
 	if (k == PATH_IS_MAYBE_VALID) {
-		/*
-		 * Caller ensures that pathvec[0] is the path to
-		 * examine.
-		 */
-		pp = VECTOR_SLOT(pathvec, 0);
-		select_find_multipaths_timeout(conf, pp);
 		wait = find_multipaths_check_timeout(
 			pp, pp->find_multipaths_timeout, &until);
 		if (wait != FIND_MULTIPATHS_WAITING)
 			k = PATH_IS_NOT_VALID;
-	} else if (pathvec != NULL && (pp = VECTOR_SLOT(pathvec, 0)))
+	} else if (pp != NULL)
 		wait = find_multipaths_check_timeout(pp, 0, &until);
 	if (wait == FIND_MULTIPATHS_WAITING)
 		printf("FIND_MULTIPATHS_WAIT_UNTIL=\"%ld.%06ld\"\n",
@@ -421,6 +419,17 @@ static int print_cmd_valid(int k, const vector pathvec,
 	return k == PATH_IS_NOT_VALID ? PATH_IS_NOT_VALID : PATH_IS_VALID;
 }
 
+static int print_cmd_valid(int k, const vector pathvec,
+			   struct config *conf)
+{
+	/* Caller ensures that pathvec[0] is the path to examine. */
+	struct path *pp = VECTOR_SLOT(pathvec, 0);
+
+	if (k == PATH_IS_MAYBE_VALID)
+		select_find_multipaths_timeout(conf, pp);
+	return print_valid_result(k, pp);
+}
+
 /*
  * Returns true if this device has been handled before,
  * and released to systemd.
@@ -597,35 +606,29 @@ out:
 	return r;
 }
 
+/*
+ * The part of the path validity check that depends on the environment
+ * of the multipath process rather than on the configuration: whether
+ * the device was released to systemd before, and whether it's in use.
+ * Takes the result of is_path_valid() and returns the updated result,
+ * or PATH_IS_ERROR.
+ */
 static int
-check_path_valid(const char *name, struct config *conf, bool is_uevent)
+check_path_valid_local(const char *name, struct path *pp, int r)
 {
-	int fd, r = PATH_IS_ERROR;
-	struct path *pp;
-	vector pathvec = NULL;
-	const char *wwid;
-
-	pp = alloc_path();
-	if (!pp)
-		return RTVL_FAIL;
-	if (is_uevent)
-		pp->can_use_env_uid = true;
-
-	r = is_path_valid(name, conf, pp, is_uevent);
-	if (r <= PATH_IS_ERROR || r >= PATH_MAX_VALID_RESULT)
-		goto fail;
+	int fd;
 
 	/* set path values if is_path_valid() didn't */
 	if (!pp->udev)
 		pp->udev = udev_device_new_from_subsystem_sysname(udev, "block",
 								  name);
 	if (!pp->udev)
-		goto fail;
+		return PATH_IS_ERROR;
 
 	if (!strlen(pp->dev_t)) {
 		dev_t devt = udev_device_get_devnum(pp->udev);
 		if (major(devt) == 0 && minor(devt) == 0)
-			goto fail;
+			return PATH_IS_ERROR;
 		snprintf(pp->dev_t, BLK_DEV_SIZE, "%d:%d", major(devt),
 			 minor(devt));
 	}
@@ -639,7 +642,7 @@ check_path_valid(const char *name, struct config *conf, bool is_uevent)
 		r = PATH_IS_VALID;
 
 	if (r != PATH_IS_MAYBE_VALID)
-		goto out;
+		return r;
 
 	/*
 	 * If opening the path with O_EXCL fails, the path
@@ -665,8 +668,33 @@ check_path_valid(const char *name, struct config *conf, bool is_uevent)
 			r = PATH_IS_VALID;
 		else
 			r = PATH_IS_NOT_VALID;
-		goto out;
 	}
+	return r;
+}
+
+static int
+check_path_valid(const char *name, struct config *conf, bool is_uevent)
+{
+	int r = PATH_IS_ERROR;
+	struct path *pp;
+	vector pathvec = NULL;
+	const char *wwid;
+
+	pp = alloc_path();
+	if (!pp)
+		return RTVL_FAIL;
+	if (is_uevent)
+		pp->can_use_env_uid = true;
+
+	r = is_path_valid(name, conf, pp, is_uevent);
+	if (r <= PATH_IS_ERROR || r >= PATH_MAX_VALID_RESULT)
+		goto fail;
+
+	r = check_path_valid_local(name, pp, r);
+	if (r == PATH_IS_ERROR)
+		goto fail;
+	if (r != PATH_IS_MAYBE_VALID)
+		goto out;
 
 	pathvec = vector_alloc();
 	if (!pathvec)
@@ -715,6 +743,78 @@ cleanup:
 	return r;
 }
 
+/*
+ * "multipath -u" is run for every block device uevent. If multipathd is
+ * running, let it evaluate the path from its in-memory configuration
+ * and path list, so that multipath.conf doesn't need to be parsed here.
+ * Returns RTVL_RETRY if multipathd didn't answer.
+ */
+static int
+check_path_valid_by_daemon(const char *name)
+{
+	int r, nr_others = 0;
+	struct path *pp;
+
+	pp = alloc_path();
+	if (!pp)
+		return RTVL_RETRY;
+
+	r = is_path_valid_by_daemon(name, pp, &nr_others);
+	if (r == PATH_IS_ERROR) {
+		free_path(pp);
+		return RTVL_RETRY;
+	}
+	if (safe_sprintf(pp->dev, "%s", name))
+		r = PATH_IS_ERROR;
+	else
+		r = check_path_valid_local(name, pp, r);
+
+	if (r == PATH_IS_ERROR)
+		r = RTVL_FAIL;
+	else {
+		/* same as the path_discovery() check in check_path_valid() */
+		if (r == PATH_IS_MAYBE_VALID && nr_others > 0)
+			r = PATH_IS_VALID;
+		else if (r != PATH_IS_MAYBE_VALID) {
+			free_path(pp);
+			pp = NULL;
+		}
+		print_valid_result(r, pp);
+		/* multipath -u must exit with status 0, see above */
+		r = RTVL_OK;
+	}
+	free_path(pp);
+	return r;
+}
+
+/*
+ * Return the device argument if the command line is "multipath -u <dev>",
+ * optionally with -v, and NULL otherwise.
+ */
+static char *
+get_uevent_valid_path_arg(int argc, char *argv[])
+{
+	char *dev = NULL;
+	bool uevent = false;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-u"))
+			uevent = true;
+		else if (!strncmp(argv[i], "-v", 2)) {
+			const char *lvl = argv[i][2] ? &argv[i][2] : argv[++i];
+
+			if (!lvl || !isdigit(lvl[0]))
+				return NULL;
+			libmp_verbosity = atoi(lvl);
+		} else if (argv[i][0] == '-' || dev)
+			return NULL;
+		else
+			dev = argv[i];
+	}
+	return uevent ? dev : NULL;
+}
+
 static int
 get_dev_type(char *dev) {
 	struct stat buf;
@@ -834,6 +934,18 @@ main (int argc, char *argv[])
 	if (atexit(dm_lib_exit) || atexit(libmultipath_exit))
 		condlog(1, "failed to register cleanup handler for libmultipath: %m");
 	logsink = LOGSINK_STDERR_WITH_TIME;
+
+	if (getuid() == 0 && (dev = get_uevent_valid_path_arg(argc, argv))) {
+		openlog("multipath", 0, LOG_DAEMON);
+		setlogmask(LOG_UPTO(libmp_verbosity + 3));
+		logsink = LOGSINK_SYSLOG;
+		r = check_path_valid_by_daemon(convert_dev(dev, false));
+		if (r != RTVL_RETRY)
+			exit(r);
+		dev = NULL;
+		logsink = LOGSINK_STDERR_WITH_TIME;
+	}
+
 	if (init_config(DEFAULT_CONFIGFILE))
 		exit(RTVL_FAIL);
 	if (atexit(uninit_config))
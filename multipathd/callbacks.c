@@ -19,6 +19,8 @@ void init_handler_callbacks(void)
 			     HANDLER(cli_list_maps_topology));
 	set_handler_callback(VRB_LIST | Q1_TOPOLOGY, HANDLER(cli_list_maps_topology));
 	set_handler_callback(VRB_LIST | Q1_MAPS | Q2_JSON, HANDLER(cli_list_maps_json));
+	set_handler_callback(VRB_LIST | Q1_MAPS | Q2_JSON | Q3_SINCE,
+			     HANDLER(cli_list_maps_json_since));
 	set_handler_callback(VRB_LIST | Q1_MAP | Q2_TOPOLOGY,
 			     HANDLER(cli_list_map_topology));
 	set_handler_callback(VRB_LIST | Q1_MAP | Q2_FMT, HANDLER(cli_list_map_fmt));
@@ -69,4 +71,6 @@ void init_handler_callbacks(void)
 	set_handler_callback(VRB_UNSETMARGINAL | Q1_PATH, HANDLER(cli_unset_marginal));
 	set_handler_callback(VRB_UNSETMARGINAL | Q1_MAP,
 			     HANDLER(cli_unset_all_marginal));
+	set_unlocked_handler_callback(VRB_SUBSCRIBE, HANDLER(cli_subscribe));
+	set_unlocked_handler_callback(VRB_VALID | Q1_PATH, HANDLER(cli_valid_path));
 }
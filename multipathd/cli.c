@@ -224,6 +224,9 @@ load_keys (void)
 	r += add_key(keys, "setmarginal", VRB_SETMARGINAL, 0);
 	r += add_key(keys, "unsetmarginal", VRB_UNSETMARGINAL, 0);
 	r += add_key(keys, "all", KEY_ALL, 0);
+	r += add_key(keys, "subscribe", VRB_SUBSCRIBE, 0);
+	r += add_key(keys, "valid", VRB_VALID, 0);
+	r += add_key(keys, "since", KEY_SINCE, 1);
 
 
 	if (r) {
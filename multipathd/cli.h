@@ -38,6 +38,8 @@ enum {
 	VRB_UNSETMARGINAL	= 23,
 	VRB_SHUTDOWN		= 24,
 	VRB_QUIT		= 25,
+	VRB_SUBSCRIBE		= 26,
+	VRB_VALID		= 27,
 
 	/* Qualifiers, values must be different from verbs */
 	KEY_PATH		= 65,
@@ -59,6 +61,7 @@ enum {
 	KEY_LOCAL		= 81,
 	KEY_GROUP		= 82,
 	KEY_KEY			= 83,
+	KEY_SINCE		= 84,
 };
 
 /*
@@ -94,6 +97,7 @@ enum {
 
 	/* byte 3: qualifier 3 */
 	Q3_FMT			= KEY_FMT << 24,
+	Q3_SINCE		= KEY_SINCE << 24,
 };
 
 #define INITIAL_REPLY_LEN	1200
@@ -31,6 +31,8 @@
 #include "foreign.h"
 #include "strbuf.h"
 #include "cli_handlers.h"
+#include "events.h"
+#include "valid.h"
 
 static int
 show_paths (struct strbuf *reply, struct vectors *vecs, char *style, int pretty)
@@ -167,6 +169,7 @@ reset_stats(struct multipath * mpp)
 	mpp->stat_total_queueing_time = 0;
 	mpp->stat_queueing_timeouts = 0;
 	mpp->stat_map_failures = 0;
+	map_state_changed(mpp);
 }
 
 static int
@@ -307,6 +310,53 @@ cli_list_maps_json (void *v, struct strbuf *reply, void *data)
 	return show_maps_json(reply, vecs);
 }
 
+/*
+ * Only print the maps whose state has changed after the given generation.
+ * Generation 0, or one that this daemon hasn't handed out, gets all maps.
+ */
+static int
+cli_list_maps_json_since (void *v, struct strbuf *reply, void *data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	char * param = get_keyparam(v, KEY_SINCE);
+	struct multipath * mpp;
+	unsigned long long since;
+	vector changed;
+	char *end;
+	int i, r;
+	bool full;
+
+	errno = 0;
+	since = strtoull(param, &end, 10);
+	if (*param == '\0' || *end != '\0' || errno)
+		return 1;
+
+	condlog(4, "list multipaths json since %llu (operator)", since);
+
+	full = since == 0 || since > get_map_state_gen();
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		if (!full && mpp->state_gen <= since)
+			continue;
+		if (update_multipath(vecs, mpp->alias, 0))
+			return 1;
+	}
+
+	changed = vector_alloc();
+	if (!changed)
+		return 1;
+	r = get_changed_maps(vecs->mpvec, since, changed);
+	if (r == -1)
+		r = 1;
+	else if (snprint_multipath_delta_json(reply, vecs,
+					      full ? vecs->mpvec : changed,
+					      get_map_state_gen(), full) < 0)
+		r = 1;
+	else
+		r = 0;
+	vector_free(changed);
+	return r;
+}
+
 static int
 cli_list_wildcards (void *v, struct strbuf *reply, void *data)
 {
@@ -944,6 +994,7 @@ cli_restore_queueing(void *v, struct strbuf *reply, void *data)
 	if (mpp->no_path_retry != NO_PATH_RETRY_UNDEF &&
 	    mpp->no_path_retry != NO_PATH_RETRY_FAIL)
 		set_no_path_retry(mpp);
+	map_state_changed(mpp);
 
 	return 0;
 }
@@ -966,6 +1017,7 @@ cli_restore_all_queueing(void *v, struct strbuf *reply, void *data)
 		if (mpp->no_path_retry != NO_PATH_RETRY_UNDEF &&
 		    mpp->no_path_retry != NO_PATH_RETRY_FAIL)
 			set_no_path_retry(mpp);
+		map_state_changed(mpp);
 	}
 	return 0;
 }
@@ -996,6 +1048,7 @@ cli_disable_queueing(void *v, struct strbuf *reply, void *data)
 	mpp->no_path_retry = NO_PATH_RETRY_FAIL;
 	mpp->disable_queueing = 1;
 	set_no_path_retry(mpp);
+	map_state_changed(mpp);
 	return 0;
 }
 
@@ -1014,6 +1067,7 @@ cli_disable_all_queueing(void *v, struct strbuf *reply, void *data)
 		mpp->no_path_retry = NO_PATH_RETRY_FAIL;
 		mpp->disable_queueing = 1;
 		set_no_path_retry(mpp);
+		map_state_changed(mpp);
 	}
 	return 0;
 }
@@ -1021,13 +1075,21 @@ cli_disable_all_queueing(void *v, struct strbuf *reply, void *data)
 static int
 cli_switch_group(void * v, struct strbuf *reply, void * data)
 {
+	struct vectors * vecs = (struct vectors *)data;
 	char * mapname = get_keyparam(v, KEY_MAP);
 	int groupnum = atoi(get_keyparam(v, KEY_GROUP));
+	struct multipath *mpp;
 
 	mapname = convert_dev(mapname, 0);
 	condlog(2, "%s: switch to path group #%i (operator)", mapname, groupnum);
 
-	return dm_switchgroup(mapname, groupnum);
+	if (dm_switchgroup(mapname, groupnum))
+		return 1;
+	mpp = find_mp_by_alias(vecs->mpvec, mapname);
+	if (mpp)
+		map_state_changed(mpp);
+	post_switchgroup_event(mapname, groupnum);
+	return 0;
 }
 
 static int
@@ -1130,6 +1192,7 @@ cli_reinstate(void * v, struct strbuf *reply, void * data)
 		pp->mpp->alias, pp->dev_t);
 
 	checker_enable(&pp->checker);
+	map_state_changed(pp->mpp);
 	return dm_reinstate_path(pp->mpp->alias, pp->dev_t);
 }
 
@@ -1183,6 +1246,7 @@ cli_fail(void * v, struct strbuf *reply, void * data)
 	 */
 	if (!r)
 		checker_disable(&pp->checker);
+	map_state_changed(pp->mpp);
 	return r;
 }
 
@@ -1494,5 +1558,101 @@ static int cli_unset_all_marginal(void * v, struct strbuf *reply, void * data)
 	return reload_and_sync_map(mpp, vecs);
 }
 
+/*
+ * The uxlsnr switches the connection into event streaming mode
+ * after this handler succeeded, see subscribe_client().
+ */
+static int cli_subscribe(void *v, struct strbuf *reply, void *data)
+{
+	condlog(3, "subscribe (operator)");
+	return 0;
+}
+
+/*
+ * Answer "multipath -u" and libmpathvalid from the daemon's state.
+ * The reply is "<result> <find_multipaths_timeout> <nr_others> [<wwid>]",
+ * see is_path_valid_by_daemon(). The checks that depend on the caller's
+ * environment (released to systemd, opened exclusively) are left to
+ * the caller.
+ */
+static int
+cli_valid_path (void * v, struct strbuf *reply, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	char * param = get_keyparam(v, KEY_PATH);
+	char wwid[WWID_SIZE] = "";
+	struct config *conf;
+	struct path *pp, *vpp;
+	int r, i, tmo = 0, nr_others = 0;
+	bool no_wwid;
+
+	param = convert_dev(param, 1);
+	condlog(4, "%s: valid path (operator)", param);
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	lock(&vecs->lock);
+	pthread_testcancel();
+	pp = find_path_by_dev(vecs->pathvec, param);
+	if (pp && pp->mpp)
+		strlcpy(wwid, pp->wwid, sizeof(wwid));
+	lock_cleanup_pop(vecs->lock);
+	if (wwid[0] != '\0')
+		return print_strbuf(reply, "%d 0 0 %s\n",
+				    PATH_IS_VALID_NO_CHECK, wwid) < 0;
+
+	/* pathinfo() may do SG_IO, don't hold vecs->lock */
+	vpp = alloc_path();
+	if (!vpp)
+		return 1;
+
+	conf = get_multipath_config();
+	pthread_cleanup_push(put_multipath_config, conf);
+	r = is_path_valid(param, conf, vpp, false);
+	if (r == PATH_IS_MAYBE_VALID) {
+		select_find_multipaths_timeout(conf, vpp);
+		tmo = vpp->find_multipaths_timeout;
+	}
+	pthread_cleanup_pop(1);
+
+	/*
+	 * The WWID of a new path may only be in the environment of its
+	 * uevent, which multipathd doesn't see. Tell the caller, so that
+	 * it checks the path itself.
+	 */
+	no_wwid = r == PATH_IS_NOT_VALID && vpp->wwid[0] == '\0' &&
+		vpp->uid_attribute && *vpp->uid_attribute;
+	if (no_wwid) {
+		free_path(vpp);
+		return print_strbuf(reply, "no wwid\n") < 0;
+	}
+
+	/*
+	 * Count the other paths with this WWID that multipathd knows of.
+	 * If there are none, other devices with this WWID may just not
+	 * have been added yet. Scanning sysfs for them would block the
+	 * listener, so answer -1 and let the caller scan.
+	 */
+	if (r == PATH_IS_MAYBE_VALID) {
+		pthread_cleanup_push(cleanup_lock, &vecs->lock);
+		lock(&vecs->lock);
+		pthread_testcancel();
+		vector_foreach_slot(vecs->pathvec, pp, i) {
+			if (strcmp(pp->dev, param) &&
+			    !strncmp(pp->wwid, vpp->wwid, WWID_SIZE))
+				nr_others++;
+		}
+		lock_cleanup_pop(vecs->lock);
+		if (nr_others == 0)
+			nr_others = -1;
+	}
+	if (r > PATH_IS_ERROR && r < PATH_MAX_VALID_RESULT)
+		r = print_strbuf(reply, "%d %d %d %s\n", r, tmo, nr_others,
+				 vpp->wwid) < 0;
+	else
+		r = 1;
+	free_path(vpp);
+	return r;
+}
+
 #define HANDLER(x) x
 #include "callbacks.c"
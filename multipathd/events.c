@@ -0,0 +1,164 @@
+/*
+ * Ring buffer of change events for uxlsnr "subscribe" clients
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "config.h"
+#include "debug.h"
+#include "print.h"
+#include "strbuf.h"
+#include "util.h"
+#include "events.h"
+
+#define EVENT_LINE_SIZE 256
+
+struct mpath_event {
+	uint64_t seq;
+	char line[EVENT_LINE_SIZE];
+};
+
+static pthread_mutex_t events_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mpath_event events[EVENT_RING_SIZE];
+/* sequence number of the most recent event, 0 if there was none yet */
+static uint64_t last_seq;
+static int events_fd = -1;
+
+int init_mpath_events(void)
+{
+	int fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+
+	if (fd == -1) {
+		condlog(1, "%s: failed to create eventfd: %m", __func__);
+		return -1;
+	}
+	pthread_mutex_lock(&events_lock);
+	events_fd = fd;
+	pthread_mutex_unlock(&events_lock);
+	return 0;
+}
+
+void cleanup_mpath_events(void)
+{
+	int fd;
+
+	pthread_mutex_lock(&events_lock);
+	fd = events_fd;
+	events_fd = -1;
+	pthread_mutex_unlock(&events_lock);
+	if (fd != -1)
+		close(fd);
+}
+
+int get_mpath_events_fd(void)
+{
+	return events_fd;
+}
+
+void drain_mpath_events_fd(void)
+{
+	uint64_t val;
+
+	if (events_fd != -1 &&
+	    read(events_fd, &val, sizeof(val)) != sizeof(val))
+		condlog(4, "%s: nothing to read", __func__);
+}
+
+uint64_t get_mpath_event_seq(void)
+{
+	uint64_t seq;
+
+	pthread_mutex_lock(&events_lock);
+	seq = last_seq;
+	pthread_mutex_unlock(&events_lock);
+	return seq;
+}
+
+static void post_event(const char *line)
+{
+	struct mpath_event *ev;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&events_lock);
+	ev = &events[++last_seq % EVENT_RING_SIZE];
+	ev->seq = last_seq;
+	strlcpy(ev->line, line, sizeof(ev->line));
+	if (events_fd != -1 &&
+	    write(events_fd, &one, sizeof(one)) != sizeof(one))
+		condlog(3, "%s: failed to wake up listener", __func__);
+	pthread_mutex_unlock(&events_lock);
+	condlog(4, "event %"PRIu64": %s", ev->seq, line);
+}
+
+void post_path_event(const struct path *pp)
+{
+	STRBUF_ON_STACK(buf);
+
+	/* chk_st comes last, it may contain blanks ("i/o pending") */
+	if (snprint_path(&buf, "path %d %m %T", pp, NULL) < 0)
+		return;
+	/* snprint_path() appends a newline */
+	truncate_strbuf(&buf, get_strbuf_len(&buf) - 1);
+	post_event(get_strbuf_str(&buf));
+}
+
+static const char * const map_event_names[] = {
+	[MPATH_EVENT_MAP_ADD] = "add",
+	[MPATH_EVENT_MAP_REMOVE] = "remove",
+	[MPATH_EVENT_MAP_RELOAD] = "reload",
+};
+
+void post_map_event(enum mpath_event_type type, const char *alias)
+{
+	char line[EVENT_LINE_SIZE];
+
+	if (type < MPATH_EVENT_MAP_ADD || type > MPATH_EVENT_MAP_RELOAD ||
+	    !alias)
+		return;
+	snprintf(line, sizeof(line), "%s %s", map_event_names[type], alias);
+	post_event(line);
+}
+
+void post_switchgroup_event(const char *alias, int pgindex)
+{
+	char line[EVENT_LINE_SIZE];
+
+	if (!alias)
+		return;
+	snprintf(line, sizeof(line), "switchgroup %s %d", alias, pgindex);
+	post_event(line);
+}
+
+int print_mpath_events(struct strbuf *buf, uint64_t *seq)
+{
+	int n = 0;
+	int rc = 0;
+
+	pthread_mutex_lock(&events_lock);
+	if (*seq > last_seq)
+		/* daemon restarted, or bogus sequence number */
+		*seq = last_seq;
+	if (last_seq - *seq > EVENT_RING_SIZE) {
+		*seq = last_seq - EVENT_RING_SIZE;
+		rc = print_strbuf(buf, "%"PRIu64" overflow\n", *seq);
+		n++;
+	}
+	while (rc >= 0 && *seq < last_seq) {
+		const struct mpath_event *ev =
+			&events[++(*seq) % EVENT_RING_SIZE];
+
+		rc = print_strbuf(buf, "%"PRIu64" %s\n", ev->seq, ev->line);
+		n++;
+	}
+	pthread_mutex_unlock(&events_lock);
+	return rc < 0 ? -1 : n;
+}
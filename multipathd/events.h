@@ -0,0 +1,44 @@
+#ifndef _EVENTS_H
+#define _EVENTS_H
+
+#include <stdint.h>
+
+struct path;
+struct strbuf;
+
+/*
+ * Change events for "subscribe" clients of the uxlsnr.
+ *
+ * Every event gets a sequence number, starting at 1. The most recent
+ * EVENT_RING_SIZE events are kept; a subscriber that falls further
+ * behind gets an "overflow" event and must resynchronize its state
+ * with a full query.
+ */
+#define EVENT_RING_SIZE 1024
+
+enum mpath_event_type {
+	MPATH_EVENT_PATH_STATE,
+	MPATH_EVENT_MAP_ADD,
+	MPATH_EVENT_MAP_REMOVE,
+	MPATH_EVENT_MAP_RELOAD,
+	MPATH_EVENT_SWITCHGROUP,
+};
+
+int init_mpath_events(void);
+void cleanup_mpath_events(void);
+int get_mpath_events_fd(void);
+void drain_mpath_events_fd(void);
+uint64_t get_mpath_event_seq(void);
+
+void post_path_event(const struct path *pp);
+void post_map_event(enum mpath_event_type type, const char *alias);
+void post_switchgroup_event(const char *alias, int pgindex);
+
+/*
+ * Append all events newer than *seq to buf, one per line, and
+ * advance *seq to the newest event.
+ * Returns the number of events printed, or -1 on error.
+ */
+int print_mpath_events(struct strbuf *buf, uint64_t *seq);
+
+#endif /* _EVENTS_H */
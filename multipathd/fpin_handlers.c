@@ -1,5 +1,7 @@
 #include <errno.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -95,9 +97,6 @@ fpin_unset_marginal_dev(uint32_t host_num, struct vectors *vecs)
 {
 	struct marginal_dev_list *tmp_marg = NULL;
 	struct marginal_dev_list *marg = NULL;
-	struct multipath *mpp;
-	int ret = 0;
-	int i;
 
 	pthread_cleanup_push(cleanup_lock, &vecs->lock);
 	lock(&vecs->lock);
@@ -121,16 +120,7 @@ fpin_unset_marginal_dev(uint32_t host_num, struct vectors *vecs)
 	}
 empty:
 	pthread_cleanup_pop(1);
-	/* walk backwards because reload_and_sync_map() can remove mpp */
-	vector_foreach_slot_backwards(vecs->mpvec, mpp, i) {
-		if (mpp->fpin_must_reload) {
-			ret = reload_and_sync_map(mpp, vecs);
-			if (ret == 2)
-				condlog(2, "map removed during reload");
-			else
-				mpp->fpin_must_reload = false;
-		}
-	}
+	/* the maps are regrouped by fpin_reload_tick() in the checker loop */
 	pthread_cleanup_pop(1);
 }
 
@@ -202,17 +192,40 @@ fpin_add_marginal_dev_info(uint32_t host_num, char *devname)
 }
 
 /*
- * This function compares Transport Address Controller Port pn,
- * Host Transport Address Controller Port pn with the els wwpn ,attached_wwpn
- * and return 1 (match) or 0 (no match) or a negative error code
+ * Index of the FC paths by target port WWPN, so that an FPIN LI frame
+ * doesn't need to look up the remote port of every path in sysfs.
+ * It's only used by the consumer thread, with vecs->lock held.
  */
-static int  extract_nvme_addresses_chk_path_pwwn(const char *address,
-		uint64_t els_wwpn, uint64_t els_attached_wwpn)
+struct fpin_path_port {
+	uint64_t wwpn;
+	uint64_t attached_wwpn;	/* host_traddr, FC-NVMe only */
+	int host_num;		/* SCSI FCP only, -1 for FC-NVMe */
+	struct path *pp;
+};
+
+static struct fpin_path_port *fpin_ports;
+static int fpin_nr_ports;
+/* the pathvec the index was built from, see get_path_free_gen() */
+static bool fpin_index_valid;
+static unsigned long fpin_indexed_gen;
+static int fpin_nr_indexed_paths;
 
+static void fpin_free_path_index(__attribute__((unused)) void *arg)
 {
-	uint64_t traddr;
-	uint64_t host_traddr;
+	free(fpin_ports);
+	fpin_ports = NULL;
+	fpin_nr_ports = 0;
+	fpin_index_valid = false;
+}
 
+/*
+ * This function extracts the Transport Address Controller Port pn and
+ * the Host Transport Address Controller Port pn from the nvme controller
+ * address, and returns 0 on success or a negative error code
+ */
+static int extract_nvme_addresses(const char *address, uint64_t *traddr,
+				  uint64_t *host_traddr)
+{
 	/*
 	 *  Find the position of "traddr=" and "host_traddr="
 	 *  and the address will be in the below format
@@ -226,141 +239,232 @@ static int  extract_nvme_addresses_chk_path_pwwn(const char *address,
 		return -EINVAL;
 
 	/* Extract traddr pn */
-	if (sscanf(traddr_start, "traddr=nn-%*[^:]:pn-%" SCNx64, &traddr) != 1)
+	if (sscanf(traddr_start, "traddr=nn-%*[^:]:pn-%" SCNx64, traddr) != 1)
 		return -EINVAL;
 
 	/* Extract host_traddr pn*/
 	if (sscanf(host_traddr_start, "host_traddr=nn-%*[^:]:pn-%" SCNx64,
-				&host_traddr) != 1)
+				host_traddr) != 1)
 		return -EINVAL;
-	condlog(4, "traddr 0x%" PRIx64 " hosttraddr 0x%" PRIx64 " els_wwpn 0x%"
-		PRIx64" els_host_traddr 0x%" PRIx64,
-			traddr, host_traddr,
-			els_wwpn, els_attached_wwpn);
-	if ((host_traddr == els_attached_wwpn) && (traddr == els_wwpn))
-		return 1;
 	return 0;
 }
 
-/*
- * This function check that the Transport Address Controller Port pn,
- * Host Transport Address Controller Port pn associated with the path matches
- * with the els wwpn ,attached_wwpn and sets the path state to
- * Marginal
- */
-static void fpin_check_set_nvme_path_marginal(uint16_t host_num, struct path *pp,
-		uint64_t els_wwpn, uint64_t attached_wwpn)
+static int fpin_get_nvme_port(struct path *pp, struct fpin_path_port *port)
 {
 	struct udev_device *ctl = NULL;
 	const char *address = NULL;
-	int ret = 0;
 
+	if (!pp->udev)
+		return -ENODEV;
 	ctl = udev_device_get_parent_with_subsystem_devtype(pp->udev, "nvme", NULL);
 	if (ctl == NULL) {
 		condlog(2, "%s: No parent device for ", pp->dev);
-		return;
+		return -ENODEV;
 	}
 	address = udev_device_get_sysattr_value(ctl, "address");
 	if (!address) {
 		condlog(2, "%s: unable to get the address ", pp->dev);
-		return;
+		return -ENODEV;
 	}
 	condlog(4, "\n address %s: dev :%s\n", address, pp->dev);
-	ret = extract_nvme_addresses_chk_path_pwwn(address, els_wwpn, attached_wwpn);
-	if (ret <= 0)
-		return;
-	ret = fpin_add_marginal_dev_info(host_num, pp->dev);
-	if (ret < 0)
-		return;
-	fpin_path_setmarginal(pp);
+	if (extract_nvme_addresses(address, &port->wwpn,
+				   &port->attached_wwpn) < 0)
+		return -EINVAL;
+	port->host_num = -1;
+	return 0;
 }
 
-/*
- * This function check the host  number, the target WWPN
- * associated with the path matches with the els wwpn and
- * sets the path and port state to Marginal
- */
-static void fpin_check_set_scsi_path_marginal(uint16_t host_num, struct path *pp,
-		uint64_t els_wwpn)
+static struct udev_device *fpin_get_rport(const struct path *pp)
 {
 	char rport_id[42];
-	const char *value = NULL;
 	struct udev_device *rport_dev = NULL;
-	uint64_t wwpn;
-	int ret = 0;
+
 	sprintf(rport_id, "rport-%d:%d-%d",
 			pp->sg_id.host_no, pp->sg_id.channel, pp->sg_id.transport_id);
 	rport_dev = udev_device_new_from_subsystem_sysname(udev,
 			"fc_remote_ports", rport_id);
-	if (!rport_dev) {
+	if (!rport_dev)
 		condlog(2, "%s: No fc_remote_port device for '%s'", pp->dev,
 				rport_id);
-		return;
-	}
+	return rport_dev;
+}
+
+static int fpin_get_scsi_port(struct path *pp, struct fpin_path_port *port)
+{
+	const char *value = NULL;
+	struct udev_device *rport_dev = NULL;
+	int ret = -ENODEV;
+
+	rport_dev = fpin_get_rport(pp);
+	if (!rport_dev)
+		return -ENODEV;
 	pthread_cleanup_push(_udev_device_unref, rport_dev);
 	value = udev_device_get_sysattr_value(rport_dev, "port_name");
-	if (!value)
-		goto unref;
-
-	wwpn =  strtol(value, NULL, 16);
-	/*
-	 * If the port wwpn matches sets the path and port state
-	 * to marginal
-	 */
-	if (wwpn == els_wwpn) {
-		ret = fpin_add_marginal_dev_info(host_num, pp->dev);
-		if (ret < 0)
-			goto unref;
-		fpin_path_setmarginal(pp);
-		fpin_set_rport_marginal(rport_dev);
+	if (value) {
+		port->wwpn = strtoull(value, NULL, 16);
+		port->attached_wwpn = 0;
+		port->host_num = pp->sg_id.host_no;
+		ret = 0;
 	}
-unref:
 	pthread_cleanup_pop(1);
-	return;
+	return ret;
+}
+
+static int fpin_port_cmp(const void *a, const void *b)
+{
+	const struct fpin_path_port *pa = a, *pb = b;
+
+	if (pa->wwpn != pb->wwpn)
+		return pa->wwpn < pb->wwpn ? -1 : 1;
+	return 0;
+}
+
+/*
+ * (Re)build the index if the set of paths has changed since the last
+ * time.
+ */
+static int fpin_update_path_index(const struct _vector *pathvec)
+{
+	struct fpin_path_port *ports = NULL;
+	struct path *pp;
+	unsigned long gen = get_path_free_gen();
+	int i, n = 0, nr_paths = VECTOR_SIZE(pathvec);
+
+	if (fpin_index_valid && gen == fpin_indexed_gen &&
+	    nr_paths == fpin_nr_indexed_paths)
+		return 0;
+
+	fpin_free_path_index(NULL);
+	if (nr_paths > 0) {
+		ports = calloc(nr_paths, sizeof(*ports));
+		if (!ports)
+			return -ENOMEM;
+	}
+	vector_foreach_slot(pathvec, pp, i) {
+		int ret;
 
+		/*checks if the bus type is nvme  and the protocol is FC-NVMe*/
+		if ((pp->bus == SYSFS_BUS_NVME) &&
+		    (pp->sg_id.proto_id == NVME_PROTOCOL_FC))
+			ret = fpin_get_nvme_port(pp, &ports[n]);
+		else if ((pp->bus == SYSFS_BUS_SCSI) &&
+			 (pp->sg_id.proto_id == SCSI_PROTOCOL_FCP))
+			ret = fpin_get_scsi_port(pp, &ports[n]);
+		else
+			continue;
+		if (ret == 0)
+			ports[n++].pp = pp;
+	}
+	if (n > 0)
+		qsort(ports, n, sizeof(*ports), fpin_port_cmp);
+	fpin_ports = ports;
+	fpin_nr_ports = n;
+	fpin_indexed_gen = gen;
+	fpin_nr_indexed_paths = nr_paths;
+	fpin_index_valid = true;
+	condlog(4, "fpin: indexed %d of %d paths", n, nr_paths);
+	return 0;
+}
+
+/* Returns the index of the first entry for wwpn, or fpin_nr_ports */
+static int fpin_find_first_port(uint64_t wwpn)
+{
+	int lo = 0, hi = fpin_nr_ports;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (fpin_ports[mid].wwpn < wwpn)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
 }
 
 /*
- * This function goes through the vecs->pathvec, and for
- * each path, it checks and sets the path state to marginal
- * if the path's associated port wwpn ,hostnum  matches with
- * els wwnpn ,attached_wwpn
+ * Stop I/O on a path that has just been set marginal with a DM message,
+ * instead of waiting for the map to be reloaded with the path in a
+ * marginal path group. The regrouping is done later by the checker
+ * loop. The path is only failed if the map keeps another usable path.
+ */
+static void fpin_fail_marginal_path(struct path *pp)
+{
+	struct multipath *mpp = pp->mpp;
+	struct path *pp1;
+	int i;
+
+	if (pp->dmstate == PSTATE_FAILED)
+		return;
+	vector_foreach_slot(mpp->paths, pp1, i) {
+		if (!pp1->marginal && pp1->dmstate == PSTATE_ACTIVE &&
+		    (pp1->state == PATH_UP || pp1->state == PATH_GHOST))
+			break;
+	}
+	if (i == VECTOR_SIZE(mpp->paths)) {
+		condlog(3, "%s: no other usable path, keeping %s active (fpin)",
+			mpp->alias, pp->dev_t);
+		return;
+	}
+	if (dm_fail_path(mpp->alias, pp->dev_t) == 0) {
+		condlog(2, "%s: failed marginal path %s (fpin)",
+			mpp->alias, pp->dev_t);
+		pp->dmstate = PSTATE_FAILED;
+	}
+}
+
+/*
+ * This function looks up the paths whose associated port wwpn, hostnum
+ * (SCSI) or host_traddr (NVMe) match with the els wwpn, attached_wwpn,
+ * sets their state to marginal, and fails them in the kernel
  */
 static int  fpin_chk_wwn_setpath_marginal(uint16_t host_num,  struct vectors *vecs,
 		uint64_t els_wwpn, uint64_t attached_wwpn)
 {
+	struct fpin_path_port *port;
 	struct path *pp;
-	struct multipath *mpp;
-	int i, k;
+	int i;
 	int ret = 0;
 
 	pthread_cleanup_push(cleanup_lock, &vecs->lock);
 	lock(&vecs->lock);
 	pthread_testcancel();
 
-	vector_foreach_slot(vecs->pathvec, pp, k) {
-		if (!pp->mpp)
+	ret = fpin_update_path_index(vecs->pathvec);
+	if (ret < 0)
+		goto unlock;
+	for (i = fpin_find_first_port(els_wwpn);
+	     i < fpin_nr_ports && fpin_ports[i].wwpn == els_wwpn; i++) {
+		port = &fpin_ports[i];
+		pp = port->pp;
+		condlog(4, "%s: wwpn 0x%" PRIx64 " host %d host_traddr 0x%"
+			PRIx64 " els_host_traddr 0x%" PRIx64, pp->dev,
+			port->wwpn, port->host_num, port->attached_wwpn,
+			attached_wwpn);
+		if (!pp->mpp || pp->marginal)
 			continue;
-		/*checks if the bus type is nvme  and the protocol is FC-NVMe*/
-		if ((pp->bus == SYSFS_BUS_NVME) && (pp->sg_id.proto_id == NVME_PROTOCOL_FC)) {
-			fpin_check_set_nvme_path_marginal(host_num, pp, els_wwpn, attached_wwpn);
-		} else if ((pp->bus == SYSFS_BUS_SCSI) &&
-			(pp->sg_id.proto_id == SCSI_PROTOCOL_FCP) &&
-			(host_num ==  pp->sg_id.host_no)) {
-			/* Checks the host number and also for the SCSI FCP */
-			fpin_check_set_scsi_path_marginal(host_num, pp, els_wwpn);
-		}
-	}
-	/* walk backwards because reload_and_sync_map() can remove mpp */
-	vector_foreach_slot_backwards(vecs->mpvec, mpp, i) {
-		if (mpp->fpin_must_reload) {
-			ret = reload_and_sync_map(mpp, vecs);
-			if (ret == 2)
-				condlog(2, "map removed during reload");
-			else
-				mpp->fpin_must_reload = false;
+		if (port->host_num >= 0) {
+			struct udev_device *rport_dev;
+
+			if (port->host_num != host_num)
+				continue;
+			if (fpin_add_marginal_dev_info(host_num, pp->dev) < 0)
+				continue;
+			rport_dev = fpin_get_rport(pp);
+			if (rport_dev) {
+				fpin_set_rport_marginal(rport_dev);
+				udev_device_unref(rport_dev);
+			}
+		} else {
+			if (port->attached_wwpn != attached_wwpn)
+				continue;
+			if (fpin_add_marginal_dev_info(host_num, pp->dev) < 0)
+				continue;
 		}
+		fpin_path_setmarginal(pp);
+		fpin_fail_marginal_path(pp);
 	}
+unlock:
 	pthread_cleanup_pop(1);
 	return ret;
 }
@@ -526,6 +630,7 @@ void *fpin_els_li_consumer(void *data)
 	pthread_cleanup_push(rcu_unregister, NULL);
 	rcu_register_thread();
 	pthread_cleanup_push(fpin_clean_marginal_dev_list, NULL);
+	pthread_cleanup_push(fpin_free_path_index, NULL);
 	INIT_LIST_HEAD(&marginal_list_head);
 	pthread_cleanup_push(fpin_clean_els_marginal_list,
 				(void *)&marginal_list_head);
@@ -565,6 +670,7 @@ void *fpin_els_li_consumer(void *data)
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
 	return NULL;
 }
 
@@ -85,12 +85,12 @@
 #include "foreign.h"
 #include "../third-party/valgrind/drd.h"
 #include "init_unwinder.h"
+#include "events.h"
 
 #define CMDSIZE 160
 #define MSG_SIZE 32
 
 int mpath_pr_event_handle(struct path *pp);
-void * mpath_pr_event_handler_fn (void * );
 
 #define LOG_MSG(lvl, pp)					\
 do {								\
@@ -456,18 +456,27 @@ static void
 switch_pathgroup (struct multipath * mpp)
 {
 	mpp->stat_switchgroup++;
-	dm_switchgroup(mpp->alias, mpp->bestpg);
+	map_state_changed(mpp);
+	/* dm_message() has logged the failure */
+	if (dm_switchgroup(mpp->alias, mpp->bestpg))
+		return;
 	condlog(2, "%s: switch to path group #%i",
 		 mpp->alias, mpp->bestpg);
+	post_switchgroup_event(mpp->alias, mpp->bestpg);
 }
 
 static int
 wait_for_events(struct multipath *mpp, struct vectors *vecs)
 {
+	int r;
+
 	if (poll_dmevents)
-		return watch_dmevents(mpp->alias);
+		r = watch_dmevents(mpp->alias);
 	else
-		return start_waiter_thread(mpp, vecs);
+		r = start_waiter_thread(mpp, vecs);
+	if (!r)
+		post_map_event(MPATH_EVENT_MAP_ADD, mpp->alias);
+	return r;
 }
 
 static void
@@ -476,6 +485,7 @@ remove_map_and_stop_waiter(struct multipath *mpp, struct vectors *vecs)
 	/* devices are automatically removed by the dmevent polling code,
 	 * so they don't need to be manually removed here */
 	condlog(3, "%s: removing map from internal tables", mpp->alias);
+	post_map_event(MPATH_EVENT_MAP_REMOVE, mpp->alias);
 	if (!poll_dmevents)
 		stop_waiter_thread(mpp);
 	remove_map(mpp, vecs->pathvec, vecs->mpvec);
@@ -562,6 +572,8 @@ int update_multipath (struct vectors *vecs, char *mapname, int reset)
 				condlog(2, "%s: mark as failed", pp->dev);
 				mpp->stat_path_failures++;
 				pp->state = PATH_DOWN;
+				map_state_changed(mpp);
+				post_path_event(pp);
 				if (oldstate == PATH_UP ||
 				    oldstate == PATH_GHOST)
 					update_queue_mode_del_path(mpp);
@@ -650,6 +662,8 @@ retry:
 		sleep(1);
 		goto retry;
 	}
+	if (!new_map && retries >= 0)
+		post_map_event(MPATH_EVENT_MAP_RELOAD, mpp->alias);
 
 fail:
 	if (new_map && (retries < 0 || wait_for_events(mpp, vecs))) {
@@ -1328,7 +1342,8 @@ rescan:
 			condlog(0, "%s: giving up reload", mpp->alias);
 		else
 			goto fail_map;
-	}
+	} else if (!start_waiter)
+		post_map_event(MPATH_EVENT_MAP_RELOAD, mpp->alias);
 
 	if ((mpp->action == ACT_CREATE ||
 	     (mpp->action == ACT_NOTHING && start_waiter && !mpp->waiter)) &&
@@ -1457,6 +1472,7 @@ ev_remove_path (struct path *pp, struct vectors * vecs, int need_do_map)
 			char devt[BLK_DEV_SIZE];
 
 			strlcpy(devt, pp->dev_t, sizeof(devt));
+			post_map_event(MPATH_EVENT_MAP_RELOAD, mpp->alias);
 
 			/* setup_multipath will free the path
 			 * regardless of whether it succeeds or
@@ -1552,6 +1568,7 @@ int resize_map(struct multipath *mpp, unsigned long long size,
 		mpp->size = orig_size;
 		return 1;
 	}
+	post_map_event(MPATH_EVENT_MAP_RELOAD, mpp->alias);
 	if (setup_multipath(vecs, mpp) != 0)
 		return 2;
 	sync_map_state(mpp);
@@ -2067,6 +2084,7 @@ deferred_failback_tick (struct vectors *vecs)
 		 */
 		if (mpp->pgfailback > 0 && mpp->failback_tick > 0) {
 			mpp->failback_tick--;
+			map_state_changed(mpp);
 
 			if (!mpp->failback_tick &&
 			    need_switch_pathgroup(mpp, &need_reload)) {
@@ -2079,6 +2097,29 @@ deferred_failback_tick (struct vectors *vecs)
 	}
 }
 
+/*
+ * The fpin consumer thread fails marginal paths right away, but leaves
+ * regrouping the affected maps to the checker loop.
+ */
+static void
+fpin_reload_tick(struct vectors *vecs)
+{
+	struct multipath *mpp;
+	int i;
+
+	/* walk backwards because reload_and_sync_map() can remove mpp */
+	vector_foreach_slot_backwards(vecs->mpvec, mpp, i) {
+		if (!mpp->fpin_must_reload)
+			continue;
+		condlog(3, "%s: regrouping after fpin marginal state change",
+			mpp->alias);
+		if (reload_and_sync_map(mpp, vecs) == 2)
+			condlog(2, "map removed during reload");
+		else
+			mpp->fpin_must_reload = false;
+	}
+}
+
 static void
 retry_count_tick(vector mpvec)
 {
@@ -2088,6 +2129,7 @@ retry_count_tick(vector mpvec)
 	vector_foreach_slot (mpvec, mpp, i) {
 		if (mpp->retry_tick > 0) {
 			mpp->stat_total_queueing_time++;
+			map_state_changed(mpp);
 			condlog(4, "%s: Retrying.. No active path", mpp->alias);
 			if(--mpp->retry_tick == 0) {
 				mpp->stat_map_failures++;
@@ -2176,6 +2218,7 @@ static int reload_map(struct vectors *vecs, struct multipath *mpp,
 			"for reload map", mpp->alias, r);
 		return 1;
 	}
+	post_map_event(MPATH_EVENT_MAP_RELOAD, mpp->alias);
 
 	return 0;
 }
@@ -2289,8 +2332,10 @@ reinstate_path:
 }
 
 static int
-should_skip_path(struct path *pp){
+should_skip_path(struct path *pp, int marginal_path_detection){
 	if (marginal_path_check_enabled(pp->mpp)) {
+		if (marginal_path_detection == MARGINAL_PATH_DETECTION_PASSIVE)
+			return io_err_stat_sample_path(pp);
 		if (pp->io_err_disable_reinstate && need_io_err_check(pp))
 			return 1;
 	} else if (san_path_check_enabled(pp->mpp)) {
@@ -2300,12 +2345,8 @@ should_skip_path(struct path *pp){
 	return 0;
 }
 
-/*
- * Returns '1' if the path has been checked, '-1' if it was blacklisted
- * and '0' otherwise
- */
-int
-check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
+static int
+do_check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 {
 	int newstate;
 	int new_path_up = 0;
@@ -2316,6 +2357,8 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 	unsigned int checkint, max_checkint;
 	struct config *conf;
 	int marginal_pathgroups, marginal_changed = 0;
+	int marginal_path_detection;
+	int skip_probe_on_io, io_progressed = 0;
 	int ret;
 	bool need_reload;
 
@@ -2334,6 +2377,8 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 	checkint = conf->checkint;
 	max_checkint = conf->max_checkint;
 	marginal_pathgroups = conf->marginal_pathgroups;
+	marginal_path_detection = conf->marginal_path_detection;
+	skip_probe_on_io = conf->skip_probe_on_io;
 	put_multipath_config(conf);
 
 	if (pp->checkint == CHECKINT_UNDEF) {
@@ -2380,7 +2425,25 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 	pp->tick = checkint;
 
 	newstate = path_offline(pp);
-	if (newstate == PATH_UP) {
+	/*
+	 * A healthy path that has completed IO since the last check without
+	 * new errors is known to work; don't add a probe to its load.
+	 * path_io_progressed() compares against the counters of its
+	 * previous call, so call it on every check, whatever the path
+	 * state, and forget the counters while the option is off.
+	 */
+	if (skip_probe_on_io == YN_YES)
+		io_progressed = path_io_progressed(pp);
+	else
+		pp->chk_io_valid = 0;
+	if (newstate == PATH_UP && io_progressed &&
+	    (pp->state == PATH_UP || pp->state == PATH_GHOST) &&
+	    pp->dmstate == PSTATE_ACTIVE) {
+		checker_clear_message(&pp->checker);
+		condlog(4, "%s: IO completed since last check, checker not called",
+			pp->dev);
+		newstate = pp->state;
+	} else if (newstate == PATH_UP) {
 		conf = get_multipath_config();
 		pthread_cleanup_push(put_multipath_config, conf);
 		newstate = get_state(pp, conf, 1, newstate);
@@ -2411,6 +2474,7 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 		    newstate != PATH_PENDING) && (pp->state == PATH_DELAYED)) {
 		/* If path state become failed again cancel path delay state */
 		pp->state = newstate;
+		post_path_event(pp);
 		/*
 		 * path state bad again should change the check interval time
 		 * to the shortest delay
@@ -2485,16 +2549,28 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 	if ((newstate == PATH_UP || newstate == PATH_GHOST) &&
 	    (san_path_check_enabled(pp->mpp) ||
 	     marginal_path_check_enabled(pp->mpp))) {
-		if (should_skip_path(pp)) {
+		if (should_skip_path(pp, marginal_path_detection)) {
 			if (!pp->marginal && pp->state != PATH_DELAYED)
 				condlog(2, "%s: path is now marginal", pp->dev);
 			if (!marginal_pathgroups) {
-				if (marginal_path_check_enabled(pp->mpp))
+				if (marginal_path_check_enabled(pp->mpp) &&
+				    marginal_path_detection ==
+				    MARGINAL_PATH_DETECTION_ACTIVE)
 					/* to reschedule as soon as possible,
 					 * so that this path can be recovered
 					 * in time */
 					pp->tick = 1;
-				pp->state = PATH_DELAYED;
+				if (pp->state != PATH_DELAYED) {
+					/*
+					 * passive detection flags paths that
+					 * are still active in the kernel
+					 */
+					if (pp->dmstate != PSTATE_FAILED)
+						fail_path(pp, pp->state == PATH_UP ||
+							  pp->state == PATH_GHOST);
+					pp->state = PATH_DELAYED;
+					post_path_event(pp);
+				}
 				return 1;
 			}
 			if (!pp->marginal) {
@@ -2521,6 +2597,9 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 	disable_reinstate = (newstate == PATH_GHOST &&
 			     count_active_paths(pp->mpp) == 0 &&
 			     path_get_tpgs(pp) == TPGS_IMPLICIT) ? 1 : 0;
+	/* don't undo fpin_fail_marginal_path() before the map is regrouped */
+	if (pp->marginal && pp->mpp->fpin_must_reload)
+		disable_reinstate = 1;
 
 	pp->chkrstate = newstate;
 	if (newstate != pp->state) {
@@ -2528,6 +2607,7 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 		pp->state = newstate;
 
 		LOG_MSG(1, pp);
+		post_path_event(pp);
 
 		/*
 		 * upon state change, reset the checkint
@@ -2662,12 +2742,55 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 	return 1;
 }
 
+/*
+ * Returns '1' if the path has been checked, '-1' if it was blacklisted
+ * and '0' otherwise
+ */
+int
+check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
+{
+	struct multipath *mpp = pp->mpp;
+	int state = pp->state, dmstate = pp->dmstate;
+	int priority = pp->priority, offline = pp->offline;
+	int marginal = pp->marginal;
+	int failback_tick = mpp ? mpp->failback_tick : 0;
+	int rc;
+
+	rc = do_check_path(vecs, pp, ticks);
+
+	/* A path moving to another map means a reload, see domap() */
+	if (pp->mpp && pp->mpp == mpp &&
+	    (pp->state != state || pp->dmstate != dmstate ||
+	     pp->priority != priority || pp->offline != offline ||
+	     pp->marginal != marginal || mpp->failback_tick != failback_tick))
+		map_state_changed(mpp);
+	return rc;
+}
+
 enum checker_state {
 	CHECKER_STARTING,
+	CHECKER_RUNNING_URGENT,
 	CHECKER_RUNNING,
 	CHECKER_FINISHED,
 };
 
+/*
+ * Paths whose check result is most likely to change what the kernel
+ * can do with IO are checked first in every checker loop: paths of maps
+ * that have no usable path left, paths with a pending check, and paths
+ * that are not up. This keeps the time to reinstate paths after an
+ * outage independent of the number of healthy paths.
+ */
+static bool
+path_check_is_urgent(struct path *pp)
+{
+	if (pp->state != PATH_UP && pp->state != PATH_GHOST)
+		return true;
+	if (!pp->mpp)
+		return false;
+	return pp->mpp->in_recovery || count_active_paths(pp->mpp) == 0;
+}
+
 static void *
 checkerloop (void *ap)
 {
@@ -2726,30 +2849,33 @@ checkerloop (void *ap)
 			pthread_testcancel();
 			get_monotonic_time(&chk_start_time);
 			if (checker_state == CHECKER_STARTING) {
-				vector_foreach_slot(vecs->pathvec, pp, i)
+				unsigned int nr_urgent = 0;
+
+				vector_foreach_slot(vecs->pathvec, pp, i) {
 					pp->is_checked = false;
+					pp->check_urgent = path_check_is_urgent(pp);
+					if (pp->check_urgent)
+						nr_urgent++;
+				}
 				i = 0;
-				checker_state = CHECKER_RUNNING;
+				checker_state = nr_urgent ? CHECKER_RUNNING_URGENT :
+					CHECKER_RUNNING;
 			} else {
 				/*
-				 * Paths could have been removed since we
-				 * dropped the lock. Find the path to continue
-				 * checking at. Since paths can be removed from
-				 * anywhere in the vector, but can only be added
-				 * at the end, the last checked path must be
-				 * between its old location, and the start or
-				 * the vector.
+				 * Paths could have been added or removed since
+				 * we dropped the lock, so the old index may not
+				 * point at the path we stopped at. Rescan from
+				 * the start; the paths checked already, in this
+				 * pass or in the urgent one, are skipped below.
 				 */
-				if (i >= VECTOR_SIZE(vecs->pathvec))
-					i = VECTOR_SIZE(vecs->pathvec) - 1;
-				while ((pp = VECTOR_SLOT(vecs->pathvec, i))) {
-					if (pp->is_checked == true)
-						break;
-					i--;
-				}
-				i++;
+				i = 0;
 			}
+next_pass:
 			vector_foreach_slot_after (vecs->pathvec, pp, i) {
+				if (pp->is_checked ||
+				    (checker_state == CHECKER_RUNNING_URGENT &&
+				     !pp->check_urgent))
+					continue;
 				pp->is_checked = true;
 				rc = check_path(vecs, pp, ticks);
 				if (rc < 0) {
@@ -2770,6 +2896,11 @@ checkerloop (void *ap)
 						goto unlock;
 				}
 			}
+			if (checker_state == CHECKER_RUNNING_URGENT) {
+				checker_state = CHECKER_RUNNING;
+				i = 0;
+				goto next_pass;
+			}
 			checker_state = CHECKER_FINISHED;
 unlock:
 			lock_cleanup_pop(vecs->lock);
@@ -2784,6 +2915,7 @@ unlock:
 		lock(&vecs->lock);
 		pthread_testcancel();
 		deferred_failback_tick(vecs);
+		fpin_reload_tick(vecs);
 		retry_count_tick(vecs->mpvec);
 		missing_uev_wait_tick(vecs);
 		ghost_delay_tick(vecs);
@@ -3845,16 +3977,14 @@ main (int argc, char *argv[])
 		return (child(NULL));
 }
 
-void *  mpath_pr_event_handler_fn (void * pathp )
+static void mpath_pr_event_handler(struct path *pp)
 {
 	struct multipath * mpp;
 	unsigned int i;
 	int ret, isFound;
-	struct path * pp = (struct path *)pathp;
 	struct prout_param_descriptor *param;
 	struct prin_resp *resp;
 
-	rcu_register_thread();
 	mpp = pp->mpp;
 
 	resp = mpath_alloc_prin_response(MPATH_PRIN_RKEY_SA);
@@ -3922,15 +4052,10 @@ void *  mpath_pr_event_handler_fn (void * pathp )
 out:
 	if (resp)
 		free(resp);
-	rcu_unregister_thread();
-	return NULL;
 }
 
 int mpath_pr_event_handle(struct path *pp)
 {
-	pthread_t thread;
-	int rc;
-	pthread_attr_t attr;
 	struct multipath * mpp;
 
 	if (pp->bus != SYSFS_BUS_SCSI)
@@ -3941,16 +4066,8 @@ int mpath_pr_event_handle(struct path *pp)
 	if (!get_be64(mpp->reservation_key))
 		goto no_pr;
 
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-
-	rc = pthread_create(&thread, NULL , mpath_pr_event_handler_fn, pp);
-	if (rc) {
-		condlog(0, "%s: ERROR; return code from pthread_create() is %d", pp->dev, rc);
-		return -1;
-	}
-	pthread_attr_destroy(&attr);
-	rc = pthread_join(thread, NULL);
+	/* The caller would wait for a helper thread anyway */
+	mpath_pr_event_handler(pp);
 	return 0;
 
 no_pr:
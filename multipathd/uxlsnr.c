@@ -19,10 +19,11 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/time.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <sys/inotify.h>
 #include <sys/eventfd.h>
 #include "checkers.h"
@@ -42,6 +43,7 @@
 #include "uxlsnr.h"
 #include "strbuf.h"
 #include "alias.h"
+#include "events.h"
 
 /* state of client connection */
 enum {
@@ -50,13 +52,22 @@ enum {
 	CLT_LOCKED_WORK,
 	CLT_WORK,
 	CLT_SEND,
+	CLT_SUBSCRIBED,
 };
 
 struct client {
 	struct list_head node;
+	/* in timers list while expires is set */
+	struct list_head timer_node;
+	/* in lock_waiters list in CLT_LOCKED_WORK state */
+	struct list_head lock_node;
+	/* in subscribers list after "subscribe" */
+	struct list_head sub_node;
 	struct timespec expires;
 	int state;
 	int fd;
+	/* EPOLLIN / EPOLLOUT seen, and not consumed yet (edge triggered) */
+	unsigned int ready;
 	vector cmdvec;
 	/* NUL byte at end */
 	char cmd[_MAX_CMD_LEN + 1];
@@ -65,31 +76,39 @@ struct client {
 	size_t cmd_len, len;
 	int error;
 	bool is_root;
+	/* set by the "subscribe" command */
+	bool subscribed;
+	uint64_t event_seq;
 };
 
-/* Indices for array of poll fds */
+/*
+ * epoll_event.data for the listener's own fds. For clients, it holds
+ * the struct client pointer, which never takes these small values.
+ */
 enum {
-	POLLFD_UX = 0,
-	POLLFD_NOTIFY,
-	POLLFD_IDLE,
-	POLLFDS_BASE,
+	EPOLL_UX = 0,
+	EPOLL_NOTIFY,
+	EPOLL_IDLE,
+	EPOLL_EVENTS,
+	EPOLL_BASE,
 };
 
-#define POLLFD_CHUNK (4096 / sizeof(struct pollfd))
-/* Minimum number of pollfds to reserve for clients */
-#define MIN_POLLS (POLLFD_CHUNK - POLLFDS_BASE)
+/* Max number of events to fetch per epoll_pwait() call */
+#define MAX_EPOLL_EVENTS 64
 /*
  * Max number of client connections allowed
  * During coldplug, there may be a large number of "multipath -u"
  * processes connecting.
  */
-#define MAX_CLIENTS (16384 - POLLFDS_BASE)
-
-/* Compile-time error if POLLFD_CHUNK is too small */
-static __attribute__((unused)) char ___a[-(MIN_POLLS <= 0)];
+#define MAX_CLIENTS (16384 - EPOLL_BASE)
 
 static LIST_HEAD(clients);
-static struct pollfd *polls;
+/* clients with a pending timeout, sorted by expiry */
+static LIST_HEAD(timers);
+static LIST_HEAD(lock_waiters);
+static LIST_HEAD(subscribers);
+static int num_clients;
+static int epoll_fd = -1;
 static int notify_fd = -1;
 static int idle_fd = -1;
 static bool clients_need_lock = false;
@@ -109,6 +128,32 @@ static bool _socket_client_is_root(int fd)
 	return false;
 }
 
+static int epoll_watch(int op, int fd, unsigned int events, uint64_t data)
+{
+	struct epoll_event ev = { .events = events, .data.u64 = data, };
+
+	if (epoll_ctl(epoll_fd, op, fd, &ev) == -1) {
+		condlog(1, "%s: epoll_ctl(%d, %d) failed: %m", __func__, op, fd);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The idle fd is only watched while some client waits for the vecs lock.
+ */
+static void update_lock_waiters(void)
+{
+	bool need_lock = !list_empty(&lock_waiters);
+
+	if (need_lock == clients_need_lock)
+		return;
+	clients_need_lock = need_lock;
+	if (idle_fd != -1)
+		epoll_watch(EPOLL_CTL_MOD, idle_fd, need_lock ? EPOLLIN : 0,
+			    EPOLL_IDLE);
+}
+
 /*
  * handle a new client joining
  */
@@ -119,7 +164,7 @@ static void new_client(int ux_sock)
 	socklen_t len = sizeof(addr);
 	int fd;
 
-	fd = accept(ux_sock, &addr, &len);
+	fd = accept4(ux_sock, &addr, &len, SOCK_NONBLOCK|SOCK_CLOEXEC);
 
 	if (fd == -1)
 		return;
@@ -130,12 +175,27 @@ static void new_client(int ux_sock)
 		return;
 	}
 	INIT_LIST_HEAD(&c->node);
+	INIT_LIST_HEAD(&c->timer_node);
+	INIT_LIST_HEAD(&c->lock_node);
+	INIT_LIST_HEAD(&c->sub_node);
 	c->fd = fd;
 	c->state = CLT_RECV;
 	c->is_root = _socket_client_is_root(c->fd);
 
+	/*
+	 * Edge triggered: we only get notified about new data or free
+	 * buffer space, see client_state_machine() for the consequences.
+	 */
+	if (epoll_watch(EPOLL_CTL_ADD, fd, EPOLLIN | EPOLLOUT | EPOLLET,
+			(uintptr_t)c) != 0) {
+		free(c);
+		close(fd);
+		return;
+	}
+
 	/* put it in our linked list */
 	list_add_tail(&c->node, &clients);
+	num_clients++;
 }
 
 /*
@@ -145,21 +205,22 @@ static void dead_client(struct client *c)
 {
 	int fd = c->fd;
 	list_del_init(&c->node);
+	list_del_init(&c->timer_node);
+	list_del_init(&c->sub_node);
+	if (!list_empty(&c->lock_node)) {
+		list_del_init(&c->lock_node);
+		update_lock_waiters();
+	}
+	num_clients--;
 	c->fd = -1;
 	reset_strbuf(&c->reply);
 	if (c->cmdvec)
 		free_keys(c->cmdvec);
 	free(c);
+	/* this also removes fd from the epoll set */
 	close(fd);
 }
 
-static void free_polls (void)
-{
-	if (polls)
-		free(polls);
-	polls = NULL;
-}
-
 void uxsock_cleanup(void *arg)
 {
 	struct client *client_loop;
@@ -168,13 +229,17 @@ void uxsock_cleanup(void *arg)
 
 	close(ux_sock);
 	close(notify_fd);
+	cleanup_mpath_events();
 
 	list_for_each_entry_safe(client_loop, client_tmp, &clients, node) {
 		dead_client(client_loop);
 	}
 
 	cli_exit();
-	free_polls();
+	if (epoll_fd != -1) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
 }
 
 void wakeup_cleanup(void *arg)
@@ -299,51 +364,63 @@ static void handle_inotify(int fd, struct watch_descriptors *wds)
 }
 
 static const struct timespec ts_zero = { .tv_sec = 0, };
-static const struct timespec ts_max = { .tv_sec = LONG_MAX, .tv_nsec = 999999999 };
 
-static struct timespec *get_soonest_timeout(struct timespec *ts)
+/*
+ * All clients use the same uxsock_timeout, so new timers normally go to
+ * the tail of the list. Searching from the tail keeps the list sorted
+ * if uxsock_timeout is changed by reconfigure.
+ */
+static void arm_client_timer(struct client *c)
 {
-	struct timespec ts_min = ts_max, now;
-	bool any = false;
-	struct client *c;
-
-	list_for_each_entry(c, &clients, node) {
-		if (timespeccmp(&c->expires, &ts_zero) != 0 &&
-		    timespeccmp(&c->expires, &ts_min) < 0) {
-			ts_min = c->expires;
-			any = true;
+	struct client *t;
+	struct list_head *pos = &timers;
+
+	get_monotonic_time(&c->expires);
+	c->expires.tv_sec += uxsock_timeout / 1000;
+	c->expires.tv_nsec += (uxsock_timeout % 1000) * 1000000;
+	normalize_timespec(&c->expires);
+
+	list_del_init(&c->timer_node);
+	list_for_each_entry_reverse(t, &timers, timer_node) {
+		if (timespeccmp(&t->expires, &c->expires) <= 0) {
+			pos = &t->timer_node;
+			break;
 		}
 	}
-
-	if (!any)
-		return NULL;
-
-	get_monotonic_time(&now);
-	timespecsub(&ts_min, &now, ts);
-	if (timespeccmp(ts, &ts_zero) < 0)
-		*ts = ts_zero;
-
-	condlog(4, "%s: next client expires in %ld.%03lds", __func__,
-		(long)ts->tv_sec, ts->tv_nsec / 1000000);
-	return ts;
+	list_add(&c->timer_node, pos);
 }
 
-bool waiting_clients(void)
+static void disarm_client_timer(struct client *c)
 {
-	return clients_need_lock;
+	c->expires = ts_zero;
+	list_del_init(&c->timer_node);
 }
 
-static void check_for_locked_work(struct client *skip)
+/* epoll timeout in ms for the soonest client expiry, -1 if none */
+static int get_soonest_timeout(void)
 {
 	struct client *c;
+	struct timespec now, ts;
+	long ms;
 
-	list_for_each_entry(c, &clients, node) {
-		if (c != skip && c->state == CLT_LOCKED_WORK) {
-			clients_need_lock = true;
-			return;
-		}
-	}
-	clients_need_lock = false;
+	if (list_empty(&timers))
+		return -1;
+
+	c = list_entry(timers.next, struct client, timer_node);
+	get_monotonic_time(&now);
+	timespecsub(&c->expires, &now, &ts);
+	if (timespeccmp(&ts, &ts_zero) < 0)
+		return 0;
+
+	/* round up, lest we wake up too early */
+	ms = ts.tv_sec * 1000 + (ts.tv_nsec + 999999) / 1000000;
+	condlog(4, "%s: next client expires in %ldms", __func__, ms);
+	return ms > INT_MAX ? INT_MAX : ms;
+}
+
+bool waiting_clients(void)
+{
+	return clients_need_lock;
 }
 
 static int parse_cmd(struct client *c)
@@ -418,16 +495,23 @@ void default_reply(struct client *c, int r)
 
 static void set_client_state(struct client *c, int state)
 {
+	if (c->state == CLT_LOCKED_WORK && state != CLT_LOCKED_WORK) {
+		list_del_init(&c->lock_node);
+		update_lock_waiters();
+	}
+
 	switch(state)
 	{
 	case CLT_RECV:
-		reset_strbuf(&c->reply);
 		memset(c->cmd, '\0', sizeof(c->cmd));
+		/* fallthrough */
+	case CLT_SUBSCRIBED:
+		reset_strbuf(&c->reply);
 		c->error = 0;
 		/* fallthrough */
 	case CLT_SEND:
 		/* no timeout while waiting for the client or sending a reply */
-		c->expires = ts_zero;
+		disarm_client_timer(c);
 		/* reuse these fields for next data transfer */
 		c->len = c->cmd_len = 0;
 		/* cmdvec isn't needed any more */
@@ -436,6 +520,12 @@ static void set_client_state(struct client *c, int state)
 			c->cmdvec = NULL;
 		}
 		break;
+	case CLT_LOCKED_WORK:
+		if (list_empty(&c->lock_node)) {
+			list_add_tail(&c->lock_node, &lock_waiters);
+			update_lock_waiters();
+		}
+		break;
 	default:
 		break;
 	}
@@ -447,46 +537,107 @@ enum {
 	STM_BREAK,
 };
 
-static int client_state_machine(struct client *c, struct vectors *vecs,
-				short revents)
+/*
+ * After "subscribe", the connection only carries events from the daemon
+ * to the client.
+ */
+static int subscribe_client(struct client *c)
+{
+	c->subscribed = true;
+	list_add_tail(&c->sub_node, &subscribers);
+	c->event_seq = get_mpath_event_seq();
+	condlog(3, "cli[%d]: subscribed to events after %"PRIu64,
+		c->fd, c->event_seq);
+	if (print_strbuf(&c->reply, "subscribed %"PRIu64"\n",
+			 c->event_seq) < 0)
+		return -ENOMEM;
+	return 0;
+}
+
+/*
+ * Send the reply length and the reply itself, continuing where the
+ * previous call stopped. c->len counts the bytes sent so far, including
+ * the length field.
+ */
+static ssize_t send_reply(struct client *c)
+{
+	size_t len = get_strbuf_len(&c->reply) + 1;
+	char *buf = (char *)get_strbuf_str(&c->reply);
+	struct iovec iov[2];
+	struct msghdr msg = { .msg_iov = iov, };
+
+	if (c->len < sizeof(len)) {
+		iov[0].iov_base = (char *)&len + c->len;
+		iov[0].iov_len = sizeof(len) - c->len;
+		iov[1].iov_base = buf;
+		iov[1].iov_len = len;
+		msg.msg_iovlen = 2;
+	} else {
+		iov[0].iov_base = buf + c->len - sizeof(len);
+		iov[0].iov_len = c->cmd_len - c->len;
+		msg.msg_iovlen = 1;
+	}
+	return sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+}
+
+/*
+ * Client fds are non-blocking and edge triggered. c->ready tracks whether
+ * the fd may be readable / writable; it's only cleared when recv() or
+ * send() returns EAGAIN. Otherwise we'd miss data that arrived while the
+ * client was in another state.
+ */
+static int client_state_machine(struct client *c, struct vectors *vecs)
 {
 	ssize_t n;
 
-	condlog(4, "%s: cli[%d] poll=%x state=%d cmd=\"%s\" repl \"%s\"", __func__,
-		c->fd, revents, c->state, c->cmd, get_strbuf_str(&c->reply));
+	condlog(4, "%s: cli[%d] ready=%x state=%d cmd=\"%s\" repl \"%s\"", __func__,
+		c->fd, c->ready, c->state, c->cmd, get_strbuf_str(&c->reply));
 
 	switch (c->state) {
 	case CLT_RECV:
-		if (!(revents & POLLIN))
+		if (!(c->ready & EPOLLIN))
 			return STM_BREAK;
 		if (c->cmd_len == 0) {
 			size_t len;
-			/*
-			 * We got POLLIN; assume that at least the length can
-			 * be read immediately.
-			 */
-			get_monotonic_time(&c->expires);
-			c->expires.tv_sec += uxsock_timeout / 1000;
-			c->expires.tv_nsec += (uxsock_timeout % 1000) * 1000000;
-			normalize_timespec(&c->expires);
+
 			n = recv(c->fd, &len, sizeof(len), 0);
-			if (n < (ssize_t)sizeof(len)) {
+			if (n == -1 && errno == EAGAIN) {
+				c->ready &= ~EPOLLIN;
+				return STM_BREAK;
+			} else if (n == -1 && errno == EINTR)
+				return STM_CONT;
+			else if (n == 0) {
+				/* client closed the connection */
+				c->error = -ECONNRESET;
+				return STM_BREAK;
+			} else if (n < (ssize_t)sizeof(len)) {
 				condlog(1, "%s: cli[%d]: failed to receive reply len: %zd",
 					__func__, c->fd, n);
 				c->error = -ECONNRESET;
+				return STM_BREAK;
 			} else if (len <= 0 || len > _MAX_CMD_LEN) {
 				condlog(1, "%s: cli[%d]: invalid command length (%zu bytes)",
 					__func__, c->fd, len);
 				c->error = -ECONNRESET;
-			} else {
-				c->cmd_len = len;
-				condlog(4, "%s: cli[%d]: connected", __func__, c->fd);
+				return STM_BREAK;
 			}
-			/* poll for data */
-			return STM_BREAK;
+			c->cmd_len = len;
+			arm_client_timer(c);
+			condlog(4, "%s: cli[%d]: connected", __func__, c->fd);
+			return STM_CONT;
 		} else if (c->len < c->cmd_len) {
 			n = recv(c->fd, c->cmd + c->len, c->cmd_len - c->len, 0);
-			if (n <= 0 && errno != EINTR && errno != EAGAIN) {
+			if (n == -1 && errno == EAGAIN) {
+				c->ready &= ~EPOLLIN;
+				return STM_BREAK;
+			} else if (n == -1 && errno == EINTR)
+				return STM_CONT;
+			else if (n == 0) {
+				condlog(1, "%s: cli[%d]: connection closed in recv",
+					__func__, c->fd);
+				c->error = -ECONNRESET;
+				return STM_BREAK;
+			} else if (n < 0) {
 				condlog(1, "%s: cli[%d]: error in recv: %m",
 					__func__, c->fd);
 				c->error = -ECONNRESET;
@@ -494,8 +645,7 @@ static int client_state_machine(struct client *c, struct vectors *vecs,
 			}
 			c->len += n;
 			if (c->len < c->cmd_len)
-				/* continue polling */
-				return STM_BREAK;
+				return STM_CONT;
 		}
 		condlog(4, "cli[%d]: Got request [%s]", c->fd, c->cmd);
 		set_client_state(c, CLT_PARSE);
@@ -507,7 +657,8 @@ static int client_state_machine(struct client *c, struct vectors *vecs,
 			/* Permission check */
 			struct key *kw = VECTOR_SLOT(c->cmdvec, 0);
 
-			if (!c->is_root && kw->code != VRB_LIST) {
+			if (!c->is_root && kw->code != VRB_LIST &&
+			    kw->code != VRB_SUBSCRIBE) {
 				c->error = -EPERM;
 				condlog(0, "%s: cli[%d]: unauthorized cmd \"%s\"",
 					__func__, c->fd, c->cmd);
@@ -526,12 +677,11 @@ static int client_state_machine(struct client *c, struct vectors *vecs,
 			/* don't use cleanup_lock(), lest we wakeup ourselves */
 			pthread_cleanup_push_cast(__unlock, &vecs->lock);
 			c->error = execute_handler(c, vecs);
-			check_for_locked_work(c);
+			/* updates clients_need_lock before releasing the lock */
+			set_client_state(c, CLT_SEND);
 			pthread_cleanup_pop(1);
 			condlog(4, "%s: cli[%d] grabbed lock", __func__, c->fd);
-			set_client_state(c, CLT_SEND);
-			/* Wait for POLLOUT */
-			return STM_BREAK;
+			return STM_CONT;
 		} else {
 			condlog(4, "%s: cli[%d] waiting for lock", __func__, c->fd);
 			return STM_BREAK;
@@ -539,73 +689,114 @@ static int client_state_machine(struct client *c, struct vectors *vecs,
 
 	case CLT_WORK:
 		c->error = execute_handler(c, vecs);
+		if (!c->error &&
+		    ((struct key *)VECTOR_SLOT(c->cmdvec, 0))->code == VRB_SUBSCRIBE)
+			c->error = subscribe_client(c);
 		set_client_state(c, CLT_SEND);
-		/* Wait for POLLOUT */
-		return STM_BREAK;
+		return STM_CONT;
 
 	case CLT_SEND:
 		if (get_strbuf_len(&c->reply) == 0)
 			default_reply(c, c->error);
 
-		if (c->cmd_len == 0) {
-			size_t len = get_strbuf_len(&c->reply) + 1;
+		if (c->cmd_len == 0)
+			c->cmd_len = sizeof(size_t) + get_strbuf_len(&c->reply) + 1;
 
-			if (send(c->fd, &len, sizeof(len), MSG_NOSIGNAL)
-			    != sizeof(len))
-				c->error = -ECONNRESET;
-			c->cmd_len = len;
+		if (!(c->ready & EPOLLOUT))
+			return STM_BREAK;
+
+		n = send_reply(c);
+		if (n == -1) {
+			if (errno == EAGAIN) {
+				c->ready &= ~EPOLLOUT;
+				return STM_BREAK;
+			} else if (errno == EINTR)
+				return STM_CONT;
+			c->error = -ECONNRESET;
 			return STM_BREAK;
 		}
+		c->len += n;
+		if (c->len < c->cmd_len)
+			return STM_CONT;
+
+		condlog(4, "cli[%d]: Reply [%zu bytes]", c->fd,
+			c->cmd_len - sizeof(size_t));
+		if (c->subscribed)
+			set_client_state(c, CLT_SUBSCRIBED);
+		else
+			set_client_state(c, CLT_RECV);
+		return STM_CONT;
 
-		if (c->len < c->cmd_len) {
-			const char *buf = get_strbuf_str(&c->reply);
+	case CLT_SUBSCRIBED:
+		while (c->ready & EPOLLIN) {
+			char buf[64];
 
-			n = send(c->fd, buf + c->len, c->cmd_len - c->len, MSG_NOSIGNAL);
-			if (n == -1) {
-				if (!(errno == EAGAIN || errno == EINTR))
-					c->error = -ECONNRESET;
-			} else
-				c->len += n;
+			/* subscribers aren't supposed to send anything */
+			n = recv(c->fd, buf, sizeof(buf), 0);
+			if (n == -1 && errno == EAGAIN)
+				c->ready &= ~EPOLLIN;
+			else if (n == 0 || (n == -1 && errno != EINTR)) {
+				c->error = -ECONNRESET;
+				return STM_BREAK;
+			}
 		}
-
-		if (c->len >= c->cmd_len) {
-			condlog(4, "cli[%d]: Reply [%zu bytes]", c->fd, c->cmd_len);
-			set_client_state(c, CLT_RECV);
+		if (c->event_seq == get_mpath_event_seq())
+			return STM_BREAK;
+		if (print_mpath_events(&c->reply, &c->event_seq) < 0) {
+			condlog(1, "%s: cli[%d]: failed to print events",
+				__func__, c->fd);
+			c->error = -ECONNRESET;
+			return STM_BREAK;
 		}
-		return STM_BREAK;
+		set_client_state(c, CLT_SEND);
+		return STM_CONT;
 
 	default:
 		return STM_BREAK;
 	}
 }
 
-static void check_timeout(struct client *c)
+/*
+ * Run the state machine for a client as far as possible. Frees the
+ * client if the connection is gone; c must not be used afterwards.
+ */
+static void handle_client(struct client *c, struct vectors *vecs,
+			  unsigned int events)
 {
+	if (events & (EPOLLHUP|EPOLLERR))
+		c->error = -ECONNRESET;
+	else {
+		c->ready |= events & (EPOLLIN|EPOLLOUT);
+		while (client_state_machine(c, vecs) == STM_CONT);
+	}
+
+	if (c->error == -ECONNRESET) {
+		condlog(4, "cli[%d]: disconnected", c->fd);
+		dead_client(c);
+	}
+}
+
+static void handle_timeouts(struct vectors *vecs)
+{
+	struct client *c, *tmp;
 	struct timespec now;
 
-	if (timespeccmp(&c->expires, &ts_zero) == 0)
+	if (list_empty(&timers))
 		return;
 
 	get_monotonic_time(&now);
-	if (timespeccmp(&c->expires, &now) > 0)
-		return;
-
-	condlog(2, "%s: cli[%d]: timed out at %ld.%03ld", __func__,
-		c->fd, (long)c->expires.tv_sec, c->expires.tv_nsec / 1000000);
+	list_for_each_entry_safe(c, tmp, &timers, timer_node) {
+		if (timespeccmp(&c->expires, &now) > 0)
+			break;
 
-	c->error = -ETIMEDOUT;
-	set_client_state(c, CLT_SEND);
-}
+		condlog(2, "%s: cli[%d]: timed out at %ld.%03ld", __func__,
+			c->fd, (long)c->expires.tv_sec,
+			c->expires.tv_nsec / 1000000);
 
-static void handle_client(struct client *c, struct vectors *vecs, short revents)
-{
-	if (revents & (POLLHUP|POLLERR)) {
-		c->error = -ECONNRESET;
-		return;
+		c->error = -ETIMEDOUT;
+		set_client_state(c, CLT_SEND);
+		handle_client(c, vecs, 0);
 	}
-
-	check_timeout(c);
-	while (client_state_machine(c, vecs, revents) == STM_CONT);
 }
 
 /*
@@ -614,31 +805,43 @@ static void handle_client(struct client *c, struct vectors *vecs, short revents)
 void *uxsock_listen(long ux_sock, void *trigger_data)
 {
 	sigset_t mask;
-	int max_pfds = MIN_POLLS + POLLFDS_BASE;
 	/* conf->sequence_nr will be 1 when uxsock_listen is first called */
 	unsigned int sequence_nr = 0;
 	struct watch_descriptors wds = { .conf_wd = -1, .dir_wd = -1, .mp_wd = -1, };
 	struct vectors *vecs = trigger_data;
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	bool ux_watched = false;
 
 	condlog(3, "uxsock: startup listener");
-	polls = calloc(1, max_pfds * sizeof(*polls));
-	if (!polls) {
-		condlog(0, "uxsock: failed to allocate poll fds");
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		condlog(0, "uxsock: failed to create epoll fd");
 		exit_daemon();
 		return NULL;
 	}
 	notify_fd = inotify_init1(IN_NONBLOCK);
 	if (notify_fd == -1) /* it's fine if notifications fail */
 		condlog(3, "failed to start up configuration notifications");
+	else if (epoll_watch(EPOLL_CTL_ADD, notify_fd, EPOLLIN,
+			     EPOLL_NOTIFY) != 0) {
+		close(notify_fd);
+		notify_fd = -1;
+	}
 
 	pthread_cleanup_push(wakeup_cleanup, &vecs->lock);
 	idle_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
-	if (idle_fd == -1) {
+	if (idle_fd == -1 ||
+	    epoll_watch(EPOLL_CTL_ADD, idle_fd, 0, EPOLL_IDLE) != 0) {
 		condlog(1, "failed to create idle fd");
 		exit_daemon();
 	} else
 		set_wakeup_fn(&vecs->lock, wakeup_listener);
 
+	if (init_mpath_events() != 0 ||
+	    epoll_watch(EPOLL_CTL_ADD, get_mpath_events_fd(), EPOLLIN,
+			EPOLL_EVENTS) != 0)
+		condlog(1, "failed to set up event notifications for subscribers");
+
 	sigfillset(&mask);
 	sigdelset(&mask, SIGINT);
 	sigdelset(&mask, SIGTERM);
@@ -646,130 +849,84 @@ void *uxsock_listen(long ux_sock, void *trigger_data)
 	sigdelset(&mask, SIGUSR1);
 	while (1) {
 		struct client *c, *tmp;
-		int i, n_pfds, poll_count, num_clients;
-		struct timespec __timeout, *timeout;
+		int i, n_events;
+		bool new_events = false;
 
-		/* setup for a poll */
-		num_clients = 0;
-		list_for_each_entry(c, &clients, node) {
-			num_clients++;
-		}
-		if (num_clients + POLLFDS_BASE > max_pfds) {
-			struct pollfd *new;
-			int n_new = max_pfds + POLLFD_CHUNK;
-
-			new = realloc(polls, n_new * sizeof(*polls));
-			if (new) {
-				max_pfds = n_new;
-				polls = new;
-			} else {
-				condlog(1, "%s: realloc failure, %d clients not served",
-					__func__,
-					num_clients + POLLFDS_BASE - max_pfds);
-				num_clients = max_pfds - POLLFDS_BASE;
-			}
-		}
 		if (num_clients < MAX_CLIENTS) {
-			polls[POLLFD_UX].fd = ux_sock;
-			polls[POLLFD_UX].events = POLLIN;
-		} else {
+			if (!ux_watched &&
+			    epoll_watch(EPOLL_CTL_ADD, ux_sock, EPOLLIN,
+					EPOLL_UX) == 0)
+				ux_watched = true;
+		} else if (ux_watched) {
 			/*
 			 * New clients can't connect, num_clients won't grow
 			 * to MAX_CLIENTS or higher
 			 */
 			condlog(1, "%s: max client connections reached, pausing polling",
 				__func__);
-			polls[POLLFD_UX].fd = -1;
+			if (epoll_watch(EPOLL_CTL_DEL, ux_sock, 0, EPOLL_UX) == 0)
+				ux_watched = false;
 		}
 
 		reset_watch(notify_fd, &wds, &sequence_nr);
-		polls[POLLFD_NOTIFY].fd = notify_fd;
-		if (notify_fd == -1 || (wds.conf_wd == -1 && wds.dir_wd == -1
-					&& wds.mp_wd == -1))
-			polls[POLLFD_NOTIFY].events = 0;
-		else
-			polls[POLLFD_NOTIFY].events = POLLIN;
-
-		polls[POLLFD_IDLE].fd = idle_fd;
-		check_for_locked_work(NULL);
-		if (clients_need_lock)
-			polls[POLLFD_IDLE].events = POLLIN;
-		else
-			polls[POLLFD_IDLE].events = 0;
-
-		/* setup the clients */
-		i = POLLFDS_BASE;
-		list_for_each_entry(c, &clients, node) {
-			switch(c->state) {
-			case CLT_RECV:
-				polls[i].events = POLLIN;
-				break;
-			case CLT_SEND:
-				polls[i].events = POLLOUT;
-				break;
-			default:
-				/* don't poll for this client */
-				continue;
-			}
-			polls[i].fd = c->fd;
-			i++;
-			if (i >= max_pfds)
-				break;
-		}
-		n_pfds = i;
-		timeout = get_soonest_timeout(&__timeout);
 
 		/* most of our life is spent in this call */
-		poll_count = ppoll(polls, n_pfds, timeout, &mask);
+		n_events = epoll_pwait(epoll_fd, events, MAX_EPOLL_EVENTS,
+				       get_soonest_timeout(), &mask);
 
 		handle_signals(false);
-		if (poll_count == -1) {
+		if (n_events == -1) {
 			if (errno == EINTR) {
 				handle_signals(true);
 				continue;
 			}
 
 			/* something went badly wrong! */
-			condlog(0, "uxsock: poll failed with %d", errno);
+			condlog(0, "uxsock: epoll_pwait failed with %d", errno);
 			exit_daemon();
 			break;
 		}
 
-		if (polls[POLLFD_IDLE].fd != -1 &&
-		    polls[POLLFD_IDLE].revents & POLLIN)
-			drain_idle_fd(idle_fd);
+		/*
+		 * handle_client() only ever frees the client it's called for,
+		 * thus the remaining entries in events[] stay valid.
+		 */
+		for (i = 0; i < n_events; i++) {
+			switch (events[i].data.u64) {
+			case EPOLL_UX:
+				/* see if we got a new client */
+				new_client(ux_sock);
+				break;
+			case EPOLL_NOTIFY:
+				/* handle inotify events on config files */
+				handle_inotify(notify_fd, &wds);
+				break;
+			case EPOLL_IDLE:
+				drain_idle_fd(idle_fd);
+				break;
+			case EPOLL_EVENTS:
+				drain_mpath_events_fd();
+				new_events = true;
+				break;
+			default:
+				c = (struct client *)(uintptr_t)events[i].data.u64;
+				handle_client(c, vecs, events[i].events);
+				break;
+			}
+		}
 
-		/* see if a client needs handling */
-		list_for_each_entry_safe(c, tmp, &clients, node) {
-			short revents = 0;
+		/* retry clients waiting for the lock */
+		list_for_each_entry_safe(c, tmp, &lock_waiters, lock_node)
+			handle_client(c, vecs, 0);
 
-			for (i = POLLFDS_BASE; i < n_pfds; i++) {
-				if (polls[i].fd == c->fd) {
-					revents = polls[i].revents;
-					break;
-				}
-			}
+		if (new_events)
+			list_for_each_entry_safe(c, tmp, &subscribers, sub_node)
+				handle_client(c, vecs, 0);
 
-			handle_client(c, trigger_data, revents);
+		handle_timeouts(vecs);
 
-			if (c->error == -ECONNRESET) {
-				condlog(4, "cli[%d]: disconnected", c->fd);
-				dead_client(c);
-				if (i < n_pfds)
-					polls[i].fd = -1;
-			}
-		}
 		/* see if we got a non-fatal signal */
 		handle_signals(true);
-
-		/* see if we got a new client */
-		if (polls[POLLFD_UX].revents & POLLIN) {
-			new_client(ux_sock);
-		}
-
-		/* handle inotify events on config files */
-		if (polls[POLLFD_NOTIFY].revents & POLLIN)
-			handle_inotify(notify_fd, &wds);
 	}
 
 	pthread_cleanup_pop(1);
@@ -0,0 +1,211 @@
+/*
+ * Tests for the generic async checker mode, see async_check_init()
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <semaphore.h>
+#include <cmocka.h>
+
+#include "../libmultipath/checkers.c"
+#include "globals.c"
+
+static sem_t check_started;
+static sem_t check_release;
+static int check_state;
+static int nr_prepared;
+static int nr_completed;
+static int completed_state;
+
+static int test_check(struct checker *c)
+{
+	sem_post(&check_started);
+	/* sem_wait() is a cancellation point */
+	while (sem_wait(&check_release) != 0)
+		;
+	c->msgid = CHECKER_MSGID_UP;
+	return check_state;
+}
+
+static void test_prepare(struct checker *c)
+{
+	nr_prepared++;
+}
+
+static void test_complete(struct checker *c, int state)
+{
+	nr_completed++;
+	completed_state = state;
+}
+
+static const struct async_check_ops test_ops = {
+	.check = test_check,
+	.prepare = test_prepare,
+	.complete = test_complete,
+};
+
+static int setup(void **state)
+{
+	struct checker *c;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return -1;
+	c->cls = alloc_checker_class();
+	if (!c->cls) {
+		free(c);
+		return -1;
+	}
+	snprintf(c->cls->name, CHECKER_NAME_LEN, "%s", "test");
+	c->fd = -1;
+	c->timeout = 30;
+	if (async_check_init(c, &test_ops, NULL)) {
+		free_checker_class(c->cls);
+		free(c);
+		return -1;
+	}
+	sem_init(&check_started, 0, 0);
+	sem_init(&check_release, 0, 0);
+	check_state = PATH_UP;
+	nr_prepared = nr_completed = 0;
+	completed_state = PATH_WILD;
+	*state = c;
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	struct checker *c = *state;
+
+	async_check_free(c);
+	free_checker_class(c->cls);
+	free(c);
+	sem_destroy(&check_started);
+	sem_destroy(&check_release);
+	return 0;
+}
+
+/* Poll until *val == wanted, for at most 5 seconds */
+static void wait_for(int *val, int wanted)
+{
+	int i;
+
+	for (i = 0; i < 5000 && uatomic_read(val) != wanted; i++)
+		usleep(1000);
+	assert_int_equal(uatomic_read(val), wanted);
+}
+
+static void test_pending(void **state)
+{
+	struct checker *c = *state;
+	struct async_check *ac = c->context;
+
+	assert_int_equal(async_check(c), PATH_PENDING);
+	assert_int_equal(c->msgid, CHECKER_MSGID_RUNNING);
+	sem_wait(&check_started);
+	assert_int_equal(async_check(c), PATH_PENDING);
+	assert_int_equal(c->msgid, CHECKER_MSGID_RUNNING);
+	assert_int_equal(nr_prepared, 1);
+	assert_int_equal(nr_completed, 0);
+
+	sem_post(&check_release);
+	wait_for(&ac->running, 0);
+	assert_int_equal(async_check(c), PATH_UP);
+}
+
+static void test_collect(void **state)
+{
+	struct checker *c = *state;
+	struct async_check *ac = c->context;
+
+	check_state = PATH_GHOST;
+	assert_int_equal(async_check(c), PATH_PENDING);
+	sem_post(&check_release);
+	wait_for(&ac->running, 0);
+	assert_int_equal(async_check(c), PATH_GHOST);
+	assert_int_equal(c->msgid, CHECKER_MSGID_UP);
+	assert_int_equal(nr_completed, 1);
+	assert_int_equal(completed_state, PATH_GHOST);
+	assert_true(ac->thread == 0);
+
+	/* once the thread has quit, the next call starts a new check */
+	wait_for(&ac->holders, 1);
+	check_state = PATH_DOWN;
+	assert_int_equal(async_check(c), PATH_PENDING);
+	assert_int_equal(nr_prepared, 2);
+	sem_post(&check_release);
+	wait_for(&ac->running, 0);
+	assert_int_equal(async_check(c), PATH_DOWN);
+	assert_int_equal(nr_completed, 2);
+}
+
+static void test_timeout(void **state)
+{
+	struct checker *c = *state;
+	struct async_check *ac = c->context;
+
+	assert_int_equal(async_check(c), PATH_PENDING);
+	sem_wait(&check_started);
+	ac->deadline -= c->timeout + 1;
+	assert_int_equal(async_check(c), PATH_TIMEOUT);
+	assert_int_equal(c->msgid, CHECKER_MSGID_TIMEOUT);
+	assert_int_equal(nr_completed, 0);
+	wait_for(&ac->holders, 1);
+
+	/* a cancelled thread that hasn't quit yet blocks new checks */
+	uatomic_add(&ac->holders, 1);
+	assert_int_equal(async_check(c), PATH_TIMEOUT);
+	assert_int_equal(c->msgid, CHECKER_MSGID_TIMEOUT);
+	assert_true(ac->stalled);
+	assert_int_equal(nr_prepared, 1);
+	uatomic_sub(&ac->holders, 1);
+
+	/* the cancelled thread is gone, a new check can start */
+	assert_int_equal(async_check(c), PATH_PENDING);
+	assert_false(ac->stalled);
+	sem_post(&check_release);
+	wait_for(&ac->running, 0);
+	assert_int_equal(async_check(c), PATH_UP);
+	assert_int_equal(nr_completed, 1);
+}
+
+static void test_sync(void **state)
+{
+	struct checker *c = *state;
+
+	checker_set_sync(c);
+	check_state = PATH_GHOST;
+	sem_post(&check_release);
+	assert_int_equal(async_check(c), PATH_GHOST);
+	assert_int_equal(c->msgid, CHECKER_MSGID_UP);
+	assert_int_equal(nr_prepared, 1);
+	assert_int_equal(nr_completed, 1);
+	assert_int_equal(completed_state, PATH_GHOST);
+}
+
+static int test_async_check(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_pending, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_collect, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_timeout, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_sync, setup, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_async_check();
+	return ret;
+}
@@ -18,6 +18,7 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <setjmp.h>
+#include <time.h>
 #include <cmocka.h>
 #include "globals.c"
 #include "blacklist.h"
@@ -591,6 +592,111 @@ static void test_filter_path_whitelist_wwid(void **state)
 	assert_int_equal(filter_path(&conf, &test_pp), MATCH_WWID_BLIST);
 }
 
+static const char * const index_patterns[] = {
+	"^sda$", "^sd", "^nvme0n1$", "^dm-", "^abc\\.d$", "^x.y$", "!^foo",
+	"^3600a", "bar$", "^q$", "^", "^$", "^a\\$$", "^(ram|loop)[0-9]",
+};
+
+static const char * const index_strings[] = {
+	"sda", "sdb", "sd", "s", "nvme0n1", "nvme0n2", "dm-3", "dm", "abc.d",
+	"abcxd", "xzy", "x.y", "foo", "foobar", "3600a0980", "360", "bar",
+	"zbar", "q", "qq", "", "a$", "ram0", "loop",
+};
+
+/* an indexed list must give the same verdicts as regexec() on each entry */
+static void test_index_verdicts(void **state)
+{
+	vector blist;
+	int expected[ARRAY_SIZE(index_strings)];
+	unsigned int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(index_patterns); i++) {
+		blist = vector_alloc();
+		assert_non_null(blist);
+		assert_int_equal(store_ble(blist, index_patterns[i],
+					   ORIGIN_CONFIG), 0);
+		for (j = 0; j < ARRAY_SIZE(index_strings); j++)
+			expected[j] = match_reglist(blist, index_strings[j]);
+		index_blacklist(blist);
+		assert_non_null(((struct blentry *)VECTOR_SLOT(blist, 0))->index);
+		for (j = 0; j < ARRAY_SIZE(index_strings); j++)
+			assert_int_equal(match_reglist(blist, index_strings[j]),
+					 expected[j]);
+		free_blacklist(blist);
+	}
+
+	blist = vector_alloc();
+	assert_non_null(blist);
+	for (i = 0; i < ARRAY_SIZE(index_patterns); i++)
+		if (index_patterns[i][0] != '!')
+			assert_int_equal(store_ble(blist, index_patterns[i],
+						   ORIGIN_CONFIG), 0);
+	for (j = 0; j < ARRAY_SIZE(index_strings); j++)
+		expected[j] = match_reglist(blist, index_strings[j]);
+	index_blacklist(blist);
+	for (j = 0; j < ARRAY_SIZE(index_strings); j++)
+		assert_int_equal(match_reglist(blist, index_strings[j]),
+				 expected[j]);
+	/* adding an entry drops the index */
+	assert_int_equal(store_ble(blist, "^zz$", ORIGIN_CONFIG), 0);
+	assert_null(((struct blentry *)VECTOR_SLOT(blist, 0))->index);
+	assert_int_equal(match_reglist(blist, "zz"), 1);
+	free_blacklist(blist);
+}
+
+#define BENCH_ENTRIES 10000
+#define BENCH_LOOKUPS 1000
+
+static double bench_lookups(const struct _vector *blist, int *hits)
+{
+	char wwid[WWID_SIZE];
+	struct timespec start, end;
+	int i;
+
+	*hits = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_LOOKUPS; i++) {
+		/* every other lookup misses the list */
+		snprintf(wwid, sizeof(wwid), "3600a098038303053453f4a%08d",
+			 i * (BENCH_ENTRIES / BENCH_LOOKUPS) + i % 2);
+		*hits += match_reglist(blist, wwid);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return ((end.tv_sec - start.tv_sec) * 1e6 +
+		(end.tv_nsec - start.tv_nsec) / 1e3) / BENCH_LOOKUPS;
+}
+
+/* a generated list of 10k anchored WWIDs, plus a few true regexes */
+static void test_index_bench_10k(void **state)
+{
+	char regex[WWID_SIZE + 3];
+	vector blist;
+	double linear_us, indexed_us;
+	int i, linear_hits, indexed_hits;
+
+	blist = vector_alloc();
+	assert_non_null(blist);
+	for (i = 0; i < BENCH_ENTRIES; i += 2) {
+		snprintf(regex, sizeof(regex), "^3600a098038303053453f4a%08d$", i);
+		assert_int_equal(store_ble(blist, regex, ORIGIN_CONFIG), 0);
+		snprintf(regex, sizeof(regex), "^3600a098038303053453f4b%08d", i);
+		assert_int_equal(store_ble(blist, regex, ORIGIN_CONFIG), 0);
+	}
+	assert_int_equal(store_ble(blist, "^(ram|zram|loop|fd|md|dm-|sr|scd|st)[0-9]",
+				   ORIGIN_CONFIG), 0);
+	assert_int_equal(store_ble(blist, "^36001405[0-9a-f]+$",
+				   ORIGIN_CONFIG), 0);
+
+	linear_us = bench_lookups(blist, &linear_hits);
+	index_blacklist(blist);
+	indexed_us = bench_lookups(blist, &indexed_hits);
+	assert_int_equal(linear_hits, BENCH_LOOKUPS / 2);
+	assert_int_equal(indexed_hits, linear_hits);
+	print_message("%d entries: %.2f us/lookup with regexec, %.2f us/lookup indexed\n",
+		      VECTOR_SIZE(blist), linear_us, indexed_us);
+	free_blacklist(blist);
+}
+
 #define test_and_reset(x) cmocka_unit_test_teardown((x), reset_blists)
 
 int test_blacklist(void)
@@ -626,6 +732,8 @@ int test_blacklist(void)
 		test_and_reset(test_filter_path_whitelist_device),
 		test_and_reset(test_filter_path_whitelist_protocol),
 		test_and_reset(test_filter_path_whitelist_wwid),
+		cmocka_unit_test(test_index_verdicts),
+		cmocka_unit_test(test_index_bench_10k),
 	};
 	return cmocka_run_group_tests(tests, setup, teardown);
 }
@@ -131,6 +131,10 @@ client_test(disable, "disable", 0, VRB_DISABLEQ, false);
 client_test(setprkey, "setprkey", 0, VRB_SETPRKEY, false);
 client_test(quit, "quit", 0, VRB_QUIT, true);
 client_test(exit, "exit", 0, VRB_QUIT, true);
+client_test(subscribe, "subscribe", 0, VRB_SUBSCRIBE, true);
+client_test(valid, "valid", 0, VRB_VALID, false);
+/* "su" matches "suspend" and "subscribe" */
+client_test(su, "su", ESRCH, 0, false);
 client_test(show_maps, "show maps", 0, VRB_LIST|Q1_MAPS, true);
 client_test(sh_maps, "sh maps", ENOENT, 0, 0);
 client_test(sho_maps, "sho maps", 0, VRB_LIST|Q1_MAPS, true);
@@ -173,6 +177,10 @@ client_param(list_path_sda, "list path sda", VRB_LIST|Q1_PATH, "sda");
 client_param(add_path_sda, "add path sda", VRB_ADD|Q1_PATH, "sda");
 client_test(list_list_path_sda, "list list path sda", 0,
 	    VRB_LIST|(VRB_LIST<<8)|(KEY_PATH<<16), false);
+client_test(show_maps_json_since, "show maps json since 42", 0,
+	    VRB_LIST|Q1_MAPS|Q2_JSON|Q3_SINCE, true);
+client_test(show_maps_since, "show maps since 42", 0,
+	    VRB_LIST|Q1_MAPS|(KEY_SINCE<<16), false);
 
 static int client_tests(void)
 {
@@ -194,6 +202,9 @@ static int client_tests(void)
 		cmocka_unit_test(client_test_setprkey),
 		cmocka_unit_test(client_test_quit),
 		cmocka_unit_test(client_test_exit),
+		cmocka_unit_test(client_test_subscribe),
+		cmocka_unit_test(client_test_valid),
+		cmocka_unit_test(client_test_su),
 		cmocka_unit_test(client_test_show_maps),
 		cmocka_unit_test(client_test_sh_maps),
 		cmocka_unit_test(client_test_sho_maps),
@@ -222,6 +233,8 @@ static int client_tests(void)
 		cmocka_unit_test(client_param_list_path_sda),
 		cmocka_unit_test(client_param_add_path_sda),
 		cmocka_unit_test(client_test_list_list_path_sda),
+		cmocka_unit_test(client_test_show_maps_json_since),
+		cmocka_unit_test(client_test_show_maps_since),
 	};
 
 	return cmocka_run_group_tests(tests, setup, teardown);
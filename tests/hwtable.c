@@ -75,6 +75,12 @@ void make_config_file_path(char *buf, int buflen,
 		snprintf(buf, buflen, fn_template, hwt->dirname, i);
 }
 
+static void make_config_cache_path(char *buf, int buflen,
+				   const struct hwt_state *hwt)
+{
+	snprintf(buf, buflen, "%s/config.cache", hwt->tmpname);
+}
+
 static void reset_vecs(struct vectors *vecs)
 {
 	remove_maps(vecs);
@@ -101,6 +107,8 @@ static void free_hwt(struct hwt_state *hwt)
 	if (hwt->tmpname != NULL) {
 		make_config_file_path(buf, sizeof(buf), hwt, -1);
 		unlink(buf);
+		make_config_cache_path(buf, sizeof(buf), hwt);
+		unlink(buf);
 		rmdir(hwt->tmpname);
 		free(hwt->tmpname);
 	}
@@ -359,6 +367,17 @@ static void write_device(FILE *ff, int nkv, const struct key_value *kv)
 	__cf->verbosity = VERBOSITY;					\
 	__cf; })
 
+#define LOAD_CONFIG_CACHED(hwt, cache) ({ \
+	char buf[PATH_MAX];	   \
+	struct config *__cf;						\
+									\
+	make_config_file_path(buf, sizeof(buf), hwt, -1);		\
+	__cf = load_config_cached(buf, cache);				\
+	assert_ptr_not_equal(__cf, NULL);				\
+	assert_ptr_not_equal(__cf->hwtable, NULL);			\
+	__cf->verbosity = VERBOSITY;					\
+	__cf; })
+
 #define FREE_CONFIG(conf) do {			\
 		free_config(conf);		\
 		conf = NULL;			\
@@ -538,6 +557,65 @@ static void test_driver(void **state)
 	FREE_CONFIG(_conf);
 }
 
+static char *print_config(void)
+{
+	struct config *conf;
+	char *cfg;
+
+	conf = get_multipath_config();
+	cfg = snprint_config(conf, NULL, NULL, NULL);
+	assert_non_null(cfg);
+	put_multipath_config(conf);
+	return cfg;
+}
+
+/*
+ * Turn on config_cache in a conf.d file, and load the configuration
+ * three times: without a cache, from the config files while writing the
+ * cache, and from the cache.
+ *
+ * Expected: the configurations are identical, and the test passes
+ * with the cached configuration.
+ */
+static void test_driver_cached(void **state)
+{
+	static const struct key_value cache_yes = { "config_cache", "yes" };
+	const struct hwt_state *hwt;
+	char cache[PATH_MAX];
+	char *cfg1, *cfg2, *cfg3;
+	struct stat st;
+
+	hwt = CHECK_STATE(state);
+	write_section(hwt->conf_dir_file[N_CONF_FILES - 1], "defaults",
+		      1, &cache_yes);
+	finish_config(hwt);
+	make_config_cache_path(cache, sizeof(cache), hwt);
+	unlink(cache);
+
+	_conf = LOAD_CONFIG_CACHED(hwt, NULL);
+	assert_int_equal(stat(cache, &st), -1);
+	cfg1 = print_config();
+
+	FREE_CONFIG(_conf);
+	_conf = LOAD_CONFIG_CACHED(hwt, cache);
+	assert_int_equal(stat(cache, &st), 0);
+	cfg2 = print_config();
+	assert_string_equal(cfg2, cfg1);
+
+	FREE_CONFIG(_conf);
+	_conf = LOAD_CONFIG_CACHED(hwt, cache);
+	cfg3 = print_config();
+	assert_string_equal(cfg3, cfg1);
+	hwt->test(hwt);
+
+	free(cfg1);
+	free(cfg2);
+	free(cfg3);
+	unlink(cache);
+	reset_vecs(hwt->vecs);
+	FREE_CONFIG(_conf);
+}
+
 /*
  * Sanity check for the test itself, because defaults may be changed
  * in libmultipath.
@@ -1667,6 +1745,55 @@ static int setup_multipath_config_3(void **state)
 	return 0;
 }
 
+/*
+ * Test for many multipaths entries, written out of order.
+ * find_mpe() must find every one of them.
+ */
+static const char * const many_wwids[] = {
+	"WWID-M07", "WWID-M02", "WWID-M11", "WWID-M01", "WWID-M05",
+	"WWID-M09", "WWID-M03", "WWID-M10", "WWID-M04", "WWID-M08",
+	"WWID-M06",
+};
+
+static void test_multipath_config_many(const struct hwt_state *hwt)
+{
+	struct config *conf = get_multipath_config();
+	char wwid[WWID_SIZE];
+	struct mpentry *mpe;
+	unsigned int i;
+
+	assert_int_equal(VECTOR_SIZE(conf->mptable), ARRAY_SIZE(many_wwids));
+	for (i = 0; i < ARRAY_SIZE(many_wwids); i++) {
+		strlcpy(wwid, many_wwids[i], sizeof(wwid));
+		mpe = find_mpe(conf->mptable, wwid);
+		assert_ptr_not_equal(mpe, NULL);
+		assert_string_equal(mpe->wwid, many_wwids[i]);
+	}
+	strlcpy(wwid, default_wwid, sizeof(wwid));
+	assert_ptr_equal(find_mpe(conf->mptable, wwid), NULL);
+}
+
+static int setup_multipath_config_many(void **state)
+{
+	struct hwt_state *hwt = CHECK_STATE(state);
+	unsigned int i;
+
+	begin_config(hwt);
+	begin_section_all(hwt, "multipaths");
+	for (i = 0; i < ARRAY_SIZE(many_wwids); i++) {
+		const struct key_value kv[] = {
+			{ _wwid, many_wwids[i] }, minio_99,
+		};
+
+		write_section(hwt->config_file, "multipath",
+			      ARRAY_SIZE(kv), kv);
+	}
+	end_section_all(hwt);
+	finish_config(hwt);
+	SET_TEST_FUNC(hwt, test_multipath_config_many);
+	return 0;
+}
+
 /*
  * Test for device with "hidden" attribute
  */
@@ -1727,11 +1854,30 @@ define_test(product_blacklist_matching)
 define_test(multipath_config)
 define_test(multipath_config_2)
 define_test(multipath_config_3)
+define_test(multipath_config_many)
 define_test(hidden)
 
+#define define_cached_test(x)			\
+	static void run_cached_##x(void **state)	\
+	{					\
+		return test_driver_cached(state);	\
+	}
+
+define_cached_test(string_hwe)
+define_cached_test(internal_nvme)
+define_cached_test(regex_2_strings_hwe_dir)
+define_cached_test(2_ident_strings_both_dir_w_prev)
+define_cached_test(blacklist_regex_inv)
+define_cached_test(product_blacklist_matching)
+define_cached_test(multipath_config_many)
+define_cached_test(hidden)
+
 #define test_entry(x) \
 	cmocka_unit_test_setup(run_##x, setup_##x)
 
+#define cached_test_entry(x) \
+	cmocka_unit_test_setup(run_cached_##x, setup_##x)
+
 static int test_hwtable(void)
 {
 	const struct CMUnitTest tests[] = {
@@ -1767,7 +1913,16 @@ static int test_hwtable(void)
 		test_entry(multipath_config),
 		test_entry(multipath_config_2),
 		test_entry(multipath_config_3),
+		test_entry(multipath_config_many),
 		test_entry(hidden),
+		cached_test_entry(string_hwe),
+		cached_test_entry(internal_nvme),
+		cached_test_entry(regex_2_strings_hwe_dir),
+		cached_test_entry(2_ident_strings_both_dir_w_prev),
+		cached_test_entry(blacklist_regex_inv),
+		cached_test_entry(product_blacklist_matching),
+		cached_test_entry(multipath_config_many),
+		cached_test_entry(hidden),
 	};
 
 	return cmocka_run_group_tests(tests, setup, teardown);
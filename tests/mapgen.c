@@ -0,0 +1,150 @@
+/*
+ * Tests for the map state generations used by "show maps json since"
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <cmocka.h>
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "debug.h"
+#include "globals.c"
+
+#define N_MAPS 4
+
+static int setup(void **state)
+{
+	vector mpvec;
+	struct multipath *mpp;
+	int i;
+
+	mpvec = vector_alloc();
+	if (!mpvec)
+		return -1;
+	for (i = 0; i < N_MAPS; i++) {
+		mpp = alloc_multipath();
+		if (!mpp || !vector_alloc_slot(mpvec)) {
+			free(mpp);
+			free_multipathvec(mpvec, KEEP_PATHS);
+			return -1;
+		}
+		vector_set_slot(mpvec, mpp);
+		map_state_changed(mpp);
+	}
+	*state = mpvec;
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	free_multipathvec(*state, KEEP_PATHS);
+	return 0;
+}
+
+static void test_gen_increases(void **state)
+{
+	vector mpvec = *state;
+	struct multipath *mpp = VECTOR_SLOT(mpvec, 0);
+	uint64_t gen = get_map_state_gen();
+
+	assert_int_not_equal(gen, 0);
+	map_state_changed(mpp);
+	assert_true(mpp->state_gen > gen);
+	assert_true(get_map_state_gen() == mpp->state_gen);
+}
+
+static void test_since_zero(void **state)
+{
+	vector changed = vector_alloc();
+
+	assert_non_null(changed);
+	assert_int_equal(get_changed_maps(*state, 0, changed), 1);
+	assert_int_equal(VECTOR_SIZE(changed), 0);
+	vector_free(changed);
+}
+
+static void test_since_future(void **state)
+{
+	vector changed = vector_alloc();
+
+	assert_non_null(changed);
+	assert_int_equal(get_changed_maps(*state, get_map_state_gen() + 1,
+					  changed), 1);
+	assert_int_equal(VECTOR_SIZE(changed), 0);
+	vector_free(changed);
+}
+
+static void test_since_current(void **state)
+{
+	vector changed = vector_alloc();
+
+	assert_non_null(changed);
+	assert_int_equal(get_changed_maps(*state, get_map_state_gen(),
+					  changed), 0);
+	assert_int_equal(VECTOR_SIZE(changed), 0);
+	vector_free(changed);
+}
+
+static void test_some_changed(void **state)
+{
+	vector mpvec = *state;
+	vector changed = vector_alloc();
+	uint64_t since = get_map_state_gen();
+
+	assert_non_null(changed);
+	map_state_changed(VECTOR_SLOT(mpvec, 3));
+	map_state_changed(VECTOR_SLOT(mpvec, 1));
+	map_state_changed(VECTOR_SLOT(mpvec, 3));
+	assert_int_equal(get_changed_maps(mpvec, since, changed), 0);
+	assert_int_equal(VECTOR_SIZE(changed), 2);
+	assert_ptr_equal(VECTOR_SLOT(changed, 0), VECTOR_SLOT(mpvec, 1));
+	assert_ptr_equal(VECTOR_SLOT(changed, 1), VECTOR_SLOT(mpvec, 3));
+	vector_free(changed);
+}
+
+static void test_changed_in_between(void **state)
+{
+	vector mpvec = *state;
+	vector changed = vector_alloc();
+	uint64_t since;
+
+	assert_non_null(changed);
+	map_state_changed(VECTOR_SLOT(mpvec, 0));
+	since = get_map_state_gen();
+	map_state_changed(VECTOR_SLOT(mpvec, 2));
+	assert_int_equal(get_changed_maps(mpvec, since, changed), 0);
+	assert_int_equal(VECTOR_SIZE(changed), 1);
+	assert_ptr_equal(VECTOR_SLOT(changed, 0), VECTOR_SLOT(mpvec, 2));
+	vector_free(changed);
+}
+
+static int test_mapgen(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_gen_increases),
+		cmocka_unit_test(test_since_zero),
+		cmocka_unit_test(test_since_future),
+		cmocka_unit_test(test_since_current),
+		cmocka_unit_test(test_some_changed),
+		cmocka_unit_test(test_changed_in_between),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_mapgen();
+	return ret;
+}
@@ -9,10 +9,12 @@
 #include <setjmp.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 #include <libudev.h>
 #include <cmocka.h>
 #include "structs.h"
 #include "config.h"
+#include "wwids.h"
 #include "mpath_valid.h"
 #include "util.h"
 #include "debug.h"
@@ -22,6 +24,7 @@ const char *test_dev = "test_name";
 #define CONF_TEMPLATE "mpathvalid-testconf-XXXXXXXX"
 char conf_name[] = CONF_TEMPLATE;
 bool initialized;
+bool daemon_running;
 
 #if 0
 static int mode_to_findmp(unsigned int mode)
@@ -74,6 +77,54 @@ int __wrap_is_path_valid(const char *name, struct config *conf, struct path *pp,
 	return r;
 }
 
+int __wrap_is_path_valid_by_daemon(const char *name, struct path *pp,
+				   int *nr_others)
+{
+	int r;
+
+	assert_ptr_equal(name, test_dev);
+	assert_ptr_not_equal(pp, NULL);
+	if (!daemon_running)
+		return MPATH_IS_ERROR;
+
+	r = mock_type(int);
+	*nr_others = mock_type(int);
+	if (r == MPATH_IS_ERROR || r == MPATH_IS_NOT_VALID)
+		return r;
+
+	strlcpy(pp->wwid, mock_ptr_type(char *), WWID_SIZE);
+	return r;
+}
+
+int __wrap_is_path_valid_wwids(const char *name, struct config *conf,
+			       struct path *pp, bool check_multipathd,
+			       const struct wwids_index *wwids)
+{
+	int r = mock_type(int);
+
+	assert_string_equal(name, mock_ptr_type(char *));
+	assert_ptr_not_equal(conf, NULL);
+	assert_ptr_not_equal(pp, NULL);
+	assert_int_equal(check_multipathd, !daemon_running);
+	if (r == MPATH_IS_ERROR || r == MPATH_IS_NOT_VALID)
+		return r;
+
+	strlcpy(pp->wwid, mock_ptr_type(char *), WWID_SIZE);
+	return r;
+}
+
+/* A busy multipathd is as good as a running one */
+int __wrap___mpath_connect(int nonblocking)
+{
+	errno = daemon_running ? EAGAIN : ECONNREFUSED;
+	return -1;
+}
+
+struct wwids_index *__wrap_load_wwids_index(void)
+{
+	return NULL;
+}
+
 int __wrap_libmultipath_init(void)
 {
 	int r = mock_type(int);
@@ -146,6 +197,7 @@ void make_config_file(int findmp)
 int setup(void **state)
 {
 	initialized = false;
+	daemon_running = false;
 	udev = udev_new();
 	if (udev == NULL)
 		return -1;
@@ -431,6 +483,105 @@ static void test_mpathvalid_is_path_good5(void **state)
 	free(wwid);
 }
 
+/* multipathd knows another path with the same wwid */
+static void test_mpathvalid_is_path_daemon1(void **state)
+{
+	char *wwid;
+	check_mpathvalid_init(FIND_MULTIPATHS_SMART, MPATH_LOG_PRIO_ERR,
+			      MPATH_LOG_STDERR);
+	daemon_running = true;
+	will_return(__wrap_is_path_valid_by_daemon, MPATH_IS_MAYBE_VALID);
+	will_return(__wrap_is_path_valid_by_daemon, 1);
+	will_return(__wrap_is_path_valid_by_daemon, TEST_WWID);
+	assert_int_equal(mpathvalid_is_path(test_dev, MPATH_DEFAULT, &wwid,
+					    NULL, 0), MPATH_IS_VALID);
+	assert_string_equal(wwid, TEST_WWID);
+	free(wwid);
+}
+
+/* multipathd is not consulted if the mode is overridden */
+static void test_mpathvalid_is_path_daemon2(void **state)
+{
+	char *wwid;
+	check_mpathvalid_init(FIND_MULTIPATHS_SMART, MPATH_LOG_PRIO_ERR,
+			      MPATH_LOG_STDERR);
+	daemon_running = true;
+	will_return(__wrap_is_path_valid, MPATH_IS_VALID);
+	will_return(__wrap_is_path_valid, FIND_MULTIPATHS_GREEDY);
+	will_return(__wrap_is_path_valid, TEST_WWID);
+	assert_int_equal(mpathvalid_is_path(test_dev, MPATH_GREEDY, &wwid,
+					    NULL, 0), MPATH_IS_VALID);
+	assert_string_equal(wwid, TEST_WWID);
+	free(wwid);
+}
+
+static void test_mpathvalid_is_paths_bad(void **state)
+{
+	const char *names[] = { "sda" };
+	int results[1];
+
+	check_mpathvalid_init(FIND_MULTIPATHS_SMART, MPATH_LOG_PRIO_ERR,
+			      MPATH_LOG_STDERR);
+	assert_int_equal(mpathvalid_is_paths(NULL, 1, MPATH_DEFAULT, 0,
+					     results, NULL), -1);
+	assert_int_equal(mpathvalid_is_paths(names, 1, MPATH_DEFAULT, 0,
+					     NULL, NULL), -1);
+	assert_int_equal(mpathvalid_is_paths(names, 1, MPATH_MODE_ERROR, 0,
+					     results, NULL), -1);
+}
+
+/* devices in the batch with the same wwid claim each other */
+static void test_mpathvalid_is_paths_good(void **state)
+{
+	const char *names[] = { "sda", "sdb", "sdc", "sdd" };
+	int results[4];
+	char *wwids[4];
+	int i;
+
+	check_mpathvalid_init(FIND_MULTIPATHS_SMART, MPATH_LOG_PRIO_ERR,
+			      MPATH_LOG_STDERR);
+	will_return(__wrap_is_path_valid_wwids, MPATH_IS_MAYBE_VALID);
+	will_return(__wrap_is_path_valid_wwids, "sda");
+	will_return(__wrap_is_path_valid_wwids, TEST_WWID);
+	will_return(__wrap_is_path_valid_wwids, MPATH_IS_NOT_VALID);
+	will_return(__wrap_is_path_valid_wwids, "sdb");
+	will_return(__wrap_is_path_valid_wwids, MPATH_IS_MAYBE_VALID);
+	will_return(__wrap_is_path_valid_wwids, "sdc");
+	will_return(__wrap_is_path_valid_wwids, TEST_WWID);
+	will_return(__wrap_is_path_valid_wwids, MPATH_IS_MAYBE_VALID);
+	will_return(__wrap_is_path_valid_wwids, "sdd");
+	will_return(__wrap_is_path_valid_wwids, "WWID_D");
+	assert_int_equal(mpathvalid_is_paths(names, 4, MPATH_DEFAULT, 0,
+					     results, wwids), 0);
+	assert_int_equal(results[0], MPATH_IS_VALID);
+	assert_int_equal(results[1], MPATH_IS_NOT_VALID);
+	assert_int_equal(results[2], MPATH_IS_VALID);
+	assert_int_equal(results[3], MPATH_IS_MAYBE_VALID);
+	assert_string_equal(wwids[0], TEST_WWID);
+	assert_ptr_equal(wwids[1], NULL);
+	assert_string_equal(wwids[2], TEST_WWID);
+	assert_string_equal(wwids[3], "WWID_D");
+	for (i = 0; i < 4; i++)
+		free(wwids[i]);
+}
+
+/* with multipathd running, the paths aren't checked against it */
+static void test_mpathvalid_is_paths_daemon(void **state)
+{
+	const char *names[] = { "sda" };
+	int results[1];
+
+	check_mpathvalid_init(FIND_MULTIPATHS_SMART, MPATH_LOG_PRIO_ERR,
+			      MPATH_LOG_STDERR);
+	daemon_running = true;
+	will_return(__wrap_is_path_valid_wwids, MPATH_IS_VALID);
+	will_return(__wrap_is_path_valid_wwids, "sda");
+	will_return(__wrap_is_path_valid_wwids, TEST_WWID);
+	assert_int_equal(mpathvalid_is_paths(names, 1, MPATH_DEFAULT, 0,
+					     results, NULL), 0);
+	assert_int_equal(results[0], MPATH_IS_VALID);
+}
+
 #define setup_test(name) \
 	cmocka_unit_test_setup_teardown(name, setup, teardown)
 
@@ -458,6 +609,11 @@ int test_mpathvalid(void)
 		setup_test(test_mpathvalid_is_path_good3),
 		setup_test(test_mpathvalid_is_path_good4),
 		setup_test(test_mpathvalid_is_path_good5),
+		setup_test(test_mpathvalid_is_path_daemon1),
+		setup_test(test_mpathvalid_is_path_daemon2),
+		setup_test(test_mpathvalid_is_paths_bad),
+		setup_test(test_mpathvalid_is_paths_good),
+		setup_test(test_mpathvalid_is_paths_daemon),
 	};
 	return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -0,0 +1,249 @@
+/*
+ * Benchmark for the layout of struct path, as seen by checkerloop().
+ *
+ * On every tick, checkerloop() and check_path() look at a few fields of
+ * every path, and most paths aren't due for a check. This compares a pass
+ * over 20000 paths with the current layout against the same pass with the
+ * layout of LIBMULTIPATH_22, where these fields were spread over the struct.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cmocka.h>
+#include "structs.h"
+#include "debug.h"
+#include "globals.c"
+
+#define BENCH_PATHS 20000
+#define BENCH_PATHS_PER_MAP 8
+#define BENCH_PASSES 20
+/* larger than the last level cache */
+#define BENCH_EVICT_SIZE (64 * 1024 * 1024)
+
+/* struct path as it was before the checker fields were grouped */
+struct path_v22 {
+	char dev[FILE_NAME_SIZE];
+	char dev_t[BLK_DEV_SIZE];
+	struct udev_device *udev;
+	struct sg_id sg_id;
+	struct hd_geometry geom;
+	char wwid[WWID_SIZE];
+	char vendor_id[SCSI_VENDOR_SIZE];
+	char product_id[PATH_PRODUCT_SIZE];
+	char rev[PATH_REV_SIZE];
+	char serial[SERIAL_SIZE];
+	char tgt_node_name[NODE_NAME_SIZE];
+	char *vpd_data;
+	unsigned long long size;
+	unsigned int checkint;
+	unsigned int tick;
+	int bus;
+	int offline;
+	int state;
+	int dmstate;
+	int chkrstate;
+	int failcount;
+	int priority;
+	int pgindex;
+	int detect_prio;
+	int detect_checker;
+	int tpgs;
+	const char *uid_attribute;
+	struct prio prio;
+	struct checker checker;
+	struct multipath * mpp;
+	int fd;
+	int initialized;
+	int retriggers;
+	int partial_retrigger_delay;
+	unsigned int path_failures;
+	time_t dis_reinstate_time;
+	int disable_reinstate;
+	int san_path_err_forget_rate;
+	time_t io_err_dis_reinstate_time;
+	int io_err_disable_reinstate;
+	int io_err_pathfail_cnt;
+	int io_err_pathfail_starttime;
+	time_t io_sample_start;
+	unsigned long long io_sample_ios;
+	unsigned long long io_sample_ticks;
+	unsigned long long io_sample_errs;
+	int chk_io_valid;
+	unsigned long long chk_io_ios;
+	unsigned long long chk_io_errs;
+	int find_multipaths_timeout;
+	int marginal;
+	int vpd_vendor_id;
+	int recheck_wwid;
+	int fast_io_fail;
+	unsigned int dev_loss;
+	int eh_deadline;
+	bool is_checked;
+	bool check_urgent;
+	bool can_use_env_uid;
+	unsigned int checker_timeout;
+	vector hwe;
+	struct gen_path generic_path;
+	int tpg_id;
+};
+
+static char *evict_buf;
+static volatile unsigned long sink;
+
+static void evict_caches(void)
+{
+	static unsigned char fill;
+
+	memset(evict_buf, ++fill, BENCH_EVICT_SIZE);
+	sink += evict_buf[fill];
+}
+
+static double elapsed_us(const struct timespec *start,
+			 const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e6 +
+		(end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/*
+ * One checker tick over all paths, none of which is due: the start loop
+ * of checkerloop(), then the snapshot in check_path() and the early
+ * return of do_check_path() for each path.
+ */
+#define define_checker_pass(type)					\
+static double checker_pass_##type(struct type **paths)			\
+{									\
+	struct timespec start, end;					\
+	unsigned long snap = 0;						\
+	int i, nr_urgent = 0;						\
+									\
+	clock_gettime(CLOCK_MONOTONIC, &start);				\
+	for (i = 0; i < BENCH_PATHS; i++) {				\
+		struct type *pp = paths[i];				\
+									\
+		pp->is_checked = false;					\
+		pp->check_urgent = (pp->state != PATH_UP &&		\
+				    pp->state != PATH_GHOST) ||		\
+			(pp->mpp && pp->mpp->in_recovery);		\
+		nr_urgent += pp->check_urgent;				\
+	}								\
+	for (i = 0; i < BENCH_PATHS; i++) {				\
+		struct type *pp = paths[i];				\
+									\
+		if (pp->is_checked ||					\
+		    (nr_urgent && !pp->check_urgent))			\
+			continue;					\
+		pp->is_checked = true;					\
+		snap += pp->state + pp->dmstate + pp->priority +	\
+			pp->offline + pp->marginal;			\
+		if (pp->initialized == INIT_REMOVED)			\
+			continue;					\
+		if (pp->tick)						\
+			pp->tick -= pp->tick > 1 ? 1 : pp->tick;	\
+		if (pp->tick)						\
+			continue;					\
+		pp->tick = pp->checkint;				\
+	}								\
+	clock_gettime(CLOCK_MONOTONIC, &end);				\
+	sink += snap;							\
+	return elapsed_us(&start, &end);				\
+}									\
+									\
+static double bench_##type(struct multipath *maps, void **filler)	\
+{									\
+	struct type **paths;						\
+	double us, best = 0;						\
+	int i;								\
+									\
+	paths = calloc(BENCH_PATHS, sizeof(*paths));			\
+	assert_non_null(paths);						\
+	/* interleave the paths with other heap objects */		\
+	for (i = 0; i < BENCH_PATHS; i++) {				\
+		paths[i] = calloc(1, sizeof(struct type));		\
+		assert_non_null(paths[i]);				\
+		filler[i] = malloc(256 + (i % 4) * 64);			\
+		assert_non_null(filler[i]);				\
+		paths[i]->state = PATH_UP;				\
+		paths[i]->dmstate = PSTATE_ACTIVE;			\
+		paths[i]->initialized = INIT_OK;			\
+		paths[i]->checkint = 5;					\
+		/* no path is due during the benchmark */		\
+		paths[i]->tick = BENCH_PASSES + 2 + i % 5;		\
+		paths[i]->mpp = &maps[i / BENCH_PATHS_PER_MAP];		\
+	}								\
+	for (i = 0; i < BENCH_PASSES; i++) {				\
+		evict_caches();						\
+		us = checker_pass_##type(paths);			\
+		if (i == 0 || us < best)				\
+			best = us;					\
+	}								\
+	for (i = 0; i < BENCH_PATHS; i++) {				\
+		assert_int_not_equal(paths[i]->tick, 0);		\
+		free(paths[i]);						\
+		free(filler[i]);					\
+	}								\
+	free(paths);							\
+	return best;							\
+}
+
+define_checker_pass(path_v22)
+define_checker_pass(path)
+
+static void test_hot_fields_together(void **state)
+{
+	size_t end = offsetof(struct path, mpp) + sizeof(struct multipath *);
+
+	/* the fields read for paths that aren't due fit in one cache line */
+	assert_true(end <= 64);
+	assert_true(offsetof(struct path, tick) < end);
+	assert_true(offsetof(struct path, marginal) < end);
+	assert_true(offsetof(struct path, is_checked) < end);
+}
+
+static void test_checker_pass_20k(void **state)
+{
+	struct multipath *maps;
+	void **filler;
+	double old_us, new_us;
+
+	maps = calloc(BENCH_PATHS / BENCH_PATHS_PER_MAP, sizeof(*maps));
+	filler = calloc(BENCH_PATHS, sizeof(*filler));
+	evict_buf = malloc(BENCH_EVICT_SIZE);
+	assert_non_null(maps);
+	assert_non_null(filler);
+	assert_non_null(evict_buf);
+
+	old_us = bench_path_v22(maps, filler);
+	new_us = bench_path(maps, filler);
+	print_message("%d paths, best of %d passes: %.0f us with the old layout, %.0f us with the new one\n",
+		      BENCH_PATHS, BENCH_PASSES, old_us, new_us);
+
+	free(evict_buf);
+	free(filler);
+	free(maps);
+}
+
+static int test_pathlayout(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_hot_fields_together),
+		cmocka_unit_test(test_checker_pass_20k),
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_pathlayout();
+	return ret;
+}